@@ -1,9 +1,16 @@
 #include "ClientHandler.h"
+#include "EmbeddingScheduler.h"
+#include "ModelRegistry.h"
+#include "ServerConfig.h"
+#include "SessionManager.h"
+#include "WsMessages.h"
+#include "WsProtocol.h"
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonArray>
 #include <QDebug>
-#include <QThreadPool>
+#include <QPointer>
+#include <QtEndian>
 
 /*
   Constructor:
@@ -16,6 +23,7 @@
 ClientHandler::ClientHandler(QWebSocket *socket, QObject *parent)
     : QObject(parent)
     , m_socket(socket)
+    , m_inference(new InferenceEngine)
 {
     Q_ASSERT(m_socket);
 
@@ -36,14 +44,40 @@ ClientHandler::ClientHandler(QWebSocket *socket, QObject *parent)
 
     // Connect signals from the InferenceEngine
     // InferenceEngineのシグナル接続
-    connect(&m_inference, &InferenceEngine::partialResponseReady,
+    connect(m_inference, &InferenceEngine::partialResponseReady,
             this, &ClientHandler::onPartialResponseReady);
-    connect(&m_inference, &InferenceEngine::generationFinished,
+    connect(m_inference, &InferenceEngine::partialDeltaReady,
+            this, &ClientHandler::onPartialDeltaReady);
+    connect(m_inference, &InferenceEngine::partialBytesReady,
+            this, &ClientHandler::onPartialBytesReady);
+    connect(m_inference, &InferenceEngine::generationStarted,
+            this, &ClientHandler::onGenerationStarted);
+    connect(m_inference, &InferenceEngine::generationFinished,
             this, &ClientHandler::onGenerationFinished);
-    connect(&m_inference, &InferenceEngine::generationError,
+    connect(m_inference, &InferenceEngine::generationStats,
+            this, &ClientHandler::onGenerationStats);
+    connect(m_inference, &InferenceEngine::generationError,
             this, &ClientHandler::onGenerationError);
-    connect(&m_inference, &InferenceEngine::remoteInitializedChanged,
-            this, &ClientHandler::onRemoteInitializedChanged);
+    connect(m_inference, &InferenceEngine::generationCancelled,
+            this, &ClientHandler::onGenerationCancelled);
+    connect(m_inference, &InferenceEngine::requestQueued,
+            this, &ClientHandler::onRequestQueued);
+    connect(m_inference, &InferenceEngine::requestRejected,
+            this, &ClientHandler::onRequestRejected);
+
+    // Requests of this connection and its sessions share the per-client
+    // concurrency limit (set before any generate() is queued to the engine thread)
+    // この接続とそのセッションのリクエストはクライアント単位の同時実行数制限を
+    // 共有する (エンジンスレッドにgenerate()をキューイングする前に設定)
+    m_clientKey = QStringLiteral("ws:%1").arg(reinterpret_cast<quintptr>(this), 0, 16);
+    m_inference->setClientKey(m_clientKey);
+    m_inference->setTransport(Metrics::Transport::WebSocket);
+    connect(m_inference, &InferenceEngine::readinessChanged,
+            this, &ClientHandler::onReadinessChanged);
+
+    // Everything is connected: hand the engine to its thread
+    // 接続が済んだのでエンジンをそのスレッドに渡す
+    m_inference->start();
 
     qDebug() << "[ClientHandler] Created for socket" << socket;
 }
@@ -51,13 +85,17 @@ ClientHandler::ClientHandler(QWebSocket *socket, QObject *parent)
 /*
   Destructor:
     - Closes the socket if it exists
+    - Releases the engine on its own thread
     - Logs destruction
   デストラクタ:
     - ソケットがあればcloseする
+    - エンジンをそのスレッド上で解放
     - 破棄をログに出す
 */
 ClientHandler::~ClientHandler()
 {
+    m_inference->deleteLater();
+
     if (m_socket) {
         m_socket->close();
         // m_socket->deleteLater(); // optional / 必要に応じて
@@ -68,10 +106,34 @@ ClientHandler::~ClientHandler()
 /*
   onTextMessageReceived(message):
     - Called when the client sends a text message
-    - Parses JSON and handles "generate" or "reinit" actions
+    - Parses JSON and handles "generate", "cancel", "reinit", "setStreamingMode",
+      "setFlushPolicy" or "listModels" actions
+    - "generate" may name a model with "model" (see "listModels"); without it
+      the previously used model (initially the default one) is kept
+    - Streaming mode ("full" by default, "delta" or "binary") can be set with
+      "setStreamingMode" {"mode": ...} or per request with "stream" on "generate"
+    - "binary" is acknowledged with {"action":"streamingMode","mode":"binary",
+      "protocolVersion":N}; the token stream then arrives as WsProtocol frames
+    - "generate" also accepts "max_tokens", "stop" (string or array),
+      "temperature" (0 = greedy), "min_p", "top_k", "seed" and "greedy"
+    - Messages with a "sessionId", and the session actions, are handled by
+      handleSessionAction()
+    - "embed" is handled by handleEmbed()
   onTextMessageReceived(message):
     - クライアントからのテキストメッセージを受け取ったときに呼ばれる
-    - JSONを解析し、"generate"や"reinit"などのアクションを処理
+    - JSONを解析し、"generate"、"cancel"、"reinit"、"setStreamingMode"、
+      "setFlushPolicy"、"listModels"などのアクションを処理
+    - "generate"は"model"でモデルを指定できる ("listModels"を参照)。
+      指定が無い場合は前回のモデル (最初は既定のモデル) のまま
+    - ストリーミング方式 (既定は"full"、"delta"または"binary") は"setStreamingMode" {"mode": ...}
+      もしくは"generate"の"stream"フィールドで指定できる
+    - "binary"には{"action":"streamingMode","mode":"binary","protocolVersion":N}で
+      応答し、以降のトークン送出はWsProtocolのフレームで届く
+    - "generate"は"max_tokens"、"stop" (文字列または配列)、"temperature"
+      (0 = greedy)、"min_p"、"top_k"、"seed"、"greedy"も受け付ける
+    - "sessionId"を持つメッセージとセッション用のアクションは
+      handleSessionAction()で処理する
+    - "embed"はhandleEmbed()で処理する
 */
 void ClientHandler::onTextMessageReceived(const QString &message)
 {
@@ -89,45 +151,333 @@ void ClientHandler::onTextMessageReceived(const QString &message)
     // Check "action" property
     // "action" プロパティで処理を分岐
     const QString action = obj.value(QStringLiteral("action")).toString();
+
+    if (handleSessionAction(action, obj)) {
+        return;
+    }
+
+    // Apply a streaming mode given as "full" / "delta" / "binary"
+    // "full" / "delta" / "binary" で指定されたストリーミング方式を適用
+    auto applyStreamingMode = [this](const QString &mode) {
+        if (mode == QLatin1String("delta")) {
+            m_inference->setStreamingMode(InferenceEngine::StreamingMode::Delta);
+        } else if (mode == QLatin1String("binary")) {
+            m_inference->setStreamingMode(InferenceEngine::StreamingMode::Utf8Bytes);
+            // Confirm, so clients can fall back to text on older servers
+            // 古いサーバーではテキストに戻せるよう、受け付けたことを通知
+            QJsonObject json;
+            json["action"]          = QStringLiteral("streamingMode");
+            json["mode"]            = mode;
+            json["protocolVersion"] = static_cast<int>(WsProtocol::Version);
+
+            const QByteArray bytes = QJsonDocument(json).toJson(QJsonDocument::Compact);
+            m_socket->sendTextMessage(QString::fromUtf8(bytes));
+        } else if (mode == QLatin1String("full")) {
+            m_inference->setStreamingMode(InferenceEngine::StreamingMode::FullText);
+        } else {
+            qDebug() << "[ClientHandler] Unknown streaming mode:" << mode;
+        }
+    };
+
     if (action == QLatin1String("generate")) {
         // Handle "generate"
         // "messages" : Array of { "role":"...", "content":"..." }
-        const QJsonArray msgs = obj.value(QStringLiteral("messages")).toArray();
-        QList<LlamaChatMessage> messageList;
-        for (const QJsonValue &val : msgs) {
-            if (!val.isObject()) continue;
-            QJsonObject mobj = val.toObject();
-            LlamaChatMessage chatMsg;
-            chatMsg.setRole(mobj.value(QStringLiteral("role")).toString());
-            chatMsg.setContent(mobj.value(QStringLiteral("content")).toString());
-            messageList.append(chatMsg);
+        const QList<LlamaChatMessage> messageList =
+            WsMessages::parseChatMessages(obj.value(QStringLiteral("messages")).toArray());
+        if (obj.contains(QStringLiteral("stream"))) {
+            applyStreamingMode(obj.value(QStringLiteral("stream")).toString());
         }
-        // blocking the main thread with generate() for too long seems to break the WebSockets connections
-        QThreadPool::globalInstance()->start([this, messageList](){
-            m_inference.generate(messageList);
-        });
+        // Templating/tokenization run on the engine thread, decoding on the
+        // DecodeScheduler thread, so the WebSocket I/O is never blocked
+        // テンプレート適用/トークナイズはエンジンスレッド、デコードは
+        // DecodeSchedulerのスレッドで行うため、WebSocketの入出力をブロックしない
+        const QString model = obj.value(QStringLiteral("model")).toString();
+        const GenerationOptions options = WsMessages::parseGenerationOptions(obj);
+        QMetaObject::invokeMethod(m_inference, [engine = m_inference, messageList, model, options]() {
+            engine->generate(messageList, model, options);
+        }, Qt::QueuedConnection);
+
+    } else if (action == QLatin1String("cancel")) {
+        // Handle "cancel" -> stops the running generation
+        QMetaObject::invokeMethod(m_inference, &InferenceEngine::cancelGeneration,
+                                  Qt::QueuedConnection);
 
     } else if (action == QLatin1String("reinit")) {
         // Handle "reinit"
         // "reinit" -> calls InferenceEngine's reinitEngine()
-        m_inference.reinitEngine();
+        QMetaObject::invokeMethod(m_inference, &InferenceEngine::reinitEngine,
+                                  Qt::QueuedConnection);
+
+    } else if (action == QLatin1String("setStreamingMode")) {
+        // Handle "setStreamingMode" -> {"mode": "full" | "delta" | "binary"}
+        applyStreamingMode(obj.value(QStringLiteral("mode")).toString());
+
+    } else if (action == QLatin1String("setFlushPolicy")) {
+        // Handle "setFlushPolicy" -> {"intervalMs": N, "tokens": N, "atNewline": bool}
+        // or {"immediate": true}; missing numbers keep the server defaults
+        int intervalMs = obj.value(QStringLiteral("intervalMs")).toInt(-1);
+        int tokens     = obj.value(QStringLiteral("tokens")).toInt(-1);
+        bool atNewline = obj.value(QStringLiteral("atNewline"))
+                             .toBool(ServerConfig::instance().streamFlushAtNewline);
+        if (obj.value(QStringLiteral("immediate")).toBool()) {
+            intervalMs = 0;
+            tokens     = 1;
+            atNewline  = false;
+        }
+        QMetaObject::invokeMethod(m_inference, [engine = m_inference, intervalMs, tokens, atNewline]() {
+            engine->setFlushPolicy(intervalMs, tokens, atNewline);
+        }, Qt::QueuedConnection);
+
+    } else if (action == QLatin1String("embed")) {
+        handleEmbed(obj);
+
+    } else if (action == QLatin1String("listModels")) {
+        // Handle "listModels" -> {"action":"models","models":[...]} (default first)
+        QJsonObject json;
+        json["action"] = QStringLiteral("models");
+        json["models"] = QJsonArray::fromStringList(ModelRegistry::instance().modelNames());
+
+        const QByteArray bytes = QJsonDocument(json).toJson(QJsonDocument::Compact);
+        m_socket->sendTextMessage(QString::fromUtf8(bytes));
 
     } else {
         qDebug() << "[ClientHandler] Unknown action:" << action;
     }
 }
 
+/*
+  handleSessionAction(action, obj):
+    - "createSession" {"model"?, "messages"?} -> "sessionCreated" {"sessionId"}
+    - "resumeSession" {"sessionId"} -> "sessionResumed" {"sessionId", "busy",
+      "messages"}; the session's events move to this connection
+    - "appendMessage" {"sessionId", "role", "content"}
+    - "generate" {"sessionId", "message"? / "messages"?, options...} appends
+      the given messages and replies to the history; the events are the usual
+      delta / stats / finished / error / cancelled messages with "sessionId"
+    - "cancel" / "closeSession" {"sessionId"}
+    - Returns false for messages that are not about a server-side session
+  handleSessionAction(action, obj):
+    - "createSession" {"model"?, "messages"?} -> "sessionCreated" {"sessionId"}
+    - "resumeSession" {"sessionId"} -> "sessionResumed" {"sessionId", "busy",
+      "messages"}。セッションのイベントはこの接続に移る
+    - "appendMessage" {"sessionId", "role", "content"}
+    - "generate" {"sessionId", "message"? / "messages"?, オプション...} は
+      指定のメッセージを追加して履歴に応答する。イベントは通常の
+      delta / stats / finished / error / cancelledに"sessionId"を付けたもの
+    - "cancel" / "closeSession" {"sessionId"}
+    - サーバー側セッションに関係しないメッセージではfalseを返す
+*/
+bool ClientHandler::handleSessionAction(const QString &action, const QJsonObject &obj)
+{
+    const QString sessionId = obj.value(QStringLiteral("sessionId")).toString();
+    if (action != QLatin1String("createSession") && sessionId.isEmpty()) {
+        return false;
+    }
+
+    SessionManager &sessions = SessionManager::instance();
+    if (action == QLatin1String("createSession")) {
+        QString error;
+        ServerSession *session = sessions.create(obj.value(QStringLiteral("model")).toString(),
+                                                 Metrics::Transport::WebSocket,
+                                                 m_clientKey, this, &error);
+        if (!session) {
+            onSessionError(QString(), error);
+            return true;
+        }
+        attachSession(session);
+        for (const LlamaChatMessage &message :
+             WsMessages::parseChatMessages(obj.value(QStringLiteral("messages")).toArray())) {
+            session->appendMessage(message);
+        }
+
+        QJsonObject json;
+        json["action"]    = QStringLiteral("sessionCreated");
+        json["sessionId"] = session->id();
+        m_socket->sendTextMessage(QString::fromUtf8(QJsonDocument(json).toJson(QJsonDocument::Compact)));
+        return true;
+    }
+
+    ServerSession *session = sessions.find(sessionId);
+    if (!session) {
+        onSessionError(sessionId, QStringLiteral("unknown session"));
+        return true;
+    }
+
+    if (action == QLatin1String("resumeSession")) {
+        attachSession(session);
+        QJsonArray messages;
+        for (const LlamaChatMessage &message : session->history()) {
+            messages.append(QJsonObject {{QStringLiteral("role"), message.role()},
+                                         {QStringLiteral("content"), message.content()}});
+        }
+        QJsonObject json;
+        json["action"]    = QStringLiteral("sessionResumed");
+        json["sessionId"] = sessionId;
+        json["busy"]      = session->isBusy();
+        json["messages"]  = messages;
+        m_socket->sendTextMessage(QString::fromUtf8(QJsonDocument(json).toJson(QJsonDocument::Compact)));
+
+    } else if (action == QLatin1String("appendMessage")) {
+        session->appendMessage(LlamaChatMessage(obj.value(QStringLiteral("role")).toString(),
+                                                obj.value(QStringLiteral("content")).toString()));
+
+    } else if (action == QLatin1String("generate")) {
+        // Only the new message travels; the history stays on the server
+        // 新しいメッセージのみを送る。履歴はサーバー側に残る
+        attachSession(session);
+        const QJsonValue single = obj.value(QStringLiteral("message"));
+        if (single.isObject()) {
+            session->appendMessage(WsMessages::parseChatMessages(QJsonArray {single}).constFirst());
+        }
+        for (const LlamaChatMessage &message :
+             WsMessages::parseChatMessages(obj.value(QStringLiteral("messages")).toArray())) {
+            session->appendMessage(message);
+        }
+        QString error;
+        if (!session->generate(WsMessages::parseGenerationOptions(obj), &error)) {
+            onSessionError(sessionId, error);
+        }
+
+    } else if (action == QLatin1String("cancel")) {
+        session->cancel();
+
+    } else if (action == QLatin1String("closeSession")) {
+        sessions.close(sessionId);
+        QJsonObject json;
+        json["action"]    = QStringLiteral("sessionClosed");
+        json["sessionId"] = sessionId;
+        m_socket->sendTextMessage(QString::fromUtf8(QJsonDocument(json).toJson(QJsonDocument::Compact)));
+
+    } else {
+        qDebug() << "[ClientHandler] Unknown session action:" << action;
+    }
+    return true;
+}
+
+/*
+  handleEmbed(obj):
+    - {"action":"embed","requestId":N,"texts":[...],"model"?,"normalize"?,"binary"?}
+    - Replies with one WsProtocol Embeddings frame (default), or with
+      {"action":"embeddings","requestId","dimensions","embeddings":[[...]]}
+      when "binary" is false; failures are "error" with the "requestId"
+    - Vectors are L2-normalized unless "normalize" is false
+    - Requests of all connections are batched together by the EmbeddingScheduler
+  handleEmbed(obj):
+    - {"action":"embed","requestId":N,"texts":[...],"model"?,"normalize"?,"binary"?}
+    - WsProtocolのEmbeddingsフレーム1つで応答する (既定)。"binary"がfalseの
+      場合は{"action":"embeddings","requestId","dimensions","embeddings":[[...]]}。
+      失敗時は"requestId"付きの"error"
+    - "normalize"がfalseでない限り、ベクトルはL2正規化する
+    - 全接続のリクエストはEmbeddingSchedulerがまとめてバッチ処理する
+*/
+void ClientHandler::handleEmbed(const QJsonObject &obj)
+{
+    const int requestId = obj.value(QStringLiteral("requestId")).toInt();
+    const bool binary   = obj.value(QStringLiteral("binary")).toBool(true);
+    const bool normalize = obj.value(QStringLiteral("normalize")).toBool(true);
+    QStringList texts;
+    for (const QJsonValue &text : obj.value(QStringLiteral("texts")).toArray()) {
+        texts.append(text.toString());
+    }
+    Metrics::instance().embeddingRequests[Metrics::index(Metrics::Transport::WebSocket)]
+        .fetch_add(1, std::memory_order_relaxed);
+
+    QPointer<ClientHandler> self(this);
+    auto reportError = [self, requestId](const QString &errorMessage) {
+        QMetaObject::invokeMethod(self, [self, requestId, errorMessage]() {
+            if (!self) {
+                return;
+            }
+            QJsonObject json;
+            json["action"]       = QStringLiteral("error");
+            json["requestId"]    = requestId;
+            json["errorMessage"] = errorMessage;
+            self->m_socket->sendTextMessage(QString::fromUtf8(QJsonDocument(json).toJson(QJsonDocument::Compact)));
+        }, Qt::QueuedConnection);
+    };
+
+    QString error;
+    const std::shared_ptr<EmbeddingScheduler> scheduler =
+        ModelRegistry::instance().embeddingScheduler(obj.value(QStringLiteral("model")).toString(), &error);
+    if (!scheduler) {
+        reportError(error);
+        return;
+    }
+
+    EmbeddingCallbacks callbacks;
+    callbacks.onFinished = [self, requestId, binary](const QByteArray &vectors, int dimensions) {
+        QMetaObject::invokeMethod(self, [self, requestId, binary, vectors, dimensions]() {
+            if (self) {
+                self->sendEmbeddings(requestId, binary, vectors, dimensions);
+            }
+        }, Qt::QueuedConnection);
+    };
+    callbacks.onError = reportError;
+    scheduler->submit(texts, normalize, std::move(callbacks));
+}
+
+/*
+  sendEmbeddings(requestId, binary, vectors, dimensions):
+    - The binary frame carries the vectors exactly as the scheduler laid
+      them out; the JSON form decodes them into arrays of numbers
+*/
+void ClientHandler::sendEmbeddings(int requestId, bool binary, const QByteArray &vectors, int dimensions)
+{
+    if (binary) {
+        m_socket->sendBinaryMessage(WsProtocol::encode(WsProtocol::FrameType::Embeddings,
+                                                       static_cast<quint32>(requestId),
+                                                       static_cast<quint32>(dimensions), vectors));
+        return;
+    }
+
+    const uchar *data = reinterpret_cast<const uchar *>(vectors.constData());
+    const qsizetype count = dimensions > 0 ? vectors.size() / (dimensions * qsizetype(sizeof(float))) : 0;
+    QJsonArray embeddings;
+    for (qsizetype v = 0; v < count; ++v) {
+        QJsonArray vector;
+        for (int i = 0; i < dimensions; ++i) {
+            vector.append(qFromLittleEndian<float>(data + (v * dimensions + i) * sizeof(float)));
+        }
+        embeddings.append(vector);
+    }
+
+    QJsonObject json;
+    json["action"]     = QStringLiteral("embeddings");
+    json["requestId"]  = requestId;
+    json["dimensions"] = dimensions;
+    json["embeddings"] = embeddings;
+    m_socket->sendTextMessage(QString::fromUtf8(QJsonDocument(json).toJson(QJsonDocument::Compact)));
+}
+
+/*
+  attachSession(session):
+    - Connections are unique, so attaching again (resume, generate) is harmless
+*/
+void ClientHandler::attachSession(ServerSession *session)
+{
+    session->attach(this);
+    connect(session, &ServerSession::partialDelta, this, &ClientHandler::onSessionDelta, Qt::UniqueConnection);
+    connect(session, &ServerSession::finished, this, &ClientHandler::onSessionFinished, Qt::UniqueConnection);
+    connect(session, &ServerSession::stats, this, &ClientHandler::onSessionStats, Qt::UniqueConnection);
+    connect(session, &ServerSession::error, this, &ClientHandler::onSessionError, Qt::UniqueConnection);
+    connect(session, &ServerSession::cancelled, this, &ClientHandler::onSessionCancelled, Qt::UniqueConnection);
+}
+
 /*
   onSocketDisconnected():
     - Called when the WebSocket disconnects
+    - Cancels any running generation, since nobody will read it
     - Emits disconnected() signal so the parent (server) can remove this handler
   onSocketDisconnected():
     - WebSocketが切断された時に呼ばれる
+    - 受け取る相手がいないため、実行中の生成を中止する
     - disconnected()シグナルをemitし、親(サーバー)がこのハンドラを削除できるようにする
 */
 void ClientHandler::onSocketDisconnected()
 {
     qDebug() << "[ClientHandler] onSocketDisconnected";
+    QMetaObject::invokeMethod(m_inference, &InferenceEngine::cancelGeneration,
+                              Qt::QueuedConnection);
     emit disconnected();
 }
 
@@ -144,22 +494,71 @@ void ClientHandler::onSocketDisconnected()
 */
 void ClientHandler::onPartialResponseReady(const QString &textSoFar)
 {
-    QJsonObject json;
-    json["action"]  = QStringLiteral("partialResponse");
-    json["content"] = textSoFar;
+    m_socket->sendTextMessage(QString::fromUtf8(WsMessages::encodePartialResponse(textSoFar)));
+}
 
-    const QByteArray bytes = QJsonDocument(json).toJson(QJsonDocument::Compact);
-    m_socket->sendTextMessage(QString::fromUtf8(bytes));
+/*
+  onPartialDeltaReady(delta, sequence, offset):
+    - Sends only the new text as "partialResponseDelta"
+    - "sequence" increases by one per message and "offset" is the UTF-16
+      position of "content" in the full response, so clients can detect gaps
+  onPartialDeltaReady(delta, sequence, offset):
+    - 新しいテキストのみを "partialResponseDelta" として送信
+    - "sequence"はメッセージごとに1ずつ増え、"offset"は全文中の"content"の
+      開始位置 (UTF-16単位) なので、クライアントは欠落を検出できる
+*/
+void ClientHandler::onPartialDeltaReady(const QString &delta, int sequence, int offset)
+{
+    m_socket->sendTextMessage(QString::fromUtf8(WsMessages::encodePartialDelta(delta, sequence, offset)));
+}
+
+/*
+  onPartialBytesReady(bytes, sequence, byteOffset):
+    - Sends a binary Delta frame; the bytes are copied once behind the header
+  onPartialBytesReady(bytes, sequence, byteOffset):
+    - バイナリのDeltaフレームを送信。バイト列はヘッダの後ろへ1回だけコピーする
+*/
+void ClientHandler::onPartialBytesReady(const QByteArray &bytes, int sequence, int byteOffset)
+{
+    m_binarySequence = sequence + 1;
+    m_binaryBytes    = byteOffset + static_cast<int>(bytes.size());
+    m_socket->sendBinaryMessage(WsProtocol::encode(WsProtocol::FrameType::Delta,
+                                                   static_cast<quint32>(sequence),
+                                                   static_cast<quint32>(byteOffset),
+                                                   bytes));
+}
+
+/*
+  onGenerationStarted(mode):
+    - Latches the generation's mode: the engine's may change before it ends
+  onGenerationStarted(mode):
+    - 生成の方式を保持する。終了までにエンジンの方式が変わる場合がある
+*/
+void ClientHandler::onGenerationStarted(InferenceEngine::StreamingMode mode)
+{
+    m_generationMode = mode;
+    resetBinaryStream();
 }
 
 /*
   onGenerationFinished(finalResponse):
     - Sends final generated text to the client as "generationFinished"
+    - In binary mode a Finished frame carrying only the total byte length is
+      sent instead, since the client already holds every byte of the text
   onGenerationFinished(finalResponse):
     - 最終応答を "generationFinished" としてクライアントに送信
+    - binaryモードでは、クライアントが全バイトを受信済みのため、総バイト数のみを
+      持つFinishedフレームを代わりに送る
 */
 void ClientHandler::onGenerationFinished(const QString &finalResponse)
 {
+    if (m_generationMode == InferenceEngine::StreamingMode::Utf8Bytes) {
+        m_socket->sendBinaryMessage(WsProtocol::encode(WsProtocol::FrameType::Finished,
+                                                       static_cast<quint32>(m_binarySequence),
+                                                       static_cast<quint32>(m_binaryBytes)));
+        return;
+    }
+
     QJsonObject json;
     json["action"]  = QStringLiteral("generationFinished");
     json["content"] = finalResponse;
@@ -168,6 +567,29 @@ void ClientHandler::onGenerationFinished(const QString &finalResponse)
     m_socket->sendTextMessage(QString::fromUtf8(bytes));
 }
 
+/*
+  resetBinaryStream():
+    - The next generation numbers its binary frames from zero again
+  resetBinaryStream():
+    - 次の生成のバイナリフレームを再び0から数える
+*/
+void ClientHandler::resetBinaryStream()
+{
+    m_binarySequence = 0;
+    m_binaryBytes    = 0;
+}
+
+/*
+  onGenerationStats(stats):
+    - Sends the request's timings as "generationStats" before "generationFinished"
+  onGenerationStats(stats):
+    - "generationFinished"の前に、リクエストの計測値を"generationStats"として送信
+*/
+void ClientHandler::onGenerationStats(const GenerationStats &stats)
+{
+    m_socket->sendTextMessage(QString::fromUtf8(WsMessages::encodeGenerationStats(stats)));
+}
+
 /*
   onGenerationError(errorMessage):
     - Sends error message to the client as "error"
@@ -185,18 +607,136 @@ void ClientHandler::onGenerationError(const QString &errorMessage)
 }
 
 /*
-  onRemoteInitializedChanged(init):
-    - Notifies the client about the engine's initialization state
-    - "remoteInitializedChanged" => {"initialized": bool}
-  onRemoteInitializedChanged(init):
-    - エンジンの初期化状態をクライアントに通知
-    - "remoteInitializedChanged" => {"initialized": bool}
+  onGenerationCancelled(partialResponse):
+    - Confirms a "cancel" with the text generated before it took effect
+  onGenerationCancelled(partialResponse):
+    - "cancel"の確認として、中止までに生成されたテキストを送信
+*/
+void ClientHandler::onGenerationCancelled(const QString &partialResponse)
+{
+    if (m_socket->state() != QAbstractSocket::ConnectedState) {
+        return;
+    }
+
+    QJsonObject json;
+    json["action"]  = QStringLiteral("generationCancelled");
+    json["content"] = partialResponse;
+
+    const QByteArray bytes = QJsonDocument(json).toJson(QJsonDocument::Compact);
+    m_socket->sendTextMessage(QString::fromUtf8(bytes));
+}
+
+/*
+  onRequestQueued(position):
+    - Tells the client it waits for a decode slot: "queued" {"position": N}
+  onRequestQueued(position):
+    - デコード枠を待っていることを通知: "queued" {"position": N}
+*/
+void ClientHandler::onRequestQueued(int position)
+{
+    QJsonObject json;
+    json["action"]   = QStringLiteral("queued");
+    json["position"] = position;
+
+    const QByteArray bytes = QJsonDocument(json).toJson(QJsonDocument::Compact);
+    m_socket->sendTextMessage(QString::fromUtf8(bytes));
+}
+
+/*
+  onRequestRejected(reason):
+    - Tells the client the request was shed: "rejected" {"reason": "overloaded"}
+  onRequestRejected(reason):
+    - リクエストが拒否されたことを通知: "rejected" {"reason": "overloaded"}
+*/
+void ClientHandler::onRequestRejected(const QString &reason)
+{
+    QJsonObject json;
+    json["action"] = QStringLiteral("rejected");
+    json["reason"] = reason;
+
+    const QByteArray bytes = QJsonDocument(json).toJson(QJsonDocument::Compact);
+    m_socket->sendTextMessage(QString::fromUtf8(bytes));
+}
+
+/*
+  onSessionDelta / onSessionFinished / onSessionStats / onSessionError /
+  onSessionCancelled:
+    - Same messages as the engine slots, tagged with "sessionId"
+    - Session errors with an empty id are failures of createSession
+  onSessionDelta / onSessionFinished / onSessionStats / onSessionError /
+  onSessionCancelled:
+    - エンジン用スロットと同じメッセージに"sessionId"を付けて送信
+    - IDが空のセッションエラーはcreateSessionの失敗
+*/
+void ClientHandler::onSessionDelta(const QString &sessionId, const QString &delta, int sequence, int offset)
+{
+    m_socket->sendTextMessage(QString::fromUtf8(WsMessages::encodePartialDelta(delta, sequence, offset, sessionId)));
+}
+
+void ClientHandler::onSessionFinished(const QString &sessionId, const QString &finalResponse)
+{
+    QJsonObject json;
+    json["action"]    = QStringLiteral("generationFinished");
+    json["sessionId"] = sessionId;
+    json["content"]   = finalResponse;
+
+    const QByteArray bytes = QJsonDocument(json).toJson(QJsonDocument::Compact);
+    m_socket->sendTextMessage(QString::fromUtf8(bytes));
+}
+
+void ClientHandler::onSessionStats(const QString &sessionId, const GenerationStats &stats)
+{
+    m_socket->sendTextMessage(QString::fromUtf8(WsMessages::encodeGenerationStats(stats, sessionId)));
+}
+
+void ClientHandler::onSessionError(const QString &sessionId, const QString &errorMessage)
+{
+    QJsonObject json;
+    json["action"]       = QStringLiteral("error");
+    json["sessionId"]    = sessionId;
+    json["errorMessage"] = errorMessage;
+
+    const QByteArray bytes = QJsonDocument(json).toJson(QJsonDocument::Compact);
+    m_socket->sendTextMessage(QString::fromUtf8(bytes));
+}
+
+void ClientHandler::onSessionCancelled(const QString &sessionId, const QString &partialResponse)
+{
+    if (m_socket->state() != QAbstractSocket::ConnectedState) {
+        return;
+    }
+
+    QJsonObject json;
+    json["action"]    = QStringLiteral("generationCancelled");
+    json["sessionId"] = sessionId;
+    json["content"]   = partialResponse;
+
+    const QByteArray bytes = QJsonDocument(json).toJson(QJsonDocument::Compact);
+    m_socket->sendTextMessage(QString::fromUtf8(bytes));
+}
+
+/*
+  onReadinessChanged(stage, timings):
+    - Notifies the client about each initialization stage of the engine
+    - "remoteInitializedChanged" => {"initialized": bool, "stage":
+      "loading" | "warming" | "ready" | "failed", "loadMs", "warmupMs"};
+      "initialized" becomes true with "ready"
+  onReadinessChanged(stage, timings):
+    - エンジンの初期化の各段階をクライアントに通知
+    - "remoteInitializedChanged" => {"initialized": bool, "stage":
+      "loading" | "warming" | "ready" | "failed", "loadMs", "warmupMs"}。
+      "initialized"は"ready"でtrueになる
 */
-void ClientHandler::onRemoteInitializedChanged(bool init)
+void ClientHandler::onReadinessChanged(InferenceEngine::Readiness stage, const ReadinessTimings &timings)
 {
+    static const char *const stageNames[] = {"loading", "warming", "ready", "failed"};
+
     QJsonObject json;
-    json["action"]     = QStringLiteral("remoteInitializedChanged");
-    json["initialized"] = init;
+    json["action"]      = QStringLiteral("remoteInitializedChanged");
+    json["initialized"] = (stage == InferenceEngine::Readiness::Ready);
+    json["stage"]       = QLatin1String(stageNames[static_cast<int>(stage)]);
+    json["loadMs"]      = timings.loadMs();
+    json["warmupMs"]    = timings.warmupMs();
 
     const QByteArray bytes = QJsonDocument(json).toJson(QJsonDocument::Compact);
     m_socket->sendTextMessage(QString::fromUtf8(bytes));
@@ -2,15 +2,23 @@
 #define CLIENTHANDLER_H
 
 #include <QObject>
+#include <QJsonObject>
 #include <QWebSocket>
 #include "InferenceEngine.h"
 
+class ServerSession;
+
 /*
   ClientHandler:
     - Manages communication with a single client (QWebSocket).
-    - Receives JSON messages ("generate", "reinit", etc.)
-    - Calls InferenceEngine accordingly.
-    - Sends back partial/final responses over the socket.
+    - Receives JSON messages ("generate", "cancel", "reinit", "setStreamingMode", etc.)
+    - Calls InferenceEngine accordingly; the engine lives on an engine thread,
+      so calls are queued and the socket thread never blocks on inference.
+    - Sends back partial/final responses over the socket, as JSON text or,
+      in "binary" streaming mode, as WsProtocol frames of raw UTF-8.
+    - Server-side sessions ("createSession") keep the history on the server,
+      so a client sends only the new message of each turn.
+    - "embed" returns embedding vectors, batched across all connections.
     - Does NOT include QThreadPool or QRunnable directly here.
 */
 class ClientHandler : public QObject
@@ -29,13 +37,50 @@ private slots:
 
     // InferenceEngine signals -> wrap into JSON and send
     void onPartialResponseReady(const QString &textSoFar);
+    void onPartialDeltaReady(const QString &delta, int sequence, int offset);
+    void onPartialBytesReady(const QByteArray &bytes, int sequence, int byteOffset);
+    void onGenerationStarted(InferenceEngine::StreamingMode mode);
     void onGenerationFinished(const QString &finalResponse);
+    void onGenerationStats(const GenerationStats &stats);
     void onGenerationError(const QString &errorMessage);
-    void onRemoteInitializedChanged(bool init);
+    void onGenerationCancelled(const QString &partialResponse);
+    void onRequestQueued(int position);
+    void onRequestRejected(const QString &reason);
+    void onReadinessChanged(InferenceEngine::Readiness stage, const ReadinessTimings &timings);
+
+    // ServerSession signals -> the same JSON with "sessionId"
+    void onSessionDelta(const QString &sessionId, const QString &delta, int sequence, int offset);
+    void onSessionFinished(const QString &sessionId, const QString &finalResponse);
+    void onSessionStats(const QString &sessionId, const GenerationStats &stats);
+    void onSessionError(const QString &sessionId, const QString &errorMessage);
+    void onSessionCancelled(const QString &sessionId, const QString &partialResponse);
 
 private:
+    bool handleSessionAction(const QString &action, const QJsonObject &obj);
+    void attachSession(ServerSession *session);
+    void handleEmbed(const QJsonObject &obj);
+    void sendEmbeddings(int requestId, bool binary, const QByteArray &vectors, int dimensions);
+    void resetBinaryStream();
+
+
     QWebSocket      *m_socket {nullptr};
-    InferenceEngine  m_inference;
+    InferenceEngine *m_inference {nullptr};
+
+    // Key of the per-client concurrency limit: this connection, since many
+    // clients may share one address behind the gateway or a NAT
+    // クライアント単位の同時実行数制限のキー。ゲートウェイやNATの背後では
+    // 多くのクライアントが同じアドレスを共有するため、この接続を単位とする
+    QString m_clientKey;
+
+    // Streaming mode of the running generation and the position of its next
+    // binary frame; set when the engine accepts a generation, so a request
+    // refused while another one runs leaves them alone
+    // 実行中の生成のストリーミング方式と、次に送るバイナリフレームの位置。
+    // エンジンが生成を受け付けた時点で設定するため、実行中に拒否された
+    // リクエストはこれらを変更しない
+    InferenceEngine::StreamingMode m_generationMode {InferenceEngine::StreamingMode::FullText};
+    int m_binarySequence {0};
+    int m_binaryBytes {0};
 };
 
 #endif // CLIENTHANDLER_H
@@ -0,0 +1,319 @@
+// ================================================================
+// Conversation.cpp
+// ================================================================
+#include "Conversation.h"
+#include <algorithm>
+#include <cstddef>
+
+/*
+  reset(model):
+    - Template properties are per model, so they are found out again
+*/
+void Conversation::reset(const llama_model *model)
+{
+    mModel = model;
+    mMessages.clear();
+    mFormatted.clear();
+    mTokens.clear();
+    mAssistantPrefix.clear();
+    mReplyPrefix.clear();
+    mReplyPrefixKnown    = false;
+    mPendingText.clear();
+    mPendingTextBeforeTurn.clear();
+    mSeparable           = Separable::Unknown;
+    mMessagesBeforeTurn  = 0;
+    mFormattedBeforeTurn = 0;
+    mTokensBeforeTurn    = 0;
+}
+
+/*
+  continues(history):
+    - Histories kept by a ServerSession share their string data with the
+      messages stored here, so the check is a pointer comparison per message
+*/
+bool Conversation::continues(const QList<LlamaChatMessage> &history) const
+{
+    auto sameText = [](const QString &a, const QString &b) {
+        return a.size() == b.size() && (a.constData() == b.constData() || a == b);
+    };
+    if (history.size() < messageCount()) {
+        return false;
+    }
+    for (size_t i = 0; i < mMessages.size(); ++i) {
+        const LlamaChatMessage &message = history.at(static_cast<qsizetype>(i));
+        if (!sameText(message.role(), mMessages[i].role) || !sameText(message.content(), mMessages[i].content)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+  prepare(newMessages, turn, errorMessage):
+    - First turn: the new messages are templated with and without the
+      assistant prefix, which also yields the prefix itself
+    - Later turns of a separable template: one pass over the new messages
+    - The first later turn also templates the full history once to decide
+      whether the template is separable
+*/
+bool Conversation::prepare(const QList<LlamaChatMessage> &newMessages, Turn *turn, QString *errorMessage)
+{
+    auto fail = [errorMessage](const char *message) {
+        if (errorMessage) {
+            *errorMessage = QString::fromLatin1(message);
+        }
+        return false;
+    };
+    if (!mModel) {
+        return fail("no model");
+    }
+    if (newMessages.isEmpty()) {
+        return fail("no new messages");
+    }
+
+    *turn = Turn {};
+    turn->startsConversation = mMessages.empty();
+    turn->messages.reserve(static_cast<size_t>(newMessages.size()));
+    for (const LlamaChatMessage &message : newMessages) {
+        turn->messages.push_back({message.role(), message.content(),
+                                  message.role().toStdString(), message.content().toStdString()});
+    }
+    std::vector<llama_chat_message> newViews;
+    appendViews(turn->messages, &newViews);
+
+    if (turn->startsConversation) {
+        if (!applyTemplate(newViews, /*addAssistant=*/false, &turn->historyText)
+            || !applyTemplate(newViews, /*addAssistant=*/true, &turn->text)) {
+            return fail("failed to apply the chat template");
+        }
+        if (turn->text.compare(0, turn->historyText.size(), turn->historyText) == 0) {
+            mAssistantPrefix = turn->text.substr(turn->historyText.size());
+            turn->assistantPrefix      = mAssistantPrefix;
+            turn->assistantPrefixKnown = true;
+        } else {
+            mSeparable = Separable::No;
+        }
+    } else if (mSeparable != Separable::No) {
+        if (!applyTemplate(newViews, /*addAssistant=*/false, &turn->historyText)) {
+            return fail("failed to apply the chat template");
+        }
+        if (mSeparable == Separable::Unknown) {
+            std::vector<llama_chat_message> allViews;
+            appendViews(mMessages, &allViews);
+            allViews.insert(allViews.end(), newViews.begin(), newViews.end());
+            std::string full;
+            if (!applyTemplate(allViews, /*addAssistant=*/false, &full)) {
+                return fail("failed to apply the chat template");
+            }
+            mSeparable = (full.size() == mFormatted.size() + turn->historyText.size()
+                          && full.compare(0, mFormatted.size(), mFormatted) == 0
+                          && full.compare(mFormatted.size(), std::string::npos, turn->historyText) == 0)
+                             ? Separable::Yes
+                             : Separable::No;
+        }
+        if (mSeparable == Separable::Yes) {
+            turn->text = turn->historyText + mAssistantPrefix;
+            turn->assistantPrefix      = mAssistantPrefix;
+            turn->assistantPrefixKnown = true;
+        }
+    }
+
+    // Fallback: template the whole history and keep what follows mFormatted
+    // 代替手段: 履歴全体にテンプレートを適用し、mFormattedより後を使う
+    if (!turn->startsConversation && mSeparable == Separable::No) {
+        std::vector<llama_chat_message> allViews;
+        appendViews(mMessages, &allViews);
+        allViews.insert(allViews.end(), newViews.begin(), newViews.end());
+        std::string full;
+        std::string fullWithPrefix;
+        if (!applyTemplate(allViews, /*addAssistant=*/false, &full)
+            || !applyTemplate(allViews, /*addAssistant=*/true, &fullWithPrefix)) {
+            return fail("failed to apply the chat template");
+        }
+        if (full.compare(0, mFormatted.size(), mFormatted) != 0
+            || fullWithPrefix.compare(0, mFormatted.size(), mFormatted) != 0) {
+            return fail("chat template rewrote earlier messages");
+        }
+        turn->historyText = full.substr(mFormatted.size());
+        turn->text        = fullWithPrefix.substr(mFormatted.size());
+        if (fullWithPrefix.compare(0, full.size(), full) == 0) {
+            turn->assistantPrefix      = fullWithPrefix.substr(full.size());
+            turn->assistantPrefixKnown = true;
+        }
+    }
+
+    // The end of the previous reply's message comes first
+    // 直前の応答メッセージの終端を先頭に置く
+    if (!turn->startsConversation) {
+        turn->text.insert(0, mPendingText);
+    }
+
+    // BOS only at the start of the conversation
+    // BOSは会話の先頭でのみ付与
+    if (!tokenize(turn->text, /*addSpecial=*/turn->startsConversation, &turn->tokens)) {
+        return fail("failed to tokenize the prompt");
+    }
+
+    // At the start of a conversation, protect BOS + system prompt from
+    // context shifts
+    // 会話の開始時に、BOS + システムプロンプトをコンテキストシフトから保護
+    if (turn->startsConversation) {
+        int nKeep = 1;
+        size_t nSystem = 0;
+        while (nSystem < turn->messages.size() && turn->messages[nSystem].roleUtf8 == "system") {
+            ++nSystem;
+        }
+        if (nSystem > 0) {
+            const std::vector<llama_chat_message> systemViews(newViews.begin(), newViews.begin() + nSystem);
+            std::string systemText;
+            std::vector<llama_token> systemTokens;
+            if (applyTemplate(systemViews, /*addAssistant=*/false, &systemText)
+                && systemText.size() <= turn->text.size()
+                && tokenize(systemText, /*addSpecial=*/true, &systemTokens)) {
+                nKeep = std::max(nKeep, static_cast<int>(systemTokens.size()));
+            }
+        }
+        turn->keepTokens = std::min(nKeep, static_cast<int>(turn->tokens.size()));
+    }
+    return true;
+}
+
+void Conversation::commit(const Turn &turn)
+{
+    mMessagesBeforeTurn  = mMessages.size();
+    mFormattedBeforeTurn = mFormatted.size();
+    mTokensBeforeTurn    = mTokens.size();
+
+    mPendingTextBeforeTurn = std::move(mPendingText);
+    mPendingText.clear();
+
+    mMessages.insert(mMessages.end(), turn.messages.begin(), turn.messages.end());
+    mFormatted += turn.historyText;
+    mTokens.insert(mTokens.end(), turn.tokens.begin(), turn.tokens.end());
+    mReplyPrefix      = turn.assistantPrefix;
+    mReplyPrefixKnown = turn.assistantPrefixKnown;
+}
+
+void Conversation::rollback()
+{
+    mMessages.resize(std::min(mMessages.size(), mMessagesBeforeTurn));
+    mFormatted.resize(std::min(mFormatted.size(), mFormattedBeforeTurn));
+    mTokens.resize(std::min(mTokens.size(), mTokensBeforeTurn));
+    mPendingText      = mPendingTextBeforeTurn;
+    mReplyPrefixKnown = false;
+}
+
+/*
+  commitReply(reply, replyTokens, dropTokens):
+    - Only the reply tokens whose pieces spell a prefix of the reply are
+      kept; a reply cut off by the length limit has its last token sampled
+      but not decoded, which leaves reply text for mPendingText
+    - A separable template renders the assistant message alone, others
+      render the full history once
+    - Templates that trim or rewrite assistant content fail the verbatim
+      check, and the caller re-templates the whole turn instead
+*/
+bool Conversation::commitReply(const QString &reply, const std::vector<llama_token> &replyTokens,
+                               size_t *dropTokens)
+{
+    *dropTokens = 0;
+    if (!mModel || !mReplyPrefixKnown || mMessages.empty()) {
+        return false;
+    }
+    const std::vector<Message> replyMessages {{QStringLiteral("assistant"), reply, "assistant", reply.toStdString()}};
+    const std::string &content = replyMessages.front().contentUtf8;
+
+    std::string decoded;
+    size_t kept = 0;
+    char buf[256];
+    for (; kept < replyTokens.size(); ++kept) {
+        const int n = llama_token_to_piece(mModel, replyTokens[kept], buf, sizeof(buf), /*lstrip=*/0, /*special=*/true);
+        if (n < 0 || decoded.size() + static_cast<size_t>(n) > content.size()
+            || content.compare(decoded.size(), static_cast<size_t>(n), buf, static_cast<size_t>(n)) != 0) {
+            break;
+        }
+        decoded.append(buf, static_cast<size_t>(n));
+    }
+
+    std::string rendered;
+    if (mSeparable == Separable::Yes) {
+        std::vector<llama_chat_message> views;
+        appendViews(replyMessages, &views);
+        if (!applyTemplate(views, /*addAssistant=*/false, &rendered)) {
+            return false;
+        }
+    } else {
+        std::vector<llama_chat_message> allViews;
+        appendViews(mMessages, &allViews);
+        appendViews(replyMessages, &allViews);
+        std::string full;
+        if (!applyTemplate(allViews, /*addAssistant=*/false, &full)
+            || full.compare(0, mFormatted.size(), mFormatted) != 0) {
+            return false;
+        }
+        rendered = full.substr(mFormatted.size());
+    }
+    if (rendered.compare(0, mReplyPrefix.size(), mReplyPrefix) != 0
+        || rendered.compare(mReplyPrefix.size(), content.size(), content) != 0) {
+        return false;
+    }
+
+    mPendingText = rendered.substr(mReplyPrefix.size() + decoded.size());
+    mFormatted += rendered;
+    mTokens.insert(mTokens.end(), replyTokens.begin(), replyTokens.begin() + static_cast<std::ptrdiff_t>(kept));
+    mMessages.push_back(replyMessages.front());
+    mReplyPrefixKnown = false;
+    *dropTokens = replyTokens.size() - kept;
+    return true;
+}
+
+bool Conversation::applyTemplate(const std::vector<llama_chat_message> &views, bool addAssistant, std::string *out)
+{
+    static constexpr size_t initialBufferSize {2048};
+    if (mBuffer.size() < initialBufferSize) {
+        mBuffer.resize(initialBufferSize);
+    }
+    int length = llama_chat_apply_template(mModel, nullptr, views.data(), views.size(), addAssistant,
+                                           mBuffer.data(), static_cast<int32_t>(mBuffer.size()));
+    if (length > static_cast<int>(mBuffer.size())) {
+        // The buffer only grows, so this second pass is rare
+        // バッファは大きくなる一方なので、この2回目の適用はまれ
+        mBuffer.resize(static_cast<size_t>(length));
+        length = llama_chat_apply_template(mModel, nullptr, views.data(), views.size(), addAssistant,
+                                           mBuffer.data(), static_cast<int32_t>(mBuffer.size()));
+    }
+    if (length < 0) {
+        return false;
+    }
+    out->assign(mBuffer.data(), static_cast<size_t>(length));
+    return true;
+}
+
+bool Conversation::tokenize(const std::string &text, bool addSpecial, std::vector<llama_token> *tokens) const
+{
+    // Every token covers at least one byte; two more for BOS/EOS
+    // 各トークンは1バイト以上に対応する。BOS/EOS用に2つ追加
+    tokens->resize(text.size() + 2);
+    int count = llama_tokenize(mModel, text.data(), static_cast<int32_t>(text.size()),
+                               tokens->data(), static_cast<int32_t>(tokens->size()),
+                               addSpecial, /*parse_special=*/true);
+    if (count < 0) {
+        tokens->resize(static_cast<size_t>(-count));
+        count = llama_tokenize(mModel, text.data(), static_cast<int32_t>(text.size()),
+                               tokens->data(), static_cast<int32_t>(tokens->size()),
+                               addSpecial, /*parse_special=*/true);
+    }
+    if (count < 0) {
+        return false;
+    }
+    tokens->resize(static_cast<size_t>(count));
+    return true;
+}
+
+void Conversation::appendViews(const std::vector<Message> &messages, std::vector<llama_chat_message> *views)
+{
+    views->reserve(views->size() + messages.size());
+    for (const Message &message : messages) {
+        views->push_back({message.roleUtf8.c_str(), message.contentUtf8.c_str()});
+    }
+}
@@ -0,0 +1,188 @@
+// ================================================================
+// Conversation.h
+// ================================================================
+#ifndef CONVERSATION_H
+#define CONVERSATION_H
+
+#include "rep_LlamaResponseGenerator_source.h"  // LlamaChatMessage
+#include "llama.h"
+#include <QList>
+#include <QString>
+#include <string>
+#include <vector>
+
+/*
+  Conversation:
+    - The templated text and prompt tokens of one decode session
+    - Each turn templates and tokenizes only the messages that are new since
+      the last turn, with one template pass and one tokenizer pass, instead
+      of re-templating the whole history on every request
+    - Whether a model's template can be applied message by message is
+      checked once per conversation against a full pass (templates that
+      merge or reorder messages fall back to templating the full history)
+    - Messages are kept as owned UTF-8 strings; the llama_chat_message views
+      passed to llama only point into them, nothing is strdup'ed
+    - Owns the generated replies: a finished reply becomes an assistant
+      message whose tokens are the ones already in the KV cache, so clients
+      resending it are recognized and it is never templated or decoded again
+    - Not thread-safe; owned by one InferenceEngine
+
+  Conversationクラス:
+    - 1つのデコードセッションのテンプレート適用済みテキストとプロンプトトークン
+    - 各ターンでは前回以降の新しいメッセージのみを、テンプレート適用1回と
+      トークナイズ1回で処理し、リクエストごとに履歴全体へテンプレートを
+      適用し直すことはしない
+    - モデルのテンプレートをメッセージ単位で適用できるかは、会話ごとに一度
+      全体への適用結果と比較して確かめる (メッセージを結合/並べ替える
+      テンプレートでは履歴全体への適用に戻す)
+    - メッセージは自前のUTF-8文字列として保持し、llamaに渡す
+      llama_chat_messageはそれを指すだけ (strdupはしない)
+    - 生成した応答を所有する: 完了した応答は、KVキャッシュに載っている
+      トークンをそのまま使うアシスタントメッセージとなるため、それを送り直す
+      クライアントも認識でき、再度テンプレート適用/デコードすることはない
+    - スレッドセーフではない。1つのInferenceEngineが所有する
+*/
+class Conversation
+{
+public:
+    struct Message
+    {
+        QString role;
+        QString content;
+        std::string roleUtf8;
+        std::string contentUtf8;
+    };
+
+    /*
+      Turn:
+        - Result of prepare(); tokens are what has to be decoded
+        - keepTokens (BOS + system prompt) is only set on the first turn
+      Turn:
+        - prepare()の結果。tokensがデコードすべきトークン
+        - keepTokens (BOS + システムプロンプト) は最初のターンでのみ設定される
+    */
+    struct Turn
+    {
+        std::vector<llama_token> tokens;
+        std::string text;          // templated delta, ending with the assistant prefix
+        bool startsConversation {false};
+        int keepTokens {0};
+
+    private:
+        friend class Conversation;
+        std::vector<Message> messages;
+        std::string historyText;   // text without the assistant prefix
+        std::string assistantPrefix;
+        bool assistantPrefixKnown {false};
+    };
+
+    /*
+      reset(model):
+        - Forgets everything; model provides the chat template and tokenizer
+          and must outlive the following prepare() calls
+      reset(model):
+        - 全てを破棄する。modelはチャットテンプレートとトークナイザを提供し、
+          以降のprepare()の間は有効であること
+    */
+    void reset(const llama_model *model);
+
+    /*
+      continues(history):
+        - True if history starts with every message of this conversation,
+          i.e. a client resending its full history only added messages
+      continues(history):
+        - historyがこの会話の全メッセージで始まる場合にtrue
+          (全履歴を送り直すクライアントがメッセージを追加しただけの場合)
+    */
+    bool continues(const QList<LlamaChatMessage> &history) const;
+
+    /*
+      prepare(newMessages, turn, errorMessage):
+        - Templates and tokenizes newMessages as the next turn, followed by
+          the assistant prefix; the conversation itself is not changed
+      prepare(newMessages, turn, errorMessage):
+        - newMessagesを次のターンとしてテンプレート適用/トークナイズし、
+          アシスタントの接頭辞を付ける。会話自体は変更しない
+    */
+    bool prepare(const QList<LlamaChatMessage> &newMessages, Turn *turn, QString *errorMessage = nullptr);
+
+    /*
+      commit(turn):
+        - Appends a prepared turn (its tokens are copied, so they can still
+          be moved into the scheduler afterwards)
+      rollback():
+        - Undoes the last commit(), e.g. when the turn was cancelled
+      commit(turn):
+        - 準備したターンを追加する (トークンはコピーするため、その後
+          スケジューラへmoveできる)
+      rollback():
+        - 直前のcommit()を取り消す (ターンが中止された場合など)
+    */
+    void commit(const Turn &turn);
+    void rollback();
+
+    /*
+      commitReply(reply, replyTokens, dropTokens):
+        - Adopts the reply generated for the last committed turn; replyTokens
+          are the reply tokens the KV cache holds after that turn's prompt
+        - Trailing tokens past the reply text (held back for a stop string)
+          are counted in dropTokens and must be removed from the KV cache;
+          reply text not decoded yet and the end of the templated message
+          are decoded at the start of the next turn
+        - Returns false (conversation unchanged) if the template does not
+          render the reply verbatim after the turn's assistant prefix
+      commitReply(reply, replyTokens, dropTokens):
+        - 直前に確定したターンに対して生成された応答を引き継ぐ。replyTokensは
+          そのターンのプロンプトの後にKVキャッシュが保持する応答トークン
+        - 応答テキストを超える末尾のトークン (停止文字列のために保留したもの) は
+          dropTokensに数え、KVキャッシュから削除すること。まだデコードしていない
+          応答テキストとテンプレートが付けるメッセージの終端は、次のターンの
+          先頭でデコードする
+        - テンプレートがターンのアシスタント接頭辞の後に応答をそのまま出力
+          しない場合はfalseを返す (会話は変更しない)
+    */
+    bool commitReply(const QString &reply, const std::vector<llama_token> &replyTokens, size_t *dropTokens);
+
+    bool isEmpty() const { return mMessages.empty(); }
+    qsizetype messageCount() const { return static_cast<qsizetype>(mMessages.size()); }
+    const std::string &formatted() const { return mFormatted; }
+    const std::vector<llama_token> &tokens() const { return mTokens; }
+
+private:
+    enum class Separable { Unknown, Yes, No };
+
+    // One template pass over views into mBuffer; false if the template failed
+    // viewsへのテンプレート適用を1回行いmBufferへ。失敗した場合はfalse
+    bool applyTemplate(const std::vector<llama_chat_message> &views, bool addAssistant, std::string *out);
+
+    // One tokenizer pass (a retry only if the byte-count bound was too small)
+    // トークナイズを1回 (バイト数による上限が足りない場合のみ再実行)
+    bool tokenize(const std::string &text, bool addSpecial, std::vector<llama_token> *tokens) const;
+
+    static void appendViews(const std::vector<Message> &messages, std::vector<llama_chat_message> *views);
+
+    const llama_model *mModel {nullptr};
+    std::vector<Message> mMessages;
+    std::string mFormatted;            // history text, without a trailing assistant prefix
+    std::vector<llama_token> mTokens;  // every prompt token submitted so far
+    std::string mAssistantPrefix;
+    Separable mSeparable {Separable::Unknown};
+
+    // Assistant prefix the reply to the last turn follows, and text of the
+    // last reply's message that is not in the KV cache yet
+    // 直前のターンの応答が続くアシスタント接頭辞と、直前の応答メッセージのうち
+    // まだKVキャッシュに無いテキスト
+    std::string mReplyPrefix;
+    bool mReplyPrefixKnown {false};
+    std::string mPendingText;
+    std::vector<char> mBuffer;
+
+    // Sizes before the last commit(), for rollback()
+    // 直前のcommit()の前のサイズ (rollback()用)
+    size_t mMessagesBeforeTurn {0};
+    size_t mFormattedBeforeTurn {0};
+    size_t mTokensBeforeTurn {0};
+    std::string mPendingTextBeforeTurn;
+};
+
+#endif // CONVERSATION_H
@@ -0,0 +1,270 @@
+// ================================================================
+// CpuPlacement.cpp
+// ================================================================
+#include "CpuPlacement.h"
+#include "ServerConfig.h"
+#include "llama.h"
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QStringList>
+#include <QThread>
+#include <algorithm>
+
+// The threadpool API moved to ggml-cpu.h when the CPU backend was split out
+// CPUバックエンドの分離に伴い、スレッドプールのAPIはggml-cpu.hに移動した
+#if __has_include("ggml-cpu.h")
+#include "ggml-cpu.h"
+#endif
+
+#ifdef Q_OS_LINUX
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+#ifdef Q_OS_LINUX
+bool setThreadAffinity(const std::vector<int> &cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+#endif
+
+ggml_numa_strategy numaStrategy(const QString &name)
+{
+    if (name == QLatin1String("distribute")) {
+        return GGML_NUMA_STRATEGY_DISTRIBUTE;
+    }
+    if (name == QLatin1String("isolate")) {
+        return GGML_NUMA_STRATEGY_ISOLATE;
+    }
+    if (name == QLatin1String("numactl")) {
+        return GGML_NUMA_STRATEGY_NUMACTL;
+    }
+    if (!name.isEmpty() && name != QLatin1String("disabled")) {
+        qWarning() << "[CpuPlacement] Unknown numaStrategy" << name << "- NUMA placement disabled";
+    }
+    return GGML_NUMA_STRATEGY_DISABLED;
+}
+
+} // namespace
+
+CpuPlacement &CpuPlacement::instance()
+{
+    static CpuPlacement placement;
+    return placement;
+}
+
+/*
+  initialize():
+    - Without explicit inference CPUs, inference gets every CPU the
+      networking threads do not use
+    - Thread counts default to every inference CPU for prefill and half of
+      them for decode; more decode threads than memory channels can feed
+      only add synchronization
+    - ggml's NUMA strategies place ggml's threads by node themselves, so
+      they are meant to be used without inferenceCpus
+*/
+void CpuPlacement::initialize()
+{
+    if (mInitialized) {
+        return;
+    }
+    mInitialized = true;
+
+    const ServerConfig &config = ServerConfig::instance();
+    const int cpuCount = std::max(QThread::idealThreadCount(), 1);
+
+    mNetworkCpus   = parseCpuList(config.networkCpus);
+    mInferenceCpus = parseCpuList(config.inferenceCpus);
+    if (mInferenceCpus.empty() && !mNetworkCpus.empty()) {
+        for (int cpu = 0; cpu < cpuCount; ++cpu) {
+            if (!std::binary_search(mNetworkCpus.begin(), mNetworkCpus.end(), cpu)) {
+                mInferenceCpus.push_back(cpu);
+            }
+        }
+    }
+
+    const int inferenceCount = mInferenceCpus.empty() ? cpuCount : static_cast<int>(mInferenceCpus.size());
+    mPrefillThreads = (config.prefillThreads > 0) ? config.prefillThreads : inferenceCount;
+    mDecodeThreads  = (config.decodeThreads > 0) ? config.decodeThreads : std::max(inferenceCount / 2, 1);
+
+    const ggml_numa_strategy numa = numaStrategy(config.numaStrategy);
+    if (numa != GGML_NUMA_STRATEGY_DISABLED) {
+        llama_numa_init(numa);
+        if (!mInferenceCpus.empty()) {
+            qWarning() << "[CpuPlacement] numaStrategy" << config.numaStrategy
+                       << "re-pins ggml threads per node; inferenceCpus only applies to the decode threads";
+        }
+    }
+
+#ifdef Q_OS_LINUX
+    if (!mNetworkCpus.empty() && !setThreadAffinity(mNetworkCpus)) {
+        qWarning() << "[CpuPlacement] Failed to pin the networking threads to" << formatCpuList(mNetworkCpus);
+    }
+#else
+    if (!mNetworkCpus.empty() || !mInferenceCpus.empty()) {
+        qWarning() << "[CpuPlacement] CPU affinity is not supported on this platform, only thread counts apply";
+    }
+#endif
+
+    logTopology();
+}
+
+void CpuPlacement::pinToInferenceCpus() const
+{
+#ifdef Q_OS_LINUX
+    if (!mInferenceCpus.empty() && !setThreadAffinity(mInferenceCpus)) {
+        qWarning() << "[CpuPlacement] Failed to pin an inference thread to" << formatCpuList(mInferenceCpus);
+    }
+#endif
+}
+
+/*
+  createThreadpools():
+    - The calling thread is worker 0 of every compute, and ggml pins it to
+      the pool's mask when a paused pool resumes
+    - Both pools start paused; a compute resumes the pool it runs on
+*/
+CpuPlacement::Threadpools CpuPlacement::createThreadpools() const
+{
+    Threadpools pools;
+    pools.prefill = createThreadpool(mPrefillThreads);
+    pools.decode  = createThreadpool(mDecodeThreads);
+    if (!pools.prefill || !pools.decode) {
+        qWarning() << "[CpuPlacement] ggml threadpools unavailable, llama.cpp uses its own threads";
+        freeThreadpools(pools);
+    }
+    return pools;
+}
+
+ggml_threadpool *CpuPlacement::createThreadpool(int threads) const
+{
+    const ServerConfig &config = ServerConfig::instance();
+    ggml_threadpool_params params = ggml_threadpool_params_default(threads);
+    for (int cpu : mInferenceCpus) {
+        if (cpu < GGML_MAX_N_THREADS) {
+            params.cpumask[cpu] = true;
+        }
+    }
+    params.strict_cpu = config.strictCpuPlacement && !mInferenceCpus.empty();
+    params.poll       = static_cast<uint32_t>(std::clamp(config.threadpoolPoll, 0, 100));
+    params.paused     = true;
+    return ggml_threadpool_new(&params);
+}
+
+void CpuPlacement::pauseThreadpool(ggml_threadpool *pool)
+{
+    if (pool) {
+        ggml_threadpool_pause(pool);
+    }
+}
+
+void CpuPlacement::freeThreadpools(Threadpools &pools)
+{
+    if (pools.prefill) {
+        ggml_threadpool_free(pools.prefill);
+        pools.prefill = nullptr;
+    }
+    if (pools.decode) {
+        ggml_threadpool_free(pools.decode);
+        pools.decode = nullptr;
+    }
+}
+
+/*
+  parseCpuList(text):
+    - Ranges reaching past the CPUs an affinity mask can hold (or, without
+      affinity support, past the CPUs Qt reports) are rejected as invalid,
+      so a typo like "0-99999999" cannot expand into a huge list
+*/
+std::vector<int> CpuPlacement::parseCpuList(const QString &text)
+{
+#ifdef Q_OS_LINUX
+    const int cpuLimit = CPU_SETSIZE;
+#else
+    const int cpuLimit = std::max(QThread::idealThreadCount(), 1);
+#endif
+
+    std::vector<int> cpus;
+    for (const QString &part : text.split(QLatin1Char(','), Qt::SkipEmptyParts)) {
+        const QStringList range = part.trimmed().split(QLatin1Char('-'));
+        bool firstOk = false;
+        bool lastOk  = false;
+        const int first = range.at(0).toInt(&firstOk);
+        const int last  = (range.size() > 1) ? range.at(1).toInt(&lastOk) : first;
+        if (!firstOk || (range.size() > 1 && !lastOk) || first < 0 || last < first || last >= cpuLimit) {
+            qWarning() << "[CpuPlacement] Ignoring invalid CPU range" << part;
+            continue;
+        }
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return cpus;
+}
+
+QString CpuPlacement::formatCpuList(const std::vector<int> &cpus)
+{
+    if (cpus.empty()) {
+        return QStringLiteral("any");
+    }
+    QStringList ranges;
+    size_t start = 0;
+    for (size_t i = 1; i <= cpus.size(); ++i) {
+        if (i == cpus.size() || cpus[i] != cpus[i - 1] + 1) {
+            ranges.append(start + 1 == i ? QString::number(cpus[start])
+                                         : QStringLiteral("%1-%2").arg(cpus[start]).arg(cpus[i - 1]));
+            start = i;
+        }
+    }
+    return ranges.join(QLatin1Char(','));
+}
+
+/*
+  logTopology():
+    - NUMA nodes come from sysfs; an inference set spanning several nodes
+      is worth a warning, its threads then read weights across sockets
+*/
+void CpuPlacement::logTopology() const
+{
+    const ServerConfig &config = ServerConfig::instance();
+    qDebug() << "[CpuPlacement]" << QThread::idealThreadCount() << "CPUs; inference on"
+             << formatCpuList(mInferenceCpus) << "with" << mPrefillThreads << "prefill /"
+             << mDecodeThreads << "decode threads; networking on" << formatCpuList(mNetworkCpus)
+             << "; NUMA" << (config.numaStrategy.isEmpty() ? QStringLiteral("disabled") : config.numaStrategy);
+
+#ifdef Q_OS_LINUX
+    const QDir nodeDir(QStringLiteral("/sys/devices/system/node"));
+    const QStringList nodes = nodeDir.entryList({QStringLiteral("node*")}, QDir::Dirs, QDir::Name);
+    int inferenceNodes = 0;
+    for (const QString &node : nodes) {
+        QFile cpuList(nodeDir.filePath(node + QStringLiteral("/cpulist")));
+        if (!cpuList.open(QIODevice::ReadOnly)) {
+            continue;
+        }
+        const std::vector<int> cpus = parseCpuList(QString::fromLatin1(cpuList.readAll()));
+        const bool hostsInference = mInferenceCpus.empty()
+                                    || std::any_of(cpus.begin(), cpus.end(), [this](int cpu) {
+                                           return std::binary_search(mInferenceCpus.begin(), mInferenceCpus.end(), cpu);
+                                       });
+        inferenceNodes += hostsInference ? 1 : 0;
+        qDebug() << "[CpuPlacement]" << node << "CPUs" << formatCpuList(cpus)
+                 << (hostsInference ? "(inference)" : "");
+    }
+    if (inferenceNodes > 1 && config.numaStrategy.isEmpty()) {
+        qWarning() << "[CpuPlacement] Inference spans" << inferenceNodes
+                   << "NUMA nodes; consider inferenceCpus on one node or one worker per node";
+    }
+#endif
+}
@@ -0,0 +1,128 @@
+// ================================================================
+// CpuPlacement.h
+// ================================================================
+#ifndef CPUPLACEMENT_H
+#define CPUPLACEMENT_H
+
+#include "ggml.h"
+#include <QString>
+#include <vector>
+
+/*
+  CpuPlacement:
+    - Decides which CPUs run inference and which run everything else
+      (Qt event loops, QtRO/WebSocket I/O, engine threads), from the
+      "CPU placement" settings of ServerConfig
+    - initialize() runs in main() before any other thread exists: it sets
+      up NUMA for llama.cpp and pins the main thread to the networking CPUs,
+      so every thread started afterwards inherits that mask; the decode and
+      embedding threads re-pin themselves to the inference CPUs
+    - Prefill steps are compute bound and scale with cores, decode steps
+      are memory-bandwidth bound and saturate early, so each DecodeScheduler
+      gets two ggml threadpools with their own thread counts over the same
+      inference CPUs and switches between them per step
+    - Affinity and topology are only available on Linux; elsewhere only the
+      thread counts apply
+
+  CpuPlacementクラス:
+    - ServerConfigの"CPU placement"の設定から、推論を実行するCPUと、それ以外
+      (Qtのイベントループ、QtRO/WebSocketのI/O、エンジンスレッド) を実行する
+      CPUを決める
+    - initialize()は他のスレッドが存在する前にmain()で呼ぶ: llama.cppの
+      NUMA設定を行い、メインスレッドをネットワーク用CPUに固定するため、
+      以降に開始する全スレッドはそのマスクを引き継ぐ。デコードスレッドと
+      埋め込みスレッドは自身を推論用CPUに固定し直す
+    - プリフィルのステップは計算律速でコア数に比例して速くなり、デコードの
+      ステップはメモリ帯域律速で早く頭打ちになる。そのため各DecodeSchedulerは
+      同じ推論用CPU上にスレッド数の異なる2つのggmlスレッドプールを持ち、
+      ステップごとに切り替える
+    - アフィニティとトポロジはLinuxのみ。他のOSではスレッド数のみ反映する
+*/
+class CpuPlacement
+{
+public:
+    /*
+      Threadpools:
+        - The pair of one DecodeScheduler, released with freeThreadpools()
+      Threadpools:
+        - 1つのDecodeSchedulerが使う組。freeThreadpools()で解放する
+    */
+    struct Threadpools
+    {
+        ggml_threadpool *prefill {nullptr};
+        ggml_threadpool *decode {nullptr};
+    };
+
+    static CpuPlacement &instance();
+
+    /*
+      initialize():
+        - NUMA, CPU sets and thread counts; logs the chosen topology
+      initialize():
+        - NUMA、CPU集合、スレッド数を設定し、選んだトポロジをログに出す
+    */
+    void initialize();
+
+    int prefillThreads() const { return mPrefillThreads; }
+    int decodeThreads() const { return mDecodeThreads; }
+
+    /*
+      pinToInferenceCpus():
+        - Restricts the calling thread to the inference CPUs (no-op when
+          none are configured)
+      pinToInferenceCpus():
+        - 呼び出し元のスレッドを推論用CPUに限定する (未設定の場合は何もしない)
+    */
+    void pinToInferenceCpus() const;
+
+    /*
+      createThreadpools():
+        - New prefill/decode pools over the inference CPUs; members stay
+          nullptr if ggml cannot create them (llama.cpp then uses its own)
+        - Call on the thread that runs the computations
+      createThreadpools():
+        - 推論用CPU上にプリフィル/デコード用のプールを新規作成。ggmlが作成
+          できない場合はnullptrのまま (llama.cppが独自のものを使う)
+        - 計算を実行するスレッド上で呼ぶこと
+    */
+    Threadpools createThreadpools() const;
+
+    /*
+      pauseThreadpool(pool):
+        - Stops the idle workers of a pool from polling; the next compute
+          on it resumes it
+      pauseThreadpool(pool):
+        - プールのアイドルなワーカーのポーリングを止める。次にそのプールで
+          計算すると再開する
+    */
+    static void pauseThreadpool(ggml_threadpool *pool);
+    static void freeThreadpools(Threadpools &pools);
+
+    CpuPlacement(const CpuPlacement &) = delete;
+    CpuPlacement &operator=(const CpuPlacement &) = delete;
+
+private:
+    CpuPlacement() = default;
+
+    /*
+      parseCpuList(text):
+        - "0-7,16-23" style lists as in cpuset / sysfs; sorted, unique
+        - Ranges past the usable CPU ids are ignored with a warning
+      parseCpuList(text):
+        - cpuset / sysfs形式のリスト ("0-7,16-23")。昇順で重複なし
+        - 使用可能なCPU番号を超える範囲は警告を出して無視する
+    */
+    static std::vector<int> parseCpuList(const QString &text);
+    static QString formatCpuList(const std::vector<int> &cpus);
+
+    ggml_threadpool *createThreadpool(int threads) const;
+    void logTopology() const;
+
+    bool mInitialized {false};
+    std::vector<int> mInferenceCpus;   // empty = not pinned
+    std::vector<int> mNetworkCpus;     // empty = not pinned
+    int mPrefillThreads {4};
+    int mDecodeThreads {4};
+};
+
+#endif // CPUPLACEMENT_H
@@ -0,0 +1,1540 @@
+// ================================================================
+// DecodeScheduler.cpp
+// ================================================================
+#include "DecodeScheduler.h"
+#include "Metrics.h"
+#include "ModelRegistry.h"
+#include "ServerConfig.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+
+namespace {
+
+// Session ids are unique across all schedulers, which share the spill directory
+// セッションIDは全スケジューラで一意 (退避ディレクトリを共有するため)
+std::atomic<quint64> nextSessionId {1};
+
+double msBetween(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to)
+{
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+} // namespace
+
+/*
+  Constructor:
+    - Cheap; ModelRegistry calls initialize() right after
+*/
+DecodeScheduler::DecodeScheduler(const ServerConfig::ModelConfig &modelConfig)
+    : mModelConfig(modelConfig)
+{
+}
+
+/*
+  Destructor:
+    - Stops the decode thread, then frees batch/context; pooled samplers
+      are freed with mSamplerPool after the sessions
+  デストラクタ:
+    - デコードスレッドを停止し、バッチ/コンテキストを解放。プール済みの
+      サンプラーはセッションの後にmSamplerPoolと共に解放される
+*/
+DecodeScheduler::~DecodeScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mWakeUp.notify_all();
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+
+    if (mInitialized) {
+        llama_batch_free(mBatch);
+    }
+    if (mCtx) {
+        llama_free(mCtx);
+        mCtx = nullptr;
+    }
+    if (mDraftCtx) {
+        llama_batch_free(mDraftBatch);
+        llama_sampler_free(mDraftSampler);
+        llama_free(mDraftCtx);
+        mDraftCtx = nullptr;
+    }
+    CpuPlacement::freeThreadpools(mThreadpools);
+    mDraftModel.reset();
+    mModel.reset();
+
+    if (mGauges) {
+        mGauges->loaded.store(0, std::memory_order_relaxed);
+        mGauges->queueDepth.store(0, std::memory_order_relaxed);
+        mGauges->runningRequests.store(0, std::memory_order_relaxed);
+        mGauges->kvCellsUsed.store(0, std::memory_order_relaxed);
+        mGauges->prefixCacheCells.store(0, std::memory_order_relaxed);
+    }
+}
+
+/*
+  initialize(onLoaded):
+    - Runs once; later callers get the cached result
+    - The context holds mMaxSequences sequences of mNCtxPerSeq tokens each,
+      plus mPrefixCacheSequences sequences sharing mPrefixCacheTokens cells
+      for the prefix cache
+    - n_batch bounds the tokens of one scheduler step, n_ubatch the tokens
+      llama.cpp computes at once inside it
+*/
+bool DecodeScheduler::initialize(const std::function<void()> &onLoaded)
+{
+    std::lock_guard<std::mutex> initLock(mInitMutex);
+    if (mInitialized) {
+        return true;
+    }
+
+    const llama_model_params modelParams = ModelRegistry::modelParams(mModelConfig.gpuLayers);
+
+    mModel = ModelRegistry::instance().acquire(mModelConfig.path.toStdString(), modelParams);
+    if (!mModel) {
+        return false;
+    }
+
+    const ServerConfig &config = ServerConfig::instance();
+    mNCtxPerSeq = std::max(config.contextTokens, 64);
+    mBatchSize = std::max(config.batchSize, mMaxSequences);
+    const int microBatchSize = (config.microBatchSize > 0)
+                                   ? std::min(config.microBatchSize, mBatchSize)
+                                   : mBatchSize;
+    mPrefillChunkTokens = (config.prefillChunkTokens > 0)
+                              ? std::min(config.prefillChunkTokens, mBatchSize)
+                              : mBatchSize;
+
+    llama_context_params ctxParams = llama_context_default_params();
+    ctxParams.n_ctx     = mNCtxPerSeq * mMaxSequences + mPrefixCacheTokens;
+    ctxParams.n_batch   = mBatchSize;
+    ctxParams.n_ubatch  = microBatchSize;
+    ctxParams.n_seq_max = mMaxSequences + mPrefixCacheSequences;
+    ctxParams.n_threads       = CpuPlacement::instance().decodeThreads();
+    ctxParams.n_threads_batch = CpuPlacement::instance().prefillThreads();
+
+    mCtx = llama_new_context_with_model(mModel.get(), ctxParams);
+    if (!mCtx) {
+        fprintf(stderr, "Error: failed to create llama_context.\n");
+        mModel.reset();
+        return false;
+    }
+
+    mBatch = llama_batch_init(mBatchSize, /*embd=*/0, /*n_seq_max=*/1);
+
+    mGauges = &Metrics::instance().model(mModelConfig.name);
+    mGauges->kvCellsCapacity.store(llama_n_ctx(mCtx), std::memory_order_relaxed);
+    mGauges->loaded.store(1, std::memory_order_relaxed);
+
+    initializeDraft();
+
+    if (onLoaded) {
+        onLoaded();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        // Hand out low sequence ids first
+        // 小さいシーケンスIDから順に割り当てる
+        for (int i = mMaxSequences - 1; i >= 0; --i) {
+            mFreeSeqIds.push_back(i);
+        }
+
+        // Sequence ids above the client range belong to the prefix cache
+        // クライアント用の範囲より上のシーケンスIDは先頭部分キャッシュが使う
+        std::vector<llama_seq_id> cacheSeqIds;
+        for (int i = 0; i < mPrefixCacheSequences; ++i) {
+            cacheSeqIds.push_back(mMaxSequences + i);
+        }
+        mPrefixCache = std::make_unique<PrefixCache>(mPrefixBlockSize, mPrefixCacheTokens,
+                                                     std::move(cacheSeqIds));
+
+        mSpillStore          = std::make_unique<KvSpillStore>(config.kvSpillDirectory);
+        mIdleOffloadAfter    = std::chrono::seconds(config.kvOffloadIdleSeconds);
+        mResidentTokenBudget = config.kvResidentTokenBudget;
+        mMaxQueuedRequests   = config.maxQueuedRequests;
+        mMaxRequestsPerClient = config.maxRequestsPerClient;
+    }
+
+    // Nobody can submit before this returns, so the warm-up has the contexts to itself
+    // これが戻るまで誰も投入できないため、ウォームアップがコンテキストを占有する
+    std::future<void> warmedUp = mWarmedUp.get_future();
+    mThread = std::thread([this]() { run(); });
+    warmedUp.wait();
+    mInitialized = true;
+
+    qDebug() << "[DecodeScheduler]" << mModelConfig.name << "ready with" << mMaxSequences << "sequences of"
+             << mNCtxPerSeq << "tokens, batch" << mBatchSize << "ubatch" << microBatchSize
+             << "prefill chunk" << mPrefillChunkTokens
+             << "draft tokens" << mDraftTokens;
+    return true;
+}
+
+/*
+  initializeDraft():
+    - Token ids must mean the same in both models, so the vocabularies have
+      to match; otherwise speculative decoding stays off
+    - Failing to load the draft is not fatal
+*/
+void DecodeScheduler::initializeDraft()
+{
+    if (mModelConfig.draftPath.isEmpty() || mModelConfig.draftTokens <= 0) {
+        return;
+    }
+
+    const llama_model_params modelParams = ModelRegistry::modelParams(mModelConfig.draftGpuLayers);
+    mDraftModel = ModelRegistry::instance().acquire(mModelConfig.draftPath.toStdString(), modelParams);
+    if (!mDraftModel) {
+        qWarning() << "[DecodeScheduler] Draft model not loaded, speculative decoding disabled";
+        return;
+    }
+    if (llama_n_vocab(mDraftModel.get()) != llama_n_vocab(mModel.get())) {
+        qWarning() << "[DecodeScheduler] Draft model vocabulary differs, speculative decoding disabled";
+        mDraftModel.reset();
+        return;
+    }
+
+    llama_context_params ctxParams = llama_context_default_params();
+    ctxParams.n_ctx     = mNCtxPerSeq * mMaxSequences;
+    ctxParams.n_batch   = mBatchSize;
+    ctxParams.n_seq_max = mMaxSequences;
+    ctxParams.n_threads       = CpuPlacement::instance().decodeThreads();
+    ctxParams.n_threads_batch = CpuPlacement::instance().decodeThreads();
+
+    mDraftCtx = llama_new_context_with_model(mDraftModel.get(), ctxParams);
+    if (!mDraftCtx) {
+        qWarning() << "[DecodeScheduler] Failed to create the draft context, speculative decoding disabled";
+        mDraftModel.reset();
+        return;
+    }
+    mDraftBatch   = llama_batch_init(mBatchSize, /*embd=*/0, /*n_seq_max=*/1);
+    mDraftSampler = llama_sampler_init_greedy();
+    mDraftTokens  = std::min(mModelConfig.draftTokens, mBatchSize - 1);
+}
+
+/*
+  warmUp():
+    - Runs at the start of run(), before initialize() returns, so no session
+      exists yet and the contexts are not shared
+    - Each shape runs on the threadpool it will use later
+    - The cells written here are cleared again; metrics are not touched
+*/
+void DecodeScheduler::warmUp()
+{
+    const int promptTokens = std::min(ServerConfig::instance().warmupTokens, mPrefillChunkTokens);
+    if (promptTokens <= 0) {
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const llama_token bos = llama_token_bos(mModel.get());
+    const llama_token token = (bos >= 0) ? bos : 0;
+    auto decode = [token](llama_context *ctx, llama_batch &batch, llama_pos from, int count) {
+        batch.n_tokens = 0;
+        for (int i = 0; i < count; ++i) {
+            batch.token[i]     = token;
+            batch.pos[i]       = from + i;
+            batch.n_seq_id[i]  = 1;
+            batch.seq_id[i][0] = 0;
+            batch.logits[i]    = (i == count - 1);
+            ++batch.n_tokens;
+        }
+        return llama_decode(ctx, batch) == 0;
+    };
+
+    // Prefill shape, then the single-token decode shape
+    // プリフィルの形状、次に1トークンのデコードの形状
+    selectThreadpool(/*prefill=*/true);
+    bool ok = decode(mCtx, mBatch, 0, promptTokens);
+    selectThreadpool(/*prefill=*/false);
+    ok = ok && decode(mCtx, mBatch, promptTokens, 1);
+    llama_synchronize(mCtx);
+    llama_kv_cache_clear(mCtx);
+    if (mDraftCtx) {
+        ok = decode(mDraftCtx, mDraftBatch, 0, promptTokens) && decode(mDraftCtx, mDraftBatch, promptTokens, 1) && ok;
+        llama_synchronize(mDraftCtx);
+        llama_kv_cache_clear(mDraftCtx);
+    }
+
+    if (!ok) {
+        qWarning() << "[DecodeScheduler]" << mModelConfig.name << "warm-up decode failed";
+        return;
+    }
+    qDebug() << "[DecodeScheduler]" << mModelConfig.name << "warmed up in" << timer.elapsed() << "ms";
+}
+
+/*
+  model():
+    - Valid after a successful initialize()
+*/
+std::shared_ptr<llama_model> DecodeScheduler::model() const
+{
+    return mModel;
+}
+
+QString DecodeScheduler::modelName() const
+{
+    return mModelConfig.name;
+}
+
+/*
+  isIdle():
+    - Jobs are attached to sessions while running or waiting
+*/
+bool DecodeScheduler::isIdle() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return std::none_of(mSessions.begin(), mSessions.end(), [](const auto &entry) {
+        return entry.second->job != nullptr;
+    });
+}
+
+/*
+  prefixCacheStats():
+    - Copied under the lock
+*/
+PrefixCache::Stats DecodeScheduler::prefixCacheStats() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mPrefixCache ? mPrefixCache->stats() : PrefixCache::Stats{};
+}
+
+/*
+  openSession():
+    - Registers a session; its sequence id is bound when its first job starts
+*/
+DecodeScheduler::SessionId DecodeScheduler::openSession()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto session = std::make_unique<Session>();
+    session->id = nextSessionId++;
+    const SessionId id = session->id;
+    mSessions.emplace(id, std::move(session));
+    return id;
+}
+
+/*
+  closeSession(id):
+    - A queued or running job ends through onCancelled with its partial
+      text, like cancel(), so the client always gets a final reply
+    - The sequence's KV cells are cleared by the decode thread before the
+      sequence id is reused
+*/
+void DecodeScheduler::closeSession(SessionId id)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto it = mSessions.find(id);
+        if (it == mSessions.end()) {
+            return;
+        }
+        if (std::unique_ptr<Job> job = std::move(it->second->job)) {
+            qDebug() << "[DecodeScheduler] Closed session" << id << "with a generation in flight after"
+                     << job->generatedTokens << "tokens";
+            if (job->callbacks.onCancelled) {
+                job->callbacks.onCancelled(job->response + job->stopMatcher.flush());
+            }
+        }
+        if (it->second->seqId >= 0) {
+            mSeqIdsToClear.push_back(it->second->seqId);
+        }
+        if (it->second->spilled) {
+            mSpillStore->remove(id);
+        }
+        mWaiting.erase(std::remove(mWaiting.begin(), mWaiting.end(), id), mWaiting.end());
+        mSessions.erase(it);
+    }
+    mWakeUp.notify_all();
+}
+
+/*
+  sessionLength(id):
+    - Valid whether the session is resident or spilled
+*/
+int DecodeScheduler::sessionLength(SessionId id) const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mSessions.find(id);
+    return it == mSessions.end() ? 0 : it->second->nPast;
+}
+
+bool DecodeScheduler::isGenerating(SessionId id) const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mSessions.find(id);
+    return it != mSessions.end() && it->second->job != nullptr;
+}
+
+/*
+  setKeepTokens(id, nKeep):
+    - Never below 0; clamped against the window when shifting
+*/
+void DecodeScheduler::setKeepTokens(SessionId id, int nKeep)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mSessions.find(id);
+    if (it != mSessions.end()) {
+        it->second->nKeep = std::max(nKeep, 0);
+    }
+}
+
+/*
+  submit(id, promptTokens, callbacks, clientKey, params):
+    - One job per session at a time
+    - Admission control happens here so an overloaded server answers at once
+    - Sequence binding happens on the decode thread (startJobs())
+*/
+bool DecodeScheduler::submit(SessionId id,
+                             std::vector<llama_token> promptTokens,
+                             GenerationCallbacks callbacks,
+                             const QString &clientKey,
+                             const GenerationParams &params)
+{
+    QString error;
+    QString rejection;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto it = mSessions.find(id);
+        if (it == mSessions.end()) {
+            error = QStringLiteral("unknown session");
+        } else if (promptTokens.empty()) {
+            error = QStringLiteral("empty prompt");
+        } else {
+            Session &session = *it->second;
+            if (session.job) {
+                error = QStringLiteral("generation already in progress");
+            } else if (std::min<llama_pos>(session.nKeep, session.nPast)
+                           + static_cast<llama_pos>(promptTokens.size()) >= mNCtxPerSeq) {
+                error = QStringLiteral("context window exceeded");
+            } else if (mMaxQueuedRequests > 0
+                       && static_cast<int>(mWaiting.size()) >= mMaxQueuedRequests) {
+                rejection = QStringLiteral("overloaded");
+            } else if (mMaxRequestsPerClient > 0 && !clientKey.isEmpty()
+                       && std::count_if(mSessions.begin(), mSessions.end(), [&clientKey](const auto &entry) {
+                              return entry.second->job && entry.second->job->clientKey == clientKey;
+                          }) >= mMaxRequestsPerClient) {
+                rejection = QStringLiteral("too many concurrent requests from this client");
+            } else {
+                auto job = std::make_unique<Job>();
+                job->prompt    = std::move(promptTokens);
+                job->callbacks = std::move(callbacks);
+                job->clientKey = clientKey;
+                job->maxTokens      = std::max(params.maxTokens, 0);
+                job->samplingParams = params.sampling;
+                job->stopMatcher    = StopMatcher(params.stopStrings);
+                session.job = std::move(job);
+                mWaiting.push_back(id);
+            }
+        }
+    }
+
+    if (!error.isEmpty()) {
+        if (callbacks.onError) {
+            callbacks.onError(error);
+        }
+        return false;
+    }
+    if (!rejection.isEmpty()) {
+        qDebug() << "[DecodeScheduler] Rejected request of session" << id << ":" << rejection;
+        if (callbacks.onRejected) {
+            callbacks.onRejected(rejection);
+        }
+        return false;
+    }
+    mWakeUp.notify_all();
+    return true;
+}
+
+/*
+  queueDepth():
+    - Waiting jobs only; running ones hold a sequence
+*/
+int DecodeScheduler::queueDepth() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return static_cast<int>(mWaiting.size());
+}
+
+/*
+  cancel(id):
+    - Detaches the job right away so a follow-up submit() is accepted
+    - Cells already decoded (or still in flight) are removed by the decode
+      thread in applyRollbacks() before anything else uses the sequence
+*/
+bool DecodeScheduler::cancel(SessionId id)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mSessions.find(id);
+    if (it == mSessions.end() || !it->second->job) {
+        return false;
+    }
+    Session &session = *it->second;
+    std::unique_ptr<Job> job = std::move(session.job);
+    mWaiting.erase(std::remove(mWaiting.begin(), mWaiting.end(), id), mWaiting.end());
+
+    if (job->started) {
+        session.rollbackFrom = (session.rollbackFrom < 0)
+                                   ? job->startPast
+                                   : std::min(session.rollbackFrom, job->startPast);
+        session.nPast = job->startPast;
+    }
+    session.lastActive = Clock::now();
+
+    qDebug() << "[DecodeScheduler] Cancelled generation of session" << id
+             << "after" << job->generatedTokens << "tokens";
+    if (job->callbacks.onCancelled) {
+        job->callbacks.onCancelled(job->response + job->stopMatcher.flush());
+    }
+    mWakeUp.notify_all();
+    return true;
+}
+
+/*
+  rewind(id, tokens):
+    - Same deferred truncation as cancel(): the cells go in applyRollbacks()
+      on the decode thread, a spilled session loses them when restored
+*/
+bool DecodeScheduler::rewind(SessionId id, int tokens)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mSessions.find(id);
+    if (it == mSessions.end() || it->second->job) {
+        return false;
+    }
+    Session &session = *it->second;
+    if (tokens <= 0 || session.nPast == 0) {
+        return true;
+    }
+    const llama_pos from = std::max<llama_pos>(session.nPast - tokens, 0);
+    session.rollbackFrom = (session.rollbackFrom < 0) ? from : std::min(session.rollbackFrom, from);
+    session.nPast = from;
+    mWakeUp.notify_all();
+    return true;
+}
+
+/*
+  selectThreadpool(prefill):
+    - llama.cpp itself only tells single-token batches apart, but a step of
+      many decoding sequences is still bandwidth bound, so the step kind is
+      decided here from its prompt tokens
+*/
+void DecodeScheduler::selectThreadpool(bool prefill)
+{
+    ggml_threadpool *pool = prefill ? mThreadpools.prefill : mThreadpools.decode;
+    if (!pool || pool == mActiveThreadpool) {
+        return;
+    }
+    const CpuPlacement &placement = CpuPlacement::instance();
+    const int threads = prefill ? placement.prefillThreads() : placement.decodeThreads();
+    llama_attach_threadpool(mCtx, pool, pool);
+    llama_set_n_threads(mCtx, threads, threads);
+    CpuPlacement::pauseThreadpool(mActiveThreadpool);
+    mActiveThreadpool = pool;
+}
+
+/*
+  run():
+    - Waits for work (or the maintenance interval), offloads idle sessions,
+      starts waiting jobs, builds one batch for all sessions, decodes it
+      without holding the lock, then samples and dispatches results
+    - With a draft model the draft inputs are collected first and drafted
+      without the lock as well; the batch is built once they are back
+    - Pins itself to the inference CPUs and creates the threadpools here,
+      so this thread is worker 0 of every compute; the warm-up follows, and
+      initialize() returns once it is done
+*/
+void DecodeScheduler::run()
+{
+    CpuPlacement::instance().pinToInferenceCpus();
+    mThreadpools = CpuPlacement::instance().createThreadpools();
+    if (mDraftCtx && mThreadpools.decode) {
+        llama_attach_threadpool(mDraftCtx, mThreadpools.decode, mThreadpools.decode);
+    }
+    warmUp();
+    mWarmedUp.set_value();
+
+    while (true) {
+        std::vector<SessionId> batchSessions;
+        std::vector<DraftRequest> drafts;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mWakeUp.wait_for(lock, mMaintenanceInterval, [this]() {
+                return mStopping || hasRunnableWork();
+            });
+            if (mStopping) {
+                return;
+            }
+
+            // Release KV cells of closed sessions before reusing their sequence ids
+            // 閉じたセッションのKVセルを解放してからシーケンスIDを再利用する
+            for (llama_seq_id seqId : mSeqIdsToClear) {
+                llama_kv_cache_seq_rm(mCtx, seqId, -1, -1);
+                if (mDraftCtx) {
+                    llama_kv_cache_seq_rm(mDraftCtx, seqId, -1, -1);
+                }
+                mFreeSeqIds.push_back(seqId);
+            }
+            mSeqIdsToClear.clear();
+
+            applyRollbacks();
+            offloadIdleSessions();
+            startJobs();
+            if (mDraftCtx) {
+                drafts = collectDrafts();
+            }
+            if (drafts.empty()) {
+                batchSessions = buildBatch();
+                publishGauges();
+            }
+        }
+
+        // Speculative decoding: drafts are verified right after the pending token
+        // 投機的デコード: 下書きは保留中のトークンの直後に並べて検証する
+        if (!drafts.empty()) {
+            draftTokens(drafts);
+            std::lock_guard<std::mutex> lock(mMutex);
+            applyDrafts(drafts);
+            batchSessions = buildBatch();
+            publishGauges();
+        }
+
+        if (batchSessions.empty()) {
+            continue;
+        }
+
+        selectThreadpool(mStepPromptTokens > 0);
+        const Clock::time_point stepStart = Clock::now();
+        const int decodeResult = llama_decode(mCtx, mBatch);
+        const double stepMs = msBetween(stepStart, Clock::now());
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (decodeResult != 0) {
+            // Roll the affected sequences back to where their request started
+            // 失敗したシーケンスをリクエスト開始時点の状態に戻す
+            for (SessionId id : batchSessions) {
+                auto it = mSessions.find(id);
+                if (it == mSessions.end() || !it->second->job) {
+                    continue;
+                }
+                Session &session = *it->second;
+                truncateSession(session, session.job->startPast);
+                finishJob(session, QStringLiteral("failed to decode"));
+            }
+            continue;
+        }
+        accountStep(batchSessions, stepMs);
+        sampleBatch(batchSessions);
+    }
+}
+
+/*
+  hasRunnableWork():
+    - Started jobs always can progress; waiting ones need a free sequence
+      or an idle resident session that can be offloaded
+*/
+bool DecodeScheduler::hasRunnableWork() const
+{
+    if (!mSeqIdsToClear.empty()) {
+        return true;
+    }
+
+    for (const auto &entry : mSessions) {
+        if (entry.second->rollbackFrom >= 0) {
+            return true;
+        }
+    }
+
+    bool idleResident = false;
+    for (const auto &entry : mSessions) {
+        const Session &session = *entry.second;
+        if (!session.job && session.seqId >= 0 && !session.pinned) {
+            idleResident = true;
+            break;
+        }
+    }
+
+    for (const auto &entry : mSessions) {
+        const Session &session = *entry.second;
+        if (!session.job) {
+            continue;
+        }
+        if (session.job->started || session.seqId >= 0 || !mFreeSeqIds.empty() || idleResident) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+  applyRollbacks():
+    - Runs after any in-flight decode has completed, so no cell written for
+      the cancelled job survives
+*/
+void DecodeScheduler::applyRollbacks()
+{
+    for (auto &entry : mSessions) {
+        Session &session = *entry.second;
+        if (session.rollbackFrom < 0) {
+            continue;
+        }
+        truncateSession(session, session.rollbackFrom);
+        session.rollbackFrom = -1;
+    }
+}
+
+/*
+  startJobs():
+    - Entries whose job was cancelled or whose session was closed are dropped
+    - A session that is already resident may start ahead of the queue, since
+      it does not compete for a sequence
+*/
+void DecodeScheduler::startJobs()
+{
+    int position = 0;
+    for (auto it = mWaiting.begin(); it != mWaiting.end();) {
+        auto sessionIt = mSessions.find(*it);
+        if (sessionIt == mSessions.end() || !sessionIt->second->job
+            || sessionIt->second->job->started) {
+            it = mWaiting.erase(it);
+            continue;
+        }
+
+        Session &session = *sessionIt->second;
+        if (startJob(session)) {
+            it = mWaiting.erase(it);
+            continue;
+        }
+
+        // Still waiting: report the position if it changed
+        // 待機継続: 順番が変わっていれば通知
+        Job &job = *session.job;
+        ++position;
+        if (job.queuePosition != position) {
+            job.queuePosition = position;
+            if (job.callbacks.onQueued) {
+                job.callbacks.onQueued(position);
+            }
+        }
+        ++it;
+    }
+}
+
+/*
+  startJob(session):
+    - A session without a sequence takes a free one, or the one of the
+      least recently active idle session, which is offloaded first
+    - Spilled state is restored into the new sequence; if that fails the
+      session starts over from an empty KV state and the request fails
+      (which also counts as leaving the queue)
+*/
+bool DecodeScheduler::startJob(Session &session)
+{
+    Job *job = session.job.get();
+
+    if (session.seqId < 0) {
+        if (mFreeSeqIds.empty()) {
+            Session *victim = nullptr;
+            for (auto &other : mSessions) {
+                Session &candidate = *other.second;
+                if (candidate.job || candidate.seqId < 0 || candidate.pinned) {
+                    continue;
+                }
+                if (!victim || candidate.lastActive < victim->lastActive) {
+                    victim = &candidate;
+                }
+            }
+            if (!victim || !offloadSession(*victim)) {
+                return false;
+            }
+        }
+
+        session.seqId = mFreeSeqIds.back();
+        mFreeSeqIds.pop_back();
+
+        if (session.spilled) {
+            session.spilled = false;
+            if (!mSpillStore->restore(mCtx, session.seqId, session.id)) {
+                truncateSession(session, 0);
+                finishJob(session, QStringLiteral("failed to restore session state"));
+                return true;
+            }
+            // Cells past nPast were rewound while the session was spilled
+            // 退避中に巻き戻されたnPast以降のセルを削除
+            llama_kv_cache_seq_rm(mCtx, session.seqId, session.nPast, -1);
+            session.sharedLength = 0;
+            qDebug() << "[DecodeScheduler] Restored session" << session.id
+                     << "(" << session.nPast << "tokens )";
+        }
+    }
+
+    job->sampler   = mSamplerPool.acquire(job->samplingParams);
+    job->startPast = session.nPast;
+    job->started   = true;
+    job->startedAt = Clock::now();
+    return true;
+}
+
+/*
+  offloadIdleSessions():
+    - First spills sessions idle longer than kvOffloadIdleSeconds
+    - Then, while resident tokens exceed kvResidentTokenBudget, spills the
+      least recently active idle sessions
+*/
+void DecodeScheduler::offloadIdleSessions()
+{
+    const Clock::time_point now = Clock::now();
+
+    if (mIdleOffloadAfter.count() > 0) {
+        for (auto &entry : mSessions) {
+            Session &session = *entry.second;
+            if (!session.job && session.seqId >= 0 && !session.pinned
+                && now - session.lastActive >= mIdleOffloadAfter) {
+                offloadSession(session);
+            }
+        }
+    }
+
+    if (mResidentTokenBudget <= 0) {
+        return;
+    }
+
+    int residentTokens = 0;
+    for (const auto &entry : mSessions) {
+        if (entry.second->seqId >= 0) {
+            residentTokens += entry.second->nPast;
+        }
+    }
+
+    while (residentTokens > mResidentTokenBudget) {
+        Session *victim = nullptr;
+        for (auto &entry : mSessions) {
+            Session &candidate = *entry.second;
+            if (candidate.job || candidate.seqId < 0 || candidate.pinned) {
+                continue;
+            }
+            if (!victim || candidate.lastActive < victim->lastActive) {
+                victim = &candidate;
+            }
+        }
+        const int victimTokens = victim ? victim->nPast : 0;
+        if (!victim || !offloadSession(*victim)) {
+            break;
+        }
+        residentTokens -= victimTokens;
+    }
+}
+
+/*
+  offloadSession(session):
+    - Empty sessions just give their sequence back
+    - A session whose state cannot be written stays resident and is pinned
+      so it is not retried on every step
+*/
+bool DecodeScheduler::offloadSession(Session &session)
+{
+    if (session.nPast > 0) {
+        const size_t bytes = mSpillStore->save(mCtx, session.seqId, session.id);
+        if (bytes == 0) {
+            qWarning() << "[DecodeScheduler] Failed to offload session" << session.id;
+            session.pinned = true;
+            return false;
+        }
+        session.spilled = true;
+        qDebug() << "[DecodeScheduler] Offloaded session" << session.id << "("
+                 << session.nPast << "tokens," << bytes << "bytes )";
+    }
+
+    llama_kv_cache_seq_rm(mCtx, session.seqId, -1, -1);
+    if (mDraftCtx) {
+        // The draft state is not spilled; it is rebuilt from the history
+        // 下書きの状態は退避せず、履歴から作り直す
+        llama_kv_cache_seq_rm(mDraftCtx, session.seqId, -1, -1);
+        session.draftPast = 0;
+    }
+    mFreeSeqIds.push_back(session.seqId);
+    session.seqId = -1;
+    return true;
+}
+
+/*
+  truncateSession(session, from):
+    - A session without a sequence only has its history and counters cut
+*/
+void DecodeScheduler::truncateSession(Session &session, llama_pos from)
+{
+    if (session.seqId >= 0) {
+        llama_kv_cache_seq_rm(mCtx, session.seqId, from, -1);
+        if (mDraftCtx && session.draftPast > from) {
+            llama_kv_cache_seq_rm(mDraftCtx, session.seqId, from, -1);
+        }
+    }
+    session.nPast     = std::min(session.nPast, from);
+    session.draftPast = std::min(session.draftPast, from);
+    if (session.history.size() > static_cast<size_t>(from)) {
+        session.history.resize(from);
+    }
+}
+
+/*
+  shiftContext(session, needed):
+    - Discards half of the tokens after nKeep (more if "needed" requires it),
+      like llama.cpp's examples, so shifts stay rare
+    - seq_add moves cell positions for every sequence in a cell, so cells
+      that may be shared with the prefix cache (and through it with other
+      sessions) are always inside the discarded range, never shifted
+    - The running job's start position moves with the shift so a later
+      rollback still removes exactly the job's cells
+*/
+bool DecodeScheduler::shiftContext(Session &session, int needed)
+{
+    const llama_pos nPast = session.nPast;
+    const llama_pos nKeep = std::min<llama_pos>(session.nKeep, nPast);
+    const llama_pos nLeft = nPast - nKeep;
+    const llama_pos overflow = nPast + needed - mNCtxPerSeq;
+
+    llama_pos nDiscard = std::max<llama_pos>(overflow, nLeft / 2);
+    nDiscard = std::max<llama_pos>(nDiscard, session.sharedLength - nKeep);
+    if (overflow > nLeft || nDiscard > nLeft || nDiscard <= 0) {
+        return false;
+    }
+
+    llama_kv_cache_seq_rm (mCtx, session.seqId, nKeep, nKeep + nDiscard);
+    llama_kv_cache_seq_add(mCtx, session.seqId, nKeep + nDiscard, nPast, -nDiscard);
+    session.nPast        = nPast - nDiscard;
+    session.sharedLength = std::min(session.sharedLength, nKeep);
+    session.history.erase(session.history.begin() + nKeep,
+                          session.history.begin() + nKeep + nDiscard);
+
+    // The draft sequence follows the same shift (its cells are never shared)
+    // 下書きシーケンスも同じだけずらす (セルは共有されない)
+    if (mDraftCtx) {
+        if (session.draftPast >= nKeep + nDiscard) {
+            llama_kv_cache_seq_rm (mDraftCtx, session.seqId, nKeep, nKeep + nDiscard);
+            llama_kv_cache_seq_add(mDraftCtx, session.seqId, nKeep + nDiscard, session.draftPast, -nDiscard);
+            session.draftPast -= nDiscard;
+        } else if (session.draftPast > nKeep) {
+            llama_kv_cache_seq_rm(mDraftCtx, session.seqId, nKeep, -1);
+            session.draftPast = nKeep;
+        }
+    }
+
+    if (Job *job = session.job.get()) {
+        if (job->startPast >= nKeep + nDiscard) {
+            job->startPast -= nDiscard;
+        } else if (job->startPast > nKeep) {
+            job->startPast = nKeep;
+        }
+    }
+
+    qDebug() << "[DecodeScheduler] Context shift of session" << session.id << ": kept" << nKeep
+             << "discarded" << nDiscard << "now" << session.nPast << "tokens";
+    return true;
+}
+
+/*
+  decodingSessions():
+    - Sessions are visited in id order, so calling it again in the same step
+      (after the drafts) selects the same sessions, minus cancelled ones
+*/
+std::vector<DecodeScheduler::Session *> DecodeScheduler::decodingSessions()
+{
+    std::vector<Session *> decoding;
+    for (auto &entry : mSessions) {
+        Session &session = *entry.second;
+        Job *job = session.job.get();
+        if (!job || !job->hasNextToken || static_cast<int>(decoding.size()) >= mBatchSize) {
+            continue;
+        }
+        if (session.nPast >= mNCtxPerSeq && !shiftContext(session, 1)) {
+            // The reply so far is in the KV cache and the history: undo the turn
+            // ここまでの応答はKVキャッシュと履歴にあるため、ターンを取り消す
+            truncateSession(session, job->startPast);
+            finishJob(session, QStringLiteral("context window exceeded"));
+            continue;
+        }
+        decoding.push_back(&session);
+    }
+    return decoding;
+}
+
+/*
+  buildBatch():
+    - Running sessions contribute their sampled token first (one each)
+    - Remaining capacity is filled with pending prompt tokens, at most
+      mPrefillChunkTokens per session and step; the session to start with
+      rotates so concurrent prompts progress evenly, and a prompt that does
+      not fit continues in the next step
+    - A prompt starting at position 0 first borrows the cells of its longest
+      cached prefix (at least one token is always left to decode for logits)
+    - Logits are requested only where a token will be sampled
+*/
+std::vector<DecodeScheduler::SessionId> DecodeScheduler::buildBatch()
+{
+    std::vector<SessionId> contributed;
+    mBatch.n_tokens = 0;
+    mStepPromptTokens = 0;
+
+    auto addToken = [this](llama_token token, llama_pos pos, llama_seq_id seqId, bool logits) {
+        const int i = mBatch.n_tokens++;
+        mBatch.token[i]     = token;
+        mBatch.pos[i]       = pos;
+        mBatch.n_seq_id[i]  = 1;
+        mBatch.seq_id[i][0] = seqId;
+        mBatch.logits[i]    = logits;
+        return i;
+    };
+
+    for (auto &entry : mSessions) {
+        if (Job *job = entry.second->job.get()) {
+            job->stepPromptTokens = 0;
+        }
+    }
+
+    // 1) Next-token decodes, each followed by its drafts (if any)
+    for (Session *sessionPtr : decodingSessions()) {
+        Session &session = *sessionPtr;
+        Job *job = session.job.get();
+        session.history.push_back(job->nextToken);
+        ++job->replyTokensInKv;
+        job->logitsIndex = addToken(job->nextToken, session.nPast++, session.seqId, true);
+        job->hasNextToken = false;
+        for (size_t i = 0; i < job->drafts.size(); ++i) {
+            addToken(job->drafts[i], session.nPast + static_cast<llama_pos>(i), session.seqId, true);
+        }
+        contributed.push_back(session.id);
+    }
+
+    // 2) Prompt chunks, round-robin starting after mPrefillCursor
+    // 2) プロンプトの分割片。mPrefillCursorの次のセッションからラウンドロビン
+    std::vector<Session *> order;
+    order.reserve(mSessions.size());
+    for (auto it = mSessions.upper_bound(mPrefillCursor); it != mSessions.end(); ++it) {
+        order.push_back(it->second.get());
+    }
+    for (auto it = mSessions.begin(); it != mSessions.end() && it->first <= mPrefillCursor; ++it) {
+        order.push_back(it->second.get());
+    }
+
+    for (Session *sessionPtr : order) {
+        Session &session = *sessionPtr;
+        Job *job = session.job.get();
+        if (!job || !job->started || job->nPromptDecoded >= job->prompt.size()) {
+            continue;
+        }
+        const int capacity = std::min(mBatchSize - mBatch.n_tokens, mPrefillChunkTokens);
+        if (capacity <= 0) {
+            break;
+        }
+
+        if (job->nPromptDecoded == 0 && session.nPast == 0) {
+            const PrefixCache::Match match = mPrefixCache->lookup(job->prompt, job->prompt.size() - 1);
+            if (match.length > 0) {
+                llama_kv_cache_seq_cp(mCtx, match.seqId, session.seqId, 0, static_cast<llama_pos>(match.length));
+                session.nPast            = static_cast<llama_pos>(match.length);
+                session.sharedLength     = session.nPast;
+                session.history.assign(job->prompt.begin(), job->prompt.begin() + match.length);
+                job->nPromptDecoded      = match.length;
+                job->reusedPromptTokens  = match.length;
+                qDebug() << "[DecodeScheduler] Prefix cache hit:" << match.length
+                         << "of" << job->prompt.size() << "prompt tokens reused";
+            }
+        }
+        if (job->prefillStartedAt == Clock::time_point{}) {
+            job->prefillStartedAt = Clock::now();
+        }
+        const size_t remaining = job->prompt.size() - job->nPromptDecoded;
+
+        // Make room for the rest of the prompt plus the first reply token
+        // プロンプトの残りと応答の最初のトークンが入る位置を確保
+        const int needed = static_cast<int>(remaining) + 1;
+        if (session.nPast + needed > mNCtxPerSeq && !shiftContext(session, needed)) {
+            // Earlier chunks of the prompt are already decoded: undo the turn
+            // プロンプトの先の分割片はデコード済みのため、ターンを取り消す
+            truncateSession(session, job->startPast);
+            finishJob(session, QStringLiteral("context window exceeded"));
+            continue;
+        }
+
+        const size_t count = std::min(remaining, static_cast<size_t>(capacity));
+        for (size_t i = 0; i < count; ++i) {
+            const bool last = (job->nPromptDecoded + 1 == job->prompt.size());
+            session.history.push_back(job->prompt[job->nPromptDecoded]);
+            const int index = addToken(job->prompt[job->nPromptDecoded],
+                                       session.nPast++, session.seqId, last);
+            if (last) {
+                job->logitsIndex = index;
+            }
+            ++job->nPromptDecoded;
+        }
+        job->stepPromptTokens = count;
+        mStepPromptTokens += count;
+        mPrefillCursor = session.id;
+        contributed.push_back(session.id);
+    }
+
+    return contributed;
+}
+
+/*
+  collectDrafts():
+    - Batch space left after the pending tokens is shared evenly, and drafts
+      never run past the session's window
+    - A long unseen history (a new or resumed conversation) is handed out in
+      mPrefillChunkTokens slices over several steps; until the draft has
+      caught up the session decodes without drafts
+*/
+std::vector<DecodeScheduler::DraftRequest> DecodeScheduler::collectDrafts()
+{
+    std::vector<DraftRequest> requests;
+    const std::vector<Session *> decoding = decodingSessions();
+    if (decoding.empty()) {
+        return requests;
+    }
+    const int spare = mBatchSize - static_cast<int>(decoding.size());
+    const int perSession = std::min(mDraftTokens, spare / static_cast<int>(decoding.size()));
+    if (perSession <= 0) {
+        return requests;
+    }
+
+    int catchUpBudget = mPrefillChunkTokens;
+    for (Session *session : decoding) {
+        const int count = std::min(perSession, mNCtxPerSeq - session->nPast - 1);
+        if (count <= 0) {
+            continue;
+        }
+        const llama_pos behind = std::max<llama_pos>(session->nPast - session->draftPast, 0);
+        const llama_pos slice  = std::min<llama_pos>(behind, catchUpBudget);
+        catchUpBudget -= slice;
+
+        DraftRequest request;
+        request.id        = session->id;
+        request.job       = session->job.get();
+        request.seqId     = session->seqId;
+        request.draftPast = session->draftPast;
+        request.catchUp.assign(session->history.begin() + session->draftPast,
+                               session->history.begin() + session->draftPast + slice);
+        request.caughtUp  = (slice == behind);
+        request.nextToken = session->job->nextToken;
+        request.count     = count;
+        requests.push_back(std::move(request));
+    }
+    return requests;
+}
+
+/*
+  draftTokens(requests):
+    - Runs on the decode thread without the lock, like the main decode: the
+      draft context, batch and sampler are only used by this thread, and the
+      requests hold copies of everything read from the sessions
+    - First feeds each draft sequence its catch-up slice plus the pending
+      token (usually just that one token), then extends all drafts in
+      lockstep, one batched draft decode per proposed token
+    - A failed draft decode only disables speculation for this step
+*/
+void DecodeScheduler::draftTokens(std::vector<DraftRequest> &requests)
+{
+    auto addDraftToken = [this](llama_token token, llama_pos pos, llama_seq_id seqId, bool logits) {
+        const int i = mDraftBatch.n_tokens++;
+        mDraftBatch.token[i]     = token;
+        mDraftBatch.pos[i]       = pos;
+        mDraftBatch.n_seq_id[i]  = 1;
+        mDraftBatch.seq_id[i][0] = seqId;
+        mDraftBatch.logits[i]    = logits;
+        return i;
+    };
+
+    auto abandon = [this, &requests]() {
+        qWarning() << "[DecodeScheduler] Draft decode failed, skipping speculation for this step";
+        for (DraftRequest &request : requests) {
+            llama_kv_cache_seq_rm(mDraftCtx, request.seqId, -1, -1);
+            request.draftPast = 0;
+            request.drafts.clear();
+        }
+    };
+
+    // Decodes the draft batch and samples the proposals it produced
+    // 下書きバッチをデコードし、得られた提案をサンプリング
+    auto flush = [this, &requests]() {
+        if (mDraftBatch.n_tokens == 0) {
+            return true;
+        }
+        if (llama_decode(mDraftCtx, mDraftBatch) != 0) {
+            mDraftBatch.n_tokens = 0;
+            return false;
+        }
+        for (DraftRequest &request : requests) {
+            if (request.logitsIndex >= 0) {
+                request.drafts.push_back(llama_sampler_sample(mDraftSampler, mDraftCtx, request.logitsIndex));
+                request.logitsIndex = -1;
+            }
+        }
+        mDraftBatch.n_tokens = 0;
+        return true;
+    };
+
+    // 1) Catch up: the history slice followed by the pending token; a
+    //    request still behind after its slice does not speculate this step
+    // 1) 追いつき: 履歴の分割片と保留中のトークン。分割片の後も追いつけない
+    //    要求はこのステップでは投機しない
+    mDraftBatch.n_tokens = 0;
+    for (DraftRequest &request : requests) {
+        for (llama_token token : request.catchUp) {
+            if (mDraftBatch.n_tokens >= mBatchSize && !flush()) {
+                abandon();
+                return;
+            }
+            addDraftToken(token, request.draftPast++, request.seqId, false);
+        }
+        if (!request.caughtUp) {
+            continue;
+        }
+        if (mDraftBatch.n_tokens >= mBatchSize && !flush()) {
+            abandon();
+            return;
+        }
+        request.logitsIndex = addDraftToken(request.nextToken, request.draftPast++, request.seqId, true);
+    }
+    if (!flush()) {
+        abandon();
+        return;
+    }
+
+    // 2) Extend every draft by one token per round
+    // 2) 1ラウンドごとに各下書きを1トークンずつ伸ばす
+    for (int round = 1; round < mDraftTokens; ++round) {
+        bool extended = false;
+        for (DraftRequest &request : requests) {
+            if (round >= request.count || request.drafts.empty()) {
+                continue;
+            }
+            request.logitsIndex = addDraftToken(request.drafts.back(), request.draftPast++, request.seqId, true);
+            extended = true;
+        }
+        if (!extended) {
+            break;
+        }
+        if (!flush()) {
+            abandon();
+            return;
+        }
+    }
+}
+
+/*
+  applyDrafts(requests):
+    - A session closed meanwhile has its sequence cleared at the top of the
+      next step; one whose job was cancelled keeps the draft position, so
+      the pending rollback also removes the drafted cells
+    - Only a job still waiting for its pending token to be decoded can be
+      the one the drafts were made for (a replacement has not sampled yet)
+*/
+void DecodeScheduler::applyDrafts(const std::vector<DraftRequest> &requests)
+{
+    for (const DraftRequest &request : requests) {
+        auto it = mSessions.find(request.id);
+        if (it == mSessions.end()) {
+            continue;
+        }
+        Session &session = *it->second;
+        session.draftPast = request.draftPast;
+        Job *job = session.job.get();
+        if (job && job == request.job && job->hasNextToken) {
+            job->drafts = request.drafts;
+        }
+    }
+}
+
+/*
+  accountStep(sessionIds, stepMs):
+    - A generating job waited for the whole step; the part proportional to
+      the prompt tokens of others in the batch is counted as prefill stall
+*/
+void DecodeScheduler::accountStep(const std::vector<SessionId> &sessionIds, double stepMs)
+{
+    if (mStepPromptTokens == 0 || mBatch.n_tokens == 0) {
+        return;
+    }
+    const double promptShare = static_cast<double>(mStepPromptTokens) / mBatch.n_tokens;
+
+    for (SessionId id : sessionIds) {
+        auto it = mSessions.find(id);
+        if (it == mSessions.end() || !it->second->job) {
+            continue;
+        }
+        Job &job = *it->second->job;
+        if (job.stepPromptTokens == 0) {
+            job.prefillStallMs += stepMs * promptShare;
+        }
+    }
+}
+
+/*
+  sampleBatch(sessionIds):
+    - Sessions closed during the decode are skipped
+    - Applies the same EOG / length cutoff rules as the single-session loop
+    - With drafts, keeps sampling while the main model picks the drafted
+      token (its cell is already decoded); the first differing sample becomes
+      the next pending token and the cells of rejected drafts are dropped
+*/
+void DecodeScheduler::sampleBatch(const std::vector<SessionId> &sessionIds)
+{
+    for (SessionId id : sessionIds) {
+        auto it = mSessions.find(id);
+        if (it == mSessions.end() || !it->second->job) {
+            continue;
+        }
+        Session &session = *it->second;
+        Job &job = *session.job;
+        if (job.logitsIndex < 0) {
+            // Prompt still being prefilled
+            continue;
+        }
+
+        // The whole prompt of a fresh conversation is now in KV: share its prefix
+        // 新しい会話のプロンプト全体がKVに載ったので、その先頭部分を共有登録する
+        if (job.startPast == 0 && !job.prefixRegistered) {
+            job.prefixRegistered = true;
+            registerPrefix(session.seqId, job.prompt);
+            session.sharedLength = std::max<llama_pos>(session.sharedLength,
+                                                       static_cast<llama_pos>(job.prompt.size()));
+        }
+
+        const std::vector<llama_token> drafts = std::move(job.drafts);
+        job.drafts.clear();
+        job.draftedTokens += static_cast<int>(drafts.size());
+        int index = job.logitsIndex;
+        job.logitsIndex = -1;
+
+        size_t accepted = 0;
+        while (true) {
+            const llama_token newTokenId = llama_sampler_sample(job.sampler.get(), mCtx, index);
+            const bool matchesDraft = accepted < drafts.size() && newTokenId == drafts[accepted];
+            if (matchesDraft) {
+                ++session.job->acceptedDraftTokens;
+            }
+            if (!acceptToken(session, newTokenId)) {
+                break;  // job finished
+            }
+            if (matchesDraft) {
+                // Already decoded after the previous token: keep its cell
+                // 直前のトークンの後にデコード済み: セルをそのまま使う
+                session.history.push_back(newTokenId);
+                ++session.nPast;
+                ++session.job->replyTokensInKv;
+                ++accepted;
+                ++index;
+                continue;
+            }
+            session.job->nextToken    = newTokenId;
+            session.job->hasNextToken = true;
+            break;
+        }
+
+        if (!drafts.empty()) {
+            truncateSession(session, session.nPast);
+        }
+    }
+}
+
+/*
+  acceptToken(session, token):
+    - The token is not decoded yet; EOG ends the job without entering KV
+    - Pieces go through the stop matcher, which holds back text that may
+      still become a stop string; only released text reaches onPiece
+*/
+bool DecodeScheduler::acceptToken(Session &session, llama_token token)
+{
+    const llama_model *model = mModel.get();
+    Job &job = *session.job;
+
+    const Clock::time_point now = Clock::now();
+    if (job.firstTokenAt == Clock::time_point{}) {
+        job.firstTokenAt = now;
+    } else {
+        const double gapMs = msBetween(job.lastTokenAt, now);
+        job.interTokenMsTotal += gapMs;
+        Metrics::instance().interTokenLatency.observe(gapMs / 1000.0);
+        ++job.interTokenGaps;
+        job.maxInterTokenMs = std::max(job.maxInterTokenMs, gapMs);
+    }
+    job.lastTokenAt = now;
+
+    if (llama_token_is_eog(model, token)) {
+        finishJob(session);
+        return false;
+    }
+
+    // Convert token -> piece
+    char buf[256] = {};
+    const int n = llama_token_to_piece(model, token, buf, sizeof(buf), /*lstrip=*/0, /*special=*/true);
+    if (n < 0) {
+        finishJob(session, QStringLiteral("failed to convert token to piece"));
+        return false;
+    }
+
+    ++job.generatedTokens;
+    const StopMatcher::Result released = job.stopMatcher.feed(std::string(buf, n));
+    if (!released.text.empty()) {
+        job.response += released.text;
+        if (job.callbacks.onPiece) {
+            job.callbacks.onPiece(released.text, job.response);
+        }
+    }
+    if (released.stopped) {
+        finishJob(session);
+        return false;
+    }
+
+    // Cut off if too long
+    if (job.maxTokens > 0) {
+        if (job.generatedTokens >= job.maxTokens) {
+            finishJob(session);
+            return false;
+        }
+    } else if (job.generatedTokens > mMaxReplyTokens) {
+        if (std::memchr(buf, '\n', static_cast<size_t>(n))) {
+            qDebug() << "Cutting off at newline.";
+            finishJob(session);
+            return false;
+        } else if (job.generatedTokens > mMaxReplyTokens + mExtraCutoffTokens) {
+            qDebug() << "Cutting off after extra tokens.";
+            finishJob(session);
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+  publishGauges():
+    - Plain stores; the counts are at most one step old when scraped
+    - Prefix cache counters are added as deltas, so they keep growing when
+      the model is unloaded and loaded again
+*/
+void DecodeScheduler::publishGauges()
+{
+    int running = 0;
+    for (const auto &entry : mSessions) {
+        if (entry.second->job && entry.second->job->started) {
+            ++running;
+        }
+    }
+    mGauges->queueDepth.store(static_cast<int>(mWaiting.size()), std::memory_order_relaxed);
+    mGauges->runningRequests.store(running, std::memory_order_relaxed);
+    mGauges->kvCellsUsed.store(llama_get_kv_cache_used_cells(mCtx), std::memory_order_relaxed);
+
+    if (mPrefixCache) {
+        const PrefixCache::Stats stats = mPrefixCache->stats();
+        mGauges->prefixCacheHits.fetch_add(static_cast<qint64>(stats.hits - mPublishedPrefixStats.hits),
+                                           std::memory_order_relaxed);
+        mGauges->prefixCacheMisses.fetch_add(static_cast<qint64>(stats.misses - mPublishedPrefixStats.misses),
+                                             std::memory_order_relaxed);
+        mGauges->prefixCacheEvictions.fetch_add(static_cast<qint64>(stats.evictions - mPublishedPrefixStats.evictions),
+                                                std::memory_order_relaxed);
+        mGauges->prefixCacheCells.store(static_cast<qint64>(stats.cachedTokens), std::memory_order_relaxed);
+        mPublishedPrefixStats = stats;
+    }
+}
+
+/*
+  registerPrefix(seqId, prompt):
+    - Clears cache sequences evicted to make room, then lets the new cache
+      sequence reference the prompt's cells (no KV data is duplicated)
+*/
+void DecodeScheduler::registerPrefix(llama_seq_id seqId, const std::vector<llama_token> &prompt)
+{
+    const PrefixCache::Insertion insertion = mPrefixCache->insert(prompt);
+    for (llama_seq_id evicted : insertion.evicted) {
+        llama_kv_cache_seq_rm(mCtx, evicted, -1, -1);
+    }
+    if (insertion.seqId >= 0) {
+        llama_kv_cache_seq_cp(mCtx, seqId, insertion.seqId, 0, static_cast<llama_pos>(insertion.length));
+    }
+}
+
+/*
+  finishJob(session, error):
+    - Empty error means normal completion; text still held by the stop
+      matcher was not a stop string after all and is sent first
+*/
+void DecodeScheduler::finishJob(Session &session, const QString &error)
+{
+    std::unique_ptr<Job> job = std::move(session.job);
+    if (!job) {
+        return;
+    }
+    session.lastActive = Clock::now();
+    session.pinned     = false;
+    if (!error.isEmpty()) {
+        if (job->callbacks.onError) {
+            job->callbacks.onError(error);
+        }
+    } else {
+        const std::string held = job->stopMatcher.flush();
+        if (!held.empty()) {
+            job->response += held;
+            if (job->callbacks.onPiece) {
+                job->callbacks.onPiece(held, job->response);
+            }
+        }
+        if (job->callbacks.onStats) {
+            job->callbacks.onStats(timingsOf(*job));
+        }
+        if (job->callbacks.onFinished) {
+            // A context shift may have discarded early reply tokens
+            // コンテキストシフトで応答の先頭が破棄されている場合がある
+            const size_t kept = std::min(session.history.size(), static_cast<size_t>(session.nKeep));
+            const size_t inKv = std::min(static_cast<size_t>(job->replyTokensInKv),
+                                         session.history.size() - kept);
+            const std::vector<llama_token> replyTokens(session.history.end() - static_cast<std::ptrdiff_t>(inKv),
+                                                       session.history.end());
+            job->callbacks.onFinished(job->response, replyTokens);
+        }
+    }
+}
+
+/*
+  timingsOf(job):
+    - Prefill throughput counts only the tokens actually decoded
+*/
+GenerationTimings DecodeScheduler::timingsOf(const Job &job)
+{
+    GenerationTimings timings;
+    timings.promptTokens       = static_cast<int>(job.prompt.size());
+    timings.reusedPromptTokens = static_cast<int>(job.reusedPromptTokens);
+    timings.generatedTokens    = job.generatedTokens;
+    timings.queueMs            = msBetween(job.submittedAt, job.startedAt);
+    timings.prefillStallMs     = job.prefillStallMs;
+    timings.maxInterTokenMs    = job.maxInterTokenMs;
+
+    if (job.firstTokenAt != Clock::time_point{}) {
+        timings.timeToFirstTokenMs = msBetween(job.submittedAt, job.firstTokenAt);
+        timings.prefillMs          = msBetween(job.prefillStartedAt, job.firstTokenAt);
+        if (timings.prefillMs > 0) {
+            timings.prefillTokensPerSecond =
+                (timings.promptTokens - timings.reusedPromptTokens) * 1000.0 / timings.prefillMs;
+        }
+    }
+    if (job.interTokenGaps > 0) {
+        timings.meanInterTokenMs = job.interTokenMsTotal / job.interTokenGaps;
+    }
+    if (job.generatedTokens > 1 && job.lastTokenAt > job.firstTokenAt) {
+        timings.decodeTokensPerSecond =
+            (job.generatedTokens - 1) * 1000.0 / msBetween(job.firstTokenAt, job.lastTokenAt);
+    }
+    timings.draftedTokens       = job.draftedTokens;
+    timings.acceptedDraftTokens = job.acceptedDraftTokens;
+    if (job.draftedTokens > 0) {
+        timings.draftAcceptanceRate = static_cast<double>(job.acceptedDraftTokens) / job.draftedTokens;
+    }
+    return timings;
+}
@@ -0,0 +1,712 @@
+// ================================================================
+// DecodeScheduler.h
+// ================================================================
+#ifndef DECODESCHEDULER_H
+#define DECODESCHEDULER_H
+
+#include "llama.h"
+#include "CpuPlacement.h"
+#include "KvSpillStore.h"
+#include "Metrics.h"
+#include "PrefixCache.h"
+#include "SamplerPool.h"
+#include "ServerConfig.h"
+#include "StopMatcher.h"
+#include <QString>
+#include <QtGlobal>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+  GenerationParams:
+    - Per-request generation settings passed to DecodeScheduler::submit()
+    - maxTokens > 0 ends the reply after that many tokens; 0 keeps the
+      server's default limit (soft cutoff at a newline, then hard cutoff)
+    - The reply ends before the first occurrence of any stop string, which
+      is not part of the response
+
+  GenerationParams:
+    - DecodeScheduler::submit()に渡すリクエストごとの生成設定
+    - maxTokensが正の場合はそのトークン数で応答を終える。0の場合はサーバー
+      既定の上限 (改行で打ち切り、それでも続く場合は強制終了) を使う
+    - いずれかの停止文字列が最初に現れた位置の手前で応答を終える
+      (停止文字列自体は応答に含めない)
+*/
+struct GenerationParams
+{
+    SamplingParams sampling;
+    int maxTokens {0};
+    std::vector<std::string> stopStrings;
+};
+
+/*
+  GenerationTimings:
+    - Per-request measurements reported through GenerationCallbacks::onStats
+    - prefillStallMs is the share of this request's decode steps spent on
+      other requests' prompt chunks, i.e. the inter-token latency they added
+
+  GenerationTimings:
+    - リクエストごとの計測値。GenerationCallbacks::onStatsで通知する
+    - prefillStallMsは、このリクエストのデコードステップのうち他リクエストの
+      プロンプト処理に費やされた時間 (他者が追加したトークン間レイテンシ)
+*/
+struct GenerationTimings
+{
+    int promptTokens {0};              // submitted prompt tokens
+    int reusedPromptTokens {0};        // taken from the prefix cache
+    int generatedTokens {0};
+    double queueMs {0};                // waiting for a sequence
+    double prefillMs {0};              // first prompt chunk -> first sampled token
+    double prefillTokensPerSecond {0};
+    double timeToFirstTokenMs {0};     // submit -> first sampled token
+    double meanInterTokenMs {0};
+    double maxInterTokenMs {0};
+    double prefillStallMs {0};
+    double decodeTokensPerSecond {0};  // first -> last sampled token
+    int draftedTokens {0};             // speculative decoding only
+    int acceptedDraftTokens {0};
+    double draftAcceptanceRate {0};
+};
+
+/*
+  GenerationCallbacks:
+    - Per-request hooks invoked from the scheduler thread
+    - Must not call back into DecodeScheduler (they run under its lock)
+    - The reply stays in the session's KV cache after onFinished, so the
+      next turn can follow it without decoding it again
+
+  GenerationCallbacks:
+    - スケジューラスレッドから呼ばれるリクエストごとのコールバック
+    - スケジューラのロック中に呼ばれるため、DecodeSchedulerを呼び返してはいけない
+    - onFinishedの後も応答はセッションのKVキャッシュに残るため、次のターンは
+      応答を再度デコードせずにその続きから始められる
+*/
+struct GenerationCallbacks
+{
+    std::function<void(const std::string &piece, const std::string &responseSoFar)> onPiece;
+    // replyTokens: the reply tokens the session's KV cache holds after the prompt
+    // replyTokens: プロンプトの後にセッションのKVキャッシュが保持する応答トークン
+    std::function<void(const std::string &response, const std::vector<llama_token> &replyTokens)> onFinished;
+    std::function<void(const QString &error)> onError;
+    std::function<void(const std::string &partialResponse)> onCancelled;
+    std::function<void(int position)> onQueued;
+    std::function<void(const QString &reason)> onRejected;
+    std::function<void(const GenerationTimings &timings)> onStats;  // right before onFinished
+};
+
+/*
+  DecodeScheduler:
+    - One per loaded model, created and evicted by ModelRegistry
+    - Owns the single multi-sequence llama_context shared by all clients
+    - Each client session is bound to its own llama_seq_id in that context
+    - A dedicated thread builds one llama_batch per step mixing prompt
+      tokens of new requests and next-token decodes of running ones,
+      then fans sampled tokens back out through GenerationCallbacks
+    - Prompts starting a conversation reuse KV cells of previously seen
+      prefixes through the PrefixCache instead of prefilling them again
+    - Sessions only hold a sequence while resident: idle ones are spilled to
+      disk through the KvSpillStore and restored on their next request
+    - Requests waiting for a sequence form a bounded FIFO admission queue;
+      waiting requests are told their position, excess ones are rejected
+    - A sequence that reaches the per-session window keeps its first nKeep
+      tokens (system prompt) and the most recent ones: the middle is removed
+      and the tail shifted down in place, without prefilling again
+    - With a draft model configured, each generating sequence gets K tokens
+      proposed by the draft and verified in the same batch; every position is
+      still sampled from the main model, so the output is unchanged
+    - Prompts are prefilled in chunks of at most prefillChunkTokens per step,
+      round-robin across sessions, so a long prompt does not stall the
+      token streams of the others
+
+  DecodeSchedulerクラス:
+    - ロードしたモデルごとに1つ。ModelRegistryが生成/破棄する
+    - 全クライアントで共有する単一のマルチシーケンスllama_contextを所有
+    - 各クライアントセッションはそのコンテキスト内の専用llama_seq_idに割り当てる
+    - 専用スレッドが1ステップごとに、新規リクエストのプロンプトトークンと
+      実行中リクエストの次トークンデコードを混ぜた1つのllama_batchを作り、
+      サンプリング結果をGenerationCallbacks経由で各クライアントへ返す
+    - 会話の先頭となるプロンプトは、PrefixCacheを通じて既出の先頭部分の
+      KVセルを再利用し、再プリフィルを省く
+    - セッションは常駐中のみシーケンスを保持し、アイドルになったものは
+      KvSpillStoreでディスクへ退避し、次のリクエスト時に復元する
+    - シーケンス待ちのリクエストは上限付きのFIFO受付キューに並び、
+      待機中のものには順番を通知し、溢れたものは拒否する
+    - セッションごとのウィンドウに達したシーケンスは、先頭nKeepトークン
+      (システムプロンプト) と直近のトークンを残し、中間を削除して後半を
+      その場でずらす (再プリフィルは行わない)
+    - 下書きモデルが設定されている場合、生成中の各シーケンスに下書きが
+      K個のトークンを提案し、同じバッチで検証する。各位置は常にメインモデル
+      からサンプリングするため、出力は変わらない
+    - プロンプトは1ステップあたり最大prefillChunkTokensずつ、セッション間で
+      ラウンドロビンにプリフィルするため、長いプロンプトが他のセッションの
+      トークン送出を止めることはない
+*/
+class DecodeScheduler
+{
+public:
+    using SessionId = quint64;
+
+    /*
+      Constructor:
+        - Remembers the model to serve; nothing is loaded before initialize()
+      コンストラクタ:
+        - 提供するモデルを記録する。initialize()まで何もロードしない
+    */
+    explicit DecodeScheduler(const ServerConfig::ModelConfig &modelConfig);
+
+    /*
+      Destructor:
+        - Stops the decode thread and frees the context; the model is freed
+          with its last borrower
+      デストラクタ:
+        - デコードスレッドを停止してコンテキストを解放。モデルは最後の借用者と共に解放
+    */
+    ~DecodeScheduler();
+
+    /*
+      initialize(onLoaded):
+        - Borrows the model, creates the shared context, starts the decode
+          thread and returns once that thread has run the warm-up decode
+        - onLoaded is called once the weights and contexts exist, right
+          before the warm-up
+        - Idempotent and thread-safe; returns false if loading failed
+      initialize(onLoaded):
+        - モデルを借用し、共有コンテキストを作成してデコードスレッドを開始し、
+          そのスレッドがウォームアップのデコードを終えてから戻る
+        - onLoadedは重みとコンテキストの準備ができた時点、ウォームアップの
+          直前に呼ばれる
+        - 何度呼んでもよくスレッドセーフ。ロード失敗時はfalseを返す
+    */
+    bool initialize(const std::function<void()> &onLoaded = {});
+
+    /*
+      model():
+        - Shared model used by the context (for templating/tokenization)
+      model():
+        - コンテキストが使うモデル (テンプレート適用/トークナイズ用)
+    */
+    std::shared_ptr<llama_model> model() const;
+
+    /*
+      modelName():
+        - Name of the served model (see ServerConfig::models)
+      modelName():
+        - 提供中のモデル名 (ServerConfig::modelsを参照)
+    */
+    QString modelName() const;
+
+    /*
+      isIdle():
+        - True if no request is running or waiting (safe to evict)
+      isIdle():
+        - 実行中/待機中のリクエストが無い場合にtrue (破棄してよい)
+    */
+    bool isIdle() const;
+
+    /*
+      openSession() / closeSession(id):
+        - A session owns one sequence of KV cache while it is resident
+        - Closing it releases the sequence's KV cells (or its spilled state);
+          a request still in flight ends with onCancelled
+      openSession() / closeSession(id):
+        - セッションは常駐中、KVキャッシュの1シーケンスを所有する
+        - 閉じるとそのシーケンスのKVセル (または退避済みの状態) を解放する。
+          処理中のリクエストはonCancelledで終わる
+    */
+    SessionId openSession();
+    void closeSession(SessionId id);
+
+    /*
+      sessionLength(id):
+        - Number of tokens the session's KV state holds (0 if it was lost)
+      sessionLength(id):
+        - セッションのKV状態が保持しているトークン数 (失われた場合は0)
+    */
+    int sessionLength(SessionId id) const;
+
+    /*
+      isGenerating(id):
+        - True while a request of the session is queued or running
+      isGenerating(id):
+        - セッションのリクエストが待機中または実行中の間true
+    */
+    bool isGenerating(SessionId id) const;
+
+    /*
+      setKeepTokens(id, nKeep):
+        - Tokens at the start of the session that survive a context shift
+          (typically BOS + system prompt); default 1 (BOS)
+      setKeepTokens(id, nKeep):
+        - コンテキストシフトで残すセッション先頭のトークン数
+          (通常はBOS + システムプロンプト)。既定は1 (BOS)
+    */
+    void setKeepTokens(SessionId id, int nKeep);
+
+    /*
+      submit(id, promptTokens, callbacks, clientKey, params):
+        - Queues a generation for the session; the prompt continues its KV state
+        - params selects the sampler, length limit and stop strings
+        - The job starts once the session has a sequence (restored if spilled);
+          until then onQueued reports its 1-based position whenever it changes
+        - Only a prompt that cannot fit even after a context shift is refused
+        - A full queue, or clientKey reaching maxRequestsPerClient, calls
+          onRejected and returns false (an empty clientKey is not limited)
+        - Returns false (and calls onError) if the request is invalid
+      submit(id, promptTokens, callbacks, clientKey, params):
+        - セッションに生成要求を登録。プロンプトは既存のKV状態の続きとして扱う
+        - paramsでサンプラー、長さの上限、停止文字列を指定する
+        - セッションにシーケンスが割り当てられると開始 (退避済みなら復元)。
+          それまでは順番 (1始まり) が変わるたびにonQueuedで通知する
+        - コンテキストシフトをしても収まらないプロンプトのみ拒否する
+        - キューが満杯、またはclientKeyがmaxRequestsPerClientに達した場合は
+          onRejectedを呼びfalseを返す (clientKeyが空なら制限しない)
+        - 不正なリクエストの場合はfalseを返す (onErrorも呼ばれる)
+    */
+    bool submit(SessionId id,
+                std::vector<llama_token> promptTokens,
+                GenerationCallbacks callbacks,
+                const QString &clientKey = {},
+                const GenerationParams &params = {});
+
+    /*
+      queueDepth():
+        - Number of requests waiting for a sequence
+      queueDepth():
+        - シーケンス待ちのリクエスト数
+    */
+    int queueDepth() const;
+
+    /*
+      cancel(id):
+        - Stops the session's running or waiting job; onCancelled is called
+          before returning and no further callbacks follow
+        - The KV cells written for the cancelled request are released, so the
+          session continues from where that request started
+        - Returns false if there was nothing to cancel
+      cancel(id):
+        - セッションの実行中/待機中のジョブを停止。戻る前にonCancelledが呼ばれ、
+          以降のコールバックは発生しない
+        - 中止したリクエストで書き込まれたKVセルは解放され、セッションは
+          そのリクエスト開始時点から続行する
+        - 中止対象が無い場合はfalseを返す
+    */
+    bool cancel(SessionId id);
+
+    /*
+      rewind(id, tokens):
+        - Drops the last "tokens" tokens of an idle session's KV state, e.g.
+          reply tokens its conversation could not adopt
+        - Returns false if the session is unknown or has a job
+      rewind(id, tokens):
+        - アイドルのセッションのKV状態から末尾"tokens"個のトークンを破棄する
+          (会話が引き継げなかった応答トークンなど)
+        - セッションが存在しない、またはジョブがある場合はfalseを返す
+    */
+    bool rewind(SessionId id, int tokens);
+
+    /*
+      prefixCacheStats():
+        - Hit/miss counters and size of the prompt prefix cache
+      prefixCacheStats():
+        - プロンプト先頭部分キャッシュのヒット/ミス数とサイズ
+    */
+    PrefixCache::Stats prefixCacheStats() const;
+
+    DecodeScheduler(const DecodeScheduler &) = delete;
+    DecodeScheduler &operator=(const DecodeScheduler &) = delete;
+
+private:
+    // Parameters of the shared context
+    // 共有コンテキストのパラメータ
+    static constexpr int mMaxSequences {8};
+
+    // Prompt prefix cache: extra sequences and KV cells reserved for it
+    // プロンプト先頭部分キャッシュ用に予約するシーケンス数とKVセル数
+    static constexpr int mPrefixCacheSequences {4};
+    static constexpr int mPrefixCacheTokens    {4096};
+    static constexpr int mPrefixBlockSize      {64};
+
+    // How often the decode thread checks for idle sessions to offload
+    // デコードスレッドがオフロード対象のアイドルセッションを確認する間隔
+    static constexpr std::chrono::milliseconds mMaintenanceInterval {1000};
+
+    // Default reply length limits (soft cutoff at newline, then hard cutoff)
+    // 既定の応答長の上限 (改行で打ち切り、それでも続く場合は強制終了)
+    static constexpr int mMaxReplyTokens    {1024};
+    static constexpr int mExtraCutoffTokens {32};
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Job
+    {
+        bool started {false};        // bound to a sequence and scheduled
+        QString clientKey;           // for the per-client concurrency limit
+        int queuePosition {0};       // last position reported through onQueued
+        llama_pos startPast {0};     // session position before this request
+        std::vector<llama_token> prompt;
+        size_t nPromptDecoded {0};   // prompt tokens already placed in a batch
+        GenerationCallbacks callbacks;
+        int maxTokens {0};
+        SamplingParams samplingParams;
+        SamplerPool::Lease sampler;  // acquired when the job starts
+        StopMatcher stopMatcher;
+        std::string response;        // text passed to onPiece so far
+        int generatedTokens {0};
+        int replyTokensInKv {0};     // generated tokens decoded into the session
+        llama_token nextToken {0};   // sampled but not yet decoded
+        bool hasNextToken {false};
+        int logitsIndex {-1};        // batch index to sample from after decode
+        bool prefixRegistered {false};
+        std::vector<llama_token> drafts; // proposed after nextToken, at logitsIndex + 1...
+
+        // Timings (see GenerationTimings)
+        // 計測値 (GenerationTimingsを参照)
+        size_t stepPromptTokens {0}; // prompt tokens in the current batch
+        size_t reusedPromptTokens {0};
+        Clock::time_point submittedAt {Clock::now()};
+        Clock::time_point startedAt;
+        Clock::time_point prefillStartedAt;
+        Clock::time_point firstTokenAt;
+        Clock::time_point lastTokenAt;
+        double interTokenMsTotal {0};
+        int interTokenGaps {0};
+        double maxInterTokenMs {0};
+        double prefillStallMs {0};
+        int draftedTokens {0};
+        int acceptedDraftTokens {0};
+    };
+
+    struct Session
+    {
+        SessionId id {0};
+        llama_seq_id seqId {-1};     // -1 while not resident
+        llama_pos nPast {0};
+        bool spilled {false};        // KV state is in the spill store
+        bool pinned {false};         // offload failed; keep resident until next job
+        llama_pos rollbackFrom {-1}; // KV cells from here on belong to a cancelled job
+        int nKeep {1};               // kept by context shifts
+        llama_pos sharedLength {0};  // cells [0, sharedLength) may be shared with the prefix cache
+        std::vector<llama_token> history; // tokens at positions 0..nPast-1
+        llama_pos draftPast {0};     // tokens of history held by the draft sequence
+        Clock::time_point lastActive {Clock::now()};
+        std::unique_ptr<Job> job;
+    };
+
+    // Inputs of one session's draft proposal, copied under the lock so the
+    // draft decodes can run without it; the results are written back after
+    // 1セッション分の下書き提案の入力。ロック保持中に複製し、下書きのデコードは
+    // ロックを外して行う。結果は後で書き戻す
+    struct DraftRequest
+    {
+        SessionId id {0};
+        const Job *job {nullptr};          // drafts are dropped if the job changed meanwhile
+        llama_seq_id seqId {-1};
+        llama_pos draftPast {0};           // advanced by the draft decodes
+        std::vector<llama_token> catchUp;  // history the draft has not seen (this step's slice)
+        bool caughtUp {false};             // the slice reaches nPast: propose after nextToken
+        llama_token nextToken {0};
+        int count {0};                     // tokens to propose
+        int logitsIndex {-1};              // in the current draft batch, -1 if none
+        std::vector<llama_token> drafts;
+    };
+
+    /*
+      run():
+        - Decode thread main loop
+      run():
+        - デコードスレッドのメインループ
+    */
+    void run();
+
+    /*
+      hasRunnableWork():
+        - True if the decode thread can make progress (lock held)
+      hasRunnableWork():
+        - デコードスレッドが処理を進められる場合にtrue (ロック保持中)
+    */
+    bool hasRunnableWork() const;
+
+    /*
+      applyRollbacks():
+        - Removes KV cells written by cancelled jobs (lock held)
+      applyRollbacks():
+        - 中止されたジョブが書き込んだKVセルを削除 (ロック保持中)
+    */
+    void applyRollbacks();
+
+    /*
+      startJobs():
+        - Starts waiting jobs in FIFO order and reports the new queue
+          positions of those that keep waiting (lock held)
+      startJobs():
+        - 待機中のジョブをFIFO順に開始し、待機が続くものには
+          新しい順番を通知する (ロック保持中)
+    */
+    void startJobs();
+
+    /*
+      startJob(session):
+        - Binds a sequence to the session's job, restoring spilled state
+        - Returns false if no sequence is available yet (lock held)
+      startJob(session):
+        - セッションのジョブにシーケンスを割り当て、退避済みの状態を復元
+        - まだシーケンスが無い場合はfalseを返す (ロック保持中)
+    */
+    bool startJob(Session &session);
+
+    /*
+      offloadIdleSessions():
+        - Spills sessions idle for too long or beyond the resident budget (lock held)
+      offloadIdleSessions():
+        - 長時間アイドル、または常駐上限を超えたセッションを退避 (ロック保持中)
+    */
+    void offloadIdleSessions();
+
+    /*
+      offloadSession(session):
+        - Saves the session's KV state and frees its sequence (lock held)
+      offloadSession(session):
+        - セッションのKV状態を保存し、シーケンスを解放 (ロック保持中)
+    */
+    bool offloadSession(Session &session);
+
+    /*
+      truncateSession(session, from):
+        - Drops KV cells (main and draft) and history from position "from" on (lock held)
+      truncateSession(session, from):
+        - 位置"from"以降のKVセル (メインと下書き) と履歴を破棄 (ロック保持中)
+    */
+    void truncateSession(Session &session, llama_pos from);
+
+    /*
+      initializeDraft():
+        - Loads the draft model and its context if one is configured
+      initializeDraft():
+        - 下書きモデルが設定されていれば、そのモデルとコンテキストを用意する
+    */
+    void initializeDraft();
+
+    /*
+      warmUp():
+        - Decodes a synthetic prompt and one next token on every context, so
+          the first request finds the weights paged in and the compute graphs
+          of both batch shapes allocated
+        - Runs on the decode thread with its CPUs and threadpools, before the
+          first request can arrive
+      warmUp():
+        - 全コンテキストで合成プロンプトと次の1トークンをデコードし、最初の
+          リクエストの時点で重みがページインされ、両方のバッチ形状の計算
+          グラフが確保済みであるようにする
+        - デコードスレッド上で、そのCPUとスレッドプールを使い、最初の
+          リクエストが届く前に実行する
+    */
+    void warmUp();
+
+    /*
+      selectThreadpool(prefill):
+        - Runs the next step on the prefill pool when it carries prompt
+          tokens, on the decode pool otherwise; the idle pool is paused
+      selectThreadpool(prefill):
+        - 次のステップにプロンプトトークンが含まれる場合はプリフィル用、
+          それ以外はデコード用のプールで実行する。使わないプールは一時停止する
+    */
+    void selectThreadpool(bool prefill);
+
+    /*
+      collectDrafts():
+        - Draft requests for the sessions decoding next step (lock held)
+      collectDrafts():
+        - 次のステップでデコードするセッションの下書き要求 (ロック保持中)
+    */
+    std::vector<DraftRequest> collectDrafts();
+
+    /*
+      draftTokens(requests):
+        - Catches the draft sequences up with their history (one prefill
+          chunk per step) and lets the draft propose tokens for each request
+          that has caught up (lock not held; decode thread only)
+      draftTokens(requests):
+        - 下書きシーケンスを履歴に追いつかせ (1ステップにつきプリフィル1チャンク)、
+          追いついた要求について下書きモデルにトークンを提案させる
+          (ロック非保持。デコードスレッドのみ)
+    */
+    void draftTokens(std::vector<DraftRequest> &requests);
+
+    /*
+      applyDrafts(requests):
+        - Stores draft positions and proposals in sessions still running
+          the same job (lock held)
+      applyDrafts(requests):
+        - 同じジョブを実行中のセッションに下書きの位置と提案を格納 (ロック保持中)
+    */
+    void applyDrafts(const std::vector<DraftRequest> &requests);
+
+    /*
+      acceptToken(session, token):
+        - Streams a sampled token and applies the stop rules
+        - Returns false if the job has finished (lock held)
+      acceptToken(session, token):
+        - サンプリングしたトークンを送出し、停止条件を適用
+        - ジョブが完了した場合はfalseを返す (ロック保持中)
+    */
+    bool acceptToken(Session &session, llama_token token);
+
+    /*
+      shiftContext(session, needed):
+        - Frees at least "needed" positions by discarding tokens after nKeep
+        - Returns false if the window cannot hold them even then (lock held)
+      shiftContext(session, needed):
+        - nKeep以降のトークンを破棄し、少なくとも"needed"個の位置を空ける
+        - それでも収まらない場合はfalseを返す (ロック保持中)
+    */
+    bool shiftContext(Session &session, int needed);
+
+    /*
+      decodingSessions():
+        - Sessions whose sampled token goes into the next batch; one that
+          runs out of window room ends with an error (lock held)
+      decodingSessions():
+        - サンプリング済みのトークンを次のバッチに入れるセッション。
+          ウィンドウに空きが無いものはエラーで終了する (ロック保持中)
+    */
+    std::vector<Session *> decodingSessions();
+
+    /*
+      buildBatch():
+        - Fills mBatch from all sessions with work (lock held)
+        - Returns the ids of sessions that contributed tokens
+      buildBatch():
+        - 処理待ちのある全セッションからmBatchを組み立てる (ロック保持中)
+        - トークンを追加したセッションのIDを返す
+    */
+    std::vector<SessionId> buildBatch();
+
+    /*
+      accountStep(sessionIds, stepMs):
+        - Adds a decoded step's duration to the timings of its jobs (lock held)
+      accountStep(sessionIds, stepMs):
+        - デコードしたステップの所要時間を各ジョブの計測値に加算 (ロック保持中)
+    */
+    void accountStep(const std::vector<SessionId> &sessionIds, double stepMs);
+
+    /*
+      sampleBatch(sessionIds):
+        - Samples next tokens for sessions whose logits were requested (lock held)
+      sampleBatch(sessionIds):
+        - ロジットを要求したセッションの次トークンをサンプリング (ロック保持中)
+    */
+    void sampleBatch(const std::vector<SessionId> &sessionIds);
+
+    /*
+      publishGauges():
+        - Updates this model's queue/KV gauges in Metrics (lock held)
+      publishGauges():
+        - Metrics内のこのモデルのキュー/KVゲージを更新 (ロック保持中)
+    */
+    void publishGauges();
+
+    /*
+      registerPrefix(seqId, prompt):
+        - Records the prompt's prefix in the prefix cache (lock held)
+      registerPrefix(seqId, prompt):
+        - プロンプトの先頭部分を先頭部分キャッシュに登録 (ロック保持中)
+    */
+    void registerPrefix(llama_seq_id seqId, const std::vector<llama_token> &prompt);
+
+    /*
+      finishJob(session, error):
+        - Emits the final callback and clears the session's job (lock held)
+      finishJob(session, error):
+        - 最終コールバックを呼び、セッションのジョブを破棄 (ロック保持中)
+    */
+    void finishJob(Session &session, const QString &error = {});
+
+    /*
+      timingsOf(job):
+        - Summarizes a finished job's measurements
+      timingsOf(job):
+        - 完了したジョブの計測値をまとめる
+    */
+    static GenerationTimings timingsOf(const Job &job);
+
+    const ServerConfig::ModelConfig mModelConfig;
+
+    std::mutex mInitMutex;
+    bool mInitialized {false};
+
+    std::shared_ptr<llama_model> mModel;
+    llama_context *mCtx {nullptr};
+    llama_batch mBatch {};
+    Metrics::ModelGauges *mGauges {nullptr};
+
+    // Window and batch sizing (from ServerConfig)
+    // ウィンドウとバッチのサイズ (ServerConfigから設定)
+    int mNCtxPerSeq {2048};
+    int mBatchSize {512};
+    int mPrefillChunkTokens {0};
+
+    // Speculative decoding (null without a draft model); the draft context
+    // uses the same sequence ids as the main one
+    // 投機的デコード (下書きモデルが無ければnull)。下書きコンテキストは
+    // メインと同じシーケンスIDを使う
+    std::shared_ptr<llama_model> mDraftModel;
+    llama_context *mDraftCtx {nullptr};
+    llama_batch mDraftBatch {};
+    llama_sampler *mDraftSampler {nullptr};
+    int mDraftTokens {0};
+
+    // ggml threadpools of the decode thread (both null = llama.cpp's own
+    // threads) and the one the main context currently runs on
+    // デコードスレッドのggmlスレッドプール (両方null = llama.cpp独自のスレッド)
+    // と、メインコンテキストが現在使っているプール
+    CpuPlacement::Threadpools mThreadpools;
+    ggml_threadpool *mActiveThreadpool {nullptr};
+
+    // Guarded by mMutex
+    // 以下はmMutexで保護
+    mutable std::mutex mMutex;
+
+    // Sampler chains of running jobs are leased from here; declared before
+    // mSessions so it outlives the jobs holding leases
+    // 実行中ジョブのサンプラーチェーンはここから借りる。リースを持つジョブより
+    // 長く存在するよう、mSessionsより前に宣言する
+    SamplerPool mSamplerPool {mMaxSequences * 2};
+    std::unique_ptr<PrefixCache> mPrefixCache;
+    PrefixCache::Stats mPublishedPrefixStats;   // last values added to mGauges
+    std::unique_ptr<KvSpillStore> mSpillStore;
+    std::chrono::seconds mIdleOffloadAfter {0};
+    int mResidentTokenBudget {0};
+    int mMaxQueuedRequests {0};
+    int mMaxRequestsPerClient {0};
+
+    // Sessions whose job waits for a sequence, oldest first
+    // シーケンス待ちのジョブを持つセッション (古い順)
+    std::deque<SessionId> mWaiting;
+    std::condition_variable mWakeUp;
+    bool mStopping {false};
+    std::map<SessionId, std::unique_ptr<Session>> mSessions;
+    std::vector<llama_seq_id> mFreeSeqIds;
+    std::vector<llama_seq_id> mSeqIdsToClear;
+
+    // Session after which the next step starts handing out prompt chunks
+    // 次のステップでプロンプトの分割片を割り当て始める位置 (このセッションの次から)
+    SessionId mPrefillCursor {0};
+    size_t mStepPromptTokens {0};
+
+    std::thread mThread;
+
+    // Set by the decode thread once warmUp() has run
+    // warmUp()の実行後にデコードスレッドが設定する
+    std::promise<void> mWarmedUp;
+};
+
+#endif // DECODESCHEDULER_H
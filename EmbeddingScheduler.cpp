@@ -0,0 +1,342 @@
+// ================================================================
+// EmbeddingScheduler.cpp
+// ================================================================
+#include "EmbeddingScheduler.h"
+#include "CpuPlacement.h"
+#include "Metrics.h"
+#include "ModelRegistry.h"
+#include <QDebug>
+#include <QtEndian>
+#include <algorithm>
+#include <cmath>
+
+/*
+  Constructor:
+    - Sizing is read here; everything llama related happens on the thread
+*/
+EmbeddingScheduler::EmbeddingScheduler(const ServerConfig::ModelConfig &modelConfig)
+    : mModelConfig(modelConfig)
+{
+    const ServerConfig &config = ServerConfig::instance();
+    mBatchTokens = std::max(config.embeddingBatchTokens, 64);
+    mMaxInputs   = std::max(config.embeddingMaxInputs, 1);
+    mBatchWindow = std::chrono::milliseconds(std::max(config.embeddingBatchWindowMs, 0));
+
+    mThread = std::thread([this]() { run(); });
+}
+
+EmbeddingScheduler::~EmbeddingScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mWakeUp.notify_all();
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+
+    if (mCtx) {
+        llama_batch_free(mBatch);
+        llama_free(mCtx);
+        mCtx = nullptr;
+    }
+    mModel.reset();
+}
+
+/*
+  submit(texts, normalize, callbacks):
+    - Wakes the thread; it decides whether to wait for more requests
+*/
+void EmbeddingScheduler::submit(const QStringList &texts, bool normalize, EmbeddingCallbacks callbacks)
+{
+    auto request = std::make_shared<Request>();
+    request->texts     = texts;
+    request->normalize = normalize;
+    request->callbacks = std::move(callbacks);
+    bool accepted = false;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (!mLoadFailed && !mStopping) {
+            mWaitingInputs += static_cast<size_t>(texts.size());
+            mWaiting.push_back(request);
+            accepted = true;
+        }
+    }
+    if (!accepted) {
+        if (request->callbacks.onError) {
+            request->callbacks.onError(QStringLiteral("failed to load model \"%1\"").arg(mModelConfig.name));
+        }
+        return;
+    }
+    mWakeUp.notify_all();
+}
+
+/*
+  isIdle():
+    - Requests the thread has taken count until they are answered
+*/
+bool EmbeddingScheduler::isIdle() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mWaiting.empty() && mActiveRequests == 0;
+}
+
+/*
+  initialize():
+    - The whole pass has to fit one micro-batch (non-causal models attend
+      over the complete input), so n_ctx = n_batch = n_ubatch
+    - Models without a pooling type of their own (chat models) get mean pooling
+*/
+bool EmbeddingScheduler::initialize()
+{
+    const llama_model_params modelParams = ModelRegistry::modelParams(mModelConfig.gpuLayers);
+
+    mModel = ModelRegistry::instance().acquire(mModelConfig.path.toStdString(), modelParams);
+    if (!mModel) {
+        return false;
+    }
+
+    llama_context_params ctxParams = llama_context_default_params();
+    ctxParams.n_ctx        = mBatchTokens;
+    ctxParams.n_batch      = mBatchTokens;
+    ctxParams.n_ubatch     = mBatchTokens;
+    ctxParams.n_seq_max    = mMaxInputs;
+    ctxParams.embeddings   = true;
+    ctxParams.pooling_type = LLAMA_POOLING_TYPE_UNSPECIFIED;
+
+    // Embedding passes are prompt-shaped: compute bound like prefill
+    // 埋め込みの順伝播はプロンプトと同じ形状で、プリフィル同様に計算律速
+    ctxParams.n_threads       = CpuPlacement::instance().prefillThreads();
+    ctxParams.n_threads_batch = CpuPlacement::instance().prefillThreads();
+
+    mCtx = llama_new_context_with_model(mModel.get(), ctxParams);
+    if (mCtx && llama_pooling_type(mCtx) == LLAMA_POOLING_TYPE_NONE) {
+        llama_free(mCtx);
+        ctxParams.pooling_type = LLAMA_POOLING_TYPE_MEAN;
+        mCtx = llama_new_context_with_model(mModel.get(), ctxParams);
+    }
+    if (!mCtx) {
+        fprintf(stderr, "Error: failed to create the embeddings llama_context.\n");
+        mModel.reset();
+        return false;
+    }
+
+    mBatch      = llama_batch_init(mBatchTokens, /*embd=*/0, /*n_seq_max=*/1);
+    mDimensions = llama_n_embd(mModel.get());
+
+    qDebug() << "[EmbeddingScheduler]" << mModelConfig.name << "ready with" << mDimensions
+             << "dimensions, up to" << mMaxInputs << "inputs /" << mBatchTokens << "tokens per pass";
+    return true;
+}
+
+/*
+  run():
+    - Waits for requests; if they would not fill a pass, keeps the window
+      open a little longer, then drains everything waiting
+    - Requests whose inputs do not fit one pass continue in the next one,
+      ahead of newer requests
+    - Decodes without holding the lock, so submit() never waits for a pass
+*/
+void EmbeddingScheduler::run()
+{
+    // ggml's per-pass threads inherit this thread's CPUs
+    // ggmlが順伝播ごとに作るスレッドはこのスレッドのCPUを引き継ぐ
+    CpuPlacement::instance().pinToInferenceCpus();
+    const bool ready = initialize();
+
+    std::vector<std::shared_ptr<Request>> active;
+    std::deque<std::shared_ptr<Request>> orphaned;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mLoadFailed = !ready;
+        if (!ready) {
+            orphaned.swap(mWaiting);
+            mWaitingInputs = 0;
+        }
+    }
+    for (const auto &request : orphaned) {
+        if (request->callbacks.onError) {
+            request->callbacks.onError(QStringLiteral("failed to load model \"%1\"").arg(mModelConfig.name));
+        }
+    }
+    if (!ready) {
+        return;
+    }
+
+    const bool encoderOnly = llama_model_has_encoder(mModel.get()) && !llama_model_has_decoder(mModel.get());
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mActiveRequests = active.size();
+            if (active.empty()) {
+                mWakeUp.wait(lock, [this]() { return mStopping || !mWaiting.empty(); });
+                // Dynamic batching: give concurrent requests a chance to join
+                // 動的バッチ: 同時に届くリクエストが合流できるよう少し待つ
+                if (!mStopping && mWaitingInputs < static_cast<size_t>(mMaxInputs)) {
+                    mWakeUp.wait_for(lock, mBatchWindow, [this]() {
+                        return mStopping || mWaitingInputs >= static_cast<size_t>(mMaxInputs);
+                    });
+                }
+            }
+            if (mStopping) {
+                orphaned.swap(mWaiting);
+                break;
+            }
+            for (auto &request : mWaiting) {
+                active.push_back(std::move(request));
+            }
+            mWaiting.clear();
+            mWaitingInputs  = 0;
+            mActiveRequests = active.size();
+        }
+
+        for (const auto &request : active) {
+            if (request->inputs.size() != static_cast<size_t>(request->texts.size())) {
+                tokenize(*request);
+            }
+        }
+
+        const std::vector<Slot> slots = buildBatch(active);
+        if (!slots.empty()) {
+            llama_kv_cache_clear(mCtx);
+            const int result = encoderOnly ? llama_encode(mCtx, mBatch) : llama_decode(mCtx, mBatch);
+            if (result != 0) {
+                qWarning() << "[EmbeddingScheduler] Forward pass failed with" << result;
+                for (const Slot &slot : slots) {
+                    slot.request->failed = true;
+                }
+            } else {
+                for (size_t i = 0; i < slots.size(); ++i) {
+                    storeVector(slots[i], static_cast<llama_seq_id>(i));
+                }
+            }
+
+            Metrics &metrics = Metrics::instance();
+            metrics.embeddedInputs.fetch_add(static_cast<qint64>(slots.size()), std::memory_order_relaxed);
+            metrics.embeddingBatchInputs.observe(static_cast<double>(slots.size()));
+        }
+
+        // Answer the requests that are complete (or failed)
+        // 完了 (または失敗) したリクエストに応答する
+        auto done = std::stable_partition(active.begin(), active.end(), [](const auto &request) {
+            return !request->failed && request->doneInputs < request->inputs.size();
+        });
+        for (auto it = done; it != active.end(); ++it) {
+            const Request &request = **it;
+            if (request.failed) {
+                if (request.callbacks.onError) {
+                    request.callbacks.onError(QStringLiteral("embedding failed"));
+                }
+            } else if (request.callbacks.onFinished) {
+                request.callbacks.onFinished(request.vectors, mDimensions);
+            }
+        }
+        active.erase(done, active.end());
+    }
+
+    for (const auto &request : active) {
+        orphaned.push_back(request);
+    }
+    for (const auto &request : orphaned) {
+        if (request->callbacks.onError) {
+            request->callbacks.onError(QStringLiteral("server shutting down"));
+        }
+    }
+}
+
+/*
+  tokenize(request):
+    - Every input gets at least one token, so every sequence yields a vector
+    - The output buffer is sized once for the whole request
+*/
+void EmbeddingScheduler::tokenize(Request &request) const
+{
+    const llama_model *model = mModel.get();
+    request.inputs.resize(static_cast<size_t>(request.texts.size()));
+    for (qsizetype i = 0; i < request.texts.size(); ++i) {
+        const std::string text = request.texts.at(i).toStdString();
+        std::vector<llama_token> &tokens = request.inputs[static_cast<size_t>(i)];
+        tokens.resize(text.size() + 2);
+        int count = llama_tokenize(model, text.data(), static_cast<int32_t>(text.size()),
+                                   tokens.data(), static_cast<int32_t>(tokens.size()),
+                                   /*add_special=*/true, /*parse_special=*/false);
+        if (count < 0) {
+            tokens.resize(static_cast<size_t>(-count));
+            count = llama_tokenize(model, text.data(), static_cast<int32_t>(text.size()),
+                                   tokens.data(), static_cast<int32_t>(tokens.size()),
+                                   /*add_special=*/true, /*parse_special=*/false);
+        }
+        tokens.resize(static_cast<size_t>(std::clamp(count, 0, mBatchTokens)));
+        if (tokens.empty()) {
+            tokens.push_back(llama_token_bos(model));
+        }
+    }
+    request.vectors.resize(static_cast<qsizetype>(request.inputs.size())
+                           * mDimensions * static_cast<qsizetype>(sizeof(float)));
+}
+
+/*
+  buildBatch(requests):
+    - Each input is truncated to mBatchTokens, so the first one always fits
+    - Every token is an output: pooling reads the whole sequence
+*/
+std::vector<EmbeddingScheduler::Slot> EmbeddingScheduler::buildBatch(
+    const std::vector<std::shared_ptr<Request>> &requests)
+{
+    std::vector<Slot> slots;
+    mBatch.n_tokens = 0;
+
+    for (const auto &request : requests) {
+        while (request->nextInput < request->inputs.size()) {
+            const std::vector<llama_token> &tokens = request->inputs[request->nextInput];
+            if (static_cast<int>(slots.size()) >= mMaxInputs
+                || mBatch.n_tokens + static_cast<int>(tokens.size()) > mBatchTokens) {
+                return slots;
+            }
+            const llama_seq_id seqId = static_cast<llama_seq_id>(slots.size());
+            for (size_t pos = 0; pos < tokens.size(); ++pos) {
+                const int i = mBatch.n_tokens++;
+                mBatch.token[i]     = tokens[pos];
+                mBatch.pos[i]       = static_cast<llama_pos>(pos);
+                mBatch.n_seq_id[i]  = 1;
+                mBatch.seq_id[i][0] = seqId;
+                mBatch.logits[i]    = true;
+            }
+            slots.push_back({request, request->nextInput});
+            ++request->nextInput;
+        }
+    }
+    return slots;
+}
+
+/*
+  storeVector(slot, seqId):
+    - Written little-endian straight into the request's payload
+*/
+void EmbeddingScheduler::storeVector(const Slot &slot, llama_seq_id seqId)
+{
+    Request &request = *slot.request;
+    const float *embedding = llama_get_embeddings_seq(mCtx, seqId);
+    if (!embedding) {
+        request.failed = true;
+        return;
+    }
+
+    float scale = 1.0f;
+    if (request.normalize) {
+        double sum = 0.0;
+        for (int i = 0; i < mDimensions; ++i) {
+            sum += static_cast<double>(embedding[i]) * embedding[i];
+        }
+        scale = (sum > 0.0) ? static_cast<float>(1.0 / std::sqrt(sum)) : 0.0f;
+    }
+
+    uchar *out = reinterpret_cast<uchar *>(request.vectors.data())
+                 + slot.input * static_cast<size_t>(mDimensions) * sizeof(float);
+    for (int i = 0; i < mDimensions; ++i) {
+        qToLittleEndian<float>(embedding[i] * scale, out + i * sizeof(float));
+    }
+    ++request.doneInputs;
+}
@@ -0,0 +1,198 @@
+// ================================================================
+// EmbeddingScheduler.h
+// ================================================================
+#ifndef EMBEDDINGSCHEDULER_H
+#define EMBEDDINGSCHEDULER_H
+
+#include "llama.h"
+#include "ServerConfig.h"
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+  EmbeddingCallbacks:
+    - Per-request hooks invoked from the embedding thread, exactly one of them
+    - vectors holds one float32 vector per input text, in input order,
+      little-endian, dimensions floats each
+
+  EmbeddingCallbacks:
+    - 埋め込みスレッドから呼ばれるリクエストごとのコールバック (どちらか1つのみ)
+    - vectorsは入力テキストごとに1つのfloat32ベクトルを入力順に並べたもの
+      (リトルエンディアン、各dimensions個)
+*/
+struct EmbeddingCallbacks
+{
+    std::function<void(const QByteArray &vectors, int dimensions)> onFinished;
+    std::function<void(const QString &error)> onError;
+};
+
+/*
+  EmbeddingScheduler:
+    - One per model serving embeddings, created by ModelRegistry on the
+      first embedding request for that model
+    - Owns an embeddings-enabled llama_context next to the model's
+      DecodeScheduler; the weights are shared through ModelRegistry
+    - A dedicated thread packs the inputs of all waiting requests into one
+      llama_batch, one sequence id per input, and pools one vector per
+      sequence from a single forward pass
+    - Dynamic batching: when a pass would not be full, the thread waits up
+      to embeddingBatchWindowMs for more requests, so small concurrent
+      requests of different clients share a forward pass
+    - The model is loaded on the embedding thread, so creating the scheduler
+      never blocks the caller
+
+  EmbeddingSchedulerクラス:
+    - 埋め込みを提供するモデルごとに1つ。そのモデルへの最初の埋め込み
+      リクエスト時にModelRegistryが生成する
+    - モデルのDecodeSchedulerとは別に、埋め込みを有効にしたllama_contextを
+      所有する。重みはModelRegistry経由で共有する
+    - 専用スレッドが待機中の全リクエストの入力を1つのllama_batchに詰め
+      (入力ごとに1つのシーケンスID)、1回の順伝播でシーケンスごとに
+      1つのベクトルをプーリングする
+    - 動的バッチ: 順伝播が埋まらない場合は最大embeddingBatchWindowMsだけ
+      追加のリクエストを待つため、複数クライアントからの小さな同時
+      リクエストが1回の順伝播を共有する
+    - モデルは埋め込みスレッドでロードするため、生成時に呼び出し元を待たせない
+*/
+class EmbeddingScheduler
+{
+public:
+    /*
+      Constructor:
+        - Starts the embedding thread, which loads the model first
+      コンストラクタ:
+        - 埋め込みスレッドを開始する (スレッドは最初にモデルをロードする)
+    */
+    explicit EmbeddingScheduler(const ServerConfig::ModelConfig &modelConfig);
+
+    /*
+      Destructor:
+        - Fails waiting requests, stops the thread and frees the context
+      デストラクタ:
+        - 待機中のリクエストを失敗させ、スレッドを停止してコンテキストを解放
+    */
+    ~EmbeddingScheduler();
+
+    /*
+      submit(texts, normalize, callbacks):
+        - Queues the texts; with normalize every vector gets unit L2 length
+        - Texts longer than embeddingBatchTokens are truncated
+        - Callbacks may run before submit() returns (e.g. the model failed to load)
+      submit(texts, normalize, callbacks):
+        - テキストをキューに入れる。normalizeの場合は各ベクトルのL2長を1にする
+        - embeddingBatchTokensより長いテキストは切り詰める
+        - submit()から戻る前にコールバックが呼ばれる場合がある (モデルの
+          ロードに失敗した場合など)
+    */
+    void submit(const QStringList &texts, bool normalize, EmbeddingCallbacks callbacks);
+
+    /*
+      isIdle():
+        - True if no request is waiting or in a pass (safe to evict)
+      isIdle():
+        - 待機中または順伝播中のリクエストが無い場合にtrue (破棄してよい)
+    */
+    bool isIdle() const;
+
+    EmbeddingScheduler(const EmbeddingScheduler &) = delete;
+    EmbeddingScheduler &operator=(const EmbeddingScheduler &) = delete;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Request
+    {
+        QStringList texts;
+        bool normalize {true};
+        EmbeddingCallbacks callbacks;
+        std::vector<std::vector<llama_token>> inputs;  // tokenized on the embedding thread
+        size_t nextInput {0};        // first input not yet placed in a pass
+        size_t doneInputs {0};       // inputs whose vector is in vectors
+        QByteArray vectors;
+        bool failed {false};
+    };
+
+    struct Slot
+    {
+        std::shared_ptr<Request> request;
+        size_t input {0};
+    };
+
+    /*
+      run():
+        - Embedding thread main loop
+      run():
+        - 埋め込みスレッドのメインループ
+    */
+    void run();
+
+    /*
+      initialize():
+        - Borrows the model and creates the embeddings context
+      initialize():
+        - モデルを借用し、埋め込み用のコンテキストを作成
+    */
+    bool initialize();
+
+    /*
+      tokenize(request):
+        - Tokenizes all texts of a request (embedding thread)
+      tokenize(request):
+        - リクエストの全テキストをトークナイズ (埋め込みスレッド)
+    */
+    void tokenize(Request &request) const;
+
+    /*
+      buildBatch(requests):
+        - Fills mBatch with inputs in FIFO order until the sequences or the
+          tokens of one pass are used up
+      buildBatch(requests):
+        - 1回の順伝播のシーケンス数またはトークン数を使い切るまで、
+          FIFO順に入力をmBatchに詰める
+    */
+    std::vector<Slot> buildBatch(const std::vector<std::shared_ptr<Request>> &requests);
+
+    /*
+      storeVector(slot, seqId):
+        - Copies (and normalizes) the pooled vector of one sequence
+      storeVector(slot, seqId):
+        - 1シーケンス分のプーリング済みベクトルをコピー (必要なら正規化)
+    */
+    void storeVector(const Slot &slot, llama_seq_id seqId);
+
+    const ServerConfig::ModelConfig mModelConfig;
+
+    std::shared_ptr<llama_model> mModel;
+    llama_context *mCtx {nullptr};
+    llama_batch mBatch {};
+    int mDimensions {0};
+
+    // Sizing of one forward pass (from ServerConfig)
+    // 1回の順伝播のサイズ (ServerConfigから設定)
+    int mBatchTokens {2048};
+    int mMaxInputs {32};
+    std::chrono::milliseconds mBatchWindow {2};
+
+    // Guarded by mMutex
+    // 以下はmMutexで保護
+    mutable std::mutex mMutex;
+    std::condition_variable mWakeUp;
+    std::deque<std::shared_ptr<Request>> mWaiting;
+    size_t mWaitingInputs {0};
+    size_t mActiveRequests {0};   // taken by the thread and not answered yet
+    bool mStopping {false};
+    bool mLoadFailed {false};
+
+    std::thread mThread;
+};
+
+#endif // EMBEDDINGSCHEDULER_H
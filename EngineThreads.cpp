@@ -0,0 +1,65 @@
+// ================================================================
+// EngineThreads.cpp
+// ================================================================
+#include "EngineThreads.h"
+#include "ServerConfig.h"
+#include <QDebug>
+#include <QMutexLocker>
+
+/*
+  instance():
+    - Function-local static
+*/
+EngineThreads &EngineThreads::instance()
+{
+    static EngineThreads threads;
+    return threads;
+}
+
+/*
+  Destructor:
+    - Safety net if shutdown() was not called
+*/
+EngineThreads::~EngineThreads()
+{
+    shutdown();
+}
+
+/*
+  nextThread():
+    - Creates engineThreadCount threads on first call
+*/
+QThread *EngineThreads::nextThread()
+{
+    QMutexLocker locker(&mMutex);
+    if (mThreads.isEmpty()) {
+        const int count = qMax(1, ServerConfig::instance().engineThreadCount);
+        for (int i = 0; i < count; ++i) {
+            auto *thread = new QThread;
+            thread->setObjectName(QStringLiteral("EngineThread-%1").arg(i));
+            thread->start();
+            mThreads.append(thread);
+        }
+        qDebug() << "[EngineThreads] Started" << count << "engine threads";
+    }
+
+    QThread *thread = mThreads.at(mNext);
+    mNext = (mNext + 1) % mThreads.size();
+    return thread;
+}
+
+/*
+  shutdown():
+    - Idempotent
+*/
+void EngineThreads::shutdown()
+{
+    QMutexLocker locker(&mMutex);
+    for (QThread *thread : std::as_const(mThreads)) {
+        thread->quit();
+        thread->wait();
+        delete thread;
+    }
+    mThreads.clear();
+    mNext = 0;
+}
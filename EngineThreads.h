@@ -0,0 +1,64 @@
+// ================================================================
+// EngineThreads.h
+// ================================================================
+#ifndef ENGINETHREADS_H
+#define ENGINETHREADS_H
+
+#include <QList>
+#include <QMutex>
+#include <QThread>
+
+/*
+  EngineThreads:
+    - Small set of worker QThreads owned by the server, each running its
+      own event loop
+    - InferenceEngine objects live on these threads, so templating,
+      tokenization and initialization never run on the networking thread
+    - Engines are spread round-robin over the threads
+
+  EngineThreadsクラス:
+    - サーバーが所有する少数のワーカーQThread (それぞれ独自のイベントループを持つ)
+    - InferenceEngineはこれらのスレッド上で動作し、テンプレート適用、
+      トークナイズ、初期化がネットワーク処理のスレッドで実行されることはない
+    - エンジンはラウンドロビンで各スレッドに割り当てる
+*/
+class EngineThreads
+{
+public:
+    /*
+      instance():
+        - Process-wide set, threads are started on first use
+      instance():
+        - プロセス全体で共有。スレッドは初回利用時に開始
+    */
+    static EngineThreads &instance();
+
+    /*
+      nextThread():
+        - Thread for the next engine (round-robin)
+      nextThread():
+        - 次のエンジンを載せるスレッド (ラウンドロビン)
+    */
+    QThread *nextThread();
+
+    /*
+      shutdown():
+        - Stops all event loops and waits for the threads; call before exit
+      shutdown():
+        - 全イベントループを停止しスレッドの終了を待つ。終了前に呼ぶこと
+    */
+    void shutdown();
+
+    EngineThreads(const EngineThreads &) = delete;
+    EngineThreads &operator=(const EngineThreads &) = delete;
+
+private:
+    EngineThreads() = default;
+    ~EngineThreads();
+
+    QMutex mMutex;
+    QList<QThread *> mThreads;
+    int mNext {0};
+};
+
+#endif // ENGINETHREADS_H
@@ -2,209 +2,453 @@
 // InferenceEngine.cpp
 // ================================================================
 #include "InferenceEngine.h"
+#include "EngineThreads.h"
+#include "Metrics.h"
+#include "ModelRegistry.h"
+#include "ServerConfig.h"
+#include "TrafficRecorder.h"
 #include <QDebug>
-#include <QThreadPool>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QMetaObject>
+#include <QThread>
+#include <QTimer>
+#include <algorithm>
+#include <mutex>
+
+namespace {
+
+/*
+  completeUtf8Length(bytes):
+    - Length of the longest prefix of "bytes" that does not end inside a
+      multi-byte UTF-8 sequence (token pieces may split characters)
+  completeUtf8Length(bytes):
+    - マルチバイトUTF-8文字の途中で終わらない最長の先頭部分の長さ
+      (トークン片は文字の途中で分割されることがある)
+*/
+size_t completeUtf8Length(const std::string &bytes)
+{
+    const size_t size = bytes.size();
+    // Look back at most 3 bytes for the lead byte of the last character
+    for (size_t back = 1; back <= 3 && back <= size; ++back) {
+        const unsigned char c = static_cast<unsigned char>(bytes[size - back]);
+        if ((c & 0xC0) == 0x80) {
+            continue;  // continuation byte
+        }
+        size_t needed = 1;
+        if ((c & 0xE0) == 0xC0)      needed = 2;
+        else if ((c & 0xF0) == 0xE0) needed = 3;
+        else if ((c & 0xF8) == 0xF0) needed = 4;
+        return (back < needed) ? size - back : size;
+    }
+    return size;
+}
+
+/*
+  toGenerationParams(options):
+    - Zero / negative fields of the POD keep the server default, since a
+      default-constructed GenerationOptions has every field set to 0
+  toGenerationParams(options):
+    - PODの0 / 負のフィールドはサーバー既定値のまま
+      (既定構築したGenerationOptionsは全フィールドが0のため)
+*/
+GenerationParams toGenerationParams(const GenerationOptions &options)
+{
+    GenerationParams params;
+    params.maxTokens = std::max(options.maxTokens(), 0);
+    for (const QString &stop : options.stop()) {
+        if (!stop.isEmpty()) {
+            params.stopStrings.push_back(stop.toStdString());
+        }
+    }
+    if (options.temperature() > 0) {
+        params.sampling.temperature = static_cast<float>(options.temperature());
+    }
+    if (options.minP() > 0) {
+        params.sampling.minP = static_cast<float>(options.minP());
+    }
+    if (options.topK() > 0) {
+        params.sampling.topK = options.topK();
+    }
+    if (options.seed() != 0) {
+        params.sampling.seed = static_cast<uint32_t>(options.seed());
+    }
+    params.sampling.greedy = options.greedy();
+    return params;
+}
+
+/*
+  modelIdentity(name):
+    - Name, file and its modification time, so persisted response cache
+      entries do not survive a replaced model file
+  modelIdentity(name):
+    - 名前、ファイルとその更新時刻。モデルファイルを差し替えた場合に、
+      永続化した応答キャッシュのエントリが使われないようにする
+*/
+QString modelIdentity(const QString &name)
+{
+    const ServerConfig::ModelConfig *config = ServerConfig::instance().findModel(name);
+    if (!config) {
+        return name;
+    }
+    return QStringLiteral("%1\n%2\n%3").arg(name, config->path,
+        QString::number(QFileInfo(config->path).lastModified().toMSecsSinceEpoch()));
+}
+
+} // namespace
+
+// Per-generation streaming state, shared by the scheduler thread (tokens)
+// and the engine thread (flush timer)
+// 生成ごとのストリーミング状態。スケジューラスレッド (トークン) と
+// エンジンスレッド (送出タイマー) で共有する
+struct InferenceEngine::StreamState
+{
+    std::mutex mutex;
+    StreamingMode mode {StreamingMode::FullText};
+    FlushPolicy policy;
+    std::string response;        // everything received so far (FullText mode)
+    std::string pendingBytes;    // received but not emitted yet
+    int pendingTokens {0};
+    Clock::time_point pendingSince;
+    int sequence {0};
+    int offset {0};              // UTF-16 units emitted so far (Delta mode)
+    int byteOffset {0};          // UTF-8 bytes emitted so far (Utf8Bytes mode)
+    int frames {0};              // partial signals emitted
+    std::vector<std::string> pieces;  // recorded for the response cache
+};
 
 /*
   Constructor:
-    - Optionally receives a llama_model and llama_context
-    - Spawns a thread to handle do_engine_init() asynchronously
+    - Lightweight; the heavy work starts with start()
   コンストラクタ:
-    - llama_model, llama_contextを任意で受け取れる
-    - do_engine_init()を非同期実行するスレッドを開始
+    - 軽量。重い処理はstart()で開始
+*/
+InferenceEngine::InferenceEngine()
+    : QObject(nullptr)
+{
+    setFlushPolicy(-1, -1, ServerConfig::instance().streamFlushAtNewline);
+
+    // Child object, so it moves to the engine thread together with the engine
+    // 子オブジェクトなので、エンジンと共にエンジンスレッドへ移動する
+    mFlushTimer = new QTimer(this);
+    mFlushTimer->setSingleShot(true);
+    connect(mFlushTimer, &QTimer::timeout, this, &InferenceEngine::flushDueStream);
+}
+
+/*
+  start():
+    - Moves to an engine thread and queues do_engine_init() there
+  start():
+    - エンジンスレッドに移動し、そのスレッドでdo_engine_init()を実行
 */
-InferenceEngine::InferenceEngine(QObject *parent,
-                                 llama_model *model,
-                                 llama_context *ctx)
-    : QObject(parent)
-    , mModel(model)
-    , mCtx(ctx)
-    , mFormattedBuffer{}  // ここで明示的にコンストラクタ呼び出し
-    , mPrevLen(0)
+void InferenceEngine::start()
 {
-    // Start initialization in background
-    // バックグラウンドで初期化開始
-    QThreadPool::globalInstance()->start([this]() {
+    moveToThread(EngineThreads::instance().nextThread());
+
+    // Start initialization on the engine thread
+    // エンジンスレッドで初期化開始
+    QMetaObject::invokeMethod(this, [this]() {
         do_engine_init();
-    });
+    }, Qt::QueuedConnection);
 }
 
 /*
   Destructor:
-    - If mSampler is allocated, free it
+    - Closes the decode session so its KV cells can be reused
+    - The engine holds no reference to the model, so nothing else to release
   デストラクタ:
-    - mSamplerが割り当てられていれば解放する
+    - デコードセッションを閉じ、KVセルを再利用可能にする
+    - エンジンはモデルへの参照を持たないため、他に解放するものは無い
 */
 InferenceEngine::~InferenceEngine()
 {
-    if (mSampler) {
-        llama_sampler_free(mSampler);
-        mSampler = nullptr;
-    }
+    releaseSession();
 }
 
 /*
-  generate(messages):
-    - Tokenizes and decodes user messages to produce text
-    - Emits partial/final responses during generation
-  generate(messages):
-    - ユーザーメッセージをトークナイズ/デコードしてテキスト生成
-    - 推論過程で部分/最終レスポンスをemitする
+  generate(messages, modelName, options):
+    - Tokenizes user messages and submits them to the model's DecodeScheduler
+    - An empty modelName keeps the current model (the default one initially)
+    - Partial/final responses are emitted from the scheduler thread, or
+      right away from the engine thread on a response cache hit
+  generate(messages, modelName, options):
+    - ユーザーメッセージをトークナイズし、モデルのDecodeSchedulerに投入
+    - modelNameが空の場合は現在のモデルのまま (最初は既定のモデル)
+    - 部分/最終レスポンスはスケジューラスレッドからemitされる
+      (応答キャッシュにヒットした場合はエンジンスレッドから即座にemit)
 */
-void InferenceEngine::generate(const QList<LlamaChatMessage>& messages)
+void InferenceEngine::generate(const QList<LlamaChatMessage>& messages, const QString &modelName,
+                               const GenerationOptions &options)
 {
-    qDebug() << "Generating response...";
+    generateStreamed(messages, modelName, options, mStreamingMode.load(), mFlushPolicy);
+}
 
-    // 1) Ensure mFormattedBuffer is sized to current n_ctx
-    //  ここで mFormattedBuffer を llama_n_ctx(mCtx) 分だけ確保しておく
-    const int nCtxTokens = llama_n_ctx(mCtx);
-    if (mFormattedBuffer.size() < static_cast<size_t>(nCtxTokens)) {
-        mFormattedBuffer.resize(nCtxTokens);
-    }
-
-    // Convert messages to llama format
-    // メッセージをllama形式に変換
-    std::vector<llama_chat_message> messagesForLlama = to_llama_messages(messages);
-
-    // 2) Apply chat template
-    //  チャットテンプレートを適用
-    int newLen = llama_chat_apply_template(
-        mModel,
-        nullptr,
-        messagesForLlama.data(),
-        messagesForLlama.size(),
-        /*force_system=*/true,
-        mFormattedBuffer.data(),
-        mFormattedBuffer.size()
-        );
-
-    if (newLen > static_cast<int>(mFormattedBuffer.size())) {
-        //  万一 newLen が想定より大きければ再確保
-        mFormattedBuffer.resize(newLen);
-        newLen = llama_chat_apply_template(
-            mModel,
-            nullptr,
-            messagesForLlama.data(),
-            messagesForLlama.size(),
-            /*force_system=*/true,
-            mFormattedBuffer.data(),
-            mFormattedBuffer.size()
-            );
-    }
-
-    if (newLen < 0) {
-        fprintf(stderr, "Failed to apply chat template.\n");
+/*
+  generateStreamed(messages, modelName, options, mode, policy):
+    - Mode and policy are fixed for the whole generation, so switching the
+      engine's mode never mixes formats inside one stream
+*/
+void InferenceEngine::generateStreamed(const QList<LlamaChatMessage>& messages, const QString &modelName,
+                                       const GenerationOptions &options, StreamingMode mode,
+                                       const FlushPolicy &policy)
+{
+    qDebug() << "Generating response...";
+    Metrics *metrics = &Metrics::instance();
+    const size_t transport = Metrics::index(mTransport);
+    metrics->requests[transport].fetch_add(1, std::memory_order_relaxed);
+    TrafficRecorder::instance().record(mTransport, modelName, messages, options);
+
+    QString bindError;
+    const std::shared_ptr<DecodeScheduler> scheduler =
+        bindModel(modelName.isEmpty() ? mModelName : modelName, &bindError);
+    if (!scheduler) {
+        metrics->generationErrors[transport].fetch_add(1, std::memory_order_relaxed);
+        emit generationError(bindError);
         return;
     }
+    // Refused before anything touches the conversation: the running turn
+    // is committed and its reply is still to be adopted
+    // 会話に触れる前に拒否する: 実行中のターンは確定済みで、応答はまだ取り込まれていない
+    if (scheduler->isGenerating(mSession)) {
+        metrics->generationErrors[transport].fetch_add(1, std::memory_order_relaxed);
+        emit generationError(QStringLiteral("generation already in progress"));
+        return;
+    }
+    const std::shared_ptr<llama_model> sharedModel = scheduler->model();
+    llama_model *model = sharedModel.get();
+
+    // If the conversation's KV state was lost (e.g. a failed restore after
+    // offloading), the whole history has to be sent again
+    // 会話のKV状態が失われた場合 (退避後の復元失敗など) は履歴全体を送り直す
+    if (!mConversation.isEmpty() && scheduler->sessionLength(mSession) == 0) {
+        mConversation.reset(model);
+    }
 
-    // 3) Build prompt string
-    //  newLen, mPrevLen を使って substring
-    std::string promptStd(
-        mFormattedBuffer.begin() + mPrevLen,
-        mFormattedBuffer.begin() + newLen
-        );
-    std::string response;
+    // A client that edited earlier messages starts over in a new session
+    // (shared prefixes are still reused through the prefix cache)
+    // 以前のメッセージを編集したクライアントは新しいセッションでやり直す
+    // (共通の先頭部分はプレフィックスキャッシュで再利用される)
+    if (!mConversation.continues(messages)) {
+        qDebug() << "[InferenceEngine] History diverged; starting a new session";
+        releaseSession();
+        if (!bindModel(mModelName, &bindError)) {
+            metrics->generationErrors[transport].fetch_add(1, std::memory_order_relaxed);
+            emit generationError(bindError);
+            return;
+        }
+    }
 
-    // Tokenize the prompt
-    // プロンプトをトークナイズ
-    const int nPromptTokens = -llama_tokenize(
-        mModel,
-        promptStd.c_str(),
-        promptStd.size(),
-        nullptr,
-        0,
-        /*bos=*/true,
-        /*newline=*/true
-        );
-
-    std::vector<llama_token> promptTokens(nPromptTokens);
-    if (llama_tokenize(
-            mModel,
-            promptStd.c_str(),
-            promptStd.size(),
-            promptTokens.data(),
-            promptTokens.size(),
-            llama_get_kv_cache_used_cells(mCtx) == 0,
-            /*newline=*/true) < 0)
-    {
-        emit generationError("failed to tokenize the prompt");
+    // 1) Template and tokenize only the messages added since the last turn
+    //  前回のターン以降に追加されたメッセージのみをテンプレート適用/トークナイズ
+    Conversation::Turn turn;
+    QString prepareError;
+    if (!mConversation.prepare(messages.mid(mConversation.messageCount()), &turn, &prepareError)) {
+        metrics->generationErrors[transport].fetch_add(1, std::memory_order_relaxed);
+        emit generationError(prepareError);
         return;
     }
 
-    // Prepare a single batch for decoding
-    llama_batch batch = llama_batch_get_one(promptTokens.data(), promptTokens.size());
-    llama_token newTokenId;
+    // 2) Deterministic requests may be answered from the response cache; a
+    //    hit leaves the conversation and the KV cache untouched, so the next
+    //    turn templates these messages as new ones
+    //  決定的なリクエストは応答キャッシュから返せる。ヒットした場合は会話と
+    //  KVキャッシュを変更しないため、次のターンではこれらのメッセージを
+    //  新規として扱う
+    auto stream = std::make_shared<StreamState>();
+    stream->mode   = mode;
+    stream->policy = policy;
+
+    GenerationParams params = toGenerationParams(options);
+    ResponseCache &responseCache = ResponseCache::instance();
+    QByteArray cacheKey;
+    if (responseCache.enabled() && ResponseCache::cacheable(params)) {
+        cacheKey = ResponseCache::key(modelIdentity(mModelName), mConversation.tokens(), turn.tokens, params);
+        ResponseCache::Entry cached;
+        if (responseCache.lookup(cacheKey, &cached)) {
+            emit generationStarted(mode);
+            replayCached(cached, static_cast<int>(turn.tokens.size()), stream);
+            return;
+        }
+    }
 
-    static constexpr int maxReplyTokens    {1024};
-    static constexpr int extraCutoffTokens {32};
-    int generatedTokenCount {0};
+    if (turn.startsConversation) {
+        scheduler->setKeepTokens(mSession, turn.keepTokens);
+    }
 
-    // Decode until EOG
-    while (true) {
-        if (llama_decode(mCtx, batch)) {
-            emit generationError("failed to decode");
-            break;
+    // 3) Hand the request to the shared decode loop
+    //  共有デコードループにリクエストを渡す
+    mStream = stream;
+
+    GenerationCallbacks callbacks;
+    // Runs for every token on the shared scheduler thread: no logging here
+    // 共有スケジューラスレッドで全トークンについて実行されるため、ここではログを出さない
+    callbacks.onPiece = [this, stream, record = !cacheKey.isEmpty()](const std::string &piece, const std::string &) {
+        std::lock_guard<std::mutex> lock(stream->mutex);
+        if (record) {
+            stream->pieces.push_back(piece);
         }
-
-        // Sample next token
-        newTokenId = llama_sampler_sample(mSampler, mCtx, /*last_n_tokens=*/-1);
-        if (llama_token_is_eog(mModel, newTokenId)) {
-            // End-of-generation
-            break;
+        streamPiece(*stream, piece);
+    };
+    const int promptTokens = static_cast<int>(turn.tokens.size());
+    callbacks.onFinished = [this, stream, cacheKey, promptTokens, session = mSession](
+                               const std::string &response, const std::vector<llama_token> &replyTokens) {
+        ResponseCache::Entry entry;
+        {
+            std::lock_guard<std::mutex> lock(stream->mutex);
+            flushStream(*stream, /*final=*/true);
+            entry.pieces = std::move(stream->pieces);
         }
-
-        // Convert token -> piece
-        char buf[256] = {};
-        int n = llama_token_to_piece(mModel, newTokenId, buf, sizeof(buf), /*replaceNL=*/0, /*utf8=*/true);
-        if (n < 0) {
-            emit generationError("failed to convert token to piece");
-            break;
+        // Queued before the signal, so the conversation holds the reply when
+        // the client's next turn reaches the engine thread; the same string
+        // data lets continues() match a resent reply by pointer
+        // 次のターンがエンジンスレッドに届く時点で会話が応答を保持しているよう、
+        // シグナルより先にキューに入れる。同じ文字列データを共有するため、
+        // 送り直された応答をcontinues()がポインタ比較で照合できる
+        const QString reply = QString::fromStdString(response);
+        QMetaObject::invokeMethod(this, [this, session, reply, replyTokens, promptTokens]() {
+            adoptReply(session, reply, replyTokens, promptTokens);
+        }, Qt::QueuedConnection);
+
+        // Emit final result
+        emit generationFinished(reply);
+
+        // Stored from the engine thread, keeping file writes off the decode loop
+        // ファイル書き込みをデコードループから外すため、エンジンスレッドで保存
+        if (!cacheKey.isEmpty()) {
+            QMetaObject::invokeMethod(this, [cacheKey, entry = std::move(entry)]() mutable {
+                ResponseCache::instance().insert(cacheKey, std::move(entry));
+            }, Qt::QueuedConnection);
         }
-
-        std::string piece(buf, n);
-        qDebug() << piece.c_str();
-
-        response += piece;
-
-        // Emit partial response
-        emit partialResponseReady(QString::fromStdString(response));
-
-        // Next batch
-        batch = llama_batch_get_one(&newTokenId, 1);
-
-        // Cut off if too long
-        ++generatedTokenCount;
-        if (generatedTokenCount > maxReplyTokens) {
-            if (piece.find('\n') != std::string::npos) {
-                qDebug() << "Cutting off at newline.";
-                break;
-            } else if (generatedTokenCount > maxReplyTokens + extraCutoffTokens) {
-                qDebug() << "Cutting off after extra tokens.";
-                break;
-            }
+    };
+    callbacks.onStats = [this, stream, metrics](const GenerationTimings &timings) {
+        // Called right before onFinished: send the tail now so it is counted
+        // onFinishedの直前に呼ばれる。残りをここで送出して数に含める
+        int frames = 0;
+        {
+            std::lock_guard<std::mutex> lock(stream->mutex);
+            flushStream(*stream, /*final=*/true);
+            frames = stream->frames;
         }
-
-        // Process events for immediate partial updates
-        QCoreApplication::processEvents();
+        GenerationStats stats;
+        stats.setPromptTokens(timings.promptTokens);
+        stats.setReusedPromptTokens(timings.reusedPromptTokens);
+        stats.setGeneratedTokens(timings.generatedTokens);
+        stats.setQueueMs(timings.queueMs);
+        stats.setPrefillMs(timings.prefillMs);
+        stats.setPrefillTokensPerSecond(timings.prefillTokensPerSecond);
+        stats.setTimeToFirstTokenMs(timings.timeToFirstTokenMs);
+        stats.setMeanInterTokenMs(timings.meanInterTokenMs);
+        stats.setMaxInterTokenMs(timings.maxInterTokenMs);
+        stats.setPrefillStallMs(timings.prefillStallMs);
+        stats.setDecodeTokensPerSecond(timings.decodeTokensPerSecond);
+        stats.setDraftedTokens(timings.draftedTokens);
+        stats.setAcceptedDraftTokens(timings.acceptedDraftTokens);
+        stats.setDraftAcceptanceRate(timings.draftAcceptanceRate);
+        stats.setStreamedFrames(frames);
+        stats.setFramesPerToken(timings.generatedTokens > 0
+                                    ? static_cast<double>(frames) / timings.generatedTokens
+                                    : 0.0);
+        emit generationStats(stats);
+
+        metrics->promptTokens.fetch_add(timings.promptTokens, std::memory_order_relaxed);
+        metrics->reusedPromptTokens.fetch_add(timings.reusedPromptTokens, std::memory_order_relaxed);
+        metrics->generatedTokens.fetch_add(timings.generatedTokens, std::memory_order_relaxed);
+        if (timings.prefillTokensPerSecond > 0) {
+            metrics->prefillTokensPerSecond.observe(timings.prefillTokensPerSecond);
+        }
+        if (timings.decodeTokensPerSecond > 0) {
+            metrics->decodeTokensPerSecond.observe(timings.decodeTokensPerSecond);
+        }
+        if (timings.generatedTokens > 0) {
+            metrics->timeToFirstToken.observe(timings.timeToFirstTokenMs / 1000.0);
+        }
+    };
+    callbacks.onError = [this, metrics, transport, session = mSession](const QString &error) {
+        metrics->generationErrors[transport].fetch_add(1, std::memory_order_relaxed);
+        // An error from the scheduler thread means the turn's KV cells are gone:
+        // undo the turn as cancelGeneration() does (submit() failing on this
+        // thread is rolled back below); queued before the signal, like adoptReply
+        // スケジューラスレッドからのエラーはターンのKVセルが破棄済みであることを示す。
+        // cancelGeneration()と同様にターンを取り消す (このスレッドでのsubmit()の
+        // 失敗は下で取り消す)。adoptReplyと同じくシグナルより先にキューに入れる
+        if (QThread::currentThread() != thread()) {
+            QMetaObject::invokeMethod(this, [this, session]() {
+                if (mSession && session == mSession) {
+                    mConversation.rollback();
+                }
+            }, Qt::QueuedConnection);
+        }
+        emit generationError(error);
+    };
+    callbacks.onCancelled = [this, stream, metrics, transport](const std::string &partialResponse) {
+        metrics->cancelledRequests[transport].fetch_add(1, std::memory_order_relaxed);
+        {
+            // The partial response below already contains the unsent text
+            // 未送出のテキストは以下の途中結果に含まれる
+            std::lock_guard<std::mutex> lock(stream->mutex);
+            stream->pendingBytes.clear();
+            stream->pendingTokens = 0;
+        }
+        emit generationCancelled(QString::fromStdString(partialResponse));
+    };
+    callbacks.onQueued = [this](int position) {
+        emit requestQueued(position);
+    };
+    callbacks.onRejected = [this, metrics, transport](const QString &reason) {
+        metrics->rejectedRequests[transport].fetch_add(1, std::memory_order_relaxed);
+        emit requestRejected(reason);
+    };
+
+    // Emitted before submit(), so it is queued ahead of the first piece
+    // submit()より前にemitし、最初の断片より先にキューに入るようにする
+    emit generationStarted(mode);
+
+    // Committed first, so a synchronous failure below can roll it back
+    // 下で即座に失敗した場合に取り消せるよう、先に確定させる
+    mConversation.commit(turn);
+    if (!scheduler->submit(mSession, std::move(turn.tokens),
+                           std::move(callbacks), mClientKey,
+                           std::move(params))) {
+        mConversation.rollback();
     }
+}
 
-    // Update mPrevLen for next usage
-    mPrevLen = llama_chat_apply_template(
-        mModel,
-        nullptr,
-        messagesForLlama.data(),
-        messagesForLlama.size(),
-        /*force_system=*/false,
-        /*dst=*/nullptr,
-        /*dst_size=*/0
-        );
-    if (mPrevLen < 0) {
-        fprintf(stderr, "Failed to apply chat template.\n");
-        mPrevLen = 0;  // fallback
+/*
+  adoptReply(session, reply, replyTokens, promptTokens):
+    - Runs before any request sent in response to the reply; a session
+      released in the meantime (diverged history, model switch) is skipped
+*/
+void InferenceEngine::adoptReply(DecodeScheduler::SessionId session, const QString &reply,
+                                 const std::vector<llama_token> &replyTokens, int promptTokens)
+{
+    const std::shared_ptr<DecodeScheduler> scheduler = mScheduler.lock();
+    if (!scheduler || !mSession || session != mSession) {
+        return;
     }
+    size_t dropTokens = 0;
+    if (mConversation.commitReply(reply, replyTokens, &dropTokens)) {
+        scheduler->rewind(mSession, static_cast<int>(dropTokens));
+        return;
+    }
+    qDebug() << "[InferenceEngine] Reply not reproduced by the chat template; re-templating the turn";
+    mConversation.rollback();
+    scheduler->rewind(mSession, static_cast<int>(replyTokens.size()) + promptTokens);
+}
 
-    // Emit final result
-    emit generationFinished(QString::fromStdString(response));
+/*
+  cancelGeneration():
+    - The scheduler rolls the KV state back to the start of the turn, so the
+      template offset is rolled back as well
+*/
+void InferenceEngine::cancelGeneration()
+{
+    const std::shared_ptr<DecodeScheduler> scheduler = mScheduler.lock();
+    if (!scheduler || !mSession) {
+        return;
+    }
+    if (scheduler->cancel(mSession)) {
+        mConversation.rollback();
+    }
 }
 
 /*
@@ -222,75 +466,290 @@ bool InferenceEngine::remoteInitialized() const
 */
 void InferenceEngine::setRemoteInitialized(bool newRemoteInitialized)
 {
-    if (mRemoteInitialized == newRemoteInitialized)
+    if (mRemoteInitialized.exchange(newRemoteInitialized) == newRemoteInitialized)
         return;
-    mRemoteInitialized = newRemoteInitialized;
-    emit remoteInitializedChanged(mRemoteInitialized);
+    emit remoteInitializedChanged(newRemoteInitialized);
+}
+
+/*
+  readiness() / setReadiness(stage, timings):
+    - Emitted on every call: the timings change even when the stage does not
+*/
+InferenceEngine::Readiness InferenceEngine::readiness() const
+{
+    return mReadiness.load();
+}
+
+void InferenceEngine::setReadiness(Readiness stage, const ReadinessTimings &timings)
+{
+    mReadiness.store(stage);
+    emit readinessChanged(stage, timings);
+}
+
+/*
+  setStreamingMode(mode) / streamingMode():
+    - Atomic, since owners call it from their own thread
+*/
+void InferenceEngine::setStreamingMode(StreamingMode mode)
+{
+    mStreamingMode.store(mode);
+}
+
+InferenceEngine::StreamingMode InferenceEngine::streamingMode() const
+{
+    return mStreamingMode.load();
 }
 
 /*
-  to_llama_messages(userMessages):
-    - Converts QList<LlamaChatMessage> to std::vector<llama_chat_message>
+  setFlushPolicy(intervalMs, maxTokens, atNewline):
+    - Copied into each new generation, so a running one keeps its policy
 */
-std::vector<llama_chat_message>
-InferenceEngine::to_llama_messages(const QList<LlamaChatMessage> &userMessages)
+void InferenceEngine::setFlushPolicy(int intervalMs, int maxTokens, bool atNewline)
 {
-    std::vector<llama_chat_message> llamaMessages;
-    llamaMessages.reserve(userMessages.size());
+    mFlushPolicy = flushPolicy(intervalMs, maxTokens, atNewline);
+}
+
+InferenceEngine::FlushPolicy InferenceEngine::flushPolicy(int intervalMs, int maxTokens, bool atNewline)
+{
+    const ServerConfig &config = ServerConfig::instance();
+    FlushPolicy policy;
+    policy.intervalMs = (intervalMs >= 0) ? intervalMs : config.streamFlushIntervalMs;
+    policy.maxTokens  = std::max((maxTokens >= 0) ? maxTokens : config.streamFlushTokens, 1);
+    policy.atNewline  = atNewline;
+    return policy;
+}
 
-    for (const auto &um : userMessages) {
-        llama_chat_message lm;
-        lm.role    = strdup(um.role().toUtf8().constData());
-        lm.content = strdup(um.content().toUtf8().constData());
-        llamaMessages.push_back(lm);
+/*
+  streamPiece(stream, piece):
+    - Coalesces one piece under the flush policy and emits when it is due
+*/
+void InferenceEngine::streamPiece(StreamState &stream, const std::string &piece)
+{
+    stream.response += piece;
+    stream.pendingBytes += piece;
+    const Clock::time_point now = Clock::now();
+    if (stream.pendingTokens++ == 0) {
+        stream.pendingSince = now;
+    }
+
+    // Flush on whichever limit is reached first
+    // いずれかの上限に最初に達した時点で送出
+    const FlushPolicy &policy = stream.policy;
+    const bool due = stream.pendingTokens >= policy.maxTokens
+                     || (policy.atNewline && piece.find('\n') != std::string::npos)
+                     || (policy.intervalMs > 0
+                         && now - stream.pendingSince >= std::chrono::milliseconds(policy.intervalMs));
+    if (due) {
+        flushStream(stream, /*final=*/false);
+    } else if (stream.pendingTokens == 1 && policy.intervalMs > 0) {
+        // Nothing may follow for a while: let the engine thread flush on time
+        // しばらく後続が無い場合に備え、エンジンスレッドで時間切れ時に送出
+        QMetaObject::invokeMethod(this, [this, interval = policy.intervalMs]() {
+            if (!mFlushTimer->isActive()) {
+                mFlushTimer->start(interval);
+            }
+        }, Qt::QueuedConnection);
     }
-    return llamaMessages;
 }
 
 /*
-  do_engine_init():
-    - Loads the model and context in a background thread
-    - Initializes the sampler
-    - Sets remoteInitialized(true) on success
+  replayCached(entry, promptTokens, stream):
+    - Feeds the cached pieces through streamPiece() in one go, so the frames
+      follow the client's streaming mode and flush policy like a decoded
+      reply; the interval limit never fires, the pieces arrive together
+    - Stats report the prompt as reused and no decode time
 */
-void InferenceEngine::do_engine_init()
+void InferenceEngine::replayCached(const ResponseCache::Entry &entry, int promptTokens,
+                                   const std::shared_ptr<StreamState> &stream)
 {
-    ggml_backend_load_all();
+    mStream = stream;
 
-    mModelParams = llama_model_default_params();
-    mModelParams.n_gpu_layers = mNGl;
+    int frames = 0;
+    std::string response;
+    {
+        std::lock_guard<std::mutex> lock(stream->mutex);
+        for (const std::string &piece : entry.pieces) {
+            streamPiece(*stream, piece);
+        }
+        flushStream(*stream, /*final=*/true);
+        frames   = stream->frames;
+        response = stream->response;
+    }
 
-    mModel = llama_load_model_from_file(mModelPath.c_str(), mModelParams);
-    if (!mModel) {
-        fprintf(stderr, "Error: unable to load model.\n");
+    const int generatedTokens = static_cast<int>(entry.pieces.size());
+    GenerationStats stats;
+    stats.setPromptTokens(promptTokens);
+    stats.setReusedPromptTokens(promptTokens);
+    stats.setGeneratedTokens(generatedTokens);
+    stats.setStreamedFrames(frames);
+    stats.setFramesPerToken(generatedTokens > 0 ? static_cast<double>(frames) / generatedTokens : 0.0);
+    emit generationStats(stats);
+    emit generationFinished(QString::fromStdString(response));
+}
+
+/*
+  flushStream(stream, final):
+    - Emits the pending text in the stream's mode (stream locked)
+    - Delta modes emit complete UTF-8 characters only, unless final
+*/
+void InferenceEngine::flushStream(StreamState &stream, bool final)
+{
+    if (stream.pendingTokens == 0 && stream.pendingBytes.empty()) {
         return;
     }
+    stream.pendingTokens = 0;
 
-    mCtxParams = llama_context_default_params();
-    mCtxParams.n_ctx   = mNCtx;
-    mCtxParams.n_batch = mNCtx;
+    switch (stream.mode) {
+    case StreamingMode::FullText:
+        stream.pendingBytes.clear();
+        emit partialResponseReady(QString::fromStdString(stream.response));
+        ++stream.frames;
+        return;
+    case StreamingMode::Delta:
+    case StreamingMode::Utf8Bytes:
+        break;
+    }
 
-    mCtx = llama_new_context_with_model(mModel, mCtxParams);
-    if (!mCtx) {
-        fprintf(stderr, "Error: failed to create llama_context.\n");
+    // Keep a split UTF-8 tail for the next piece
+    // 分割されたUTF-8の末尾は次のピースまで保持
+    const size_t ready = final ? stream.pendingBytes.size() : completeUtf8Length(stream.pendingBytes);
+    if (ready == 0) {
         return;
     }
+    if (stream.mode == StreamingMode::Utf8Bytes) {
+        emit partialBytesReady(QByteArray(stream.pendingBytes.data(), static_cast<qsizetype>(ready)),
+                               stream.sequence++, stream.byteOffset);
+        stream.byteOffset += static_cast<int>(ready);
+    } else {
+        const QString text = QString::fromUtf8(stream.pendingBytes.data(), static_cast<qsizetype>(ready));
+        emit partialDeltaReady(text, stream.sequence++, stream.offset);
+        stream.offset += text.size();
+    }
+    stream.pendingBytes.erase(0, ready);
+    ++stream.frames;
+}
 
-    // Initialize sampler
-    mSampler = llama_sampler_chain_init(llama_sampler_chain_default_params());
-    llama_sampler_chain_add(mSampler, llama_sampler_init_min_p(0.05f, 1));
-    llama_sampler_chain_add(mSampler, llama_sampler_init_temp(0.8f));
-    llama_sampler_chain_add(mSampler, llama_sampler_init_dist(LLAMA_DEFAULT_SEED));
+/*
+  flushDueStream():
+    - Flush timer on the engine thread; re-arms itself if the pending text
+      is younger than the interval (the timer may belong to an older window)
+*/
+void InferenceEngine::flushDueStream()
+{
+    const std::shared_ptr<StreamState> stream = mStream;
+    if (!stream) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(stream->mutex);
+    if (stream->pendingTokens == 0) {
+        return;
+    }
+    const auto interval = std::chrono::milliseconds(stream->policy.intervalMs);
+    const auto age = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - stream->pendingSince);
+    if (age < interval) {
+        mFlushTimer->start(interval - age);
+        return;
+    }
+    flushStream(*stream, /*final=*/false);
+}
+
+/*
+  setTransport(transport):
+    - Only labels metrics; set before start() so sessions are counted right
+*/
+void InferenceEngine::setTransport(Metrics::Transport transport)
+{
+    mTransport = transport;
+}
+
+/*
+  setClientKey(key):
+    - Passed along with every submitted request
+*/
+void InferenceEngine::setClientKey(const QString &key)
+{
+    mClientKey = key;
+}
+
+/*
+  bindModel(name, errorMessage, onLoaded):
+    - Gets the model's scheduler from ModelRegistry (loading it if needed)
+    - A different model, or the same one evicted and loaded again, means a
+      new session: the conversation is templated from the start again
+*/
+std::shared_ptr<DecodeScheduler> InferenceEngine::bindModel(const QString &name, QString *errorMessage,
+                                                            const std::function<void()> &onLoaded)
+{
+    std::shared_ptr<DecodeScheduler> scheduler = ModelRegistry::instance().scheduler(name, errorMessage, onLoaded);
+    if (!scheduler) {
+        return nullptr;
+    }
+    if (scheduler != mScheduler.lock() || !mSession) {
+        releaseSession();
+        mScheduler  = scheduler;
+        mModelName  = scheduler->modelName();
+        mSession    = scheduler->openSession();
+        Metrics::instance().activeSessions[Metrics::index(mTransport)].fetch_add(1, std::memory_order_relaxed);
+        mConversation.reset(scheduler->model().get());
+        qDebug() << "[InferenceEngine] Using model" << mModelName;
+    }
+    return scheduler;
+}
+
+/*
+  releaseSession():
+    - Nothing to close if the model has been evicted meanwhile
+*/
+void InferenceEngine::releaseSession()
+{
+    if (mSession) {
+        if (const std::shared_ptr<DecodeScheduler> scheduler = mScheduler.lock()) {
+            scheduler->closeSession(mSession);
+        }
+        Metrics::instance().activeSessions[Metrics::index(mTransport)].fetch_sub(1, std::memory_order_relaxed);
+        mSession = 0;
+    }
+    mScheduler.reset();
+}
+
+/*
+  do_engine_init():
+    - Binds the current model (the default one at first), loading it on first use
+    - Opens this engine's decode session
+    - Loading lasts until the weights are in memory, Warming until the
+      scheduler's warm-up decode has run; only then is remoteInitialized set
+*/
+void InferenceEngine::do_engine_init()
+{
+    QElapsedTimer timer;
+    timer.start();
+    ReadinessTimings timings;
+    setReadiness(Readiness::Loading, timings);
+
+    QString error;
+    const bool bound = bindModel(mModelName, &error, [this, &timer, &timings]() {
+        timings.setLoadMs(timer.nsecsElapsed() / 1e6);
+        setReadiness(Readiness::Warming, timings);
+    }) != nullptr;
+    if (!bound) {
+        qWarning() << "[InferenceEngine]" << error;
+        setReadiness(Readiness::Failed, timings);
+        return;
+    }
+    if (timings.loadMs() > 0) {
+        timings.setWarmupMs(timer.nsecsElapsed() / 1e6 - timings.loadMs());
+    }
 
     // Indicate successful init
     setRemoteInitialized(true);
+    setReadiness(Readiness::Ready, timings);
     qDebug() << "Engine initialization complete.";
-    qDebug() << "m_remoteInitialized =" << remoteInitialized();
+    qDebug() << "m_remoteInitialized =" << remoteInitialized() << "on" << QThread::currentThread();
 }
 
 /*
   reinitEngine():
-    - Frees existing model/context/sampler
+    - Closes the decode session (the conversation's KV state is dropped)
     - Resets remoteInitialized(false)
     - Calls do_engine_init() again
 */
@@ -298,21 +757,9 @@ void InferenceEngine::reinitEngine()
 {
     qDebug() << "[reinitEngine] Re-initializing LLaMA engine...";
 
-    // 1) Free existing sampler / ctx / model
-    if (mSampler) {
-        llama_sampler_free(mSampler);
-        mSampler = nullptr;
-    }
-
-    if (mCtx) {
-        llama_free(mCtx);
-        mCtx = nullptr;
-    }
-
-    if (mModel) {
-        llama_free_model(mModel);
-        mModel = nullptr;
-    }
+    // 1) Close the session and forget the conversation prefix
+    releaseSession();
+    mConversation.reset(nullptr);
 
     // 2) Reset remoteInitialized to false
     setRemoteInitialized(false);
@@ -322,12 +769,3 @@ void InferenceEngine::reinitEngine()
 
     qDebug() << "[reinitEngine] Requested do_engine_init() again.";
 }
-
-// Default model path
-const std::string InferenceEngine::mModelPath {
-#ifdef LLAMA_MODEL_FILE
-    LLAMA_MODEL_FILE
-#else
-#error "LLAMA_MODEL_FILE is not defined. Please define it via target_compile_definitions() in CMake."
-#endif
-};
@@ -6,8 +6,17 @@
 
 #include "rep_LlamaResponseGenerator_source.h"  // Short definitions from .rep file / .repファイルからの定義
 #include "llama.h"
+#include "Conversation.h"
+#include "DecodeScheduler.h"
+#include "Metrics.h"
+#include "ResponseCache.h"
 #include <QObject>
 #include <QString>
+#include <QTimer>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
 
 /*
   InferenceEngine:
@@ -39,46 +48,180 @@ class InferenceEngine : public QObject
                                FINAL)
 
 public:
+    /*
+      StreamingMode:
+        - FullText: partialResponseReady(textSoFar) after every token (legacy)
+        - Delta: partialDeltaReady(piece, sequence, offset) with only the new text
+        - Utf8Bytes: partialBytesReady(bytes, sequence, byteOffset) with the new
+          text as raw UTF-8, never converted to QString (binary WebSocket frames)
+      StreamingMode:
+        - FullText: トークンごとにpartialResponseReady(これまでの全文)を送る (従来動作)
+        - Delta: partialDeltaReady(piece, sequence, offset)で新しい差分のみを送る
+        - Utf8Bytes: partialBytesReady(bytes, sequence, byteOffset)で新しい差分を
+          QStringに変換せず生のUTF-8のまま送る (WebSocketのバイナリフレーム用)
+    */
+    enum class StreamingMode {
+        FullText,
+        Delta,
+        Utf8Bytes
+    };
+    Q_ENUM(StreamingMode)
+
+    /*
+      Readiness:
+        - Loading: the model is being loaded (or the engine is reinitializing)
+        - Warming: weights are loaded, the warm-up decode is running
+        - Ready: requests run at full speed (remoteInitialized is true)
+        - Failed: the model could not be loaded
+      Readiness:
+        - Loading: モデルをロード中 (またはエンジンを再初期化中)
+        - Warming: 重みのロードが済み、ウォームアップのデコードを実行中
+        - Ready: リクエストを最大速度で処理できる (remoteInitializedがtrue)
+        - Failed: モデルをロードできなかった
+    */
+    enum class Readiness {
+        Loading,
+        Warming,
+        Ready,
+        Failed
+    };
+    Q_ENUM(Readiness)
+
+    /*
+      FlushPolicy:
+        - Partial responses are coalesced and emitted when intervalMs have
+          passed since the first unsent token, maxTokens are pending, or (with
+          atNewline) a token contains a newline, whichever comes first
+        - maxTokens 1 means one emit per token (immediate mode)
+      FlushPolicy:
+        - 部分レスポンスはまとめて送り、最初の未送出トークンからintervalMs経過、
+          未送出がmaxTokensに到達、(atNewlineなら) 改行を含むトークン、の
+          いずれか最初の条件で送出する
+        - maxTokensが1の場合はトークンごとに送出する (即時モード)
+    */
+    struct FlushPolicy
+    {
+        int intervalMs {25};
+        int maxTokens {8};
+        bool atNewline {true};
+    };
+
     /*
       Constructor:
-        - Accepts optional llama_model/llama_context pointers
-        - Starts async initialization in a background thread
+        - Has no parent (objects cannot be moved together with their parent);
+          owners must release it with deleteLater()
+        - The model itself is borrowed from ModelRegistry, not loaded per engine
       コンストラクタ:
-        - llama_model/llama_contextポインタを任意で受け取る
-        - バックグラウンドスレッドで非同期初期化を開始
+        - 親を持たない (親子をまとめて別スレッドへ移動できないため)。
+          所有者はdeleteLater()で解放すること
+        - モデル本体はエンジンごとにロードせず、ModelRegistryから借用する
     */
-    explicit InferenceEngine(QObject *parent = nullptr,
-                             llama_model *model = nullptr,
-                             llama_context *ctx = nullptr);
+    InferenceEngine();
+
+    /*
+      start():
+        - Moves the engine onto one of the EngineThreads and queues the
+          initialization there, so it never runs on the caller's thread
+        - Call once, after connecting to the engine's signals
+      start():
+        - エンジンをEngineThreadsのいずれかに移動し、初期化をそのスレッドに
+          キューイングする (呼び出し元スレッドでは実行しない)
+        - エンジンのシグナルを接続した後に一度だけ呼ぶこと
+    */
+    void start();
 
     /*
       Destructor:
-        - Frees the sampler if allocated
+        - Closes the decode session (frees its KV cells), releases the shared model
+        - Runs on the engine thread (via deleteLater())
       デストラクタ:
-        - サンプラーが確保されていれば解放する
+        - デコードセッションを閉じ(KVセルを解放)、共有モデルを手放す
+        - エンジンスレッド上で実行される (deleteLater()経由)
     */
     ~InferenceEngine() override;
 
+public slots:
     /*
       generate(...):
-        - Generates text based on the provided messages
-        - Emits partial and final responses during the process
+        - Templates and tokenizes the provided messages, then submits them
+          to the DecodeScheduler and returns without waiting
+        - modelName selects one of ServerConfig::models; empty keeps the
+          current model, switching starts the conversation's KV state over
+        - options sets max tokens, stop strings and sampling for this request;
+          fields left at 0 keep the server defaults
+        - Partial and final responses are emitted from the scheduler thread
+        - Runs on the engine thread; other threads invoke it queued
       generate(...):
-        - 与えられたメッセージに基づきテキストを生成
-        - 推論の途中/最終結果をシグナルで通知
+        - 与えられたメッセージにテンプレート適用とトークナイズを行い、
+          DecodeSchedulerに投入して完了を待たずに戻る
+        - modelNameでServerConfig::modelsのモデルを選択。空なら現在のモデルのまま。
+          切り替えると会話のKV状態は最初から作り直す
+        - optionsでこのリクエストの最大トークン数、停止文字列、サンプリングを指定。
+          0のままのフィールドはサーバー既定値を使う
+        - 推論の途中/最終結果はスケジューラスレッドからシグナルで通知
+        - エンジンスレッド上で実行する。他スレッドからはキュー経由で呼ぶこと
     */
-    void generate(const QList<LlamaChatMessage>& messages);
+    void generate(const QList<LlamaChatMessage>& messages, const QString &modelName = {},
+                  const GenerationOptions &options = {});
+
+    /*
+      generateStreamed(messages, modelName, options, mode, policy):
+        - generate() with the streaming mode and flush policy of this request
+          instead of the engine's (setStreamingMode / setFlushPolicy), for
+          owners that serve several clients through one engine
+      generateStreamed(messages, modelName, options, mode, policy):
+        - エンジンの設定 (setStreamingMode / setFlushPolicy) ではなく、この
+          リクエストのストリーミング方式と送出方針を使うgenerate()。1つの
+          エンジンで複数のクライアントに応答する所有者向け
+    */
+    void generateStreamed(const QList<LlamaChatMessage>& messages, const QString &modelName,
+                          const GenerationOptions &options, StreamingMode mode, const FlushPolicy &policy);
 
     /*
       reinitEngine():
         - Re-initializes the engine
-        - Frees existing model/context/sampler, then reruns do_engine_init()
+        - Closes the decode session (dropping the conversation's KV state),
+          then reruns do_engine_init()
       reinitEngine():
         - エンジンを再初期化
-        - 既存のモデル/コンテキスト/サンプラーを解放し、再度do_engine_init()を実行
+        - デコードセッションを閉じ(会話のKV状態を破棄)、再度do_engine_init()を実行
     */
     void reinitEngine();
 
+    /*
+      cancelGeneration():
+        - Stops the running generation of this engine, if any
+        - Emits generationCancelled with the text generated so far
+        - The cancelled turn is forgotten: the next generate() continues from
+          the conversation state before it
+      cancelGeneration():
+        - このエンジンで実行中の生成があれば停止
+        - それまでに生成したテキストと共にgenerationCancelledをemit
+        - 中止したターンは破棄され、次のgenerate()はその前の会話状態から続行
+    */
+    void cancelGeneration();
+
+    /*
+      setFlushPolicy(intervalMs, maxTokens, atNewline):
+        - Coalescing of partial responses from the next generation on
+        - Negative intervalMs / maxTokens keep the server defaults
+          (ServerConfig::streamFlush*); maxTokens 1 streams every token
+      setFlushPolicy(intervalMs, maxTokens, atNewline):
+        - 次の生成からの部分レスポンスのまとめ方を設定
+        - intervalMs / maxTokensが負の場合はサーバー既定値
+          (ServerConfig::streamFlush*)。maxTokensが1ならトークンごとに送る
+    */
+    void setFlushPolicy(int intervalMs, int maxTokens, bool atNewline);
+
+public:
+    /*
+      flushPolicy(intervalMs, maxTokens, atNewline):
+        - Policy with negative values replaced by the server defaults
+      flushPolicy(intervalMs, maxTokens, atNewline):
+        - 負の値をサーバー既定値に置き換えた送出方針
+    */
+    static FlushPolicy flushPolicy(int intervalMs, int maxTokens, bool atNewline);
+
     /*
       remoteInitialized():
         - Getter for mRemoteInitialized property
@@ -97,6 +240,45 @@ public:
     */
     void setRemoteInitialized(bool newRemoteInitialized);
 
+    /*
+      readiness():
+        - Current initialization stage (see Readiness)
+      readiness():
+        - 現在の初期化段階 (Readinessを参照)
+    */
+    Readiness readiness() const;
+
+    /*
+      setStreamingMode(mode):
+        - Selects how partial responses are emitted; takes effect from the
+          next generation (a running one keeps its mode), default is FullText
+      setStreamingMode(mode):
+        - 部分レスポンスの送り方を選択。次の生成から有効 (実行中の生成は
+          その方式のまま)。既定はFullText
+    */
+    void setStreamingMode(StreamingMode mode);
+    StreamingMode streamingMode() const;
+
+    /*
+      setClientKey(key):
+        - Identifies the client for the per-client concurrency limit
+        - Empty (the default) means the engine is not limited per client
+      setClientKey(key):
+        - クライアントごとの同時実行数制限に使うクライアント識別子
+        - 空 (既定) の場合はクライアント単位の制限を受けない
+    */
+    void setClientKey(const QString &key);
+
+    /*
+      setTransport(transport):
+        - Front end this engine serves, used as the metrics label
+        - Call before start(); the default is QtRemoteObjects
+      setTransport(transport):
+        - このエンジンが担当する経路。メトリクスのラベルに使う
+        - start()の前に呼ぶこと。既定はQtRemoteObjects
+    */
+    void setTransport(Metrics::Transport transport);
+
 signals:
     /*
       reinitialized():
@@ -114,6 +296,38 @@ signals:
     */
     void partialResponseReady(const QString &response);
 
+    /*
+      partialDeltaReady(delta, sequence, offset):
+        - Emitted in Delta mode with only the newly generated text
+        - sequence starts at 0 per generation and increases by one per emit
+        - offset is the UTF-16 position of delta within the full response
+      partialDeltaReady(delta, sequence, offset):
+        - Deltaモードで、新たに生成されたテキストのみをemit
+        - sequenceは生成ごとに0から始まり、emitのたびに1ずつ増える
+        - offsetは全文中でのdeltaの開始位置 (UTF-16単位)
+    */
+    void partialDeltaReady(const QString &delta, int sequence, int offset);
+
+    /*
+      partialBytesReady(bytes, sequence, byteOffset):
+        - Emitted in Utf8Bytes mode with the new text as UTF-8 (complete
+          characters only); byteOffset is its position in the full response
+      partialBytesReady(bytes, sequence, byteOffset):
+        - Utf8Bytesモードで、新しいテキストをUTF-8 (完全な文字のみ) でemit。
+          byteOffsetは全文中での開始位置 (バイト単位)
+    */
+    void partialBytesReady(const QByteArray &bytes, int sequence, int byteOffset);
+
+    /*
+      generationStarted(mode):
+        - Emitted when a request is accepted, before any of its partial
+          responses, with the streaming mode the whole generation uses
+      generationStarted(mode):
+        - リクエストを受け付けたときに、その部分レスポンスより先にemit。
+          生成全体で使うストリーミング方式を伴う
+    */
+    void generationStarted(InferenceEngine::StreamingMode mode);
+
     /*
       generationFinished(response):
         - Emitted with final text when generation completes
@@ -122,6 +336,18 @@ signals:
     */
     void generationFinished(const QString &response);
 
+    /*
+      generationStats(stats):
+        - Emitted right before generationFinished with the request's prefill
+          throughput, latencies, the stall caused by other prompts and the
+          partial-response frames emitted per generated token
+      generationStats(stats):
+        - generationFinishedの直前に、リクエストのプリフィル速度、レイテンシ、
+          他のプロンプトにより生じた待ち時間、生成トークンあたりの部分レスポンス
+          送出回数をemit
+    */
+    void generationStats(const GenerationStats &stats);
+
     /*
       generationError(error):
         - Emitted if an error occurs during generation
@@ -130,6 +356,30 @@ signals:
     */
     void generationError(const QString &error);
 
+    /*
+      generationCancelled(partialResponse):
+        - Emitted when cancelGeneration() stopped a generation
+      generationCancelled(partialResponse):
+        - cancelGeneration()で生成が停止されたときにemit
+    */
+    void generationCancelled(const QString &partialResponse);
+
+    /*
+      requestQueued(position):
+        - Emitted while the request waits for a decode slot (1 = next)
+      requestQueued(position):
+        - リクエストがデコード枠を待っている間にemit (1 = 次に開始)
+    */
+    void requestQueued(int position);
+
+    /*
+      requestRejected(reason):
+        - Emitted if the server is overloaded and did not accept the request
+      requestRejected(reason):
+        - サーバーが過負荷でリクエストを受け付けなかった場合にemit
+    */
+    void requestRejected(const QString &reason);
+
     /*
       remoteInitializedChanged(newRemoteInitialized):
         - Emitted when the remoteInitialized property changes
@@ -138,51 +388,148 @@ signals:
     */
     void remoteInitializedChanged(bool newRemoteInitialized);
 
+    /*
+      readinessChanged(stage, timings):
+        - Emitted on every stage of do_engine_init(); timings holds the load
+          and warm-up durations measured so far (0 if the model was already
+          loaded by another engine)
+      readinessChanged(stage, timings):
+        - do_engine_init()の各段階でemit。timingsはそれまでに計測したロードと
+          ウォームアップの所要時間 (他のエンジンがロード済みの場合は0)
+    */
+    void readinessChanged(InferenceEngine::Readiness stage, const ReadinessTimings &timings);
+
 private:
-    // Internal parameters
-    // 内部パラメータ
-    static constexpr int mNGl  {99};
-    static constexpr int mNCtx {2048};
+    using Clock = std::chrono::steady_clock;
+    struct StreamState;
+
+    /*
+      flushStream(stream, final):
+        - Emits the coalesced text of a generation (stream's mutex held)
+        - final also emits a trailing incomplete UTF-8 sequence
+      flushStream(stream, final):
+        - 生成中にまとめたテキストをemit (streamのmutexを保持中)
+        - finalの場合は末尾の不完全なUTF-8も送る
+    */
+    void flushStream(StreamState &stream, bool final);
 
-    // Default model path (via CMake)
-    // デフォルトのモデルパス (CMakeで定義)
-    static const std::string mModelPath;
+    /*
+      streamPiece(stream, piece):
+        - Appends a generated piece and flushes per the policy (stream's
+          mutex held)
+      streamPiece(stream, piece):
+        - 生成したピースを追加し、方針に従って送出する (streamのmutexを保持中)
+    */
+    void streamPiece(StreamState &stream, const std::string &piece);
 
-    // Holds llama params/context/model/sampler
-    // llama 用パラメータ／コンテキスト／モデル／サンプラーを保持
-    llama_model_params mModelParams;
-    llama_sampler*     mSampler    {nullptr};
-    llama_model*       mModel      {nullptr};
-    llama_context_params mCtxParams;
-    llama_context*       mCtx      {nullptr};
+    /*
+      replayCached(entry, promptTokens, stream):
+        - Emits a response cache hit as partial responses, stats and
+          generationFinished, exactly like a decoded reply
+      replayCached(entry, promptTokens, stream):
+        - 応答キャッシュのヒットを、デコードした応答と同じく部分レスポンス、
+          統計、generationFinishedとしてemitする
+    */
+    void replayCached(const ResponseCache::Entry &entry, int promptTokens,
+                      const std::shared_ptr<StreamState> &stream);
 
-    bool mRemoteInitialized {false};
+    /*
+      adoptReply(session, reply, replyTokens, promptTokens):
+        - Hands a finished reply to the conversation, whose tokens stay in
+          the KV cache; if the conversation cannot adopt it, the turn and its
+          reply are rewound so the next request templates them again
+      adoptReply(session, reply, replyTokens, promptTokens):
+        - 完了した応答を会話に引き継ぐ (トークンはKVキャッシュに残す)。
+          引き継げない場合はターンと応答を巻き戻し、次のリクエストで
+          改めてテンプレートを適用する
+    */
+    void adoptReply(DecodeScheduler::SessionId session, const QString &reply,
+                    const std::vector<llama_token> &replyTokens, int promptTokens);
+
+    /*
+      flushDueStream():
+        - Flush timer handler for text no further token arrived for
+      flushDueStream():
+        - 後続のトークンが来ないテキストを送出するタイマー処理
+    */
+    void flushDueStream();
+
+    // Flush policy for new generations, the current generation's stream
+    // and its flush timer (engine thread)
+    // 新しい生成の送出方針、現在の生成のストリームとその送出タイマー (エンジンスレッド)
+    FlushPolicy mFlushPolicy;
+    std::shared_ptr<StreamState> mStream;
+    QTimer *mFlushTimer {nullptr};
+
+    // The KV cache lives in one sequence of the model's DecodeScheduler;
+    // only a weak reference is kept so idle models can be evicted
+    // KVキャッシュはモデルのDecodeScheduler内の1シーケンスに置かれる。
+    // アイドルのモデルを破棄できるよう、弱参照のみを保持する
+    std::weak_ptr<DecodeScheduler> mScheduler;
+    QString mModelName;
+    DecodeScheduler::SessionId mSession {0};
+
+    // Written on the engine thread, read by owners on other threads
+    // エンジンスレッドで書き込み、他スレッドの所有者が読む
+    std::atomic<bool> mRemoteInitialized {false};
+    std::atomic<Readiness> mReadiness {Readiness::Loading};
+
+    /*
+      setReadiness(stage, timings):
+        - Updates mReadiness and emits readinessChanged
+      setReadiness(stage, timings):
+        - mReadinessを更新し、readinessChangedをemit
+    */
+    void setReadiness(Readiness stage, const ReadinessTimings &timings);
+
+    // Read on the engine thread when a generation starts, written from the owner's thread
+    // 生成の開始時にエンジンスレッドで読み、所有者のスレッドから書き込む
+    std::atomic<StreamingMode> mStreamingMode {StreamingMode::FullText};
+
+    // Set by the owner before the first queued generate()
+    // 最初のgenerate()をキューイングする前に所有者が設定する
+    QString mClientKey;
+    Metrics::Transport mTransport {Metrics::Transport::QtRemoteObjects};
 
     /*
       do_engine_init():
-        - Heavy initialization (model/context creation)
-        - Runs in a background thread
+        - Heavy initialization (shared scheduler/model on first use)
+        - Opens this engine's decode session
+        - Reports Loading, Warming and Ready (or Failed) through readinessChanged
+        - Runs on the engine thread
       do_engine_init():
-        - モデル/コンテキストをロードする重い初期化処理
-        - バックグラウンドスレッドで実行
+        - 重い初期化処理 (初回は共有スケジューラ/モデルを作成)
+        - このエンジン用のデコードセッションを開く
+        - Loading、Warming、Ready (またはFailed) をreadinessChangedで通知
+        - エンジンスレッド上で実行
     */
     void do_engine_init();
 
     /*
-      to_llama_messages(userMessages):
-        - Converts QList<LlamaChatMessage> into std::vector<llama_chat_message>
-      to_llama_messages(userMessages):
-        - QList<LlamaChatMessage>をstd::vector<llama_chat_message>に変換
+      bindModel(name, errorMessage, onLoaded):
+        - Returns the scheduler of the named model with this engine's session
+          open on it (empty name = default model)
+        - onLoaded: see ModelRegistry::scheduler()
+      bindModel(name, errorMessage, onLoaded):
+        - 名前付きモデル (空 = 既定) のスケジューラを返し、このエンジンの
+          セッションがそこで開かれた状態にする
+    */
+    std::shared_ptr<DecodeScheduler> bindModel(const QString &name, QString *errorMessage,
+                                               const std::function<void()> &onLoaded = {});
+
+    /*
+      releaseSession():
+        - Closes the decode session on the current scheduler, if still loaded
+      releaseSession():
+        - 現在のスケジューラがロード済みであれば、デコードセッションを閉じる
     */
-    std::vector<llama_chat_message> to_llama_messages(const QList<LlamaChatMessage> &userMessages);
+    void releaseSession();
 
-    // ======================
-    // Remove "static" usage
-    // ======================
-    // For each InferenceEngine instance, maintain its own buffer
-    // → これでスレッドセーフに（複数エンジンが同時生成しても競合しない）
-    std::vector<char> mFormattedBuffer;
-    int mPrevLen = 0;
+    // Templated text and prompt tokens of the current session; each turn
+    // only processes the messages added since the previous one
+    // 現在のセッションのテンプレート適用済みテキストとプロンプトトークン。
+    // 各ターンでは前回以降に追加されたメッセージのみを処理する
+    Conversation mConversation;
 };
 
 #endif // INFERENCEENGINE_H
@@ -0,0 +1,170 @@
+// ================================================================
+// KvSpillStore.cpp
+// ================================================================
+#include "KvSpillStore.h"
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QStandardPaths>
+#include <atomic>
+#include <mutex>
+
+#ifdef Q_OS_UNIX
+#include <cerrno>
+#include <csignal>
+#endif
+
+namespace {
+// Stores of one process (one per loaded model) get numbered subdirectories
+// 1プロセス内のストア (ロード済みモデルごとに1つ) には連番のサブディレクトリを使う
+std::atomic<int> nextStoreIndex {0};
+
+/*
+  processRunning(pid):
+    - Signal 0 only checks for existence; EPERM means it runs as another user
+  processRunning(pid):
+    - シグナル0は存在確認のみ。EPERMは別ユーザーで動作していることを示す
+*/
+bool processRunning(qint64 pid)
+{
+#ifdef Q_OS_UNIX
+    return ::kill(static_cast<pid_t>(pid), 0) == 0 || errno == EPERM;
+#else
+    Q_UNUSED(pid)
+    return true;
+#endif
+}
+} // namespace
+
+/*
+  Constructor:
+    - Creates the spill directory; files are keyed by session id, so a
+      per-process subdirectory avoids clashes between server instances, and
+      a per-store one lets a model's store be removed without touching the
+      files of other models
+*/
+KvSpillStore::KvSpillStore(const QString &directory)
+{
+    QString baseDirectory = directory;
+    if (baseDirectory.isEmpty()) {
+        baseDirectory = QDir(QStandardPaths::writableLocation(QStandardPaths::TempLocation))
+                            .filePath(QStringLiteral("LLMRemoteServer-kv"));
+    }
+
+    static std::once_flag pruned;
+    std::call_once(pruned, [&baseDirectory]() { pruneStaleDirectories(baseDirectory); });
+
+    mProcessDirectory = QDir(baseDirectory).filePath(QString::number(QCoreApplication::applicationPid()));
+    mDirectory        = QDir(mProcessDirectory).filePath(QString::number(nextStoreIndex++));
+    if (!QDir().mkpath(mDirectory)) {
+        qWarning() << "[KvSpillStore] Cannot create spill directory" << mDirectory;
+    }
+}
+
+/*
+  Destructor:
+    - The process directory goes as well once its last store is gone
+      (rmdir fails while other stores still have theirs)
+*/
+KvSpillStore::~KvSpillStore()
+{
+    if (!QDir(mDirectory).removeRecursively()) {
+        qWarning() << "[KvSpillStore] Cannot remove spill directory" << mDirectory;
+    }
+    QDir().rmdir(mProcessDirectory);
+}
+
+/*
+  pruneStaleDirectories(baseDirectory):
+    - Only numeric names are process directories; anything else in a
+      user-configured directory is left alone
+*/
+void KvSpillStore::pruneStaleDirectories(const QString &baseDirectory)
+{
+    const qint64 ownPid = QCoreApplication::applicationPid();
+    const QDir base(baseDirectory);
+    for (const QString &name : base.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        bool isPid = false;
+        const qint64 pid = name.toLongLong(&isPid);
+        if (!isPid || pid <= 0 || pid == ownPid || processRunning(pid)) {
+            continue;
+        }
+        if (QDir(base.filePath(name)).removeRecursively()) {
+            qDebug() << "[KvSpillStore] Removed stale spill directory" << base.filePath(name);
+        }
+    }
+}
+
+/*
+  save(ctx, seqId, sessionId):
+    - Sizes the file first, then lets llama write directly into the mapping
+*/
+size_t KvSpillStore::save(llama_context *ctx, llama_seq_id seqId, quint64 sessionId)
+{
+    const size_t size = llama_state_seq_get_size(ctx, seqId);
+    if (size == 0) {
+        return 0;
+    }
+
+    QFile file(filePath(sessionId));
+    if (!file.open(QIODevice::ReadWrite | QIODevice::Truncate)
+        || !file.resize(static_cast<qint64>(size))) {
+        qWarning() << "[KvSpillStore] Cannot create" << file.fileName() << file.errorString();
+        return 0;
+    }
+
+    uchar *data = file.map(0, static_cast<qint64>(size));
+    if (!data) {
+        qWarning() << "[KvSpillStore] Cannot map" << file.fileName() << file.errorString();
+        file.remove();
+        return 0;
+    }
+
+    const size_t written = llama_state_seq_get_data(ctx, data, size, seqId);
+    file.unmap(data);
+    if (written != size) {
+        file.remove();
+        return 0;
+    }
+    return written;
+}
+
+/*
+  restore(ctx, seqId, sessionId):
+    - Reads straight from the mapping into the context
+*/
+bool KvSpillStore::restore(llama_context *ctx, llama_seq_id seqId, quint64 sessionId)
+{
+    QFile file(filePath(sessionId));
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "[KvSpillStore] Cannot open" << file.fileName() << file.errorString();
+        return false;
+    }
+
+    const qint64 size = file.size();
+    uchar *data = file.map(0, size);
+    if (!data) {
+        qWarning() << "[KvSpillStore] Cannot map" << file.fileName() << file.errorString();
+        return false;
+    }
+
+    const size_t read = llama_state_seq_set_data(ctx, data, static_cast<size_t>(size), seqId);
+    file.unmap(data);
+    file.remove();
+    return read != 0;
+}
+
+/*
+  remove(sessionId):
+    - Missing files are fine (session was never spilled)
+*/
+void KvSpillStore::remove(quint64 sessionId)
+{
+    QFile::remove(filePath(sessionId));
+}
+
+QString KvSpillStore::filePath(quint64 sessionId) const
+{
+    return QDir(mDirectory).filePath(QStringLiteral("session-%1.kv").arg(sessionId));
+}
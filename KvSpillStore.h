@@ -0,0 +1,93 @@
+// ================================================================
+// KvSpillStore.h
+// ================================================================
+#ifndef KVSPILLSTORE_H
+#define KVSPILLSTORE_H
+
+#include "llama.h"
+#include <QString>
+#include <QtGlobal>
+
+/*
+  KvSpillStore:
+    - Saves and restores the KV state of one sequence with the llama
+      state-seq APIs, one file per session in a spill directory
+    - Files are memory-mapped, so the state is copied straight between the
+      context and the page cache without an intermediate buffer
+    - Must be used from the thread that owns the llama_context
+    - Each store has its own directory below <spill directory>/<pid>, removed
+      with the store; directories left by processes that no longer run are
+      deleted when the first store of a process is created
+
+  KvSpillStoreクラス:
+    - llamaのstate-seq APIで1シーケンス分のKV状態を保存/復元し、
+      退避ディレクトリにセッションごとに1ファイルを置く
+    - ファイルはメモリマップするため、中間バッファを介さずに
+      コンテキストとページキャッシュの間で直接コピーされる
+    - llama_contextを所有するスレッドから使うこと
+    - ストアごとに<退避ディレクトリ>/<pid>配下の専用ディレクトリを持ち、
+      ストアと共に削除する。既に動いていないプロセスが残したディレクトリは、
+      プロセスで最初のストアを作成する時に削除する
+*/
+class KvSpillStore
+{
+public:
+    /*
+      Constructor:
+        - Empty directory means a subdirectory of the system temp location
+      コンストラクタ:
+        - ディレクトリが空の場合はシステムの一時ディレクトリ配下を使う
+    */
+    explicit KvSpillStore(const QString &directory = {});
+
+    /*
+      Destructor:
+        - Deletes the store's directory with every state still in it
+      デストラクタ:
+        - ストアのディレクトリを、残っている状態ごと削除
+    */
+    ~KvSpillStore();
+
+    KvSpillStore(const KvSpillStore &) = delete;
+    KvSpillStore &operator=(const KvSpillStore &) = delete;
+
+    /*
+      save(ctx, seqId, sessionId):
+        - Writes the sequence state; returns the number of bytes or 0 on failure
+      save(ctx, seqId, sessionId):
+        - シーケンス状態を書き出し、書き込んだバイト数を返す (失敗時は0)
+    */
+    size_t save(llama_context *ctx, llama_seq_id seqId, quint64 sessionId);
+
+    /*
+      restore(ctx, seqId, sessionId):
+        - Loads a saved state into seqId (which must be empty) and deletes the file
+      restore(ctx, seqId, sessionId):
+        - 保存済みの状態をseqId (空であること) に読み込み、ファイルを削除
+    */
+    bool restore(llama_context *ctx, llama_seq_id seqId, quint64 sessionId);
+
+    /*
+      remove(sessionId):
+        - Deletes a saved state that will not be restored
+      remove(sessionId):
+        - 復元しない保存済み状態を削除
+    */
+    void remove(quint64 sessionId);
+
+private:
+    QString filePath(quint64 sessionId) const;
+
+    /*
+      pruneStaleDirectories(baseDirectory):
+        - Removes <baseDirectory>/<pid> of processes that are gone
+      pruneStaleDirectories(baseDirectory):
+        - 終了したプロセスの<baseDirectory>/<pid>を削除
+    */
+    static void pruneStaleDirectories(const QString &baseDirectory);
+
+    QString mProcessDirectory;   // <spill directory>/<pid>
+    QString mDirectory;          // this store's subdirectory
+};
+
+#endif // KVSPILLSTORE_H
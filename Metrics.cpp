@@ -0,0 +1,245 @@
+// ================================================================
+// Metrics.cpp
+// ================================================================
+#include "Metrics.h"
+
+namespace {
+
+const char *const transportLabels[] = {"qtro", "ws"};
+
+void appendHeader(QByteArray &out, const char *name, const char *help, const char *type)
+{
+    out += "# HELP ";
+    out += name;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
+
+void appendSample(QByteArray &out, const char *name, const QByteArray &labels, double value)
+{
+    out += name;
+    if (!labels.isEmpty()) {
+        out += '{';
+        out += labels;
+        out += '}';
+    }
+    out += ' ';
+    out += QByteArray::number(value, 'g', 12);
+    out += '\n';
+}
+
+void appendPerTransport(QByteArray &out, const char *name, const char *help, const char *type,
+                        const Metrics::PerTransport &values)
+{
+    appendHeader(out, name, help, type);
+    for (size_t i = 0; i < values.size(); ++i) {
+        appendSample(out, name, QByteArray("transport=\"") + transportLabels[i] + '"',
+                     static_cast<double>(values[i].load(std::memory_order_relaxed)));
+    }
+}
+
+void addRelaxed(std::atomic<double> &target, double value)
+{
+    double current = target.load(std::memory_order_relaxed);
+    while (!target.compare_exchange_weak(current, current + value, std::memory_order_relaxed)) {
+    }
+}
+
+} // namespace
+
+/*
+  Histogram:
+    - Buckets are counted individually and summed up when rendering, so an
+      observation touches one bucket only
+*/
+Metrics::Histogram::Histogram(std::vector<double> upperBounds)
+    : mUpperBounds(std::move(upperBounds))
+    , mBuckets(new std::atomic<quint64>[mUpperBounds.size() + 1])
+{
+    for (size_t i = 0; i <= mUpperBounds.size(); ++i) {
+        mBuckets[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void Metrics::Histogram::observe(double value)
+{
+    size_t bucket = 0;
+    while (bucket < mUpperBounds.size() && value > mUpperBounds[bucket]) {
+        ++bucket;
+    }
+    mBuckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    mCount.fetch_add(1, std::memory_order_relaxed);
+    addRelaxed(mSum, value);
+}
+
+void Metrics::Histogram::render(QByteArray &out, const char *name, const char *help) const
+{
+    appendHeader(out, name, help, "histogram");
+    const QByteArray bucketName = QByteArray(name) + "_bucket";
+    quint64 cumulative = 0;
+    for (size_t i = 0; i < mUpperBounds.size(); ++i) {
+        cumulative += mBuckets[i].load(std::memory_order_relaxed);
+        appendSample(out, bucketName.constData(),
+                     "le=\"" + QByteArray::number(mUpperBounds[i], 'g', 6) + '"',
+                     static_cast<double>(cumulative));
+    }
+    cumulative += mBuckets[mUpperBounds.size()].load(std::memory_order_relaxed);
+    appendSample(out, bucketName.constData(), "le=\"+Inf\"", static_cast<double>(cumulative));
+    appendSample(out, (QByteArray(name) + "_sum").constData(), {}, mSum.load(std::memory_order_relaxed));
+    appendSample(out, (QByteArray(name) + "_count").constData(), {},
+                 static_cast<double>(mCount.load(std::memory_order_relaxed)));
+}
+
+/*
+  Constructor:
+    - Bucket bounds cover small CPU models up to large GPU batches
+*/
+Metrics::Metrics()
+    : prefillTokensPerSecond({10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000})
+    , decodeTokensPerSecond({1, 2.5, 5, 10, 20, 30, 50, 75, 100, 200})
+    , timeToFirstToken({0.05, 0.1, 0.25, 0.5, 1, 2, 5, 10, 30, 60})
+    , interTokenLatency({0.005, 0.01, 0.02, 0.035, 0.05, 0.075, 0.1, 0.2, 0.5, 1})
+    , embeddingBatchInputs({1, 2, 4, 8, 16, 32, 64, 128})
+{
+}
+
+Metrics &Metrics::instance()
+{
+    static Metrics metrics;
+    return metrics;
+}
+
+/*
+  model(name):
+    - Entries are never removed, so callers may cache the reference
+*/
+Metrics::ModelGauges &Metrics::model(const QString &name)
+{
+    std::lock_guard<std::mutex> lock(mModelsMutex);
+    std::unique_ptr<ModelGauges> &gauges = mModels[name];
+    if (!gauges) {
+        gauges = std::make_unique<ModelGauges>();
+    }
+    return *gauges;
+}
+
+/*
+  loadSummary():
+    - Models that are not loaded report zero capacity, so they add nothing
+*/
+Metrics::LoadSummary Metrics::loadSummary() const
+{
+    LoadSummary summary;
+    for (const auto &sessions : activeSessions) {
+        summary.activeSessions += sessions.load(std::memory_order_relaxed);
+    }
+    std::lock_guard<std::mutex> lock(mModelsMutex);
+    for (const auto &entry : mModels) {
+        const ModelGauges &gauges = *entry.second;
+        if (!gauges.loaded.load(std::memory_order_relaxed)) {
+            continue;
+        }
+        summary.queueDepth      += gauges.queueDepth.load(std::memory_order_relaxed);
+        summary.runningRequests += gauges.runningRequests.load(std::memory_order_relaxed);
+        summary.freeKvCells     += gauges.kvCellsCapacity.load(std::memory_order_relaxed)
+                                   - gauges.kvCellsUsed.load(std::memory_order_relaxed);
+    }
+    return summary;
+}
+
+/*
+  render():
+    - Values are read one by one without a snapshot; Prometheus tolerates
+      the small skew between related series
+*/
+QByteArray Metrics::render() const
+{
+    QByteArray out;
+    out.reserve(8192);
+
+    appendPerTransport(out, "llm_requests_total", "Generation requests received.", "counter", requests);
+    appendPerTransport(out, "llm_generation_errors_total", "Generations that failed.", "counter", generationErrors);
+    appendPerTransport(out, "llm_requests_rejected_total", "Requests shed by admission control.", "counter", rejectedRequests);
+    appendPerTransport(out, "llm_requests_cancelled_total", "Generations cancelled by clients.", "counter", cancelledRequests);
+    appendPerTransport(out, "llm_active_sessions", "Open decode sessions.", "gauge", activeSessions);
+
+    appendHeader(out, "llm_prompt_tokens_total", "Prompt tokens submitted.", "counter");
+    appendSample(out, "llm_prompt_tokens_total", {}, static_cast<double>(promptTokens.load(std::memory_order_relaxed)));
+    appendHeader(out, "llm_reused_prompt_tokens_total", "Prompt tokens taken from the prefix cache.", "counter");
+    appendSample(out, "llm_reused_prompt_tokens_total", {}, static_cast<double>(reusedPromptTokens.load(std::memory_order_relaxed)));
+    appendHeader(out, "llm_generated_tokens_total", "Tokens generated.", "counter");
+    appendSample(out, "llm_generated_tokens_total", {}, static_cast<double>(generatedTokens.load(std::memory_order_relaxed)));
+
+    prefillTokensPerSecond.render(out, "llm_prefill_tokens_per_second", "Prefill throughput per request.");
+    decodeTokensPerSecond.render(out, "llm_decode_tokens_per_second", "Decode throughput per request.");
+    timeToFirstToken.render(out, "llm_time_to_first_token_seconds", "Submit to first generated token.");
+    interTokenLatency.render(out, "llm_inter_token_latency_seconds", "Gap between consecutive generated tokens.");
+
+    appendPerTransport(out, "llm_embedding_requests_total", "Embedding requests received.", "counter", embeddingRequests);
+    appendHeader(out, "llm_embedded_inputs_total", "Texts embedded.", "counter");
+    appendSample(out, "llm_embedded_inputs_total", {}, static_cast<double>(embeddedInputs.load(std::memory_order_relaxed)));
+    embeddingBatchInputs.render(out, "llm_embedding_batch_inputs", "Inputs packed into one embedding forward pass.");
+
+    const struct
+    {
+        const char *name;
+        const char *help;
+        const char *type;
+        const std::atomic<qint64> &value;
+    } responseCache[] = {
+        {"llm_response_cache_hits_total", "Generations replayed from the response cache.", "counter", responseCacheHits},
+        {"llm_response_cache_misses_total", "Cacheable generations not found in the response cache.", "counter", responseCacheMisses},
+        {"llm_response_cache_evictions_total", "Response cache entries evicted for space.", "counter", responseCacheEvictions},
+        {"llm_response_cache_bytes", "Memory held by the response cache.", "gauge", responseCacheBytes},
+        {"llm_response_cache_entries", "Replies held in the response cache.", "gauge", responseCacheEntries},
+    };
+    for (const auto &metric : responseCache) {
+        appendHeader(out, metric.name, metric.help, metric.type);
+        appendSample(out, metric.name, {}, static_cast<double>(metric.value.load(std::memory_order_relaxed)));
+    }
+
+    std::lock_guard<std::mutex> lock(mModelsMutex);
+    struct Gauge
+    {
+        const char *name;
+        const char *help;
+        const char *type;
+        double (*read)(const ModelGauges &);
+    };
+    const Gauge gauges[] = {
+        {"llm_model_loaded", "1 if the model is loaded.", "gauge",
+         [](const ModelGauges &g) { return static_cast<double>(g.loaded.load(std::memory_order_relaxed)); }},
+        {"llm_model_load_seconds", "Duration of the last load of the model.", "gauge",
+         [](const ModelGauges &g) { return g.loadSeconds.load(std::memory_order_relaxed); }},
+        {"llm_queue_depth", "Requests waiting for a decode sequence.", "gauge",
+         [](const ModelGauges &g) { return static_cast<double>(g.queueDepth.load(std::memory_order_relaxed)); }},
+        {"llm_running_requests", "Requests holding a decode sequence.", "gauge",
+         [](const ModelGauges &g) { return static_cast<double>(g.runningRequests.load(std::memory_order_relaxed)); }},
+        {"llm_kv_cells_used", "KV cache cells in use.", "gauge",
+         [](const ModelGauges &g) { return static_cast<double>(g.kvCellsUsed.load(std::memory_order_relaxed)); }},
+        {"llm_kv_cells_capacity", "KV cache cells of the context (n_ctx).", "gauge",
+         [](const ModelGauges &g) { return static_cast<double>(g.kvCellsCapacity.load(std::memory_order_relaxed)); }},
+        {"llm_prefix_cache_hits_total", "Prompts that reused a cached prefix.", "counter",
+         [](const ModelGauges &g) { return static_cast<double>(g.prefixCacheHits.load(std::memory_order_relaxed)); }},
+        {"llm_prefix_cache_misses_total", "Prompts without a cached prefix.", "counter",
+         [](const ModelGauges &g) { return static_cast<double>(g.prefixCacheMisses.load(std::memory_order_relaxed)); }},
+        {"llm_prefix_cache_evictions_total", "Cached prefixes evicted for space.", "counter",
+         [](const ModelGauges &g) { return static_cast<double>(g.prefixCacheEvictions.load(std::memory_order_relaxed)); }},
+        {"llm_prefix_cache_cells", "KV cells referenced by cached prefixes.", "gauge",
+         [](const ModelGauges &g) { return static_cast<double>(g.prefixCacheCells.load(std::memory_order_relaxed)); }},
+    };
+    for (const Gauge &gauge : gauges) {
+        appendHeader(out, gauge.name, gauge.help, gauge.type);
+        for (const auto &entry : mModels) {
+            QByteArray name = entry.first.toUtf8();
+            name.replace('\\', "\\\\").replace('"', "\\\"");
+            appendSample(out, gauge.name, "model=\"" + name + '"', gauge.read(*entry.second));
+        }
+    }
+    return out;
+}
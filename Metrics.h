@@ -0,0 +1,177 @@
+// ================================================================
+// Metrics.h
+// ================================================================
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QByteArray>
+#include <QString>
+#include <QtGlobal>
+#include <array>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/*
+  Metrics:
+    - Process-wide counters, gauges and histograms in the Prometheus text
+      exposition format, served by MetricsServer on /metrics
+    - Recording is lock-free (relaxed atomics), so it can sit on the
+      generate() and decode hot paths; only rendering and the first lookup
+      of a model's gauges take a lock
+
+  Metricsクラス:
+    - プロセス全体のカウンタ、ゲージ、ヒストグラム。Prometheusのテキスト形式で
+      MetricsServerが/metricsとして公開する
+    - 記録はロックフリー (relaxedなatomic) のため、generate()やデコードの
+      ホットパスに置ける。ロックを取るのは出力時とモデル別ゲージの初回取得のみ
+*/
+class Metrics
+{
+public:
+    /*
+      Transport:
+        - Front end a request arrived through (label "transport")
+      Transport:
+        - リクエストが届いた経路 (ラベル"transport")
+    */
+    enum class Transport {
+        QtRemoteObjects,
+        WebSocket,
+        Count
+    };
+
+    /*
+      Histogram:
+        - Fixed upper bounds; observe() is two atomic increments plus a CAS
+          on the sum
+      Histogram:
+        - 上限値は固定。observe()はatomicの加算2回と合計値のCAS
+    */
+    class Histogram
+    {
+    public:
+        explicit Histogram(std::vector<double> upperBounds);
+        void observe(double value);
+        void render(QByteArray &out, const char *name, const char *help) const;
+
+    private:
+        const std::vector<double> mUpperBounds;
+        std::unique_ptr<std::atomic<quint64>[]> mBuckets;  // non-cumulative, +Inf last
+        std::atomic<quint64> mCount {0};
+        std::atomic<double> mSum {0.0};
+    };
+
+    /*
+      PerTransport:
+        - One counter or gauge per Transport
+      PerTransport:
+        - Transportごとのカウンタまたはゲージ
+    */
+    using PerTransport = std::array<std::atomic<qint64>, static_cast<size_t>(Transport::Count)>;
+
+    /*
+      ModelGauges:
+        - Published by each DecodeScheduler (decode thread) and ModelRegistry
+      ModelGauges:
+        - 各DecodeScheduler (デコードスレッド) とModelRegistryが更新する
+    */
+    struct ModelGauges
+    {
+        std::atomic<int> loaded {0};
+        std::atomic<double> loadSeconds {0.0};
+        std::atomic<int> queueDepth {0};
+        std::atomic<int> runningRequests {0};
+        std::atomic<qint64> kvCellsUsed {0};
+        std::atomic<qint64> kvCellsCapacity {0};
+
+        // Prompt prefix cache; the counters keep counting across reloads
+        // プロンプト先頭部分キャッシュ。カウンタは再ロード後も加算を続ける
+        std::atomic<qint64> prefixCacheHits {0};
+        std::atomic<qint64> prefixCacheMisses {0};
+        std::atomic<qint64> prefixCacheEvictions {0};
+        std::atomic<qint64> prefixCacheCells {0};
+    };
+
+    static Metrics &instance();
+
+    /*
+      model(name):
+        - Gauges of a model; the reference stays valid for the process lifetime
+      model(name):
+        - モデルのゲージ。参照はプロセス終了まで有効
+    */
+    ModelGauges &model(const QString &name);
+
+    /*
+      LoadSummary / loadSummary():
+        - Totals over all models and transports, published to a gateway
+      LoadSummary / loadSummary():
+        - 全モデル・全経路の合計。ゲートウェイへ公開する
+    */
+    struct LoadSummary
+    {
+        int queueDepth {0};
+        int runningRequests {0};
+        qint64 activeSessions {0};
+        qint64 freeKvCells {0};
+    };
+    LoadSummary loadSummary() const;
+
+    /*
+      render():
+        - All metrics in the Prometheus text format (version 0.0.4)
+      render():
+        - 全メトリクスをPrometheusのテキスト形式 (version 0.0.4) で出力
+    */
+    QByteArray render() const;
+
+    static size_t index(Transport transport) { return static_cast<size_t>(transport); }
+
+    // Requests and their outcomes, per transport
+    // リクエスト数と結果 (経路別)
+    PerTransport requests {};
+    PerTransport generationErrors {};
+    PerTransport rejectedRequests {};
+    PerTransport cancelledRequests {};
+
+    // Decode sessions currently open, per transport
+    // 現在開いているデコードセッション数 (経路別)
+    PerTransport activeSessions {};
+
+    std::atomic<qint64> promptTokens {0};
+    std::atomic<qint64> reusedPromptTokens {0};
+    std::atomic<qint64> generatedTokens {0};
+
+    Histogram prefillTokensPerSecond;
+    Histogram decodeTokensPerSecond;
+    Histogram timeToFirstToken;    // seconds
+    Histogram interTokenLatency;   // seconds, one sample per token gap
+
+    // Embedding requests per transport, and inputs per forward pass
+    // 埋め込みリクエスト数 (経路別) と順伝播あたりの入力数
+    PerTransport embeddingRequests {};
+    std::atomic<qint64> embeddedInputs {0};
+    Histogram embeddingBatchInputs;
+
+    // Response cache lookups and its memory footprint, published by ResponseCache
+    // 応答キャッシュの検索結果とメモリ使用量 (ResponseCacheが更新する)
+    std::atomic<qint64> responseCacheHits {0};
+    std::atomic<qint64> responseCacheMisses {0};
+    std::atomic<qint64> responseCacheEvictions {0};
+    std::atomic<qint64> responseCacheBytes {0};
+    std::atomic<qint64> responseCacheEntries {0};
+
+    Metrics(const Metrics &) = delete;
+    Metrics &operator=(const Metrics &) = delete;
+
+private:
+    Metrics();
+
+    mutable std::mutex mModelsMutex;
+    std::map<QString, std::unique_ptr<ModelGauges>> mModels;
+};
+
+#endif // METRICS_H
@@ -0,0 +1,88 @@
+// ================================================================
+// MetricsServer.cpp
+// ================================================================
+#include "MetricsServer.h"
+#include "Metrics.h"
+#include <QDebug>
+#include <QTcpSocket>
+
+namespace {
+
+QByteArray httpResponse(const char *status, const char *contentType, const QByteArray &body)
+{
+    QByteArray response;
+    response.reserve(body.size() + 128);
+    response += "HTTP/1.1 ";
+    response += status;
+    response += "\r\nContent-Type: ";
+    response += contentType;
+    response += "\r\nContent-Length: ";
+    response += QByteArray::number(body.size());
+    response += "\r\nConnection: close\r\n\r\n";
+    response += body;
+    return response;
+}
+
+} // namespace
+
+MetricsServer::MetricsServer(QObject *parent)
+    : QObject(parent)
+    , mServer(new QTcpServer(this))
+{
+    connect(mServer, &QTcpServer::newConnection, this, &MetricsServer::onNewConnection);
+}
+
+bool MetricsServer::startServer(quint16 port, const QHostAddress &address)
+{
+    if (!mServer->listen(address, port)) {
+        qWarning() << "[MetricsServer] Failed to listen on port" << port << ":" << mServer->errorString();
+        return false;
+    }
+    qDebug() << "[MetricsServer] Serving /metrics on" << address.toString() << "port" << port;
+    return true;
+}
+
+/*
+  onNewConnection():
+    - Sockets are children of the server and delete themselves once closed
+*/
+void MetricsServer::onNewConnection()
+{
+    while (QTcpSocket *socket = mServer->nextPendingConnection()) {
+        connect(socket, &QTcpSocket::readyRead, this, [this, socket]() {
+            handleRequest(socket);
+        });
+        connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+    }
+}
+
+/*
+  handleRequest(socket):
+    - Only the request line matters; headers are skipped
+*/
+void MetricsServer::handleRequest(QTcpSocket *socket)
+{
+    // Wait until the head is complete (the request has no body)
+    // ヘッダが揃うまで待つ (リクエストにボディは無い)
+    if (!socket->peek(mMaxRequestBytes).contains("\r\n\r\n")) {
+        if (socket->bytesAvailable() >= mMaxRequestBytes) {
+            socket->write(httpResponse("431 Request Header Fields Too Large", "text/plain", {}));
+            socket->disconnectFromHost();
+        }
+        return;
+    }
+
+    const QList<QByteArray> requestLine = socket->readLine().trimmed().split(' ');
+    socket->readAll();
+    disconnect(socket, &QTcpSocket::readyRead, this, nullptr);
+
+    if (requestLine.size() < 2 || requestLine[0] != "GET") {
+        socket->write(httpResponse("405 Method Not Allowed", "text/plain", "only GET is supported\n"));
+    } else if (requestLine[1].split('?').first() != "/metrics") {
+        socket->write(httpResponse("404 Not Found", "text/plain", "see /metrics\n"));
+    } else {
+        socket->write(httpResponse("200 OK", "text/plain; version=0.0.4; charset=utf-8",
+                                   Metrics::instance().render()));
+    }
+    socket->disconnectFromHost();
+}
@@ -0,0 +1,57 @@
+// ================================================================
+// MetricsServer.h
+// ================================================================
+#ifndef METRICSSERVER_H
+#define METRICSSERVER_H
+
+#include <QHostAddress>
+#include <QObject>
+#include <QTcpServer>
+
+class QTcpSocket;
+
+/*
+  MetricsServer:
+    - Minimal HTTP/1.1 listener answering "GET /metrics" with Metrics::render()
+    - Every response closes the connection; anything else gets 404 / 405
+    - Meant for a local scraper, so it binds to localhost by default
+
+  MetricsServerクラス:
+    - "GET /metrics"にMetrics::render()で応答する最小限のHTTP/1.1リスナー
+    - 応答ごとに接続を閉じる。それ以外のリクエストには404 / 405を返す
+    - ローカルのスクレイパー向けのため、既定ではlocalhostで待ち受ける
+*/
+class MetricsServer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit MetricsServer(QObject *parent = nullptr);
+
+    /*
+      startServer(port, address):
+        - Starts listening; returns false if the port cannot be bound
+      startServer(port, address):
+        - 待ち受けを開始。ポートを確保できない場合はfalseを返す
+    */
+    bool startServer(quint16 port, const QHostAddress &address = QHostAddress::LocalHost);
+
+private slots:
+    void onNewConnection();
+
+private:
+    /*
+      handleRequest(socket):
+        - Answers once the request head is complete
+      handleRequest(socket):
+        - リクエストヘッダが揃った時点で応答する
+    */
+    void handleRequest(QTcpSocket *socket);
+
+    // Request heads larger than this are rejected
+    // これより大きいリクエストヘッダは拒否する
+    static constexpr qint64 mMaxRequestBytes {8192};
+
+    QTcpServer *mServer {nullptr};
+};
+
+#endif // METRICSSERVER_H
@@ -0,0 +1,390 @@
+// ================================================================
+// ModelRegistry.cpp
+// ================================================================
+#include "ModelRegistry.h"
+#include "DecodeScheduler.h"
+#include "EmbeddingScheduler.h"
+#include "Metrics.h"
+#include "ServerConfig.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <algorithm>
+
+#ifdef Q_OS_LINUX
+#include <sys/mman.h>
+#endif
+
+namespace {
+
+/*
+  adviseMappedModel(path):
+    - llama.cpp keeps its mapping private, so the ranges backed by the file
+      are looked up in /proc/self/maps
+    - Hints only: a kernel without THP for file mappings refuses
+      MADV_HUGEPAGE, which is logged and otherwise ignored
+  adviseMappedModel(path):
+    - llama.cppはマッピングを公開しないため、ファイルに対応する範囲を
+      /proc/self/mapsから探す
+    - ヒントに過ぎない: ファイルマッピングのTHPに対応しないカーネルは
+      MADV_HUGEPAGEを拒否するが、ログに出すだけで無視する
+*/
+void adviseMappedModel(const std::string &path)
+{
+#ifdef Q_OS_LINUX
+    const ServerConfig &config = ServerConfig::instance();
+    if (!config.useMmap || (!config.prefetchModel && !config.transparentHugePages)) {
+        return;
+    }
+    QFile maps(QStringLiteral("/proc/self/maps"));
+    if (!maps.open(QIODevice::ReadOnly)) {
+        return;
+    }
+    const QByteArray suffix = ' ' + QFileInfo(QString::fromStdString(path)).canonicalFilePath().toLocal8Bit();
+
+    quint64 advisedBytes = 0;
+    bool hugePagesRefused = false;
+    for (const QByteArray &line : maps.readAll().split('\n')) {
+        if (!line.endsWith(suffix)) {
+            continue;
+        }
+        const qsizetype dash  = line.indexOf('-');
+        const qsizetype space = line.indexOf(' ');
+        bool startOk = false;
+        bool endOk   = false;
+        const quint64 start = line.left(dash).toULongLong(&startOk, 16);
+        const quint64 end   = line.mid(dash + 1, space - dash - 1).toULongLong(&endOk, 16);
+        if (!startOk || !endOk || end <= start) {
+            continue;
+        }
+        void *address = reinterpret_cast<void *>(static_cast<quintptr>(start));
+        const size_t length = static_cast<size_t>(end - start);
+        if (config.transparentHugePages && madvise(address, length, MADV_HUGEPAGE) != 0) {
+            hugePagesRefused = true;
+        }
+        if (config.prefetchModel) {
+            madvise(address, length, MADV_WILLNEED);
+        }
+        advisedBytes += length;
+    }
+    if (hugePagesRefused) {
+        qWarning() << "[ModelRegistry] Transparent huge pages not available for" << path.c_str();
+    }
+    qDebug() << "[ModelRegistry] Advised" << advisedBytes / (1024 * 1024) << "MB of mapped weights";
+#else
+    Q_UNUSED(path);
+#endif
+}
+
+} // namespace
+
+/*
+  instance():
+    - Function-local static, initialized thread-safely on first use
+*/
+ModelRegistry &ModelRegistry::instance()
+{
+    static ModelRegistry registry;
+    return registry;
+}
+
+/*
+  acquire(path, params):
+    - Looks up a live model for "path"
+    - Otherwise the first caller publishes a pending load under mMutex and
+      loads outside it; later callers for the same path wait on its future,
+      callers for other paths are not held up
+*/
+std::shared_ptr<llama_model> ModelRegistry::acquire(const std::string &path,
+                                                    const llama_model_params &params)
+{
+    std::call_once(mBackendsLoaded, []() {
+        ggml_backend_load_all();
+    });
+
+    std::promise<std::shared_ptr<llama_model>> loading;
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+
+        if (auto model = mModels[path].lock()) {
+            qDebug() << "[ModelRegistry] Reusing loaded model" << path.c_str();
+            return model;
+        }
+        auto it = mLoadingModels.find(path);
+        if (it != mLoadingModels.end()) {
+            // Another caller is loading this model: wait without the lock
+            // 他の呼び出しがロード中: ロックを外して待つ
+            std::shared_future<std::shared_ptr<llama_model>> pending = it->second;
+            lock.unlock();
+            return pending.get();
+        }
+        mLoadingModels[path] = loading.get_future().share();
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    std::shared_ptr<llama_model> model;
+    if (llama_model *raw = llama_load_model_from_file(path.c_str(), params)) {
+        qDebug() << "[ModelRegistry] Loaded model" << path.c_str()
+                 << "in" << timer.elapsed() << "ms"
+                 << (params.use_mmap ? "(mmap" : "(read") << (params.use_mlock ? "+ mlock)" : ")");
+        adviseMappedModel(path);
+
+        // The last borrower frees the weights
+        // 最後の借用者が重みを解放する
+        model.reset(raw, [path](llama_model *m) {
+            qDebug() << "[ModelRegistry] Freeing model" << path.c_str();
+            llama_free_model(m);
+        });
+    } else {
+        fprintf(stderr, "Error: unable to load model.\n");
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mLoadingModels.erase(path);
+        if (model) {
+            mModels[path] = model;
+        } else {
+            mModels.erase(path);
+        }
+    }
+    loading.set_value(model);
+    return model;
+}
+
+/*
+  modelParams(gpuLayers):
+    - Every model of the process (main, draft, embeddings) loads the same way
+*/
+llama_model_params ModelRegistry::modelParams(int gpuLayers)
+{
+    const ServerConfig &config = ServerConfig::instance();
+    llama_model_params params = llama_model_default_params();
+    params.n_gpu_layers = gpuLayers;
+    params.use_mmap     = config.useMmap;
+    params.use_mlock    = config.useMlock;
+    return params;
+}
+
+/*
+  scheduler(name, errorMessage, onLoaded):
+    - The first caller publishes a pending entry under mSchedulerMutex and
+      loads outside it; later callers for the same model wait on the entry's
+      future, while requests for other (loaded) models are not held up
+    - The budget is checked against the file size before loading (gguf
+      weights are mapped 1:1) and against llama_model_size() afterwards
+*/
+std::shared_ptr<DecodeScheduler> ModelRegistry::scheduler(const QString &name, QString *errorMessage,
+                                                          const std::function<void()> &onLoaded)
+{
+    const ServerConfig::ModelConfig *modelConfig = ServerConfig::instance().findModel(name);
+    if (!modelConfig) {
+        if (errorMessage) {
+            *errorMessage = QStringLiteral("unknown model \"%1\"").arg(name);
+        }
+        return nullptr;
+    }
+    auto failed = [&]() -> std::shared_ptr<DecodeScheduler> {
+        if (errorMessage) {
+            *errorMessage = QStringLiteral("failed to load model \"%1\"").arg(modelConfig->name);
+        }
+        return nullptr;
+    };
+
+    std::promise<std::shared_ptr<DecodeScheduler>> loading;
+    std::vector<std::shared_ptr<void>> evicted;
+    {
+        std::unique_lock<std::mutex> lock(mSchedulerMutex);
+
+        auto it = mSchedulers.find(modelConfig->name);
+        if (it != mSchedulers.end()) {
+            it->second.lastUsed = std::chrono::steady_clock::now();
+            if (it->second.scheduler) {
+                return it->second.scheduler;
+            }
+            // Another caller is loading this model: wait without the lock
+            // 他の呼び出しがロード中: ロックを外して待つ
+            std::shared_future<std::shared_ptr<DecodeScheduler>> pending = it->second.pending;
+            lock.unlock();
+            std::shared_ptr<DecodeScheduler> scheduler = pending.get();
+            return scheduler ? scheduler : failed();
+        }
+
+        LoadedScheduler &placeholder = mSchedulers[modelConfig->name];
+        placeholder.pending  = loading.get_future().share();
+        placeholder.bytes    = static_cast<quint64>(QFileInfo(modelConfig->path).size());
+        placeholder.lastUsed = std::chrono::steady_clock::now();
+        evictFor(&evicted);
+    }
+    // Freed before loading so the weights are gone; joins the evicted threads
+    // ロード前に解放して重みを手放す。破棄したスケジューラのスレッドはここで終了を待つ
+    evicted.clear();
+
+    QElapsedTimer timer;
+    timer.start();
+    auto scheduler = std::make_shared<DecodeScheduler>(*modelConfig);
+    const bool loaded = scheduler->initialize(onLoaded);
+
+    {
+        std::lock_guard<std::mutex> lock(mSchedulerMutex);
+        if (loaded) {
+            LoadedScheduler &entry = mSchedulers[modelConfig->name];
+            entry.scheduler = scheduler;
+            entry.bytes     = llama_model_size(scheduler->model().get());
+            entry.lastUsed  = std::chrono::steady_clock::now();
+        } else {
+            mSchedulers.erase(modelConfig->name);
+        }
+    }
+
+    if (!loaded) {
+        loading.set_value(nullptr);
+        return failed();
+    }
+    Metrics::instance().model(modelConfig->name).loadSeconds.store(timer.elapsed() / 1000.0,
+                                                                  std::memory_order_relaxed);
+    loading.set_value(scheduler);
+    return scheduler;
+}
+
+/*
+  embeddingScheduler(name, errorMessage):
+    - Created on first use; its thread borrows the weights through acquire()
+    - Counted with the file size, like a decode scheduler while loading; the
+      budget is enforced before its thread starts loading
+*/
+std::shared_ptr<EmbeddingScheduler> ModelRegistry::embeddingScheduler(const QString &name, QString *errorMessage)
+{
+    const ServerConfig::ModelConfig *modelConfig = ServerConfig::instance().findModel(name);
+    if (!modelConfig) {
+        if (errorMessage) {
+            *errorMessage = QStringLiteral("unknown model \"%1\"").arg(name);
+        }
+        return nullptr;
+    }
+
+    // Declared before the lock, so the evicted schedulers are freed after unlocking
+    // ロックより先に宣言し、破棄したスケジューラをロック解除後に解放する
+    std::vector<std::shared_ptr<void>> evicted;
+    std::lock_guard<std::mutex> lock(mSchedulerMutex);
+    LoadedEmbeddingScheduler &entry = mEmbeddingSchedulers[modelConfig->name];
+    entry.lastUsed = std::chrono::steady_clock::now();
+    if (!entry.scheduler) {
+        entry.bytes = static_cast<quint64>(QFileInfo(modelConfig->path).size());
+        evictFor(&evicted);
+        entry.scheduler = std::make_shared<EmbeddingScheduler>(*modelConfig);
+    }
+    return entry.scheduler;
+}
+
+/*
+  evictFor(released):
+    - A model's decode and embedding schedulers share its weights: they are
+      counted once and evicted together, so the weights are really freed
+    - Only models nobody is using right now are candidates: no running or
+      waiting request, and no caller holding a strong reference; models still
+      loading count against the budget with their file size but are kept
+    - If nothing can be evicted the model is loaded over budget (with a warning)
+    - Victims are only moved out of the maps: destroying the last reference
+      joins the scheduler's thread, which must not happen under mSchedulerMutex
+*/
+void ModelRegistry::evictFor(std::vector<std::shared_ptr<void>> *released)
+{
+    const int budgetMB = ServerConfig::instance().modelMemoryBudgetMB;
+    if (budgetMB <= 0) {
+        return;
+    }
+    const quint64 budget = static_cast<quint64>(budgetMB) * 1024 * 1024;
+
+    auto modelBytes = [this](const QString &name) -> quint64 {
+        const auto decode = mSchedulers.find(name);
+        if (decode != mSchedulers.end()) {
+            return decode->second.bytes;
+        }
+        const auto embedding = mEmbeddingSchedulers.find(name);
+        return embedding != mEmbeddingSchedulers.end() ? embedding->second.bytes : 0;
+    };
+    auto loadedBytes = [this, &modelBytes]() {
+        quint64 total = 0;
+        for (const auto &entry : mSchedulers) {
+            total += entry.second.bytes;
+        }
+        for (const auto &entry : mEmbeddingSchedulers) {
+            if (mSchedulers.find(entry.first) == mSchedulers.end()) {
+                total += modelBytes(entry.first);
+            }
+        }
+        return total;
+    };
+    auto unused = [](const auto &scheduler) {
+        return scheduler && scheduler.use_count() == 1 && scheduler->isIdle();
+    };
+
+    while (loadedBytes() > budget) {
+        QString victim;
+        std::chrono::steady_clock::time_point victimUsed;
+        auto consider = [&](const QString &name) {
+            const auto decode    = mSchedulers.find(name);
+            const auto embedding = mEmbeddingSchedulers.find(name);
+            std::chrono::steady_clock::time_point lastUsed;
+            if (decode != mSchedulers.end()) {
+                if (!unused(decode->second.scheduler)) {
+                    return;
+                }
+                lastUsed = decode->second.lastUsed;
+            }
+            if (embedding != mEmbeddingSchedulers.end()) {
+                if (!unused(embedding->second.scheduler)) {
+                    return;
+                }
+                lastUsed = std::max(lastUsed, embedding->second.lastUsed);
+            }
+            if (victim.isEmpty() || lastUsed < victimUsed) {
+                victim     = name;
+                victimUsed = lastUsed;
+            }
+        };
+        for (const auto &entry : mSchedulers) {
+            consider(entry.first);
+        }
+        for (const auto &entry : mEmbeddingSchedulers) {
+            consider(entry.first);
+        }
+        if (victim.isEmpty()) {
+            qWarning() << "[ModelRegistry] Memory budget exceeded, no idle model to evict";
+            return;
+        }
+        qDebug() << "[ModelRegistry] Evicting model" << victim
+                 << "(" << modelBytes(victim) / (1024 * 1024) << "MB )";
+        if (auto decode = mSchedulers.find(victim); decode != mSchedulers.end()) {
+            released->push_back(std::move(decode->second.scheduler));
+            mSchedulers.erase(decode);
+        }
+        if (auto embedding = mEmbeddingSchedulers.find(victim); embedding != mEmbeddingSchedulers.end()) {
+            released->push_back(std::move(embedding->second.scheduler));
+            mEmbeddingSchedulers.erase(embedding);
+        }
+    }
+}
+
+/*
+  modelNames():
+    - Straight from ServerConfig; loaded or not
+*/
+QStringList ModelRegistry::modelNames() const
+{
+    const ServerConfig &config = ServerConfig::instance();
+    QStringList names;
+    if (const ServerConfig::ModelConfig *defaultConfig = config.findModel({})) {
+        names.append(defaultConfig->name);
+    }
+    for (const ServerConfig::ModelConfig &model : config.models) {
+        if (!names.contains(model.name)) {
+            names.append(model.name);
+        }
+    }
+    return names;
+}
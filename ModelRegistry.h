@@ -0,0 +1,187 @@
+// ================================================================
+// ModelRegistry.h
+// ================================================================
+#ifndef MODELREGISTRY_H
+#define MODELREGISTRY_H
+
+#include "llama.h"
+#include <QString>
+#include <QStringList>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class DecodeScheduler;
+class EmbeddingScheduler;
+
+/*
+  ModelRegistry:
+    - Process-wide owner of loaded llama_model instances
+    - Every InferenceEngine borrows the weights through a shared_ptr
+    - The model is loaded on first acquire() and freed when the last
+      borrower releases it
+    - Serves the named models of ServerConfig::models: each one gets its own
+      DecodeScheduler (and EmbeddingScheduler), created on first request and
+      evicted (least recently used, idle ones only) when the loaded weights
+      exceed modelMemoryBudgetMB
+
+  ModelRegistryクラス:
+    - プロセス全体でロード済みのllama_modelを管理
+    - 各InferenceEngineはshared_ptr経由で重みを借用する
+    - 最初のacquire()でロードし、最後の借用者が手放した時点で解放
+    - ServerConfig::modelsの名前付きモデルを提供する。モデルごとに専用の
+      DecodeScheduler (およびEmbeddingScheduler) を最初のリクエスト時に作成し、
+      ロード済みの重みがmodelMemoryBudgetMBを超えた場合はアイドルのものを
+      最も古く使われた順に破棄
+*/
+class ModelRegistry
+{
+public:
+    /*
+      instance():
+        - Returns the process-wide registry
+      instance():
+        - プロセス全体で共有されるレジストリを返す
+    */
+    static ModelRegistry &instance();
+
+    /*
+      acquire(path, params):
+        - Returns the already loaded model for "path", or loads it
+        - Concurrent callers wait for the first load instead of loading twice
+        - Returns nullptr if the model could not be loaded
+      acquire(path, params):
+        - "path"のモデルがロード済みならそれを返し、未ロードならロードする
+        - 同時に呼ばれた場合は二重ロードせず、最初のロード完了を待つ
+        - ロードに失敗した場合はnullptrを返す
+    */
+    std::shared_ptr<llama_model> acquire(const std::string &path,
+                                         const llama_model_params &params);
+
+    /*
+      modelParams(gpuLayers):
+        - Load parameters with the mmap / mlock settings of ServerConfig
+      modelParams(gpuLayers):
+        - ServerConfigのmmap / mlock設定を反映したロード用パラメータ
+    */
+    static llama_model_params modelParams(int gpuLayers);
+
+    /*
+      scheduler(name, errorMessage, onLoaded):
+        - Returns the DecodeScheduler of the named model (empty = default),
+          loading and warming up the model first if needed
+        - onLoaded is called between loading and warm-up (only if this call
+          loads the model); concurrent callers for the same model wait for
+          that load, other models are served meanwhile
+        - Callers must not keep the returned pointer beyond the current call
+          (hold a weak_ptr instead), otherwise the model cannot be evicted
+        - Returns nullptr for unknown names or failed loads
+      scheduler(name, errorMessage, onLoaded):
+        - 名前付きモデル (空 = 既定) のDecodeSchedulerを返す。必要ならロードと
+          ウォームアップを行う
+        - onLoadedはロードとウォームアップの間に呼ばれる (この呼び出しで
+          ロードした場合のみ)。同じモデルへの同時呼び出しはそのロードを待ち、
+          その間も他のモデルは提供される
+        - 戻り値を呼び出しの範囲を超えて保持しないこと (weak_ptrで保持する)。
+          保持するとモデルを破棄できなくなる
+        - 未知の名前やロード失敗の場合はnullptrを返す
+    */
+    std::shared_ptr<DecodeScheduler> scheduler(const QString &name, QString *errorMessage = nullptr,
+                                               const std::function<void()> &onLoaded = {});
+
+    /*
+      embeddingScheduler(name, errorMessage):
+        - Returns the EmbeddingScheduler of the named model (empty = default)
+        - Cheap: the model is loaded on the scheduler's own thread, so this
+          may be called from the networking thread
+        - Counts against modelMemoryBudgetMB; evicted together with the
+          model's DecodeScheduler once both are idle (same rules as scheduler())
+        - Returns nullptr for unknown names
+      embeddingScheduler(name, errorMessage):
+        - 名前付きモデル (空 = 既定) のEmbeddingSchedulerを返す
+        - モデルはスケジューラ自身のスレッドでロードするため軽量で、
+          ネットワーク処理のスレッドから呼んでもよい
+        - modelMemoryBudgetMBの対象。モデルのDecodeSchedulerと共にアイドルに
+          なれば一緒に破棄する (規則はscheduler()と同じ)
+        - 未知の名前の場合はnullptrを返す
+    */
+    std::shared_ptr<EmbeddingScheduler> embeddingScheduler(const QString &name, QString *errorMessage = nullptr);
+
+    /*
+      modelNames():
+        - Names of the configured models, default first
+      modelNames():
+        - 設定済みのモデル名 (既定のモデルが先頭)
+    */
+    QStringList modelNames() const;
+
+    ModelRegistry(const ModelRegistry &) = delete;
+    ModelRegistry &operator=(const ModelRegistry &) = delete;
+
+private:
+    ModelRegistry() = default;
+
+    // Guards mModels and mLoadingModels; never held while a model loads
+    // mModelsとmLoadingModelsを保護する。モデルのロード中は保持しない
+    std::mutex mMutex;
+
+    // Loaded models keyed by file path (weak: freed with the last borrower)
+    // ファイルパスをキーにしたロード済みモデル (weak: 最後の借用者と共に解放)
+    std::map<std::string, std::weak_ptr<llama_model>> mModels;
+
+    // Loads in progress keyed by file path; null result = failed
+    // ファイルパスをキーにしたロード中のモデル。結果がnullなら失敗
+    std::map<std::string, std::shared_future<std::shared_ptr<llama_model>>> mLoadingModels;
+
+    // ggml_backend_load_all() must run only once per process
+    // ggml_backend_load_all()はプロセス内で一度だけ実行する
+    std::once_flag mBackendsLoaded;
+
+    struct LoadedScheduler
+    {
+        std::shared_ptr<DecodeScheduler> scheduler;   // null while loading
+        std::shared_future<std::shared_ptr<DecodeScheduler>> pending;   // set while loading; null result = failed
+        quint64 bytes {0};   // model weight size (file size while loading)
+        std::chrono::steady_clock::time_point lastUsed;
+    };
+
+    struct LoadedEmbeddingScheduler
+    {
+        std::shared_ptr<EmbeddingScheduler> scheduler;
+        quint64 bytes {0};   // model file size (the weights load on its thread)
+        std::chrono::steady_clock::time_point lastUsed;
+    };
+
+    /*
+      evictFor(released):
+        - Drops idle models until the registered ones fit the budget (lock held)
+        - The evicted schedulers go to "released"; the caller frees them
+          after unlocking
+      evictFor(released):
+        - 登録済みのモデルが予算内に収まるまでアイドルのモデルを破棄 (ロック保持中)
+        - 破棄したスケジューラは"released"に移す。呼び出し側がロックを
+          外してから解放する
+    */
+    void evictFor(std::vector<std::shared_ptr<void>> *released);
+
+    // Guards mSchedulers (separate from mMutex: loading a scheduler calls acquire());
+    // never held while a model loads or warms up
+    // mSchedulersを保護 (スケジューラのロードがacquire()を呼ぶためmMutexとは別)。
+    // モデルのロードやウォームアップ中は保持しない
+    std::mutex mSchedulerMutex;
+
+    // Schedulers of loaded models keyed by model name
+    // ロード済みモデルのスケジューラ (モデル名がキー)
+    std::map<QString, LoadedScheduler> mSchedulers;
+
+    // Embedding schedulers keyed by model name (guarded by mSchedulerMutex)
+    // 埋め込みスケジューラ (モデル名がキー、mSchedulerMutexで保護)
+    std::map<QString, LoadedEmbeddingScheduler> mEmbeddingSchedulers;
+};
+
+#endif // MODELREGISTRY_H
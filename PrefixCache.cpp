@@ -0,0 +1,176 @@
+// ================================================================
+// PrefixCache.cpp
+// ================================================================
+#include "PrefixCache.h"
+#include <algorithm>
+
+/*
+  Constructor:
+    - All cache sequences start free
+*/
+PrefixCache::PrefixCache(size_t blockSize, size_t maxTokens, std::vector<llama_seq_id> cacheSeqIds)
+    : mBlockSize(blockSize)
+    , mMaxTokens(maxTokens)
+    , mFreeSeqIds(std::move(cacheSeqIds))
+{
+}
+
+/*
+  hashBlock(seed, tokens, count):
+    - FNV-1a over the token ids, continuing from the previous block's hash
+*/
+uint64_t PrefixCache::hashBlock(uint64_t seed, const llama_token *tokens, size_t count)
+{
+    uint64_t hash = seed;
+    for (size_t i = 0; i < count; ++i) {
+        const uint32_t value = static_cast<uint32_t>(tokens[i]);
+        for (int byte = 0; byte < 4; ++byte) {
+            hash ^= (value >> (byte * 8)) & 0xFFu;
+            hash *= 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+/*
+  lookup(tokens, maxLength):
+    - Walks the prompt block by block while the chained hash is indexed
+    - The hit is verified token by token to rule out hash collisions
+*/
+PrefixCache::Match PrefixCache::lookup(const std::vector<llama_token> &tokens, size_t maxLength)
+{
+    Match match;
+    const size_t limit = std::min(tokens.size(), maxLength);
+
+    uint64_t hash = 14695981039346656037ull;
+    size_t entryIndex = 0;
+    size_t matched = 0;
+    for (size_t end = mBlockSize; end <= limit; end += mBlockSize) {
+        hash = hashBlock(hash, tokens.data() + end - mBlockSize, mBlockSize);
+        auto it = mIndex.find(hash);
+        if (it == mIndex.end()) {
+            break;
+        }
+        entryIndex = it->second;
+        matched = end;
+    }
+
+    if (matched > 0) {
+        Entry &entry = mEntries[entryIndex];
+        if (entry.tokens.size() < matched
+            || !std::equal(tokens.begin(), tokens.begin() + matched, entry.tokens.begin())) {
+            matched = 0;
+        } else {
+            entry.lastUsed = ++mClock;
+            match.seqId  = entry.seqId;
+            match.length = matched;
+        }
+    }
+
+    if (match.length > 0) {
+        ++mStats.hits;
+        mStats.reusedTokens += match.length;
+    } else {
+        ++mStats.misses;
+    }
+    return match;
+}
+
+/*
+  insert(tokens):
+    - Skips prefixes shorter than one block or already fully cached
+    - Makes room by evicting least recently used entries, then claims a
+      free cache sequence for the new entry
+*/
+PrefixCache::Insertion PrefixCache::insert(const std::vector<llama_token> &tokens)
+{
+    Insertion insertion;
+    const size_t length = (std::min(tokens.size(), mMaxTokens) / mBlockSize) * mBlockSize;
+    if (length == 0) {
+        return insertion;
+    }
+
+    // Already covered by an existing entry?
+    for (Entry &entry : mEntries) {
+        if (entry.tokens.size() >= length
+            && std::equal(tokens.begin(), tokens.begin() + length, entry.tokens.begin())) {
+            entry.lastUsed = ++mClock;
+            return insertion;
+        }
+    }
+
+    while (!mEntries.empty()
+           && (mFreeSeqIds.empty() || mStats.cachedTokens + length > mMaxTokens)) {
+        evictOne(insertion.evicted);
+    }
+    if (mFreeSeqIds.empty()) {
+        return insertion;
+    }
+
+    Entry entry;
+    entry.seqId = mFreeSeqIds.back();
+    mFreeSeqIds.pop_back();
+    entry.tokens.assign(tokens.begin(), tokens.begin() + length);
+    entry.lastUsed = ++mClock;
+    mStats.cachedTokens += length;
+    mEntries.push_back(std::move(entry));
+    rebuildIndex();
+
+    insertion.seqId  = mEntries.back().seqId;
+    insertion.length = length;
+    return insertion;
+}
+
+/*
+  stats():
+    - Snapshot of the counters
+*/
+PrefixCache::Stats PrefixCache::stats() const
+{
+    return mStats;
+}
+
+/*
+  rebuildIndex():
+    - Entries are few (one per cache sequence), so the index is rebuilt
+      from scratch whenever they change; more recent entries win
+*/
+void PrefixCache::rebuildIndex()
+{
+    mIndex.clear();
+    std::vector<size_t> order(mEntries.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+        return mEntries[a].lastUsed < mEntries[b].lastUsed;
+    });
+
+    for (size_t index : order) {
+        const Entry &entry = mEntries[index];
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t end = mBlockSize; end <= entry.tokens.size(); end += mBlockSize) {
+            hash = hashBlock(hash, entry.tokens.data() + end - mBlockSize, mBlockSize);
+            mIndex[hash] = index;
+        }
+    }
+}
+
+/*
+  evictOne(evicted):
+    - Removes the least recently used entry and reports its sequence id
+*/
+void PrefixCache::evictOne(std::vector<llama_seq_id> &evicted)
+{
+    auto it = std::min_element(mEntries.begin(), mEntries.end(),
+                               [](const Entry &a, const Entry &b) { return a.lastUsed < b.lastUsed; });
+    if (it == mEntries.end()) {
+        return;
+    }
+    evicted.push_back(it->seqId);
+    mStats.cachedTokens -= it->tokens.size();
+    ++mStats.evictions;
+    mFreeSeqIds.push_back(it->seqId);
+    mEntries.erase(it);
+    rebuildIndex();
+}
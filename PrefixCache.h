@@ -0,0 +1,116 @@
+// ================================================================
+// PrefixCache.h
+// ================================================================
+#ifndef PREFIXCACHE_H
+#define PREFIXCACHE_H
+
+#include "llama.h"
+#include <QtGlobal>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/*
+  PrefixCache:
+    - Remembers which token prefixes are held in KV cells of dedicated
+      "cache sequences" of the shared context
+    - Prefixes are indexed in fixed-size blocks by a chained hash, so a
+      lookup costs one hash per block of the new prompt
+    - Capped by the total number of cached tokens; the least recently
+      used prefix is evicted first
+    - Pure bookkeeping: the caller performs the llama_kv_cache_seq_cp /
+      llama_kv_cache_seq_rm calls on the decode thread
+
+  PrefixCacheクラス:
+    - 共有コンテキスト内の専用「キャッシュシーケンス」のKVセルに、
+      どのトークン列の先頭部分が保持されているかを記録する
+    - 先頭部分は固定長ブロック単位の連鎖ハッシュで索引化し、
+      検索は新しいプロンプトのブロックごとに1回のハッシュ計算で済む
+    - キャッシュ全体のトークン数で上限を設け、最も古く使われた先頭部分から破棄
+    - 管理情報のみを扱い、llama_kv_cache_seq_cp / llama_kv_cache_seq_rm の
+      呼び出しはデコードスレッド上で呼び出し側が行う
+*/
+class PrefixCache
+{
+public:
+    struct Match
+    {
+        llama_seq_id seqId {-1};  // cache sequence holding the prefix
+        size_t length {0};        // matched tokens (positions 0..length-1)
+    };
+
+    struct Insertion
+    {
+        llama_seq_id seqId {-1};             // copy positions 0..length-1 into this sequence
+        size_t length {0};
+        std::vector<llama_seq_id> evicted;   // clear these sequences first
+    };
+
+    struct Stats
+    {
+        quint64 hits {0};
+        quint64 misses {0};
+        quint64 reusedTokens {0};
+        quint64 evictions {0};
+        size_t cachedTokens {0};
+    };
+
+    /*
+      Constructor:
+        - cacheSeqIds are sequence ids reserved for the cache in the context
+      コンストラクタ:
+        - cacheSeqIdsはコンテキスト内でキャッシュ用に予約したシーケンスID
+    */
+    PrefixCache(size_t blockSize, size_t maxTokens, std::vector<llama_seq_id> cacheSeqIds);
+
+    /*
+      lookup(tokens, maxLength):
+        - Longest block-aligned cached prefix of tokens, at most maxLength
+      lookup(tokens, maxLength):
+        - tokensに一致する、ブロック境界に揃った最長のキャッシュ済み先頭部分 (最大maxLength)
+    */
+    Match lookup(const std::vector<llama_token> &tokens, size_t maxLength);
+
+    /*
+      insert(tokens):
+        - Registers the block-aligned prefix of tokens if it is not covered yet
+        - Returns seqId -1 if nothing needs to be copied
+      insert(tokens):
+        - まだ保持されていなければ、tokensのブロック境界までの先頭部分を登録
+        - コピー不要な場合はseqIdが-1
+    */
+    Insertion insert(const std::vector<llama_token> &tokens);
+
+    Stats stats() const;
+
+private:
+    struct Entry
+    {
+        llama_seq_id seqId {-1};
+        std::vector<llama_token> tokens;
+        quint64 lastUsed {0};
+    };
+
+    // Chained hash over tokens[0..end) extending "seed"
+    // seedを引き継いだtokens[0..end)の連鎖ハッシュ
+    static uint64_t hashBlock(uint64_t seed, const llama_token *tokens, size_t count);
+
+    void rebuildIndex();
+    void evictOne(std::vector<llama_seq_id> &evicted);
+
+    const size_t mBlockSize;
+    const size_t mMaxTokens;
+
+    std::vector<Entry> mEntries;
+    std::vector<llama_seq_id> mFreeSeqIds;
+
+    // chained block hash -> index into mEntries
+    // 連鎖ブロックハッシュ -> mEntriesのインデックス
+    std::unordered_map<uint64_t, size_t> mIndex;
+
+    quint64 mClock {0};
+    Stats mStats;
+};
+
+#endif // PREFIXCACHE_H
@@ -1,4 +1,9 @@
 #include "QtRoRemoteGenerator.h"
+#include "EmbeddingScheduler.h"
+#include "ModelRegistry.h"
+#include "SessionManager.h"
+#include <QDebug>
+#include <QPointer>
 
 /*
   QtRORemoteGenerator constructor:
@@ -10,39 +15,333 @@
 */
 QtRORemoteGenerator::QtRORemoteGenerator(QObject *parent)
     : LlamaResponseGeneratorSimpleSource{parent}
+    , mInferenceEngine(new InferenceEngine)
 {
+    // Models clients may select with generateWithModel()
+    // generateWithModel()でクライアントが選択できるモデル
+    setAvailableModels(ModelRegistry::instance().modelNames());
+    mInferenceEngine->setTransport(Metrics::Transport::QtRemoteObjects);
+
     // When InferenceEngine reinitialized -> reinitialized signal here
     // InferenceEngineが再初期化されたら -> このクラスのreinitializedシグナルをemit
-    connect(&mInferenceEngine, &InferenceEngine::reinitialized,
+    connect(mInferenceEngine, &InferenceEngine::reinitialized,
             this, &QtRORemoteGenerator::reinitialized);
 
     // Partial/final response
     // 部分/最終レスポンスを受け取り、このクラスのシグナルに渡す
-    connect(&mInferenceEngine, &InferenceEngine::partialResponseReady,
+    connect(mInferenceEngine, &InferenceEngine::partialResponseReady,
             this, &QtRORemoteGenerator::partialResponseReady);
-    connect(&mInferenceEngine, &InferenceEngine::generationFinished,
+    connect(mInferenceEngine, &InferenceEngine::partialDeltaReady,
+            this, &QtRORemoteGenerator::partialResponseDelta);
+    connect(mInferenceEngine, &InferenceEngine::generationFinished,
             this, &QtRORemoteGenerator::generationFinished);
+    connect(mInferenceEngine, &InferenceEngine::generationStats,
+            this, &QtRORemoteGenerator::generationStats);
+
+    // Streaming mode negotiated through the streamingMode property
+    // streamingModeプロパティで選択されたストリーミング方式をエンジンに反映
+    connect(this, &QtRORemoteGenerator::streamingModeChanged,
+            this, [this](StreamingMode mode) {
+                mInferenceEngine->setStreamingMode(mode == Delta
+                                                      ? InferenceEngine::StreamingMode::Delta
+                                                      : InferenceEngine::StreamingMode::FullText);
+            });
 
     // Error reporting
     // エラー報告を受け取り、このクラスのシグナルに渡す
-    connect(&mInferenceEngine, &InferenceEngine::generationError,
+    connect(mInferenceEngine, &InferenceEngine::generationError,
             this, &QtRORemoteGenerator::generationError);
+    connect(mInferenceEngine, &InferenceEngine::generationCancelled,
+            this, &QtRORemoteGenerator::generationCancelled);
+
+    // Admission queue feedback
+    // 受付キューの状況を通知
+    connect(mInferenceEngine, &InferenceEngine::requestQueued,
+            this, &QtRORemoteGenerator::requestQueued);
+    connect(mInferenceEngine, &InferenceEngine::requestRejected,
+            this, &QtRORemoteGenerator::requestRejected);
 
     // Remote initialization state
     // リモート初期化状態が変化したら、setRemoteInitializedを呼び出し
-    connect(&mInferenceEngine, &InferenceEngine::remoteInitializedChanged,
+    connect(mInferenceEngine, &InferenceEngine::remoteInitializedChanged,
             this, &QtRORemoteGenerator::setRemoteInitialized);
+
+    // Readiness stages and their timings (the enums share their order)
+    // 準備段階とその所要時間 (列挙値の並びは共通)
+    connect(mInferenceEngine, &InferenceEngine::readinessChanged,
+            this, [this](InferenceEngine::Readiness stage, const ReadinessTimings &timings) {
+                setReadinessTimings(timings);
+                setReadinessStage(static_cast<ReadinessStage>(stage));
+            });
+
+    // Everything is connected: hand the engine to its thread
+    // 接続が済んだのでエンジンをそのスレッドに渡す
+    mInferenceEngine->start();
+}
+
+/*
+  Destructor:
+    - The engine belongs to another thread, so it is deleted there
+  デストラクタ:
+    - エンジンは別スレッドに属するため、そのスレッドで削除する
+*/
+QtRORemoteGenerator::~QtRORemoteGenerator()
+{
+    mInferenceEngine->deleteLater();
 }
 
 /*
   generate(messages):
-    - Delegates text generation to the internal InferenceEngine
+    - Queues text generation on the internal InferenceEngine's thread
   generate(messages):
-    - 内部のInferenceEngineにテキスト生成を委譲
+    - 内部のInferenceEngineのスレッドにテキスト生成をキューイング
 */
 void QtRORemoteGenerator::generate(const QList<LlamaChatMessage> &messages)
 {
-    mInferenceEngine.generate(messages);
+    QMetaObject::invokeMethod(mInferenceEngine, [engine = mInferenceEngine, messages]() {
+        engine->generate(messages);
+    }, Qt::QueuedConnection);
+}
+
+/*
+  generateWithModel(model, messages):
+    - Same as generate(), with an explicit model name
+  generateWithModel(model, messages):
+    - generate()と同じだが、モデル名を明示する
+*/
+void QtRORemoteGenerator::generateWithModel(const QString &model, const QList<LlamaChatMessage> &messages)
+{
+    QMetaObject::invokeMethod(mInferenceEngine, [engine = mInferenceEngine, model, messages]() {
+        engine->generate(messages, model);
+    }, Qt::QueuedConnection);
+}
+
+/*
+  generateWithOptions(model, messages, options):
+    - Same as generateWithModel(), with per-request limits and sampling
+  generateWithOptions(model, messages, options):
+    - generateWithModel()と同じだが、リクエストごとの上限とサンプリングを指定する
+*/
+void QtRORemoteGenerator::generateWithOptions(const QString &model,
+                                              const QList<LlamaChatMessage> &messages,
+                                              const GenerationOptions &options)
+{
+    QMetaObject::invokeMethod(mInferenceEngine, [engine = mInferenceEngine, model, messages, options]() {
+        engine->generate(messages, model, options);
+    }, Qt::QueuedConnection);
+}
+
+/*
+  generateStreamed(model, messages, options, stream):
+    - The mode and policy travel with the request, so nothing shared changes
+  generateStreamed(model, messages, options, stream):
+    - 方式と方針はリクエストと共に渡すため、共有の設定は変わらない
+*/
+void QtRORemoteGenerator::generateStreamed(const QString &model,
+                                           const QList<LlamaChatMessage> &messages,
+                                           const GenerationOptions &options,
+                                           const StreamOptions &stream)
+{
+    const InferenceEngine::StreamingMode mode = stream.delta() ? InferenceEngine::StreamingMode::Delta
+                                                               : InferenceEngine::StreamingMode::FullText;
+    const InferenceEngine::FlushPolicy policy =
+        InferenceEngine::flushPolicy(stream.flushIntervalMs(), stream.flushTokens(), stream.flushAtNewline());
+    QMetaObject::invokeMethod(mInferenceEngine,
+                              [engine = mInferenceEngine, model, messages, options, mode, policy]() {
+        engine->generateStreamed(messages, model, options, mode, policy);
+    }, Qt::QueuedConnection);
+}
+
+/*
+  setFlushPolicy(intervalMs, maxTokens, atNewline):
+    - Applied by the engine from its next generation on
+  setFlushPolicy(intervalMs, maxTokens, atNewline):
+    - エンジンが次の生成から適用する
+*/
+void QtRORemoteGenerator::setFlushPolicy(int intervalMs, int maxTokens, bool atNewline)
+{
+    QMetaObject::invokeMethod(mInferenceEngine, [engine = mInferenceEngine, intervalMs, maxTokens, atNewline]() {
+        engine->setFlushPolicy(intervalMs, maxTokens, atNewline);
+    }, Qt::QueuedConnection);
+}
+
+void QtRORemoteGenerator::setHost(QRemoteObjectHostBase *host)
+{
+    mHost = host;
+}
+
+QString QtRORemoteGenerator::sessionSourceName(const QString &sessionId)
+{
+    return QStringLiteral("LlamaSession/") + sessionId;
+}
+
+/*
+  sessionSource(session):
+    - The source is a child of the session, so it goes away with it; it is
+      withdrawn from the host first, while the session still exists (that
+      connection is not made on the source, which attach() disconnects)
+    - The session is attached to the source: a WebSocket client resuming it
+      drops these connections, and the next QtRO call makes them again
+*/
+LlamaSessionSimpleSource *QtRORemoteGenerator::sessionSource(ServerSession *session)
+{
+    if (!mHost) {
+        qWarning() << "[QtRORemoteGenerator] No host to remote session" << session->id();
+        return nullptr;
+    }
+    auto *source = session->findChild<LlamaSessionSimpleSource *>(QString(), Qt::FindDirectChildrenOnly);
+    if (!source) {
+        source = new LlamaSessionSimpleSource(session);
+        source->setSessionId(session->id());
+        if (!mHost->enableRemoting(source, sessionSourceName(session->id()))) {
+            qWarning() << "[QtRORemoteGenerator] Cannot remote session" << session->id();
+            delete source;
+            return nullptr;
+        }
+        QPointer<QRemoteObjectHostBase> host = mHost;
+        connect(session, &QObject::destroyed, this, [host, source]() {
+            if (host) {
+                host->disableRemoting(source);
+            }
+        });
+    }
+    if (session->owner() != source) {
+        session->attach(source);
+        connect(session, &ServerSession::partialDelta, source,
+                [source](const QString &, const QString &delta, int sequence, int offset) {
+                    emit source->delta(delta, sequence, offset);
+                });
+        connect(session, &ServerSession::finished, source,
+                [source](const QString &, const QString &finalResponse) {
+                    emit source->finished(finalResponse);
+                });
+        connect(session, &ServerSession::stats, source,
+                [source](const QString &, const GenerationStats &stats) {
+                    emit source->stats(stats);
+                });
+        connect(session, &ServerSession::error, source,
+                [source](const QString &, const QString &errorMessage) {
+                    emit source->error(errorMessage);
+                });
+        connect(session, &ServerSession::cancelled, source,
+                [source](const QString &, const QString &partialResponse) {
+                    emit source->cancelled(partialResponse);
+                });
+    }
+    return source;
+}
+
+/*
+  createSession(model):
+    - The source is remoted before the id is returned, so the replica can
+      acquire it before its first generateInSession()
+*/
+QString QtRORemoteGenerator::createSession(const QString &model)
+{
+    QString error;
+    ServerSession *session = SessionManager::instance().create(
+        model, Metrics::Transport::QtRemoteObjects, QString(), nullptr, &error);
+    if (!session) {
+        qWarning() << "[QtRORemoteGenerator] Cannot create session:" << error;
+        return QString();
+    }
+    if (!sessionSource(session)) {
+        SessionManager::instance().close(session->id());
+        return QString();
+    }
+    return session->id();
+}
+
+bool QtRORemoteGenerator::appendMessage(const QString &sessionId, const LlamaChatMessage &message)
+{
+    ServerSession *session = SessionManager::instance().find(sessionId);
+    if (!session) {
+        return false;
+    }
+    session->appendMessage(message);
+    return true;
+}
+
+bool QtRORemoteGenerator::generateInSession(const QString &sessionId, const GenerationOptions &options)
+{
+    ServerSession *session = SessionManager::instance().find(sessionId);
+    if (!session) {
+        return false;
+    }
+    LlamaSessionSimpleSource *source = sessionSource(session);
+    if (!source) {
+        return false;
+    }
+    QString error;
+    if (!session->generate(options, &error)) {
+        emit source->error(error);
+        return false;
+    }
+    return true;
+}
+
+QList<LlamaChatMessage> QtRORemoteGenerator::sessionHistory(const QString &sessionId)
+{
+    const ServerSession *session = SessionManager::instance().find(sessionId);
+    return session ? session->history() : QList<LlamaChatMessage>();
+}
+
+void QtRORemoteGenerator::cancelSession(const QString &sessionId)
+{
+    if (ServerSession *session = SessionManager::instance().find(sessionId)) {
+        session->cancel();
+    }
+}
+
+bool QtRORemoteGenerator::closeSession(const QString &sessionId)
+{
+    return SessionManager::instance().close(sessionId);
+}
+
+int QtRORemoteGenerator::embed(const QStringList &texts)
+{
+    return embedWithModel(QString(), texts);
+}
+
+/*
+  embedWithModel(model, texts):
+    - Results arrive on the embedding thread and are queued back to this
+      thread; errors are queued as well, so the replica always sees the
+      returned id before the signal
+*/
+int QtRORemoteGenerator::embedWithModel(const QString &model, const QStringList &texts)
+{
+    const int requestId = mNextEmbeddingId++;
+    Metrics::instance().embeddingRequests[Metrics::index(Metrics::Transport::QtRemoteObjects)]
+        .fetch_add(1, std::memory_order_relaxed);
+
+    QPointer<QtRORemoteGenerator> self(this);
+    auto reportError = [self, requestId](const QString &errorMessage) {
+        QMetaObject::invokeMethod(self, [self, requestId, errorMessage]() {
+            if (self) {
+                emit self->embeddingError(requestId, errorMessage);
+            }
+        }, Qt::QueuedConnection);
+    };
+
+    QString error;
+    const std::shared_ptr<EmbeddingScheduler> scheduler = ModelRegistry::instance().embeddingScheduler(model, &error);
+    if (!scheduler) {
+        reportError(error);
+        return requestId;
+    }
+
+    EmbeddingCallbacks callbacks;
+    callbacks.onFinished = [self, requestId](const QByteArray &vectors, int dimensions) {
+        QMetaObject::invokeMethod(self, [self, requestId, vectors, dimensions]() {
+            if (self) {
+                emit self->embeddingsReady(requestId, dimensions, vectors);
+            }
+        }, Qt::QueuedConnection);
+    };
+    callbacks.onError = reportError;
+    scheduler->submit(texts, /*normalize=*/true, std::move(callbacks));
+    return requestId;
 }
 
 /*
@@ -53,5 +352,18 @@ void QtRORemoteGenerator::generate(const QList<LlamaChatMessage> &messages)
 */
 void QtRORemoteGenerator::reinitEngine()
 {
-    mInferenceEngine.reinitEngine();
+    QMetaObject::invokeMethod(mInferenceEngine, &InferenceEngine::reinitEngine,
+                              Qt::QueuedConnection);
+}
+
+/*
+  cancelGeneration():
+    - Delegates cancellation to the internal InferenceEngine
+  cancelGeneration():
+    - 内部のInferenceEngineに生成の中止を委譲
+*/
+void QtRORemoteGenerator::cancelGeneration()
+{
+    QMetaObject::invokeMethod(mInferenceEngine, &InferenceEngine::cancelGeneration,
+                              Qt::QueuedConnection);
 }
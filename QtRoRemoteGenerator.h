@@ -4,18 +4,46 @@
 #include "rep_LlamaResponseGenerator_source.h"  // Short definitions from .rep file (シンプルソースからのメソッド定義)
 #include "InferenceEngine.h"
 #include <QObject>
+#include <QPointer>
+#include <QRemoteObjectHostBase>
 #include <QString>
 
+class ServerSession;
+
 /*
   QtRORemoteGenerator:
     - Inherits LlamaResponseGeneratorSimpleSource (generated from .rep file)
     - Uses an internal InferenceEngine to handle AI inference
     - Overrides generate(...) and reinitEngine() to delegate to the engine
+    - The engine lives on an engine thread; calls are queued to it, so the
+      remoting thread never waits for templating or tokenization
+    - The streamingMode property and setFlushPolicy() are global: they are
+      shared by every replica of this source, so one client writing them
+      changes the format for all others (FullText keeps partialResponseReady,
+      Delta switches to partialResponseDelta); clients sharing a server pass
+      their own StreamOptions to generateStreamed() instead
+    - readinessStage / readinessTimings follow the engine through Loading,
+      Warming and Ready; remoteInitialized turns true together with Ready
+    - Server-side sessions (createSession) have their own engines; each is
+      remoted as its own LlamaSession source named "LlamaSession/<id>", so
+      only the replicas that acquire it receive its signals
 
   QtRORemoteGeneratorクラス:
     - .repファイルから生成されたLlamaResponseGeneratorSimpleSourceを継承
     - 内部でInferenceEngineを使用し、AI推論を処理
     - generate(...), reinitEngine()をオーバーライドし、エンジンに処理を委譲
+    - エンジンはエンジンスレッド上にあり、呼び出しはキュー経由で渡すため、
+      リモート通信のスレッドがテンプレート適用やトークナイズを待つことはない
+    - streamingModeプロパティとsetFlushPolicy()はグローバル: このソースの
+      全レプリカで共有されるため、あるクライアントが書き込むと他の全クライアント
+      の形式も変わる (FullTextはpartialResponseReady、Deltaは
+      partialResponseDeltaで送信)。サーバーを共有するクライアントは代わりに
+      generateStreamed()で自身のStreamOptionsを渡す
+    - readinessStage / readinessTimingsはエンジンのLoading、Warming、Readyを
+      反映する。remoteInitializedはReadyと同時にtrueになる
+    - サーバー側セッション (createSession) はそれぞれ専用のエンジンを持つ。
+      各セッションは"LlamaSession/<id>"という名前の専用のLlamaSessionソース
+      として公開し、それを取得したレプリカだけがシグナルを受け取る
 */
 class QtRORemoteGenerator : public LlamaResponseGeneratorSimpleSource
 {
@@ -32,11 +60,28 @@ public:
 
     /*
       Destructor:
-        - Default
+        - Releases the engine on its own thread
       デストラクタ:
-        - デフォルト
+        - エンジンをそのスレッド上で解放
+    */
+    ~QtRORemoteGenerator() override;
+
+    /*
+      setHost(host):
+        - Host that remotes this source; the session sources are remoted
+          there as well
+      setHost(host):
+        - このソースを公開するホスト。セッションのソースもそこで公開する
     */
-    ~QtRORemoteGenerator() override = default;
+    void setHost(QRemoteObjectHostBase *host);
+
+    /*
+      sessionSourceName(sessionId):
+        - Name under which the session's LlamaSession source is remoted
+      sessionSourceName(sessionId):
+        - セッションのLlamaSessionソースを公開する名前
+    */
+    static QString sessionSourceName(const QString &sessionId);
 
     /*
       generate(...):
@@ -48,6 +93,111 @@ public:
     */
     void generate(const QList<LlamaChatMessage>& messages) override;
 
+    /*
+      generateWithModel(model, messages):
+        - Like generate(), on one of the models listed in availableModels
+      generateWithModel(model, messages):
+        - generate()と同様だが、availableModelsに含まれるモデルを指定する
+    */
+    void generateWithModel(const QString &model, const QList<LlamaChatMessage>& messages) override;
+
+    /*
+      generateWithOptions(model, messages, options):
+        - Like generateWithModel(), with max tokens, stop strings and sampler
+          settings (0 = server default, seed 0 = random)
+      generateWithOptions(model, messages, options):
+        - generateWithModel()と同様だが、最大トークン数、停止文字列、
+          サンプラー設定を指定する (0 = サーバー既定値、seed 0 = ランダム)
+    */
+    void generateWithOptions(const QString &model,
+                             const QList<LlamaChatMessage>& messages,
+                             const GenerationOptions &options) override;
+
+    /*
+      generateStreamed(model, messages, options, stream):
+        - Like generateWithOptions(), streamed per stream instead of the
+          global streamingMode / flush policy: delta selects
+          partialResponseDelta, negative flush values keep the server defaults
+      generateStreamed(model, messages, options, stream):
+        - generateWithOptions()と同様だが、グローバルなstreamingMode / 送出方針
+          ではなくstreamに従って送る: deltaでpartialResponseDeltaを選択し、
+          負の送出設定値はサーバー既定値を使う
+    */
+    void generateStreamed(const QString &model,
+                          const QList<LlamaChatMessage>& messages,
+                          const GenerationOptions &options,
+                          const StreamOptions &stream) override;
+
+    /*
+      setFlushPolicy(intervalMs, maxTokens, atNewline):
+        - How partial responses of generate*() except generateStreamed() are
+          coalesced; global like streamingMode, i.e. it applies to every
+          replica (negative = server default, maxTokens 1 = one signal per token)
+      setFlushPolicy(intervalMs, maxTokens, atNewline):
+        - generateStreamed()以外のgenerate*()の部分レスポンスのまとめ方。
+          streamingModeと同様にグローバルで、全レプリカに適用される
+          (負 = サーバー既定値、maxTokens 1 = トークンごとに1シグナル)
+    */
+    void setFlushPolicy(int intervalMs, int maxTokens, bool atNewline) override;
+
+    /*
+      createSession(model):
+        - Opens a server-side session and returns its id (empty on failure);
+          its signals are sent by the source named sessionSourceName(id)
+      createSession(model):
+        - サーバー側セッションを開き、そのIDを返す (失敗時は空)。
+          シグナルはsessionSourceName(id)という名前のソースが送る
+    */
+    QString createSession(const QString &model) override;
+
+    /*
+      appendMessage(sessionId, message):
+        - Adds a message to the session's history (false if unknown)
+      appendMessage(sessionId, message):
+        - セッションの履歴にメッセージを追加 (未知の場合はfalse)
+    */
+    bool appendMessage(const QString &sessionId, const LlamaChatMessage &message) override;
+
+    /*
+      generateInSession(sessionId, options):
+        - Replies to the session's history; the session source streams
+          through delta and ends with finished / error / cancelled
+        - A session a WebSocket client had resumed moves back to the source
+      generateInSession(sessionId, options):
+        - セッションの履歴に応答する。セッションのソースがdeltaで送出し、
+          finished / error / cancelledで終わる
+        - WebSocketクライアントが再開していたセッションはソースに戻る
+    */
+    bool generateInSession(const QString &sessionId, const GenerationOptions &options) override;
+
+    /*
+      sessionHistory(sessionId):
+        - Canonical history, e.g. to redraw a conversation after reconnecting
+      sessionHistory(sessionId):
+        - 正規の履歴 (再接続後に会話を再表示する場合など)
+    */
+    QList<LlamaChatMessage> sessionHistory(const QString &sessionId) override;
+
+    void cancelSession(const QString &sessionId) override;
+    bool closeSession(const QString &sessionId) override;
+
+    /*
+      embed(texts) / embedWithModel(model, texts):
+        - Queues the texts for embedding and returns a request id
+        - embeddingsReady(requestId, dimensions, vectors) follows with one
+          unit-length float32 vector per text (little-endian, input order),
+          or embeddingError(requestId, errorMessage)
+        - Requests of all replicas are batched together on the server
+      embed(texts) / embedWithModel(model, texts):
+        - テキストを埋め込みのキューに入れ、リクエストIDを返す
+        - その後embeddingsReady(requestId, dimensions, vectors)で、テキストごとに
+          長さ1のfloat32ベクトル (リトルエンディアン、入力順) を返す。
+          失敗時はembeddingError(requestId, errorMessage)
+        - 全レプリカのリクエストはサーバー側でまとめてバッチ処理する
+    */
+    int embed(const QStringList &texts) override;
+    int embedWithModel(const QString &model, const QStringList &texts) override;
+
     /*
       reinitEngine():
         - Re-initializes the inference engine
@@ -56,6 +206,14 @@ public:
     */
     void reinitEngine() override;
 
+    /*
+      cancelGeneration():
+        - Stops the running generation of the internal engine
+      cancelGeneration():
+        - 内部エンジンで実行中の生成を停止
+    */
+    void cancelGeneration() override;
+
 signals:
     /*
       reinitialized():
@@ -66,9 +224,25 @@ signals:
     void reinitialized();
 
 private:
-    // Internal engine handling inference
-    // 推論を処理する内部エンジン
-    InferenceEngine mInferenceEngine;
+    /*
+      sessionSource(session):
+        - Remotes the session's source on first use and routes the session's
+          signals to it (nullptr without a host)
+      sessionSource(session):
+        - 初回にセッションのソースを公開し、セッションのシグナルをそこへ
+          届ける (ホストが無い場合はnullptr)
+    */
+    LlamaSessionSimpleSource *sessionSource(ServerSession *session);
+
+    QPointer<QRemoteObjectHostBase> mHost;
+
+    // Internal engine handling inference (lives on an engine thread)
+    // 推論を処理する内部エンジン (エンジンスレッド上で動作)
+    InferenceEngine *mInferenceEngine {nullptr};
+
+    // Id of the next embedding request (unique per source)
+    // 次の埋め込みリクエストのID (ソース内で一意)
+    int mNextEmbeddingId {1};
 };
 
 #endif // QTROREMOTEGENERATOR_H
@@ -43,25 +43,25 @@ QtWSRemoteGenerator::~QtWSRemoteGenerator()
 }
 
 /*
-  startServer(port):
+  startServer(port, address):
     - Tries to listen on the specified port (ws://)
     - If successful, connects the newConnection signal to onNewConnection()
     - Returns true on success, false otherwise
 
-  startServer(port):
+  startServer(port, address):
     - 指定したポートでのリッスンを試みる (ws://)
     - 成功した場合は newConnection シグナルと onNewConnection() を接続
     - 成功ならtrue、失敗ならfalseを返す
 */
-bool QtWSRemoteGenerator::startServer(quint16 port)
+bool QtWSRemoteGenerator::startServer(quint16 port, const QHostAddress &address)
 {
-    const bool ok = m_webSocketServer->listen(QHostAddress::Any, port);
+    const bool ok = m_webSocketServer->listen(address, port);
     if (!ok) {
         qWarning() << "[QtWSRemoteGenerator] Failed to listen on port" << port
                    << ":" << m_webSocketServer->errorString();
         return false;
     }
-    qDebug() << "[QtWSRemoteGenerator] Listening on ws://0.0.0.0:" << port;
+    qDebug() << "[QtWSRemoteGenerator] Listening on ws://" << address.toString() << ":" << port;
 
     connect(m_webSocketServer, &QWebSocketServer::newConnection,
             this, &QtWSRemoteGenerator::onNewConnection);
@@ -3,6 +3,7 @@
 
 #include <QObject>
 #include <QWebSocketServer>
+#include <QHostAddress>
 #include <QList>
 #include "ClientHandler.h"
 
@@ -44,15 +45,15 @@ public:
     ~QtWSRemoteGenerator();
 
     /*
-      startServer(port):
-        - Binds QWebSocketServer to the specified port
+      startServer(port, address):
+        - Binds QWebSocketServer to the specified port (all interfaces by default)
         - Returns true if successful, false otherwise
 
-      startServer(port):
-        - 指定ポートを使用してQWebSocketServerを起動
+      startServer(port, address):
+        - 指定ポートを使用してQWebSocketServerを起動 (既定は全インターフェース)
         - 成功すればtrue、失敗すればfalseを返す
     */
-    bool startServer(quint16 port);
+    bool startServer(quint16 port, const QHostAddress &address = QHostAddress::Any);
 
 private slots:
     /*
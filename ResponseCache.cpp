@@ -0,0 +1,319 @@
+// ================================================================
+// ResponseCache.cpp
+// ================================================================
+#include "ResponseCache.h"
+#include "Metrics.h"
+#include "ServerConfig.h"
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <algorithm>
+
+namespace {
+constexpr quint32 kFileMagic {0x4C524331};   // "LRC1"
+const QString kFileSuffix = QStringLiteral(".resp");
+
+qint64 nowMs()
+{
+    return QDateTime::currentMSecsSinceEpoch();
+}
+} // namespace
+
+ResponseCache &ResponseCache::instance()
+{
+    static ResponseCache cache;
+    return cache;
+}
+
+/*
+  Constructor:
+    - Reads the "Response cache" settings; unlike KvSpillStore the
+      directory is not per process, since entries are meant to outlive it
+*/
+ResponseCache::ResponseCache()
+{
+    const ServerConfig &config = ServerConfig::instance();
+    mMaxBytes     = static_cast<size_t>(std::max(config.responseCacheMB, 0)) * 1024 * 1024;
+    mTtlMs        = static_cast<qint64>(std::max(config.responseCacheTtlSeconds, 0)) * 1000;
+    mMaxDiskBytes = static_cast<qint64>(std::max(config.responseCacheDiskMB, 0)) * 1024 * 1024;
+    if (!enabled()) {
+        return;
+    }
+
+    if (!config.responseCacheDirectory.isEmpty()) {
+        mDirectory = config.responseCacheDirectory;
+        if (QDir().mkpath(mDirectory)) {
+            pruneDirectory();
+        } else {
+            qWarning() << "[ResponseCache] Cannot create cache directory" << mDirectory << "- memory only";
+            mDirectory.clear();
+        }
+    }
+    qDebug() << "[ResponseCache] Enabled with" << config.responseCacheMB << "MB, TTL"
+             << config.responseCacheTtlSeconds << "s, directory"
+             << (mDirectory.isEmpty() ? QStringLiteral("none") : mDirectory);
+}
+
+bool ResponseCache::cacheable(const GenerationParams &params)
+{
+    return params.sampling.greedy || params.sampling.seed != LLAMA_DEFAULT_SEED;
+}
+
+/*
+  key(modelId, history, turn, params):
+    - Every variable-length field is prefixed with its length, so adjacent
+      fields cannot run into each other
+*/
+QByteArray ResponseCache::key(const QString &modelId,
+                              const std::vector<llama_token> &history,
+                              const std::vector<llama_token> &turn,
+                              const GenerationParams &params)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    auto addRaw = [&hash](const void *data, size_t size) {
+        hash.addData(QByteArrayView(static_cast<const char *>(data), static_cast<qsizetype>(size)));
+    };
+    auto addInt = [&addRaw](qint64 value) {
+        addRaw(&value, sizeof(value));
+    };
+    auto addBytes = [&addRaw, &addInt](const char *data, size_t size) {
+        addInt(static_cast<qint64>(size));
+        addRaw(data, size);
+    };
+
+    const QByteArray model = modelId.toUtf8();
+    addBytes(model.constData(), static_cast<size_t>(model.size()));
+
+    // The split between history and turn does not change the prompt
+    // historyとturnの区切りはプロンプトを変えない
+    addInt(static_cast<qint64>(history.size() + turn.size()));
+    addRaw(history.data(), history.size() * sizeof(llama_token));
+    addRaw(turn.data(), turn.size() * sizeof(llama_token));
+
+    addInt(params.maxTokens);
+    addInt(static_cast<qint64>(params.stopStrings.size()));
+    for (const std::string &stop : params.stopStrings) {
+        addBytes(stop.data(), stop.size());
+    }
+
+    const SamplingParams &sampling = params.sampling;
+    addInt(sampling.greedy ? 1 : 0);
+    if (!sampling.greedy) {
+        addRaw(&sampling.temperature, sizeof(sampling.temperature));
+        addRaw(&sampling.minP, sizeof(sampling.minP));
+        addInt(sampling.topK);
+        addInt(sampling.seed);
+    }
+    return hash.result();
+}
+
+/*
+  lookup(key, entry):
+    - The disk is read without the lock; a file found there is promoted
+      into memory
+*/
+bool ResponseCache::lookup(const QByteArray &key, Entry *entry)
+{
+    if (!enabled()) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        const auto found = mIndex.constFind(key);
+        if (found != mIndex.constEnd()) {
+            const List::iterator it = found.value();
+            if (!expired(it->entry, nowMs())) {
+                mLru.splice(mLru.begin(), mLru, it);
+                *entry = it->entry;
+                ++mStats.hits;
+                publishLocked();
+                return true;
+            }
+            eraseLocked(it);
+        }
+        if (mDirectory.isEmpty()) {
+            ++mStats.misses;
+            publishLocked();
+            return false;
+        }
+    }
+
+    Entry stored;
+    const bool found = readFile(key, &stored);
+    if (found && expired(stored, nowMs())) {
+        QFile::remove(filePath(key));
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!found || expired(stored, nowMs())) {
+        ++mStats.misses;
+        publishLocked();
+        return false;
+    }
+    *entry = stored;
+    insertLocked(key, std::move(stored));
+    ++mStats.hits;
+    publishLocked();
+    return true;
+}
+
+void ResponseCache::insert(const QByteArray &key, Entry entry)
+{
+    if (!enabled() || sizeOf(entry) > mMaxBytes) {
+        return;
+    }
+    entry.storedAtMs = nowMs();
+    if (!mDirectory.isEmpty()) {
+        writeFile(key, entry);
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    insertLocked(key, std::move(entry));
+    publishLocked();
+}
+
+ResponseCache::Stats ResponseCache::stats() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mStats;
+}
+
+size_t ResponseCache::sizeOf(const Entry &entry)
+{
+    size_t bytes = sizeof(Node);
+    for (const std::string &piece : entry.pieces) {
+        bytes += sizeof(std::string) + piece.size();
+    }
+    return bytes;
+}
+
+bool ResponseCache::expired(const Entry &entry, qint64 now) const
+{
+    return mTtlMs > 0 && now - entry.storedAtMs > mTtlMs;
+}
+
+void ResponseCache::insertLocked(const QByteArray &key, Entry entry)
+{
+    const auto found = mIndex.constFind(key);
+    if (found != mIndex.constEnd()) {
+        eraseLocked(found.value());
+    }
+
+    const size_t bytes = sizeOf(entry);
+    while (!mLru.empty() && mStats.bytes + bytes > mMaxBytes) {
+        eraseLocked(std::prev(mLru.end()));
+        ++mStats.evictions;
+    }
+    mLru.push_front(Node {key, std::move(entry), bytes});
+    mIndex.insert(key, mLru.begin());
+    mStats.bytes += bytes;
+    mStats.entries = mLru.size();
+}
+
+void ResponseCache::eraseLocked(List::iterator it)
+{
+    mStats.bytes -= it->bytes;
+    mIndex.remove(it->key);
+    mLru.erase(it);
+    mStats.entries = mLru.size();
+}
+
+void ResponseCache::publishLocked() const
+{
+    Metrics &metrics = Metrics::instance();
+    metrics.responseCacheHits.store(static_cast<qint64>(mStats.hits), std::memory_order_relaxed);
+    metrics.responseCacheMisses.store(static_cast<qint64>(mStats.misses), std::memory_order_relaxed);
+    metrics.responseCacheEvictions.store(static_cast<qint64>(mStats.evictions), std::memory_order_relaxed);
+    metrics.responseCacheBytes.store(static_cast<qint64>(mStats.bytes), std::memory_order_relaxed);
+    metrics.responseCacheEntries.store(static_cast<qint64>(mStats.entries), std::memory_order_relaxed);
+}
+
+QString ResponseCache::filePath(const QByteArray &key) const
+{
+    return QDir(mDirectory).filePath(QString::fromLatin1(key.toHex()) + kFileSuffix);
+}
+
+bool ResponseCache::readFile(const QByteArray &key, Entry *entry) const
+{
+    QFile file(filePath(key));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    QDataStream in(&file);
+    quint32 magic = 0;
+    quint32 count = 0;
+    in >> magic >> entry->storedAtMs >> count;
+    if (magic != kFileMagic || in.status() != QDataStream::Ok) {
+        qWarning() << "[ResponseCache] Ignoring unreadable" << file.fileName();
+        return false;
+    }
+    entry->pieces.clear();
+    entry->pieces.reserve(std::min<quint32>(count, 4096));
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        QByteArray piece;
+        in >> piece;
+        entry->pieces.emplace_back(piece.constData(), static_cast<size_t>(piece.size()));
+    }
+    return in.status() == QDataStream::Ok;
+}
+
+/*
+  writeFile(key, entry):
+    - QSaveFile renames a complete file into place, so several workers may
+      share one directory
+*/
+void ResponseCache::writeFile(const QByteArray &key, const Entry &entry)
+{
+    QSaveFile file(filePath(key));
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "[ResponseCache] Cannot create" << file.fileName() << file.errorString();
+        return;
+    }
+    QDataStream out(&file);
+    out << kFileMagic << entry.storedAtMs << static_cast<quint32>(entry.pieces.size());
+    for (const std::string &piece : entry.pieces) {
+        out << QByteArray::fromRawData(piece.data(), static_cast<qsizetype>(piece.size()));
+    }
+    if (!file.commit()) {
+        qWarning() << "[ResponseCache] Cannot write" << file.fileName() << file.errorString();
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mDiskBytes += file.size();
+    if (mMaxDiskBytes > 0 && mDiskBytes > mMaxDiskBytes) {
+        pruneDirectory();
+    }
+}
+
+/*
+  pruneDirectory():
+    - Drops files past the TTL, then the oldest ones beyond the disk budget;
+      the modification time stands in for storedAtMs
+*/
+void ResponseCache::pruneDirectory()
+{
+    const QDir dir(mDirectory);
+    const QFileInfoList files = dir.entryInfoList({QStringLiteral("*") + kFileSuffix}, QDir::Files, QDir::Time);
+    const qint64 now = nowMs();
+    qint64 kept = 0;
+    int removed = 0;
+    for (const QFileInfo &info : files) {   // newest first
+        const bool tooOld = mTtlMs > 0 && now - info.lastModified().toMSecsSinceEpoch() > mTtlMs;
+        const bool overBudget = mMaxDiskBytes > 0 && kept + info.size() > mMaxDiskBytes;
+        if (tooOld || overBudget) {
+            removed += QFile::remove(info.filePath()) ? 1 : 0;
+        } else {
+            kept += info.size();
+        }
+    }
+    mDiskBytes = kept;
+    if (removed > 0) {
+        qDebug() << "[ResponseCache] Pruned" << removed << "files from" << mDirectory;
+    }
+}
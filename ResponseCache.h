@@ -0,0 +1,157 @@
+// ================================================================
+// ResponseCache.h
+// ================================================================
+#ifndef RESPONSECACHE_H
+#define RESPONSECACHE_H
+
+#include "DecodeScheduler.h"
+#include "llama.h"
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <QtGlobal>
+#include <cstddef>
+#include <list>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+  ResponseCache:
+    - Remembers complete replies of deterministic requests (greedy, or an
+      explicit seed), keyed by a SHA-256 over the model, the prompt tokens of
+      the conversation and the resolved generation parameters
+    - A hit is replayed piece by piece through the engine's normal streaming
+      signals, so clients cannot tell it from a decoded reply
+    - Bounded by the bytes of its entries; the least recently used entry is
+      evicted first, and entries older than the TTL are dropped on access
+    - With a directory configured, entries are also written there (one file
+      per key) and survive restarts; memory misses fall back to the disk
+    - Disabled when responseCacheMB is 0; thread-safe
+
+  ResponseCacheクラス:
+    - 決定的なリクエスト (greedy、またはシード指定) の完全な応答を記憶する。
+      キーはモデル、会話のプロンプトトークン、解決済みの生成設定のSHA-256
+    - ヒットした応答はエンジンの通常のストリーミングシグナルでピースごとに
+      再生するため、クライアントからはデコードした応答と区別できない
+    - エントリのバイト数で上限を設け、最も古く使われたエントリから破棄する。
+      TTLを過ぎたエントリはアクセス時に破棄する
+    - ディレクトリを設定した場合はエントリをそこにも書き出し (キーごとに
+      1ファイル)、再起動後も残る。メモリでヒットしない場合はディスクを参照する
+    - responseCacheMBが0の場合は無効。スレッドセーフ
+*/
+class ResponseCache
+{
+public:
+    /*
+      Entry:
+        - The reply as the pieces onPiece delivered, so a replay produces
+          the same frames as the original generation
+      Entry:
+        - onPieceが渡したピース単位の応答。再生時に元の生成と同じ
+          フレームになる
+    */
+    struct Entry
+    {
+        std::vector<std::string> pieces;
+        qint64 storedAtMs {0};     // milliseconds since the epoch
+    };
+
+    struct Stats
+    {
+        quint64 hits {0};
+        quint64 misses {0};
+        quint64 evictions {0};
+        size_t bytes {0};
+        size_t entries {0};
+    };
+
+    static ResponseCache &instance();
+
+    bool enabled() const { return mMaxBytes > 0; }
+
+    /*
+      cacheable(params):
+        - True if the request always produces the same reply for the same
+          prompt; randomly seeded sampling is never cached
+      cacheable(params):
+        - 同じプロンプトに対して常に同じ応答になる場合にtrue。
+          ランダムシードのサンプリングはキャッシュしない
+    */
+    static bool cacheable(const GenerationParams &params);
+
+    /*
+      key(modelId, history, turn, params):
+        - history are the prompt tokens already in the session, turn the
+          tokens of the new turn; sampling fields greedy ignores are left out
+      key(modelId, history, turn, params):
+        - historyはセッションに投入済みのプロンプトトークン、turnは新しい
+          ターンのトークン。greedyで無視されるサンプリング設定は含めない
+    */
+    static QByteArray key(const QString &modelId,
+                          const std::vector<llama_token> &history,
+                          const std::vector<llama_token> &turn,
+                          const GenerationParams &params);
+
+    /*
+      lookup(key, entry):
+        - Copies a live entry into entry and marks it most recently used
+      lookup(key, entry):
+        - 有効なエントリをentryにコピーし、最も新しく使われたものとする
+    */
+    bool lookup(const QByteArray &key, Entry *entry);
+
+    /*
+      insert(key, entry):
+        - Stores a finished reply; entries larger than the whole budget are
+          not kept
+      insert(key, entry):
+        - 完了した応答を保存する。上限全体より大きいエントリは保持しない
+    */
+    void insert(const QByteArray &key, Entry entry);
+
+    Stats stats() const;
+
+    ResponseCache(const ResponseCache &) = delete;
+    ResponseCache &operator=(const ResponseCache &) = delete;
+
+private:
+    ResponseCache();
+
+    struct Node
+    {
+        QByteArray key;
+        Entry entry;
+        size_t bytes {0};
+    };
+    using List = std::list<Node>;
+
+    static size_t sizeOf(const Entry &entry);
+    bool expired(const Entry &entry, qint64 now) const;
+
+    // Memory side (mutex held)
+    // メモリ側 (mutexを保持中)
+    void insertLocked(const QByteArray &key, Entry entry);
+    void eraseLocked(List::iterator it);
+    void publishLocked() const;
+
+    // Disk side; readFile/writeFile do not touch the LRU
+    // ディスク側。readFile/writeFileはLRUに触れない
+    QString filePath(const QByteArray &key) const;
+    bool readFile(const QByteArray &key, Entry *entry) const;
+    void writeFile(const QByteArray &key, const Entry &entry);
+    void pruneDirectory();
+
+    size_t mMaxBytes {0};
+    qint64 mTtlMs {0};            // 0 = no expiry
+    QString mDirectory;           // empty = memory only
+    qint64 mMaxDiskBytes {0};     // 0 = unbounded
+    qint64 mDiskBytes {0};
+
+    mutable std::mutex mMutex;
+    List mLru;                    // front = most recently used
+    QHash<QByteArray, List::iterator> mIndex;
+    Stats mStats;
+};
+
+#endif // RESPONSECACHE_H
@@ -0,0 +1,125 @@
+// ================================================================
+// SamplerPool.cpp
+// ================================================================
+#include "SamplerPool.h"
+#include <iterator>
+
+/*
+  Constructor:
+    - Nothing is built up front; chains are created on first use
+*/
+SamplerPool::SamplerPool(size_t maxIdle)
+    : mMaxIdle(maxIdle)
+{
+}
+
+SamplerPool::~SamplerPool()
+{
+    for (const Idle &idle : mIdle) {
+        llama_sampler_free(idle.sampler);
+    }
+}
+
+/*
+  acquire(params):
+    - Takes the most recently released match, which is the warmest one
+    - llama_sampler_reset() also reseeds the dist stage (a fixed seed
+      replays the same sequence, LLAMA_DEFAULT_SEED draws a new one)
+*/
+SamplerPool::Lease SamplerPool::acquire(const SamplingParams &params)
+{
+    for (auto it = mIdle.rbegin(); it != mIdle.rend(); ++it) {
+        if (it->params == params) {
+            llama_sampler *sampler = it->sampler;
+            mIdle.erase(std::next(it).base());
+            llama_sampler_reset(sampler);
+            return Lease(this, sampler, params);
+        }
+    }
+    return Lease(this, build(params), params);
+}
+
+/*
+  release(sampler, params):
+    - A pool of size 0 frees every chain right away
+*/
+void SamplerPool::release(llama_sampler *sampler, const SamplingParams &params)
+{
+    if (!sampler) {
+        return;
+    }
+    if (mMaxIdle == 0) {
+        llama_sampler_free(sampler);
+        return;
+    }
+    if (mIdle.size() >= mMaxIdle) {
+        llama_sampler_free(mIdle.front().sampler);
+        mIdle.erase(mIdle.begin());
+    }
+    mIdle.push_back({params, sampler});
+}
+
+/*
+  build(params):
+    - top_k -> min_p -> temp -> dist, skipping disabled stages
+*/
+llama_sampler *SamplerPool::build(const SamplingParams &params)
+{
+    llama_sampler *sampler = llama_sampler_chain_init(llama_sampler_chain_default_params());
+    if (params.greedy) {
+        llama_sampler_chain_add(sampler, llama_sampler_init_greedy());
+        return sampler;
+    }
+    if (params.topK > 0) {
+        llama_sampler_chain_add(sampler, llama_sampler_init_top_k(params.topK));
+    }
+    if (params.minP > 0.0f) {
+        llama_sampler_chain_add(sampler, llama_sampler_init_min_p(params.minP, 1));
+    }
+    llama_sampler_chain_add(sampler, llama_sampler_init_temp(params.temperature));
+    llama_sampler_chain_add(sampler, llama_sampler_init_dist(params.seed));
+    return sampler;
+}
+
+SamplerPool::Lease::Lease(SamplerPool *pool, llama_sampler *sampler, const SamplingParams &params)
+    : mPool(pool)
+    , mSampler(sampler)
+    , mParams(params)
+{
+}
+
+SamplerPool::Lease::~Lease()
+{
+    reset();
+}
+
+SamplerPool::Lease::Lease(Lease &&other) noexcept
+    : mPool(other.mPool)
+    , mSampler(other.mSampler)
+    , mParams(other.mParams)
+{
+    other.mPool    = nullptr;
+    other.mSampler = nullptr;
+}
+
+SamplerPool::Lease &SamplerPool::Lease::operator=(Lease &&other) noexcept
+{
+    if (this != &other) {
+        reset();
+        mPool    = other.mPool;
+        mSampler = other.mSampler;
+        mParams  = other.mParams;
+        other.mPool    = nullptr;
+        other.mSampler = nullptr;
+    }
+    return *this;
+}
+
+void SamplerPool::Lease::reset()
+{
+    if (mPool && mSampler) {
+        mPool->release(mSampler, mParams);
+    }
+    mPool    = nullptr;
+    mSampler = nullptr;
+}
@@ -0,0 +1,123 @@
+// ================================================================
+// SamplerPool.h
+// ================================================================
+#ifndef SAMPLERPOOL_H
+#define SAMPLERPOOL_H
+
+#include "llama.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+  SamplingParams:
+    - Sampler settings of one request; the defaults match the server's
+      former fixed chain (min_p 0.05 -> temp 0.8 -> random seed)
+    - topK / minP of 0 disable that stage; greedy ignores everything else
+
+  SamplingParams:
+    - 1リクエスト分のサンプラー設定。既定値はこれまでの固定チェーン
+      (min_p 0.05 -> temp 0.8 -> ランダムシード) と同じ
+    - topK / minP が0の場合はその段を省く。greedyの場合は他の設定を無視する
+*/
+struct SamplingParams
+{
+    float temperature {0.8f};
+    float minP {0.05f};
+    int topK {0};
+    uint32_t seed {LLAMA_DEFAULT_SEED};
+    bool greedy {false};
+
+    bool operator==(const SamplingParams &other) const
+    {
+        if (greedy || other.greedy) {
+            return greedy == other.greedy;
+        }
+        return temperature == other.temperature && minP == other.minP
+               && topK == other.topK && seed == other.seed;
+    }
+};
+
+/*
+  SamplerPool:
+    - Keeps idle sampler chains so requests reuse them instead of building
+      a chain (and its buffers) for every generation
+    - A chain is only reused for identical SamplingParams and is reset
+      before it is handed out, so no state leaks between requests
+    - At most maxIdle chains are kept; the oldest idle one is freed first
+    - Not thread-safe: the DecodeScheduler uses it under its lock
+
+  SamplerPoolクラス:
+    - アイドルのサンプラーチェーンを保持し、生成のたびにチェーン (と
+      そのバッファ) を作り直さずにリクエスト間で再利用する
+    - 再利用は同一のSamplingParamsに限り、渡す前にリセットするため
+      リクエスト間で状態が漏れることはない
+    - 保持するのは最大maxIdle個で、最も古いアイドルのものから解放する
+    - スレッドセーフではない。DecodeSchedulerがロック中に使う
+*/
+class SamplerPool
+{
+public:
+    /*
+      Lease:
+        - Owns an acquired chain and hands it back to the pool when destroyed
+        - The pool must outlive its leases
+      Lease:
+        - 取得したチェーンを所有し、破棄時にプールへ返却する
+        - プールはリースより長く存在すること
+    */
+    class Lease
+    {
+    public:
+        Lease() = default;
+        ~Lease();
+        Lease(Lease &&other) noexcept;
+        Lease &operator=(Lease &&other) noexcept;
+        Lease(const Lease &) = delete;
+        Lease &operator=(const Lease &) = delete;
+
+        llama_sampler *get() const { return mSampler; }
+        explicit operator bool() const { return mSampler != nullptr; }
+
+    private:
+        friend class SamplerPool;
+        Lease(SamplerPool *pool, llama_sampler *sampler, const SamplingParams &params);
+        void reset();
+
+        SamplerPool *mPool {nullptr};
+        llama_sampler *mSampler {nullptr};
+        SamplingParams mParams;
+    };
+
+    explicit SamplerPool(size_t maxIdle);
+    ~SamplerPool();
+
+    /*
+      acquire(params):
+        - Reset idle chain with these params, or a newly built one
+      acquire(params):
+        - 同じ設定のアイドルチェーン (リセット済み)、無ければ新規に作成したもの
+    */
+    Lease acquire(const SamplingParams &params);
+
+    SamplerPool(const SamplerPool &) = delete;
+    SamplerPool &operator=(const SamplerPool &) = delete;
+
+private:
+    // Called by Lease; frees the oldest idle chain when the pool is full
+    // Leaseから呼ばれる。プールが満杯なら最も古いアイドルチェーンを解放
+    void release(llama_sampler *sampler, const SamplingParams &params);
+
+    struct Idle
+    {
+        SamplingParams params;
+        llama_sampler *sampler {nullptr};
+    };
+
+    static llama_sampler *build(const SamplingParams &params);
+
+    const size_t mMaxIdle;
+    std::vector<Idle> mIdle;  // oldest first
+};
+
+#endif // SAMPLERPOOL_H
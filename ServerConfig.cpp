@@ -0,0 +1,183 @@
+// ================================================================
+// ServerConfig.cpp
+// ================================================================
+#include "ServerConfig.h"
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+namespace {
+
+// Model downloaded at build time (via CMake)
+// ビルド時にダウンロードしたモデル (CMakeで定義)
+const char *const builtInModelPath {
+#ifdef LLAMA_MODEL_FILE
+    LLAMA_MODEL_FILE
+#else
+#error "LLAMA_MODEL_FILE is not defined. Please define it via target_compile_definitions() in CMake."
+#endif
+};
+
+} // namespace
+
+/*
+  instance():
+    - Function-local static holding the defaults until loadFromFile()
+*/
+ServerConfig &ServerConfig::instance()
+{
+    static ServerConfig config = []() {
+        ServerConfig defaults;
+        defaults.models.append({QStringLiteral("default"), QString::fromUtf8(builtInModelPath)});
+        return defaults;
+    }();
+    return config;
+}
+
+/*
+  loadFromFile(path, errorMessage):
+    - Reads a JSON object and copies over the keys it contains
+*/
+bool ServerConfig::loadFromFile(const QString &path, QString *errorMessage)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        if (errorMessage) {
+            *errorMessage = file.errorString();
+        }
+        return false;
+    }
+
+    QJsonParseError parseError;
+    const QJsonDocument doc = QJsonDocument::fromJson(file.readAll(), &parseError);
+    if (!doc.isObject()) {
+        if (errorMessage) {
+            *errorMessage = parseError.errorString();
+        }
+        return false;
+    }
+    const QJsonObject obj = doc.object();
+
+    auto readInt = [&obj](const char *key, int &field) {
+        const QJsonValue value = obj.value(QLatin1String(key));
+        if (value.isDouble()) {
+            field = value.toInt();
+        }
+    };
+    auto readBool = [&obj](const char *key, bool &field) {
+        const QJsonValue value = obj.value(QLatin1String(key));
+        if (value.isBool()) {
+            field = value.toBool();
+        }
+    };
+    auto readString = [&obj](const char *key, QString &field) {
+        const QJsonValue value = obj.value(QLatin1String(key));
+        if (value.isString()) {
+            field = value.toString();
+        }
+    };
+
+    readString("listenAddress", listenAddress);
+    readInt("qtroPort", qtroPort);
+    readInt("wsPort", wsPort);
+    readString("registryUrl", registryUrl);
+    readString("workerName", workerName);
+    readString("advertiseHost", advertiseHost);
+    readInt("statusPort", statusPort);
+    readInt("loadPublishIntervalMs", loadPublishIntervalMs);
+    readBool("useMmap", useMmap);
+    readBool("useMlock", useMlock);
+    readBool("prefetchModel", prefetchModel);
+    readBool("transparentHugePages", transparentHugePages);
+    readInt("warmupTokens", warmupTokens);
+    readInt("kvOffloadIdleSeconds", kvOffloadIdleSeconds);
+    readInt("kvResidentTokenBudget", kvResidentTokenBudget);
+    readString("kvSpillDirectory", kvSpillDirectory);
+    readInt("contextTokens", contextTokens);
+    readInt("batchSize", batchSize);
+    readInt("microBatchSize", microBatchSize);
+    readInt("prefillChunkTokens", prefillChunkTokens);
+    readInt("streamFlushIntervalMs", streamFlushIntervalMs);
+    readInt("streamFlushTokens", streamFlushTokens);
+    readBool("streamFlushAtNewline", streamFlushAtNewline);
+    readInt("responseCacheMB", responseCacheMB);
+    readInt("responseCacheTtlSeconds", responseCacheTtlSeconds);
+    readString("responseCacheDirectory", responseCacheDirectory);
+    readInt("responseCacheDiskMB", responseCacheDiskMB);
+    readInt("maxQueuedRequests", maxQueuedRequests);
+    readInt("maxRequestsPerClient", maxRequestsPerClient);
+    readInt("engineThreadCount", engineThreadCount);
+    readString("inferenceCpus", inferenceCpus);
+    readString("networkCpus", networkCpus);
+    readInt("prefillThreads", prefillThreads);
+    readInt("decodeThreads", decodeThreads);
+    readBool("strictCpuPlacement", strictCpuPlacement);
+    readInt("threadpoolPoll", threadpoolPoll);
+    readString("numaStrategy", numaStrategy);
+    readInt("sessionIdleSeconds", sessionIdleSeconds);
+    readInt("maxSessions", maxSessions);
+    readInt("embeddingBatchTokens", embeddingBatchTokens);
+    readInt("embeddingMaxInputs", embeddingMaxInputs);
+    readInt("embeddingBatchWindowMs", embeddingBatchWindowMs);
+    readInt("metricsPort", metricsPort);
+    readString("defaultModel", defaultModel);
+    readInt("modelMemoryBudgetMB", modelMemoryBudgetMB);
+
+    // "models" replaces the built-in model list as a whole
+    // "models"は組み込みのモデル一覧を丸ごと置き換える
+    const QJsonValue modelsValue = obj.value(QLatin1String("models"));
+    if (modelsValue.isArray()) {
+        QList<ModelConfig> parsed;
+        for (const QJsonValue &entry : modelsValue.toArray()) {
+            const QJsonObject modelObj = entry.toObject();
+            ModelConfig model;
+            model.name      = modelObj.value(QLatin1String("name")).toString();
+            model.path      = modelObj.value(QLatin1String("path")).toString();
+            model.gpuLayers = modelObj.value(QLatin1String("gpuLayers")).toInt(model.gpuLayers);
+            model.draftPath      = modelObj.value(QLatin1String("draftPath")).toString();
+            model.draftGpuLayers = modelObj.value(QLatin1String("draftGpuLayers")).toInt(model.draftGpuLayers);
+            model.draftTokens    = modelObj.value(QLatin1String("draftTokens")).toInt(model.draftTokens);
+            if (model.name.isEmpty() || model.path.isEmpty()) {
+                if (errorMessage) {
+                    *errorMessage = QStringLiteral("every entry of \"models\" needs a name and a path");
+                }
+                return false;
+            }
+            parsed.append(model);
+        }
+        if (parsed.isEmpty()) {
+            if (errorMessage) {
+                *errorMessage = QStringLiteral("\"models\" is empty");
+            }
+            return false;
+        }
+        models = parsed;
+    }
+    if (!defaultModel.isEmpty() && !findModel(defaultModel)) {
+        if (errorMessage) {
+            *errorMessage = QStringLiteral("unknown defaultModel \"%1\"").arg(defaultModel);
+        }
+        return false;
+    }
+
+    return true;
+}
+
+/*
+  findModel(name):
+    - Linear search; the list is short
+*/
+const ServerConfig::ModelConfig *ServerConfig::findModel(const QString &name) const
+{
+    const QString wanted = name.isEmpty() ? defaultModel : name;
+    if (wanted.isEmpty()) {
+        return models.isEmpty() ? nullptr : &models.first();
+    }
+    for (const ModelConfig &model : models) {
+        if (model.name == wanted) {
+            return &model;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,300 @@
+// ================================================================
+// ServerConfig.h
+// ================================================================
+#ifndef SERVERCONFIG_H
+#define SERVERCONFIG_H
+
+#include <QList>
+#include <QString>
+
+/*
+  ServerConfig:
+    - Runtime settings of the server, with built-in defaults
+    - Optionally overridden from a JSON file given with --config
+    - Filled once in main() before any engine is created, read-only afterwards
+
+  ServerConfig構造体:
+    - サーバーの実行時設定 (既定値付き)
+    - --config で指定したJSONファイルで上書き可能
+    - main()でエンジン生成前に一度だけ設定し、以降は読み取り専用
+*/
+struct ServerConfig
+{
+    /*
+      ModelConfig:
+        - One servable gguf model, selected by name in requests
+      ModelConfig:
+        - リクエストで名前により選択できる1つのggufモデル
+    */
+    struct ModelConfig
+    {
+        QString name;
+        QString path;
+        int gpuLayers {99};
+
+        // Optional draft model of the same tokenizer family for speculative decoding
+        // 投機的デコード用の、同じトークナイザ系列の下書きモデル (任意)
+        QString draftPath;
+        int draftGpuLayers {99};
+        int draftTokens {4};    // tokens proposed per step
+    };
+
+    /*
+      instance():
+        - Process-wide settings
+      instance():
+        - プロセス全体で共有される設定
+    */
+    static ServerConfig &instance();
+
+    /*
+      loadFromFile(path, errorMessage):
+        - Overrides the fields present in a JSON object file
+        - Keys are the field names below; unknown keys are ignored
+      loadFromFile(path, errorMessage):
+        - JSONオブジェクトファイルに含まれるフィールドで上書き
+        - キーは下記のフィールド名。未知のキーは無視する
+    */
+    bool loadFromFile(const QString &path, QString *errorMessage = nullptr);
+
+    /*
+      findModel(name):
+        - Model with that name; empty name means defaultModel
+        - Returns nullptr for unknown names
+      findModel(name):
+        - その名前のモデル。空の場合はdefaultModel
+        - 未知の名前の場合はnullptrを返す
+    */
+    const ModelConfig *findModel(const QString &name) const;
+
+    // ---- Models ----
+    // ---- モデル ----
+
+    // Servable models ("models": [{"name", "path", "gpuLayers",
+    // "draftPath", "draftGpuLayers", "draftTokens"}]);
+    // defaults to the model downloaded at build time, named "default"
+    // 利用可能なモデル ("models": [{"name", "path", "gpuLayers",
+    // "draftPath", "draftGpuLayers", "draftTokens"}])。
+    // 既定はビルド時にダウンロードしたモデル (名前は"default")
+    QList<ModelConfig> models;
+
+    // Model used when a request names none (empty = first entry of models)
+    // リクエストでモデル名が無い場合に使うモデル (空 = modelsの先頭)
+    QString defaultModel;
+
+    // Megabytes of model weights kept loaded; idle models are evicted
+    // least recently used first (0 = unlimited)
+    // ロードしたままにするモデル重みの上限 (MB)。アイドルのモデルを
+    // 最も古く使われたものから破棄する (0 = 無制限)
+    int modelMemoryBudgetMB {0};
+
+    // ---- Listeners ----
+    // ---- リスナー ----
+
+    // Address and ports of the QtRO and WebSocket endpoints
+    // QtROとWebSocketのエンドポイントのアドレスとポート
+    QString listenAddress {QStringLiteral("0.0.0.0")};
+    int qtroPort {12345};
+    int wsPort {12346};
+
+    // ---- Cluster (worker of an LLMRemoteGateway) ----
+    // ---- クラスタ (LLMRemoteGatewayのワーカー) ----
+
+    // QtRO registry of the gateway to join, e.g. "tcp://127.0.0.1:12400"
+    // (empty = standalone server)
+    // 参加するゲートウェイのQtROレジストリ (例 "tcp://127.0.0.1:12400")
+    // (空 = 単独のサーバー)
+    QString registryUrl;
+
+    // Name this worker registers under (empty = advertiseHost:qtroPort)
+    // このワーカーの登録名 (空 = advertiseHost:qtroPort)
+    QString workerName;
+
+    // Host the gateway connects to for this worker's endpoints
+    // ゲートウェイがこのワーカーのエンドポイントへ接続する際のホスト
+    QString advertiseHost {QStringLiteral("127.0.0.1")};
+
+    // Port of the WorkerStatus source and how often its load is published
+    // WorkerStatusソースのポートと、負荷を公開する間隔
+    int statusPort {12348};
+    int loadPublishIntervalMs {500};
+
+    // ---- Model loading ----
+    // ---- モデルのロード ----
+
+    // Map the weight file instead of reading it (llama use_mmap); pages are
+    // then faulted in on first use unless prefetched or locked
+    // 重みファイルを読み込まずにマップする (llamaのuse_mmap)。プリフェッチ
+    // またはロックしない限り、ページは初回使用時に読み込まれる
+    bool useMmap {true};
+
+    // Lock the weights in RAM (llama use_mlock): no page faults or swapping
+    // after loading, at the cost of a slower load and pinned memory
+    // 重みをRAMにロックする (llamaのuse_mlock)。ロード後のページフォルトや
+    // スワップが無くなる代わりに、ロードが遅くなりメモリが固定される
+    bool useMlock {false};
+
+    // madvise hints for the mapped weights (Linux): read them ahead
+    // (MADV_WILLNEED) and back them with transparent huge pages (MADV_HUGEPAGE)
+    // マップした重みへのmadviseヒント (Linux): 先読み (MADV_WILLNEED) と
+    // Transparent Huge Pagesの使用 (MADV_HUGEPAGE)
+    bool prefetchModel {true};
+    bool transparentHugePages {false};
+
+    // Prompt tokens of the synthetic warm-up decode run before a model is
+    // reported ready (0 = no warm-up)
+    // モデルの準備完了を通知する前に実行する、合成ウォームアップデコードの
+    // プロンプトトークン数 (0 = ウォームアップしない)
+    int warmupTokens {32};
+
+    // ---- KV offload (idle sessions) ----
+    // ---- KVのオフロード (アイドルセッション) ----
+
+    // Seconds without a request before a session's KV state is spilled to disk (0 = never)
+    // リクエストが無い状態がこの秒数続いたセッションのKV状態をディスクへ退避 (0 = 退避しない)
+    int kvOffloadIdleSeconds {300};
+
+    // Upper bound of KV tokens kept resident across sessions (0 = context capacity)
+    // 全セッションで常駐させるKVトークン数の上限 (0 = コンテキスト容量まで)
+    int kvResidentTokenBudget {0};
+
+    // Directory for spilled session state (empty = system temp directory)
+    // 退避したセッション状態の保存先 (空 = システムの一時ディレクトリ)
+    QString kvSpillDirectory;
+
+    // ---- Decoding ----
+    // ---- デコード ----
+
+    // KV window of one session; longer conversations are context-shifted
+    // 1セッションのKVウィンドウ。これを超える会話はコンテキストシフトする
+    int contextTokens {2048};
+
+    // Tokens per scheduler step (llama n_batch); at least the number of sequences
+    // スケジューラの1ステップあたりのトークン数 (llamaのn_batch)。シーケンス数以上
+    int batchSize {512};
+
+    // Tokens computed at once inside a step (llama n_ubatch, 0 = batchSize)
+    // ステップ内で一度に計算するトークン数 (llamaのn_ubatch、0 = batchSize)
+    int microBatchSize {512};
+
+    // Prompt tokens one request may prefill per step (0 = batchSize)
+    // 1リクエストが1ステップでプリフィルできるプロンプトトークン数 (0 = batchSize)
+    int prefillChunkTokens {256};
+
+    // ---- Streaming ----
+    // ---- ストリーミング ----
+
+    // Default coalescing of partial responses: flush after this many
+    // milliseconds (0 = no time limit) or tokens (1 = every token), or at a
+    // newline, whichever comes first; clients may override it per session
+    // 部分レスポンスをまとめる既定の方針: このミリ秒数 (0 = 時間制限なし)
+    // またはトークン数 (1 = トークンごと) に達するか、改行で送出 (最初に
+    // 満たした条件)。クライアントはセッションごとに変更できる
+    int streamFlushIntervalMs {25};
+    int streamFlushTokens {8};
+    bool streamFlushAtNewline {true};
+
+    // ---- Response cache ----
+    // ---- 応答キャッシュ ----
+
+    // Memory for replies of deterministic requests (greedy or seeded) that
+    // are replayed on an identical prompt (0 = disabled)
+    // 同一プロンプトで再生する、決定的なリクエスト (greedyまたはシード指定)
+    // の応答に使うメモリ (0 = 無効)
+    int responseCacheMB {0};
+
+    // Seconds a cached reply stays valid (0 = until evicted)
+    // キャッシュした応答の有効秒数 (0 = 破棄されるまで)
+    int responseCacheTtlSeconds {3600};
+
+    // Directory persisting cached replies across restarts (empty = memory
+    // only) and its size limit (0 = unlimited)
+    // キャッシュした応答を再起動後も保持するディレクトリ (空 = メモリのみ)
+    // とその容量の上限 (0 = 無制限)
+    QString responseCacheDirectory;
+    int responseCacheDiskMB {1024};
+
+    // ---- Admission control ----
+    // ---- 受付制御 ----
+
+    // Requests allowed to wait for a decode sequence; more are rejected (0 = unlimited)
+    // デコードシーケンス待ちで並べるリクエスト数。超えた分は拒否 (0 = 無制限)
+    int maxQueuedRequests {64};
+
+    // Running + waiting requests allowed per client (0 = unlimited)
+    // クライアントごとに許可する実行中+待機中のリクエスト数 (0 = 無制限)
+    int maxRequestsPerClient {0};
+
+    // ---- Sessions ----
+    // ---- セッション ----
+
+    // Server-side sessions (createSession) unused for this long are closed,
+    // whether or not a client is still connected (0 = never)
+    // この時間使われなかったサーバー側セッション (createSession) は、
+    // クライアントの接続有無にかかわらず閉じる (0 = 閉じない)
+    int sessionIdleSeconds {1800};
+
+    // Server-side sessions that may exist at once (0 = unlimited)
+    // 同時に存在できるサーバー側セッション数 (0 = 無制限)
+    int maxSessions {1024};
+
+    // ---- Embeddings ----
+    // ---- 埋め込み ----
+
+    // Tokens and inputs of one embedding forward pass; longer inputs are truncated
+    // 埋め込みの1回の順伝播のトークン数と入力数。これより長い入力は切り詰める
+    int embeddingBatchTokens {2048};
+    int embeddingMaxInputs {32};
+
+    // Milliseconds a pass that is not full waits for more requests (0 = never waits)
+    // 埋まっていない順伝播が追加のリクエストを待つミリ秒数 (0 = 待たない)
+    int embeddingBatchWindowMs {2};
+
+    // ---- Metrics ----
+    // ---- メトリクス ----
+
+    // Local port of the Prometheus /metrics endpoint (0 = disabled)
+    // Prometheus用/metricsエンドポイントのローカルポート (0 = 無効)
+    int metricsPort {12347};
+
+    // ---- Threads ----
+    // ---- スレッド ----
+
+    // Worker threads hosting InferenceEngine objects (templating/tokenization)
+    // InferenceEngineを載せるワーカースレッド数 (テンプレート適用/トークナイズ用)
+    int engineThreadCount {2};
+
+    // ---- CPU placement ----
+    // ---- CPUの割り当て ----
+
+    // CPUs of the inference threads and of everything else (Qt event loops,
+    // QtRO/WebSocket I/O, engine threads) as cpuset lists, e.g. "2-15,18-31";
+    // empty inferenceCpus = every CPU not in networkCpus, empty networkCpus =
+    // not pinned (Linux only)
+    // 推論スレッドと、それ以外 (Qtのイベントループ、QtRO/WebSocketのI/O、
+    // エンジンスレッド) のCPUをcpuset形式で指定 (例 "2-15,18-31")。
+    // inferenceCpusが空 = networkCpus以外の全CPU、networkCpusが空 = 固定しない
+    // (Linuxのみ)
+    QString inferenceCpus;
+    QString networkCpus;
+
+    // ggml threads of prefill steps (compute bound) and of decode-only steps
+    // (memory-bandwidth bound); 0 = every inference CPU / half of them
+    // プリフィルのステップ (計算律速) と、デコードのみのステップ (メモリ帯域律速)
+    // のggmlスレッド数。0 = 推論用CPUの全て / その半分
+    int prefillThreads {0};
+    int decodeThreads {0};
+
+    // One CPU per ggml thread instead of the whole inference set, and how
+    // long idle ggml threads spin before sleeping (0-100)
+    // ggmlスレッドを推論用CPU全体ではなく1つのCPUに固定するか、および
+    // アイドルのggmlスレッドがスリープ前にスピンする度合い (0-100)
+    bool strictCpuPlacement {false};
+    int threadpoolPoll {50};
+
+    // ggml NUMA strategy: "distribute", "isolate", "numactl" or empty (disabled)
+    // ggmlのNUMA戦略: "distribute"、"isolate"、"numactl"、空 (無効)
+    QString numaStrategy;
+};
+
+#endif // SERVERCONFIG_H
@@ -0,0 +1,130 @@
+// ================================================================
+// ServerSession.cpp
+// ================================================================
+#include "ServerSession.h"
+#include <QDebug>
+#include <QMetaObject>
+
+/*
+  Constructor:
+    - Engine signals arrive from the scheduler thread and are queued to
+      this object's thread, where the history is updated
+*/
+ServerSession::ServerSession(const QString &id, const QString &model, Metrics::Transport transport,
+                             const QString &clientKey, QObject *parent)
+    : QObject(parent)
+    , mId(id)
+    , mModel(model)
+    , mEngine(new InferenceEngine)
+{
+    mLastActive.start();
+    mEngine->setTransport(transport);
+    mEngine->setClientKey(clientKey);
+    mEngine->setStreamingMode(InferenceEngine::StreamingMode::Delta);
+
+    connect(mEngine, &InferenceEngine::partialDeltaReady,
+            this, [this](const QString &delta, int sequence, int offset) {
+                emit partialDelta(mId, delta, sequence, offset);
+            });
+    connect(mEngine, &InferenceEngine::generationStats,
+            this, [this](const GenerationStats &generationStats) {
+                emit stats(mId, generationStats);
+            });
+    connect(mEngine, &InferenceEngine::generationFinished,
+            this, [this](const QString &finalResponse) {
+                // Before finished(), so a client reacting to it sees the reply.
+                // The string is the one the engine's Conversation keeps, so
+                // the resent reply is matched by pointer and not templated
+                // finished()に反応するクライアントが応答を参照できるよう先に追加。
+                // エンジンのConversationが保持する文字列と同じため、送り直した
+                // 応答はポインタ比較で照合され、テンプレートは適用されない
+                mHistory.append(LlamaChatMessage(QStringLiteral("assistant"), finalResponse));
+                mBusy = false;
+                mLastActive.restart();
+                emit finished(mId, finalResponse);
+            });
+    connect(mEngine, &InferenceEngine::generationError,
+            this, [this](const QString &errorMessage) {
+                mBusy = false;
+                mLastActive.restart();
+                emit error(mId, errorMessage);
+            });
+    connect(mEngine, &InferenceEngine::requestRejected,
+            this, [this](const QString &reason) {
+                mBusy = false;
+                mLastActive.restart();
+                emit error(mId, QStringLiteral("rejected: ") + reason);
+            });
+    connect(mEngine, &InferenceEngine::generationCancelled,
+            this, [this](const QString &partialResponse) {
+                mBusy = false;
+                mLastActive.restart();
+                emit cancelled(mId, partialResponse);
+            });
+
+    mEngine->start();
+}
+
+ServerSession::~ServerSession()
+{
+    if (mBusy) {
+        QMetaObject::invokeMethod(mEngine, &InferenceEngine::cancelGeneration, Qt::QueuedConnection);
+    }
+    mEngine->deleteLater();
+}
+
+qint64 ServerSession::idleMs() const
+{
+    return mBusy ? 0 : mLastActive.elapsed();
+}
+
+void ServerSession::appendMessage(const LlamaChatMessage &message)
+{
+    mHistory.append(message);
+    mLastActive.restart();
+}
+
+/*
+  generate(options, errorMessage):
+    - The whole history is handed over (implicitly shared, no copy); the
+      engine's Conversation recognizes the messages it has already seen,
+      including its own previous reply, and decodes only the new message
+*/
+bool ServerSession::generate(const GenerationOptions &options, QString *errorMessage)
+{
+    if (mBusy) {
+        if (errorMessage) {
+            *errorMessage = QStringLiteral("generation already in progress");
+        }
+        return false;
+    }
+    if (mHistory.isEmpty() || mHistory.constLast().role() == QLatin1String("assistant")) {
+        if (errorMessage) {
+            *errorMessage = QStringLiteral("no new message to reply to");
+        }
+        return false;
+    }
+
+    mBusy = true;
+    mLastActive.restart();
+    QMetaObject::invokeMethod(mEngine, [engine = mEngine, history = mHistory, model = mModel, options]() {
+        engine->generate(history, model, options);
+    }, Qt::QueuedConnection);
+    return true;
+}
+
+void ServerSession::cancel()
+{
+    if (mBusy) {
+        QMetaObject::invokeMethod(mEngine, &InferenceEngine::cancelGeneration, Qt::QueuedConnection);
+    }
+}
+
+void ServerSession::attach(QObject *owner)
+{
+    if (mOwner && mOwner != owner) {
+        disconnect(this, nullptr, mOwner, nullptr);
+        qDebug() << "[ServerSession]" << mId << "moved to a new connection";
+    }
+    mOwner = owner;
+}
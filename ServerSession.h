@@ -0,0 +1,120 @@
+// ================================================================
+// ServerSession.h
+// ================================================================
+#ifndef SERVERSESSION_H
+#define SERVERSESSION_H
+
+#include "rep_LlamaResponseGenerator_source.h"  // LlamaChatMessage, GenerationOptions, GenerationStats
+#include "InferenceEngine.h"
+#include "Metrics.h"
+#include <QElapsedTimer>
+#include <QList>
+#include <QObject>
+#include <QPointer>
+#include <QString>
+
+/*
+  ServerSession:
+    - A conversation whose canonical history is kept by the server, so
+      clients only send the new message of each turn
+    - Owns one InferenceEngine (and with it the decode session holding the
+      conversation's KV state); lives on the networking thread
+    - Replies are appended to the history when a generation finishes; the
+      engine's Conversation already owns the reply (its tokens stay in the
+      KV cache), so resending the history only templates the messages added
+      since, never the reply itself
+    - Signals carry the session id, so one receiver can serve many sessions
+      (and QtRO replicas, which all see every signal, can filter)
+    - Streams in Delta mode with the server's default flush policy
+
+  ServerSessionクラス:
+    - サーバーが正規の履歴を保持する会話。クライアントは各ターンで
+      新しいメッセージのみを送る
+    - InferenceEngineを1つ所有する (会話のKV状態を持つデコードセッションも
+      それに含まれる)。ネットワーク処理のスレッド上で動作する
+    - 生成が終わると応答を履歴に追加する。エンジンのConversationは応答を
+      既に所有している (トークンはKVキャッシュに残る) ため、履歴を送り直しても
+      テンプレートを適用するのはその後に追加されたメッセージのみで、
+      応答自体には適用しない
+    - シグナルはセッションIDを持つため、1つの受信側が多数のセッションを扱える
+      (全シグナルを受け取るQtROのレプリカも絞り込める)
+    - Delta方式で、サーバー既定の送出方針によりストリーミングする
+*/
+class ServerSession : public QObject
+{
+    Q_OBJECT
+public:
+    ServerSession(const QString &id, const QString &model, Metrics::Transport transport,
+                  const QString &clientKey, QObject *parent = nullptr);
+
+    /*
+      Destructor:
+        - Cancels a running generation and releases the engine on its thread
+      デストラクタ:
+        - 実行中の生成を中止し、エンジンをそのスレッド上で解放
+    */
+    ~ServerSession() override;
+
+    QString id() const { return mId; }
+    QString model() const { return mModel; }
+    const QList<LlamaChatMessage> &history() const { return mHistory; }
+    bool isBusy() const { return mBusy; }
+
+    /*
+      idleMs():
+        - Milliseconds since the last request (0 while generating)
+      idleMs():
+        - 最後のリクエストからのミリ秒数 (生成中は0)
+    */
+    qint64 idleMs() const;
+
+    /*
+      appendMessage(message):
+        - Adds a message to the history; it is sent with the next generate()
+      appendMessage(message):
+        - 履歴にメッセージを追加する。次のgenerate()で送られる
+    */
+    void appendMessage(const LlamaChatMessage &message);
+
+    /*
+      generate(options, errorMessage):
+        - Starts a reply to the current history; fails if a generation is
+          already running or the history does not end with a new message
+      generate(options, errorMessage):
+        - 現在の履歴への応答を開始する。生成中の場合や、履歴の最後が
+          新しいメッセージでない場合は失敗する
+    */
+    bool generate(const GenerationOptions &options, QString *errorMessage = nullptr);
+
+    void cancel();
+
+    /*
+      attach(owner):
+        - Routes this session's signals to owner only: connections made by
+          a previous owner are removed (a resumed session moves to the new
+          connection)
+      attach(owner):
+        - このセッションのシグナルをownerにのみ届ける。以前の所有者の接続は
+          削除する (再開したセッションは新しい接続に移る)
+    */
+    void attach(QObject *owner);
+    QObject *owner() const { return mOwner; }
+
+signals:
+    void partialDelta(const QString &sessionId, const QString &delta, int sequence, int offset);
+    void finished(const QString &sessionId, const QString &finalResponse);
+    void stats(const QString &sessionId, const GenerationStats &stats);
+    void error(const QString &sessionId, const QString &errorMessage);
+    void cancelled(const QString &sessionId, const QString &partialResponse);
+
+private:
+    QString mId;
+    QString mModel;
+    InferenceEngine *mEngine {nullptr};
+    QList<LlamaChatMessage> mHistory;
+    bool mBusy {false};
+    QPointer<QObject> mOwner;
+    QElapsedTimer mLastActive;
+};
+
+#endif // SERVERSESSION_H
@@ -0,0 +1,85 @@
+// ================================================================
+// SessionManager.cpp
+// ================================================================
+#include "SessionManager.h"
+#include "ServerConfig.h"
+#include <QDebug>
+#include <QUuid>
+
+SessionManager &SessionManager::instance()
+{
+    static SessionManager manager;
+    return manager;
+}
+
+/*
+  Constructor:
+    - Expiry is checked once a minute; idle sessions have usually had their
+      KV state spilled to disk by the scheduler long before
+*/
+SessionManager::SessionManager()
+{
+    connect(&mExpiryTimer, &QTimer::timeout, this, &SessionManager::closeIdleSessions);
+    mExpiryTimer.start(60 * 1000);
+}
+
+ServerSession *SessionManager::create(const QString &model, Metrics::Transport transport,
+                                      const QString &clientKey, QObject *owner, QString *errorMessage)
+{
+    const ServerConfig &config = ServerConfig::instance();
+    if (config.maxSessions > 0 && mSessions.size() >= config.maxSessions) {
+        if (errorMessage) {
+            *errorMessage = QStringLiteral("too many sessions");
+        }
+        return nullptr;
+    }
+    if (!model.isEmpty() && !config.findModel(model)) {
+        if (errorMessage) {
+            *errorMessage = QStringLiteral("unknown model \"%1\"").arg(model);
+        }
+        return nullptr;
+    }
+
+    // Random (version 4) ids: knowing one is what allows resuming a session
+    // ランダムな (version 4) ID: IDを知っていることがセッション再開の条件
+    const QString id = QUuid::createUuid().toString(QUuid::WithoutBraces);
+    auto *session = new ServerSession(id, model, transport, clientKey, this);
+    session->attach(owner);
+    mSessions.insert(id, session);
+    qDebug() << "[SessionManager] Created session" << id << "(" << mSessions.size() << "open )";
+    return session;
+}
+
+ServerSession *SessionManager::find(const QString &id) const
+{
+    return mSessions.value(id, nullptr);
+}
+
+bool SessionManager::close(const QString &id)
+{
+    ServerSession *session = mSessions.take(id);
+    if (!session) {
+        return false;
+    }
+    qDebug() << "[SessionManager] Closed session" << id;
+    session->deleteLater();
+    return true;
+}
+
+void SessionManager::closeIdleSessions()
+{
+    const int idleSeconds = ServerConfig::instance().sessionIdleSeconds;
+    if (idleSeconds <= 0) {
+        return;
+    }
+    const qint64 limitMs = static_cast<qint64>(idleSeconds) * 1000;
+    for (auto it = mSessions.begin(); it != mSessions.end();) {
+        if (it.value()->idleMs() >= limitMs) {
+            qDebug() << "[SessionManager] Session" << it.key() << "expired";
+            it.value()->deleteLater();
+            it = mSessions.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
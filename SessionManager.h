@@ -0,0 +1,85 @@
+// ================================================================
+// SessionManager.h
+// ================================================================
+#ifndef SESSIONMANAGER_H
+#define SESSIONMANAGER_H
+
+#include "ServerSession.h"
+#include <QHash>
+#include <QObject>
+#include <QString>
+#include <QTimer>
+
+/*
+  SessionManager:
+    - Server-side conversation sessions shared by the WebSocket and QtRO
+      endpoints, keyed by a random, unguessable id
+    - Sessions outlive connections: a client that reconnects resumes its
+      session by id and continues without resending the history
+    - Sessions unused for ServerConfig::sessionIdleSeconds are closed; at
+      most ServerConfig::maxSessions exist at a time
+    - Lives on the networking thread (created on first use there)
+
+  SessionManagerクラス:
+    - WebSocketとQtROの両エンドポイントで共有する、サーバー側の会話セッション。
+      推測できないランダムなIDで管理する
+    - セッションは接続より長く存続する。再接続したクライアントはIDで
+      セッションを再開し、履歴を送り直さずに続けられる
+    - ServerConfig::sessionIdleSeconds の間使われなかったセッションは閉じる。
+      同時に存在できるのは最大 ServerConfig::maxSessions 個
+    - ネットワーク処理のスレッド上で動作する (そこで最初に使われた時に生成)
+*/
+class SessionManager : public QObject
+{
+    Q_OBJECT
+public:
+    /*
+      instance():
+        - Process-wide manager (networking thread only)
+      instance():
+        - プロセス全体で共有 (ネットワーク処理のスレッドからのみ使用)
+    */
+    static SessionManager &instance();
+
+    /*
+      create(model, transport, clientKey, owner, errorMessage):
+        - New empty session attached to owner; nullptr if the model is
+          unknown or the session limit is reached
+      create(model, transport, clientKey, owner, errorMessage):
+        - ownerに結び付いた空のセッションを作る。モデルが未知の場合や
+          セッション数の上限に達した場合はnullptr
+    */
+    ServerSession *create(const QString &model, Metrics::Transport transport,
+                          const QString &clientKey, QObject *owner, QString *errorMessage = nullptr);
+
+    /*
+      find(id):
+        - nullptr for unknown or expired ids
+      find(id):
+        - 未知または期限切れのIDの場合はnullptr
+    */
+    ServerSession *find(const QString &id) const;
+
+    /*
+      close(id):
+        - Ends a session (cancels a running generation); false if unknown
+      close(id):
+        - セッションを終了する (実行中の生成は中止)。未知の場合はfalse
+    */
+    bool close(const QString &id);
+
+    int sessionCount() const { return static_cast<int>(mSessions.size()); }
+
+    SessionManager(const SessionManager &) = delete;
+    SessionManager &operator=(const SessionManager &) = delete;
+
+private:
+    SessionManager();
+
+    void closeIdleSessions();
+
+    QHash<QString, ServerSession *> mSessions;
+    QTimer mExpiryTimer;
+};
+
+#endif // SESSIONMANAGER_H
@@ -0,0 +1,91 @@
+// ================================================================
+// StopMatcher.cpp
+// ================================================================
+#include "StopMatcher.h"
+#include <algorithm>
+
+/*
+  Constructor:
+    - Precomputes the failure function of every stop string
+*/
+StopMatcher::StopMatcher(std::vector<std::string> stopStrings)
+{
+    for (std::string &stop : stopStrings) {
+        if (stop.empty()) {
+            continue;
+        }
+        Pattern pattern;
+        pattern.text = std::move(stop);
+        pattern.failure.assign(pattern.text.size(), 0);
+        size_t k = 0;
+        for (size_t i = 1; i < pattern.text.size(); ++i) {
+            while (k > 0 && pattern.text[i] != pattern.text[k]) {
+                k = pattern.failure[k - 1];
+            }
+            if (pattern.text[i] == pattern.text[k]) {
+                ++k;
+            }
+            pattern.failure[i] = k;
+        }
+        mPatterns.push_back(std::move(pattern));
+    }
+}
+
+/*
+  feed(piece):
+    - Every pattern state refers to bytes inside mHeld, because only bytes
+      beyond the longest partial match are ever released
+*/
+StopMatcher::Result StopMatcher::feed(const std::string &piece)
+{
+    Result result;
+    if (mStopped) {
+        result.stopped = true;
+        return result;
+    }
+    if (mPatterns.empty()) {
+        result.text = piece;
+        return result;
+    }
+
+    for (const char c : piece) {
+        mHeld += c;
+        for (Pattern &pattern : mPatterns) {
+            while (pattern.state > 0 && pattern.text[pattern.state] != c) {
+                pattern.state = pattern.failure[pattern.state - 1];
+            }
+            if (pattern.text[pattern.state] == c) {
+                ++pattern.state;
+            }
+            if (pattern.state == pattern.text.size()) {
+                mStopped = true;
+                result.text = mHeld.substr(0, mHeld.size() - pattern.text.size());
+                result.stopped = true;
+                mHeld.clear();
+                return result;
+            }
+        }
+    }
+
+    size_t hold = 0;
+    for (const Pattern &pattern : mPatterns) {
+        hold = std::max(hold, pattern.state);
+    }
+    result.text = mHeld.substr(0, mHeld.size() - hold);
+    mHeld.erase(0, mHeld.size() - hold);
+    return result;
+}
+
+/*
+  flush():
+    - Also resets the automata so a partial match does not leak into reuse
+*/
+std::string StopMatcher::flush()
+{
+    std::string held;
+    held.swap(mHeld);
+    for (Pattern &pattern : mPatterns) {
+        pattern.state = 0;
+    }
+    return held;
+}
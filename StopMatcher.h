@@ -0,0 +1,78 @@
+// ================================================================
+// StopMatcher.h
+// ================================================================
+#ifndef STOPMATCHER_H
+#define STOPMATCHER_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/*
+  StopMatcher:
+    - Finds the first occurrence of any stop string in text that arrives
+      piece by piece (token pieces)
+    - One KMP automaton per stop string, so each byte is examined once no
+      matter how the text is split
+    - Text that could still turn into a stop string is held back until it
+      is either matched (and dropped) or ruled out (and released)
+
+  StopMatcherクラス:
+    - 断片 (トークン片) ごとに届くテキストから、いずれかの停止文字列の
+      最初の出現を見つける
+    - 停止文字列ごとにKMPオートマトンを持つため、テキストの分割に関係なく
+      各バイトを1回だけ調べる
+    - 停止文字列になり得るテキストは、一致 (破棄) か不一致 (送出) が
+      確定するまで保留する
+*/
+class StopMatcher
+{
+public:
+    struct Result
+    {
+        std::string text;    // safe to emit now
+        bool stopped {false};
+    };
+
+    /*
+      Constructor:
+        - Empty stop strings are ignored
+      コンストラクタ:
+        - 空の停止文字列は無視する
+    */
+    explicit StopMatcher(std::vector<std::string> stopStrings = {});
+
+    /*
+      feed(piece):
+        - Consumes the next piece; once stopped, the text before the stop
+          string is returned and further input is ignored
+      feed(piece):
+        - 次の断片を処理する。停止した場合は停止文字列より前のテキストを返し、
+          以降の入力は無視する
+    */
+    Result feed(const std::string &piece);
+
+    /*
+      flush():
+        - Releases the held-back text (the stream ended without a match)
+      flush():
+        - 保留中のテキストを送出する (一致せずにストリームが終わった場合)
+    */
+    std::string flush();
+
+    bool empty() const { return mPatterns.empty(); }
+
+private:
+    struct Pattern
+    {
+        std::string text;
+        std::vector<size_t> failure;  // KMP failure function
+        size_t state {0};             // bytes currently matched
+    };
+
+    std::vector<Pattern> mPatterns;
+    std::string mHeld;
+    bool mStopped {false};
+};
+
+#endif // STOPMATCHER_H
@@ -0,0 +1,92 @@
+// ================================================================
+// TrafficRecorder.cpp
+// ================================================================
+#include "TrafficRecorder.h"
+#include <QDebug>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+TrafficRecorder &TrafficRecorder::instance()
+{
+    static TrafficRecorder recorder;
+    return recorder;
+}
+
+/*
+  open(path, errorMessage):
+    - Called once from main() before any engine exists
+*/
+bool TrafficRecorder::open(const QString &path, QString *errorMessage)
+{
+    QMutexLocker locker(&mMutex);
+    mFile.setFileName(path);
+    if (!mFile.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+        if (errorMessage) {
+            *errorMessage = mFile.errorString();
+        }
+        return false;
+    }
+    mClock.start();
+    mOpen.store(true, std::memory_order_relaxed);
+    qDebug() << "[TrafficRecorder] Recording requests to" << path;
+    return true;
+}
+
+/*
+  record(transport, model, messages, options):
+    - Field names match the WebSocket "generate" action, so a line can be
+      sent as-is by the benchmark's WebSocket client
+*/
+void TrafficRecorder::record(Metrics::Transport transport,
+                             const QString &model,
+                             const QList<LlamaChatMessage> &messages,
+                             const GenerationOptions &options)
+{
+    if (!isOpen()) {
+        return;
+    }
+
+    QJsonArray messageArray;
+    for (const LlamaChatMessage &message : messages) {
+        QJsonObject entry;
+        entry["role"]    = message.role();
+        entry["content"] = message.content();
+        messageArray.append(entry);
+    }
+
+    QJsonObject json;
+    json["transport"] = (transport == Metrics::Transport::WebSocket) ? QStringLiteral("ws")
+                                                                     : QStringLiteral("qtro");
+    if (!model.isEmpty()) {
+        json["model"] = model;
+    }
+    json["messages"] = messageArray;
+    if (options.maxTokens() > 0) {
+        json["max_tokens"] = options.maxTokens();
+    }
+    if (!options.stop().isEmpty()) {
+        json["stop"] = QJsonArray::fromStringList(options.stop());
+    }
+    if (options.temperature() > 0) {
+        json["temperature"] = options.temperature();
+    }
+    if (options.minP() > 0) {
+        json["min_p"] = options.minP();
+    }
+    if (options.topK() > 0) {
+        json["top_k"] = options.topK();
+    }
+    if (options.seed() != 0) {
+        json["seed"] = options.seed();
+    }
+    if (options.greedy()) {
+        json["greedy"] = true;
+    }
+
+    QMutexLocker locker(&mMutex);
+    json["offset_ms"] = static_cast<double>(mClock.elapsed());
+    mFile.write(QJsonDocument(json).toJson(QJsonDocument::Compact));
+    mFile.write("\n");
+    mFile.flush();
+}
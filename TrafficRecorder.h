@@ -0,0 +1,72 @@
+// ================================================================
+// TrafficRecorder.h
+// ================================================================
+#ifndef TRAFFICRECORDER_H
+#define TRAFFICRECORDER_H
+
+#include "rep_LlamaResponseGenerator_source.h"  // LlamaChatMessage, GenerationOptions
+#include "Metrics.h"
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutex>
+#include <QString>
+#include <atomic>
+
+/*
+  TrafficRecorder:
+    - Appends every generate request to a JSONL file (--record-traffic), in
+      the workload format replayed by LLMRemoteServerBench:
+        {"offset_ms": N, "transport": "ws"|"qtro", "model": "...",
+         "messages": [{"role", "content"}...], "max_tokens": N, "stop": [...], ...}
+    - offset_ms is the arrival time since recording started; option fields
+      are only written when they differ from the server default
+    - Disabled unless open() was called; record() is then a single atomic load
+
+  TrafficRecorderクラス:
+    - 全てのgenerateリクエストをJSONLファイルに追記する (--record-traffic)。
+      形式はLLMRemoteServerBenchが再生するワークロード形式と同じ:
+        {"offset_ms": N, "transport": "ws"|"qtro", "model": "...",
+         "messages": [{"role", "content"}...], "max_tokens": N, "stop": [...], ...}
+    - offset_msは記録開始からの到着時刻。オプションのフィールドは
+      サーバー既定値と異なる場合のみ書き出す
+    - open()を呼ばない限り無効で、その場合record()はatomicの読み出し1回のみ
+*/
+class TrafficRecorder
+{
+public:
+    static TrafficRecorder &instance();
+
+    /*
+      open(path, errorMessage):
+        - Starts recording, appending to an existing file
+      open(path, errorMessage):
+        - 記録を開始する (既存のファイルには追記)
+    */
+    bool open(const QString &path, QString *errorMessage = nullptr);
+
+    bool isOpen() const { return mOpen.load(std::memory_order_relaxed); }
+
+    /*
+      record(transport, model, messages, options):
+        - Writes one line; thread-safe (engines call it from their threads)
+      record(transport, model, messages, options):
+        - 1行書き出す。スレッドセーフ (各エンジンのスレッドから呼ばれる)
+    */
+    void record(Metrics::Transport transport,
+                const QString &model,
+                const QList<LlamaChatMessage> &messages,
+                const GenerationOptions &options);
+
+    TrafficRecorder(const TrafficRecorder &) = delete;
+    TrafficRecorder &operator=(const TrafficRecorder &) = delete;
+
+private:
+    TrafficRecorder() = default;
+
+    std::atomic<bool> mOpen {false};
+    QMutex mMutex;
+    QFile mFile;
+    QElapsedTimer mClock;
+};
+
+#endif // TRAFFICRECORDER_H
@@ -0,0 +1,41 @@
+// ================================================================
+// WorkerStatusPublisher.cpp
+// ================================================================
+#include "WorkerStatusPublisher.h"
+#include "Metrics.h"
+#include "QtRoRemoteGenerator.h"
+#include "ServerConfig.h"
+#include "SessionManager.h"
+#include <algorithm>
+
+WorkerStatusPublisher::WorkerStatusPublisher(QtRORemoteGenerator *generator, QObject *parent)
+    : WorkerStatusSimpleSource(parent)
+    , mGenerator(generator)
+{
+    const ServerConfig &config = ServerConfig::instance();
+    const QString host = config.advertiseHost;
+    setName(config.workerName.isEmpty() ? QStringLiteral("%1:%2").arg(host).arg(config.qtroPort)
+                                        : config.workerName);
+    setQtroUrl(QStringLiteral("tcp://%1:%2").arg(host).arg(config.qtroPort));
+    setWsUrl(QStringLiteral("ws://%1:%2").arg(host).arg(config.wsPort));
+
+    connect(&mTimer, &QTimer::timeout, this, &WorkerStatusPublisher::publish);
+    mTimer.start(std::max(config.loadPublishIntervalMs, 50));
+
+    // Readiness is published right away, the gateway waits for it
+    // 準備状態はすぐに公開する (ゲートウェイはこれを待つ)
+    connect(mGenerator, &QtRORemoteGenerator::readinessStageChanged,
+            this, &WorkerStatusPublisher::publish);
+    publish();
+}
+
+void WorkerStatusPublisher::publish()
+{
+    const Metrics::LoadSummary load = Metrics::instance().loadSummary();
+    setReady(mGenerator->readinessStage() == QtRORemoteGenerator::Ready);
+    setQueueDepth(load.queueDepth);
+    setRunningRequests(load.runningRequests);
+    setActiveSessions(static_cast<int>(load.activeSessions));
+    setServerSessions(SessionManager::instance().sessionCount());
+    setFreeKvCells(load.freeKvCells);
+}
@@ -0,0 +1,57 @@
+// ================================================================
+// WorkerStatusPublisher.h
+// ================================================================
+#ifndef WORKERSTATUSPUBLISHER_H
+#define WORKERSTATUSPUBLISHER_H
+
+#include "rep_WorkerStatus_source.h"
+#include <QObject>
+#include <QTimer>
+
+class QtRORemoteGenerator;
+
+/*
+  WorkerStatusPublisher:
+    - WorkerStatus source of a server running as a gateway worker
+    - Registered in the gateway's QtRO registry as "WorkerStatus/<name>",
+      which is how the gateway discovers the worker
+    - Advertises the worker's endpoints and, every loadPublishIntervalMs,
+      its load (queue depth, running requests, sessions, free KV cells);
+      QtRO only sends the properties that changed
+    - ready follows the readiness of the QtRO generator (warm-up included)
+
+  WorkerStatusPublisherクラス:
+    - ゲートウェイのワーカーとして動作するサーバーのWorkerStatusソース
+    - ゲートウェイのQtROレジストリに"WorkerStatus/<名前>"として登録し、
+      ゲートウェイはこれによりワーカーを発見する
+    - ワーカーのエンドポイントと、loadPublishIntervalMsごとの負荷
+      (キュー長、実行中リクエスト、セッション、空きKVセル) を公開する。
+      QtROは変化したプロパティのみを送る
+    - readyはQtROジェネレータの準備状態 (ウォームアップを含む) に従う
+*/
+class WorkerStatusPublisher : public WorkerStatusSimpleSource
+{
+    Q_OBJECT
+public:
+    /*
+      Constructor:
+        - Fills in name and endpoint URLs from ServerConfig and starts publishing
+      コンストラクタ:
+        - ServerConfigから名前とエンドポイントのURLを設定し、公開を開始
+    */
+    explicit WorkerStatusPublisher(QtRORemoteGenerator *generator, QObject *parent = nullptr);
+
+private:
+    /*
+      publish():
+        - Copies the current load from Metrics and SessionManager
+      publish():
+        - 現在の負荷をMetricsとSessionManagerからコピー
+    */
+    void publish();
+
+    QtRORemoteGenerator *mGenerator {nullptr};
+    QTimer mTimer;
+};
+
+#endif // WORKERSTATUSPUBLISHER_H
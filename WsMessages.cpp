@@ -0,0 +1,97 @@
+// ================================================================
+// WsMessages.cpp
+// ================================================================
+#include "WsMessages.h"
+#include <QJsonDocument>
+
+namespace WsMessages {
+
+QList<LlamaChatMessage> parseChatMessages(const QJsonArray &array)
+{
+    QList<LlamaChatMessage> messages;
+    messages.reserve(array.size());
+    for (const QJsonValue &val : array) {
+        if (!val.isObject()) continue;
+        const QJsonObject mobj = val.toObject();
+        messages.append(LlamaChatMessage(mobj.value(QStringLiteral("role")).toString(),
+                                         mobj.value(QStringLiteral("content")).toString()));
+    }
+    return messages;
+}
+
+GenerationOptions parseGenerationOptions(const QJsonObject &obj)
+{
+    GenerationOptions options;
+    options.setMaxTokens(obj.value(QStringLiteral("max_tokens")).toInt());
+
+    const QJsonValue stop = obj.value(QStringLiteral("stop"));
+    QStringList stopStrings;
+    if (stop.isString()) {
+        stopStrings.append(stop.toString());
+    } else if (stop.isArray()) {
+        for (const QJsonValue &entry : stop.toArray()) {
+            if (entry.isString()) {
+                stopStrings.append(entry.toString());
+            }
+        }
+    }
+    options.setStop(stopStrings);
+
+    const QJsonValue temperature = obj.value(QStringLiteral("temperature"));
+    options.setTemperature(temperature.toDouble());
+    options.setMinP(obj.value(QStringLiteral("min_p")).toDouble());
+    options.setTopK(obj.value(QStringLiteral("top_k")).toInt());
+    options.setSeed(obj.value(QStringLiteral("seed")).toInt());
+    options.setGreedy(obj.value(QStringLiteral("greedy")).toBool()
+                      || (temperature.isDouble() && temperature.toDouble() == 0.0));
+    return options;
+}
+
+QByteArray encodePartialResponse(const QString &textSoFar)
+{
+    QJsonObject json;
+    json["action"]  = QStringLiteral("partialResponse");
+    json["content"] = textSoFar;
+    return QJsonDocument(json).toJson(QJsonDocument::Compact);
+}
+
+QByteArray encodePartialDelta(const QString &delta, int sequence, int offset, const QString &sessionId)
+{
+    QJsonObject json;
+    json["action"]   = QStringLiteral("partialResponseDelta");
+    json["content"]  = delta;
+    json["sequence"] = sequence;
+    json["offset"]   = offset;
+    if (!sessionId.isEmpty()) {
+        json["sessionId"] = sessionId;
+    }
+    return QJsonDocument(json).toJson(QJsonDocument::Compact);
+}
+
+QByteArray encodeGenerationStats(const GenerationStats &stats, const QString &sessionId)
+{
+    QJsonObject json;
+    json["action"]                 = QStringLiteral("generationStats");
+    json["promptTokens"]           = stats.promptTokens();
+    json["reusedPromptTokens"]     = stats.reusedPromptTokens();
+    json["generatedTokens"]        = stats.generatedTokens();
+    json["queueMs"]                = stats.queueMs();
+    json["prefillMs"]              = stats.prefillMs();
+    json["prefillTokensPerSecond"] = stats.prefillTokensPerSecond();
+    json["timeToFirstTokenMs"]     = stats.timeToFirstTokenMs();
+    json["meanInterTokenMs"]       = stats.meanInterTokenMs();
+    json["maxInterTokenMs"]        = stats.maxInterTokenMs();
+    json["prefillStallMs"]         = stats.prefillStallMs();
+    json["decodeTokensPerSecond"]  = stats.decodeTokensPerSecond();
+    json["draftedTokens"]          = stats.draftedTokens();
+    json["acceptedDraftTokens"]    = stats.acceptedDraftTokens();
+    json["draftAcceptanceRate"]    = stats.draftAcceptanceRate();
+    json["streamedFrames"]         = stats.streamedFrames();
+    json["framesPerToken"]         = stats.framesPerToken();
+    if (!sessionId.isEmpty()) {
+        json["sessionId"] = sessionId;
+    }
+    return QJsonDocument(json).toJson(QJsonDocument::Compact);
+}
+
+} // namespace WsMessages
@@ -0,0 +1,75 @@
+// ================================================================
+// WsMessages.h
+// ================================================================
+#ifndef WSMESSAGES_H
+#define WSMESSAGES_H
+
+#include "rep_LlamaResponseGenerator_source.h"  // LlamaChatMessage, GenerationOptions
+#include <QByteArray>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QList>
+#include <QString>
+
+/*
+  WsMessages:
+    - JSON conversions of the WebSocket protocol that run once per request
+      or once per streamed frame, kept free of sockets and engines so the
+      hot-path benchmark can measure exactly the code ClientHandler runs
+
+  WsMessages:
+    - リクエストごと、またはストリーミングのフレームごとに実行される
+      WebSocketプロトコルのJSON変換。ソケットやエンジンに依存しないため、
+      ホットパスのベンチマークでClientHandlerと同じコードを計測できる
+*/
+namespace WsMessages {
+
+/*
+  parseChatMessages(array):
+    - "messages" of a "generate" request; non-object entries are skipped
+  parseChatMessages(array):
+    - "generate"リクエストの"messages"。オブジェクト以外の要素は読み飛ばす
+*/
+QList<LlamaChatMessage> parseChatMessages(const QJsonArray &array);
+
+/*
+  parseGenerationOptions(obj):
+    - Reads the optional per-request fields of a "generate" message;
+      missing fields stay 0 (server default)
+    - "temperature": 0 is taken as greedy decoding, since 0 in
+      GenerationOptions means "server default"
+  parseGenerationOptions(obj):
+    - "generate"メッセージの任意のリクエスト別フィールドを読む。
+      無いフィールドは0 (サーバー既定値) のまま
+    - GenerationOptionsの0は「サーバー既定値」を意味するため、
+      "temperature": 0 はgreedyデコードとして扱う
+*/
+GenerationOptions parseGenerationOptions(const QJsonObject &obj);
+
+/*
+  encodePartialResponse(textSoFar):
+    - "partialResponse" message (full text so far), compact UTF-8 JSON
+  encodePartialDelta(delta, sequence, offset, sessionId):
+    - "partialResponseDelta" message, compact UTF-8 JSON; "sessionId" is
+      added for server-side sessions
+  encodePartialResponse(textSoFar):
+    - "partialResponse"メッセージ (これまでの全文)。コンパクトなUTF-8のJSON
+  encodePartialDelta(delta, sequence, offset, sessionId):
+    - "partialResponseDelta"メッセージ。コンパクトなUTF-8のJSON。
+      サーバー側セッションでは"sessionId"を追加する
+*/
+QByteArray encodePartialResponse(const QString &textSoFar);
+QByteArray encodePartialDelta(const QString &delta, int sequence, int offset,
+                              const QString &sessionId = {});
+
+/*
+  encodeGenerationStats(stats, sessionId):
+    - "generationStats" message with every GenerationStats field
+  encodeGenerationStats(stats, sessionId):
+    - GenerationStatsの全フィールドを持つ"generationStats"メッセージ
+*/
+QByteArray encodeGenerationStats(const GenerationStats &stats, const QString &sessionId = {});
+
+} // namespace WsMessages
+
+#endif // WSMESSAGES_H
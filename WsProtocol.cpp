@@ -0,0 +1,53 @@
+// ================================================================
+// WsProtocol.cpp
+// ================================================================
+#include "WsProtocol.h"
+#include <QtEndian>
+#include <cstring>
+
+namespace WsProtocol {
+
+/*
+  encode(type, sequence, byteOffset, payload):
+    - Sized up front, so the header and payload are written in place
+*/
+QByteArray encode(FrameType type, quint32 sequence, quint32 byteOffset, QByteArrayView payload)
+{
+    QByteArray frame(HeaderSize + payload.size(), Qt::Uninitialized);
+    uchar *data = reinterpret_cast<uchar *>(frame.data());
+    data[0] = Version;
+    data[1] = static_cast<quint8>(type);
+    qToLittleEndian<quint16>(0, data + 2);
+    qToLittleEndian<quint32>(sequence, data + 4);
+    qToLittleEndian<quint32>(byteOffset, data + 8);
+    if (!payload.isEmpty()) {
+        std::memcpy(data + HeaderSize, payload.data(), static_cast<size_t>(payload.size()));
+    }
+    return frame;
+}
+
+/*
+  decode(message, frame):
+    - Rejects other versions and unknown frame types
+*/
+bool decode(QByteArrayView message, Frame *frame)
+{
+    if (message.size() < HeaderSize) {
+        return false;
+    }
+    const uchar *data = reinterpret_cast<const uchar *>(message.data());
+    if (data[0] != Version) {
+        return false;
+    }
+    const quint8 type = data[1];
+    if (type < static_cast<quint8>(FrameType::Delta) || type > static_cast<quint8>(FrameType::Embeddings)) {
+        return false;
+    }
+    frame->type       = static_cast<FrameType>(type);
+    frame->sequence   = qFromLittleEndian<quint32>(data + 4);
+    frame->byteOffset = qFromLittleEndian<quint32>(data + 8);
+    frame->payload    = message.sliced(HeaderSize);
+    return true;
+}
+
+} // namespace WsProtocol
@@ -0,0 +1,84 @@
+// ================================================================
+// WsProtocol.h
+// ================================================================
+#ifndef WSPROTOCOL_H
+#define WSPROTOCOL_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QtGlobal>
+
+/*
+  WsProtocol:
+    - Binary WebSocket frames used by the "binary" streaming mode
+    - Each frame is a fixed 12-byte little-endian header followed by raw
+      UTF-8 (no JSON, no UTF-16 round trip):
+        offset 0  quint8  version (= Version)
+        offset 1  quint8  FrameType
+        offset 2  quint16 reserved (0)
+        offset 4  quint32 sequence (per generation, starts at 0)
+        offset 8  quint32 byte offset of the payload in the full response
+        offset 12 payload
+    - Embeddings frames reuse the header: sequence = the request's
+      "requestId", byte offset field = dimensions, payload = one float32
+      vector per input text (little-endian, input order)
+    - Only the token stream and embeddings use binary frames; all other
+      messages stay JSON text frames, so the two never need to be told
+      apart by content
+
+  WsProtocol:
+    - "binary"ストリーミング方式で使うWebSocketのバイナリフレーム
+    - 各フレームは12バイト固定のリトルエンディアンのヘッダと、それに続く
+      生のUTF-8 (JSONもUTF-16変換も介さない):
+        オフセット0  quint8  バージョン (= Version)
+        オフセット1  quint8  FrameType
+        オフセット2  quint16 予約 (0)
+        オフセット4  quint32 シーケンス番号 (生成ごとに0から)
+        オフセット8  quint32 全文中でのペイロードのバイト位置
+        オフセット12 ペイロード
+    - Embeddingsフレームは同じヘッダを使う: シーケンス番号 = リクエストの
+      "requestId"、バイト位置の欄 = 次元数、ペイロード = 入力テキストごとの
+      float32ベクトル (リトルエンディアン、入力順)
+    - バイナリフレームを使うのはトークンの送出と埋め込みのみ。その他の
+      メッセージはJSONのテキストフレームのままなので、内容で区別する必要は無い
+*/
+namespace WsProtocol {
+
+constexpr quint8 Version {1};
+constexpr qsizetype HeaderSize {12};
+
+enum class FrameType : quint8 {
+    Delta    = 1,  // payload: new UTF-8 text (complete characters)
+    Finished = 2,  // payload empty; byte offset = total response length
+    Embeddings = 3, // payload: float32 vectors; byte offset = dimensions
+};
+
+struct Frame
+{
+    FrameType type {FrameType::Delta};
+    quint32 sequence {0};
+    quint32 byteOffset {0};
+    QByteArrayView payload;  // points into the decoded message
+};
+
+/*
+  encode(type, sequence, byteOffset, payload):
+    - Builds one frame with a single allocation
+  encode(type, sequence, byteOffset, payload):
+    - 1回の確保でフレームを1つ組み立てる
+*/
+QByteArray encode(FrameType type, quint32 sequence, quint32 byteOffset, QByteArrayView payload = {});
+
+/*
+  decode(message, frame):
+    - Parses a received binary message; false if it is not a valid frame
+    - frame->payload stays valid as long as message does
+  decode(message, frame):
+    - 受信したバイナリメッセージを解析。正しいフレームでなければfalse
+    - frame->payloadはmessageが有効な間のみ有効
+*/
+bool decode(QByteArrayView message, Frame *frame);
+
+} // namespace WsProtocol
+
+#endif // WSPROTOCOL_H
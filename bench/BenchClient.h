@@ -0,0 +1,60 @@
+// ================================================================
+// BenchClient.h
+// ================================================================
+#ifndef BENCHCLIENT_H
+#define BENCHCLIENT_H
+
+#include "Workload.h"
+#include <QObject>
+#include <QString>
+#include <QUrl>
+
+/*
+  BenchClient:
+    - One connection to the server that runs one request at a time
+    - Subclasses speak WebSocket JSON/binary frames or QtRO; the LoadRunner
+      only sees the signals below and timestamps them itself
+    - streamed() is emitted once per partial response received, so
+      inter-token latency is measured per frame (use a flush policy of one
+      token per frame for per-token numbers)
+
+  BenchClientクラス:
+    - 一度に1リクエストを実行する、サーバーへの1接続
+    - 派生クラスがWebSocketのJSON/バイナリフレームまたはQtROで通信する。
+      LoadRunnerは下記のシグナルのみを受け取り、自身で時刻を記録する
+    - streamed()は部分レスポンスを受信するたびに1回emitされるため、
+      トークン間レイテンシはフレーム単位で計測される (トークン単位の値には
+      1トークン1フレームの送出方針を使う)
+*/
+class BenchClient : public QObject
+{
+    Q_OBJECT
+public:
+    using QObject::QObject;
+
+    /*
+      open(url):
+        - Connects; ready() or failed() follows
+      open(url):
+        - 接続する。その後ready()またはfailed()がemitされる
+    */
+    virtual void open(const QUrl &url) = 0;
+
+    /*
+      send(request):
+        - Starts a request; only called after ready() and after the previous
+          request has finished or failed
+      send(request):
+        - リクエストを開始する。ready()の後、かつ前のリクエストが
+          終了または失敗した後にのみ呼ばれる
+    */
+    virtual void send(const BenchRequest &request) = 0;
+
+signals:
+    void ready();
+    void streamed();
+    void finished(int generatedTokens);
+    void failed(const QString &reason);
+};
+
+#endif // BENCHCLIENT_H
@@ -0,0 +1,322 @@
+// ================================================================
+// HotPathBench.cpp
+// ================================================================
+#include "Conversation.h"
+#include "WsMessages.h"
+#include "llama.h"
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QtTest>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Vocab-only gguf shipped with llama.cpp (tokenizer, no weights)
+// llama.cppに同梱の語彙のみのgguf (トークナイザのみで重みは無い)
+const char *const defaultVocabPath {
+#ifdef HOTPATH_VOCAB_FILE
+    HOTPATH_VOCAB_FILE
+#else
+    ""
+#endif
+};
+
+/*
+  makeHistory(turns):
+    - System prompt plus alternating user/assistant messages of about 80
+      words each, partly non-ASCII so UTF-8 conversions are exercised
+  makeHistory(turns):
+    - システムプロンプトと、交互のuser/assistantメッセージ (各80語程度)。
+      UTF-8変換も通るよう一部を非ASCIIにする
+*/
+QList<LlamaChatMessage> makeHistory(int turns)
+{
+    const QString sentence = QStringLiteral(
+        "The lighthouse keeper wrote the weather into the log every evening, "
+        "灯台守は毎晩天気を記録した, and counted the ships passing the cape. ");
+    QList<LlamaChatMessage> history;
+    history.append(LlamaChatMessage(QStringLiteral("system"),
+                                    QStringLiteral("You are a helpful assistant.")));
+    for (int i = 0; i < turns; ++i) {
+        const QString role = (i % 2 == 0) ? QStringLiteral("user") : QStringLiteral("assistant");
+        history.append(LlamaChatMessage(role, sentence.repeated(4) + QString::number(i)));
+    }
+    return history;
+}
+
+// A "generate" request as a client sends it
+// クライアントが送る形の"generate"リクエスト
+QString makeGenerateMessage(const QList<LlamaChatMessage> &history)
+{
+    QJsonArray messages;
+    for (const LlamaChatMessage &message : history) {
+        messages.append(QJsonObject {{QStringLiteral("role"), message.role()},
+                                     {QStringLiteral("content"), message.content()}});
+    }
+    QJsonObject json;
+    json["action"]      = QStringLiteral("generate");
+    json["messages"]    = messages;
+    json["max_tokens"]  = 256;
+    json["temperature"] = 0.7;
+    json["stop"]        = QJsonArray {QStringLiteral("\n\nUser:")};
+    return QString::fromUtf8(QJsonDocument(json).toJson(QJsonDocument::Compact));
+}
+
+void addHistoryRows()
+{
+    QTest::addColumn<int>("turns");
+    for (int turns : {1, 8, 32, 128}) {
+        QTest::addRow("%d turns", turns) << turns;
+    }
+}
+
+} // namespace
+
+/*
+  HotPathBench:
+    - QBENCHMARK suite for the server's own per-request and per-token work,
+      without any model compute: WebSocket JSON parsing, message
+      conversion, chat templating and tokenization of a full history and of
+      one new turn on top of growing histories,
+      the token piece -> QString streaming path and partial-response JSON
+    - Uses a vocab-only gguf, so it runs in seconds on any machine; set
+      LLMREMOTESERVER_BENCH_VOCAB to use another one
+    - Machine-readable output via the usual Qt Test switches, e.g.
+        LLMRemoteServerHotPaths -o hotpaths.xml,xml -o -,txt
+
+  HotPathBench:
+    - モデル計算を除いた、サーバー自身のリクエストごと/トークンごとの処理の
+      QBENCHMARK群: WebSocketのJSON解析、メッセージ変換、履歴全体および
+      増えていく履歴に続く1ターンへのチャットテンプレート適用とトークナイズ、
+      トークン片からQStringへの
+      ストリーミング経路、部分レスポンスのJSON
+    - 語彙のみのggufを使うため、どのマシンでも数秒で終わる。
+      別のファイルはLLMREMOTESERVER_BENCH_VOCABで指定する
+    - Qt Testの通常のオプションで機械可読な出力が得られる。例:
+        LLMRemoteServerHotPaths -o hotpaths.xml,xml -o -,txt
+*/
+class HotPathBench : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void parseGenerateMessage_data() { addHistoryRows(); }
+    void parseGenerateMessage();
+    void prepareFullHistory_data() { addHistoryRows(); }
+    void prepareFullHistory();
+    void prepareNextTurn_data() { addHistoryRows(); }
+    void prepareNextTurn();
+    void tokenizePrompt_data() { addHistoryRows(); }
+    void tokenizePrompt();
+    void streamPieces_data();
+    void streamPieces();
+    void encodePartialDelta();
+    void encodePartialResponse_data();
+    void encodePartialResponse();
+
+private:
+    std::string formatHistory(const QList<LlamaChatMessage> &history);
+
+    llama_model *mModel {nullptr};
+};
+
+void HotPathBench::initTestCase()
+{
+    QByteArray path = qgetenv("LLMREMOTESERVER_BENCH_VOCAB");
+    if (path.isEmpty()) {
+        path = defaultVocabPath;
+    }
+    QVERIFY2(!path.isEmpty(), "no vocab file; set LLMREMOTESERVER_BENCH_VOCAB");
+
+    ggml_backend_load_all();
+    llama_model_params params = llama_model_default_params();
+    params.vocab_only = true;
+    mModel = llama_load_model_from_file(path.constData(), params);
+    QVERIFY2(mModel, path.constData());
+}
+
+void HotPathBench::cleanupTestCase()
+{
+    if (mModel) {
+        llama_free_model(mModel);
+        mModel = nullptr;
+    }
+}
+
+/*
+  parseGenerateMessage():
+    - What ClientHandler::onTextMessageReceived does before queuing a
+      "generate" to the engine
+*/
+void HotPathBench::parseGenerateMessage()
+{
+    QFETCH(int, turns);
+    const QString message = makeGenerateMessage(makeHistory(turns));
+
+    QBENCHMARK {
+        const QJsonObject obj = QJsonDocument::fromJson(message.toUtf8()).object();
+        const QString action  = obj.value(QStringLiteral("action")).toString();
+        const QList<LlamaChatMessage> messages =
+            WsMessages::parseChatMessages(obj.value(QStringLiteral("messages")).toArray());
+        const GenerationOptions options = WsMessages::parseGenerationOptions(obj);
+        QCOMPARE(messages.size(), turns + 1);
+        Q_UNUSED(action)
+        Q_UNUSED(options)
+    }
+}
+
+/*
+  prepareFullHistory():
+    - A whole history templated and tokenized at once: the first turn of a
+      conversation (every turn, before turns were made incremental)
+*/
+void HotPathBench::prepareFullHistory()
+{
+    QFETCH(int, turns);
+    const QList<LlamaChatMessage> history = makeHistory(turns);
+
+    QBENCHMARK {
+        Conversation conversation;
+        conversation.reset(mModel);
+        Conversation::Turn turn;
+        QVERIFY(conversation.prepare(history, &turn));
+    }
+}
+
+/*
+  prepareNextTurn():
+    - One new user message on top of a committed history; should not
+      depend on the history length
+*/
+void HotPathBench::prepareNextTurn()
+{
+    QFETCH(int, turns);
+    const QList<LlamaChatMessage> history = makeHistory(turns);
+    const QList<LlamaChatMessage> next {
+        LlamaChatMessage(QStringLiteral("user"), QStringLiteral("And what happened the next morning?"))};
+
+    Conversation conversation;
+    conversation.reset(mModel);
+    Conversation::Turn turn;
+    QVERIFY(conversation.prepare(history, &turn));
+    conversation.commit(turn);
+    // The first later turn decides whether the template is separable
+    // 最初の後続ターンでテンプレートが分割可能かを判定する
+    QVERIFY(conversation.prepare(next, &turn));
+
+    QBENCHMARK {
+        QVERIFY(conversation.prepare(next, &turn));
+    }
+}
+
+/*
+  tokenizePrompt():
+    - Single pass over the templated history into a buffer sized from the
+      byte count, as in Conversation
+*/
+void HotPathBench::tokenizePrompt()
+{
+    QFETCH(int, turns);
+    const std::string prompt = formatHistory(makeHistory(turns));
+
+    QBENCHMARK {
+        std::vector<llama_token> tokens(prompt.size() + 2);
+        QVERIFY(llama_tokenize(mModel, prompt.c_str(), static_cast<int32_t>(prompt.size()),
+                               tokens.data(), static_cast<int32_t>(tokens.size()),
+                               /*add_special=*/true, /*parse_special=*/true) >= 0);
+    }
+}
+
+void HotPathBench::streamPieces_data()
+{
+    QTest::addColumn<bool>("fullText");
+    QTest::addRow("delta") << false;
+    QTest::addRow("full text") << true;
+}
+
+/*
+  streamPieces():
+    - One 512-token response streamed token by token: llama_token_to_piece
+      and the QString conversion of the delta (Delta mode) or of the whole
+      response so far (FullText mode)
+*/
+void HotPathBench::streamPieces()
+{
+    QFETCH(bool, fullText);
+    const std::string text = formatHistory(makeHistory(8));
+    std::vector<llama_token> tokens(text.size() + 1);
+    const int count = llama_tokenize(mModel, text.c_str(), static_cast<int32_t>(text.size()),
+                                     tokens.data(), static_cast<int32_t>(tokens.size()),
+                                     /*add_special=*/false, /*parse_special=*/false);
+    QVERIFY(count > 0);
+    tokens.resize(std::min<size_t>(static_cast<size_t>(count), 512));
+
+    QBENCHMARK {
+        std::string response;
+        qsizetype converted = 0;
+        for (llama_token token : tokens) {
+            char buf[256];
+            const int n = llama_token_to_piece(mModel, token, buf, sizeof(buf), /*lstrip=*/0, /*special=*/true);
+            if (n <= 0) {
+                continue;
+            }
+            const std::string piece(buf, static_cast<size_t>(n));
+            response += piece;
+            converted += fullText ? QString::fromStdString(response).size()
+                                  : QString::fromStdString(piece).size();
+        }
+        QVERIFY(converted > 0);
+    }
+}
+
+void HotPathBench::encodePartialDelta()
+{
+    const QString delta = QStringLiteral(" keeper 灯台");
+    int sequence = 0;
+
+    QBENCHMARK {
+        const QByteArray json = WsMessages::encodePartialDelta(delta, sequence, sequence * 9);
+        ++sequence;
+        QVERIFY(!json.isEmpty());
+    }
+}
+
+void HotPathBench::encodePartialResponse_data()
+{
+    QTest::addColumn<int>("length");
+    for (int length : {256, 4096, 16384}) {
+        QTest::addRow("%d chars", length) << length;
+    }
+}
+
+void HotPathBench::encodePartialResponse()
+{
+    QFETCH(int, length);
+    const QString text = QStringLiteral("灯台守は毎晩天気を記録した。 The keeper logged the weather. ")
+                             .repeated(length / 40 + 1)
+                             .left(length);
+
+    QBENCHMARK {
+        const QByteArray json = WsMessages::encodePartialResponse(text);
+        QVERIFY(!json.isEmpty());
+    }
+}
+
+// Whole history templated once, outside of any measurement
+// 計測の外で、履歴全体に一度だけテンプレートを適用
+std::string HotPathBench::formatHistory(const QList<LlamaChatMessage> &history)
+{
+    Conversation conversation;
+    conversation.reset(mModel);
+    Conversation::Turn turn;
+    return conversation.prepare(history, &turn) ? turn.text : std::string();
+}
+
+QTEST_GUILESS_MAIN(HotPathBench)
+#include "HotPathBench.moc"
@@ -0,0 +1,43 @@
+# ----------------------------------------------------------------------------
+# ホットパスのマイクロベンチマーク (Qt Test の QBENCHMARK、語彙のみの gguf を使用)
+# Hot-path micro-benchmarks (Qt Test QBENCHMARK over a vocab-only gguf)
+# ----------------------------------------------------------------------------
+# サーバー本体と同じ条件でビルドする (トップレベルの CMakeLists.txt から include)
+# Built under the same conditions as the server (included from the top-level CMakeLists.txt)
+find_package(Qt6 6.8 REQUIRED COMPONENTS Test)
+
+set(HOTPATH_SERVER_SOURCES ${LLMREMOTESERVER_SOURCES})
+list(TRANSFORM HOTPATH_SERVER_SOURCES PREPEND "${PROJECT_SOURCE_DIR}/")
+
+qt_add_executable(LLMRemoteServerHotPaths
+    ${PROJECT_SOURCE_DIR}/bench/HotPathBench.cpp
+    ${HOTPATH_SERVER_SOURCES}
+)
+
+target_compile_definitions(LLMRemoteServerHotPaths PRIVATE
+    LLAMA_MODEL_FILE="${LLAMA_MODEL_NAME}"
+    HOTPATH_VOCAB_FILE="${LLAMA_SOURCE_DIR}/models/ggml-vocab-llama-bpe.gguf"
+)
+
+qt6_add_repc_sources(LLMRemoteServerHotPaths
+    ${PROJECT_SOURCE_DIR}/QtRemoteObjectsFiles/LlamaResponseGenerator.rep
+    ${PROJECT_SOURCE_DIR}/QtRemoteObjectsFiles/WorkerStatus.rep
+)
+
+target_include_directories(LLMRemoteServerHotPaths PRIVATE
+    ${PROJECT_SOURCE_DIR}
+    ${PROJECT_SOURCE_DIR}/3rdparty/llama.cpp/include
+    ${PROJECT_SOURCE_DIR}/3rdparty/llama.cpp/ggml/include
+)
+
+target_link_libraries(LLMRemoteServerHotPaths PRIVATE
+    Qt6::Core
+    Qt6::Network
+    Qt6::RemoteObjects
+    Qt6::Concurrent
+    Qt6::WebSockets
+    Qt6::Test
+    ${LLAMA_LIB}
+    ${GGML_LIB}
+    ${GGML_CPU_LIB}
+)
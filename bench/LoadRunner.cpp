@@ -0,0 +1,313 @@
+// ================================================================
+// LoadRunner.cpp
+// ================================================================
+#include "LoadRunner.h"
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace {
+
+struct Summary
+{
+    size_t count {0};
+    double mean {0};
+    double p50 {0};
+    double p95 {0};
+    double p99 {0};
+    double max {0};
+};
+
+// Nearest-rank percentiles; the input is sorted in place
+// 最近順位法によるパーセンタイル。入力はその場でソートする
+Summary summarize(std::vector<double> &values)
+{
+    Summary summary;
+    if (values.empty()) {
+        return summary;
+    }
+    std::sort(values.begin(), values.end());
+    auto percentile = [&values](double p) {
+        const size_t rank = static_cast<size_t>(std::ceil(p * static_cast<double>(values.size())));
+        return values[std::clamp<size_t>(rank, 1, values.size()) - 1];
+    };
+
+    double sum = 0;
+    for (double value : values) {
+        sum += value;
+    }
+    summary.count = values.size();
+    summary.mean  = sum / static_cast<double>(values.size());
+    summary.p50   = percentile(0.50);
+    summary.p95   = percentile(0.95);
+    summary.p99   = percentile(0.99);
+    summary.max   = values.back();
+    return summary;
+}
+
+QJsonObject toJson(const Summary &summary)
+{
+    QJsonObject json;
+    json["count"] = static_cast<qint64>(summary.count);
+    json["mean"]  = summary.mean;
+    json["p50"]   = summary.p50;
+    json["p95"]   = summary.p95;
+    json["p99"]   = summary.p99;
+    json["max"]   = summary.max;
+    return json;
+}
+
+constexpr double nsPerMs {1e6};
+
+} // namespace
+
+LoadRunner::LoadRunner(const QList<BenchRequest> &workload, const Options &options, QObject *parent)
+    : QObject(parent)
+    , mWorkload(workload)
+    , mOptions(options)
+{
+    if (mOptions.requestCount <= 0) {
+        mOptions.requestCount = static_cast<int>(mWorkload.size());
+    }
+    mArrivalTimer.setSingleShot(true);
+    mArrivalTimer.setTimerType(Qt::PreciseTimer);
+    connect(&mArrivalTimer, &QTimer::timeout, this, &LoadRunner::onArrivalTimer);
+}
+
+void LoadRunner::start(const QList<BenchClient *> &clients)
+{
+    mClients = clients;
+    mRunning = QList<int>(clients.size(), -1);
+    mSamples.assign(static_cast<size_t>(mOptions.requestCount), Sample {});
+
+    for (int i = 0; i < mClients.size(); ++i) {
+        BenchClient *client = mClients.at(i);
+        connect(client, &BenchClient::streamed, this, [this, i]() {
+            const int index = mRunning.at(i);
+            if (index < 0) {
+                return;
+            }
+            Sample &sample    = mSamples[static_cast<size_t>(index)];
+            const qint64 now  = mClock.nsecsElapsed();
+            if (sample.firstNs < 0) {
+                sample.firstNs = now;
+            } else {
+                mInterTokenMs.push_back(static_cast<double>(now - sample.lastNs) / nsPerMs);
+            }
+            sample.lastNs = now;
+        });
+        connect(client, &BenchClient::finished, this, [this, i](int generatedTokens) {
+            complete(i, true, generatedTokens, {});
+        });
+        connect(client, &BenchClient::failed, this, [this, i](const QString &reason) {
+            complete(i, false, 0, reason);
+        });
+    }
+
+    scheduleArrivals();
+    mClock.start();
+    onArrivalTimer();
+}
+
+/*
+  scheduleArrivals():
+    - Precomputed so the schedule does not depend on how fast the loop runs
+*/
+void LoadRunner::scheduleArrivals()
+{
+    const size_t count = mSamples.size();
+    mArrivalNs.assign(count, 0);
+
+    if (mOptions.arrival == Arrival::Recorded) {
+        double firstOffset = -1;
+        for (size_t i = 0; i < count; ++i) {
+            const double offset = mWorkload.at(static_cast<qsizetype>(i % mWorkload.size())).offsetMs;
+            if (offset >= 0 && (firstOffset < 0 || offset < firstOffset)) {
+                firstOffset = offset;
+            }
+        }
+        // Repeated passes over the workload follow each other back to back
+        // ワークロードを繰り返す場合は前の周回の直後に続ける
+        double passStart = 0;
+        double lastArrival = 0;
+        for (size_t i = 0; i < count; ++i) {
+            const size_t entry = i % static_cast<size_t>(mWorkload.size());
+            if (entry == 0 && i > 0) {
+                passStart = lastArrival;
+            }
+            const double offset = mWorkload.at(static_cast<qsizetype>(entry)).offsetMs;
+            lastArrival = passStart + std::max(0.0, offset - firstOffset) / mOptions.speed;
+            mArrivalNs[i] = static_cast<qint64>(lastArrival * nsPerMs);
+        }
+        std::sort(mArrivalNs.begin(), mArrivalNs.end());
+        return;
+    }
+
+    if (mOptions.ratePerSecond <= 0) {
+        return;
+    }
+    const double meanGapNs = 1e9 / mOptions.ratePerSecond;
+    std::mt19937 random(mOptions.seed);
+    std::exponential_distribution<double> exponential(1.0);
+    double at = 0;
+    for (size_t i = 0; i < count; ++i) {
+        mArrivalNs[i] = static_cast<qint64>(at);
+        at += (mOptions.arrival == Arrival::Poisson) ? meanGapNs * exponential(random) : meanGapNs;
+    }
+}
+
+/*
+  onArrivalTimer():
+    - Admits every request whose arrival time has passed, then sleeps until
+      the next one
+*/
+void LoadRunner::onArrivalTimer()
+{
+    const qint64 now = mClock.nsecsElapsed();
+    while (mNextArrival < mArrivalNs.size() && mArrivalNs[mNextArrival] <= now) {
+        mSamples[mNextArrival].arrivalNs = mArrivalNs[mNextArrival];
+        mPending.enqueue(static_cast<int>(mNextArrival));
+        ++mNextArrival;
+    }
+    dispatch();
+
+    if (mNextArrival < mArrivalNs.size()) {
+        const qint64 waitNs = mArrivalNs[mNextArrival] - mClock.nsecsElapsed();
+        mArrivalTimer.start(static_cast<int>(std::max<qint64>(0, waitNs / 1000000)));
+    }
+}
+
+void LoadRunner::dispatch()
+{
+    for (int i = 0; i < mClients.size() && !mPending.isEmpty(); ++i) {
+        if (mRunning.at(i) >= 0) {
+            continue;
+        }
+        const int index = mPending.dequeue();
+        mRunning[i] = index;
+        mSamples[static_cast<size_t>(index)].sentNs = mClock.nsecsElapsed();
+        mClients.at(i)->send(mWorkload.at(index % mWorkload.size()));
+    }
+}
+
+void LoadRunner::complete(int clientIndex, bool ok, int generatedTokens, const QString &error)
+{
+    const int index = mRunning.at(clientIndex);
+    if (index < 0) {
+        return;
+    }
+    mRunning[clientIndex] = -1;
+
+    Sample &sample = mSamples[static_cast<size_t>(index)];
+    sample.endNs           = mClock.nsecsElapsed();
+    sample.ok              = ok;
+    sample.generatedTokens = generatedTokens;
+    sample.error           = error;
+    if (!ok) {
+        qWarning() << "[LoadRunner] Request" << index << "failed:" << error;
+    }
+
+    ++mCompleted;
+    if (mCompleted == static_cast<int>(mSamples.size())) {
+        emit finished();
+        return;
+    }
+    dispatch();
+}
+
+/*
+  report():
+    - Throughput spans from the first arrival to the last completion
+*/
+QJsonObject LoadRunner::report() const
+{
+    std::vector<double> ttft;
+    std::vector<double> endToEnd;
+    std::vector<double> queueWait;
+    std::vector<double> interToken = mInterTokenMs;
+    qint64 generatedTokens = 0;
+    qint64 lastEndNs       = 0;
+    int failures           = 0;
+    QJsonObject errors;
+
+    for (const Sample &sample : mSamples) {
+        lastEndNs = std::max(lastEndNs, sample.endNs);
+        if (!sample.ok) {
+            ++failures;
+            errors[sample.error] = errors.value(sample.error).toInt() + 1;
+            continue;
+        }
+        generatedTokens += sample.generatedTokens;
+        queueWait.push_back(static_cast<double>(sample.sentNs - sample.arrivalNs) / nsPerMs);
+        endToEnd.push_back(static_cast<double>(sample.endNs - sample.arrivalNs) / nsPerMs);
+        if (sample.firstNs >= 0) {
+            ttft.push_back(static_cast<double>(sample.firstNs - sample.arrivalNs) / nsPerMs);
+        }
+    }
+
+    const double wallSeconds = static_cast<double>(lastEndNs) / 1e9;
+    QJsonObject json;
+    json["requests"]          = static_cast<int>(mSamples.size());
+    json["succeeded"]         = static_cast<int>(mSamples.size()) - failures;
+    json["failed"]            = failures;
+    json["clients"]           = static_cast<int>(mClients.size());
+    json["wallSeconds"]       = wallSeconds;
+    json["generatedTokens"]   = generatedTokens;
+    json["tokensPerSecond"]   = wallSeconds > 0 ? static_cast<double>(generatedTokens) / wallSeconds : 0.0;
+    json["requestsPerSecond"] = wallSeconds > 0
+                                    ? static_cast<double>(json.value("succeeded").toInt()) / wallSeconds
+                                    : 0.0;
+    json["timeToFirstTokenMs"] = toJson(summarize(ttft));
+    json["interTokenMs"]       = toJson(summarize(interToken));
+    json["endToEndMs"]         = toJson(summarize(endToEnd));
+    json["queueWaitMs"]        = toJson(summarize(queueWait));
+    if (!errors.isEmpty()) {
+        json["errors"] = errors;
+    }
+    return json;
+}
+
+void LoadRunner::printTable(QTextStream &out) const
+{
+    const QJsonObject json = report();
+
+    out << QStringLiteral("requests %1 (ok %2, failed %3), clients %4, %5 s\n")
+               .arg(json.value("requests").toInt())
+               .arg(json.value("succeeded").toInt())
+               .arg(json.value("failed").toInt())
+               .arg(json.value("clients").toInt())
+               .arg(json.value("wallSeconds").toDouble(), 0, 'f', 2);
+    out << QStringLiteral("generated tokens %1, %2 tok/s, %3 req/s\n\n")
+               .arg(json.value("generatedTokens").toInteger())
+               .arg(json.value("tokensPerSecond").toDouble(), 0, 'f', 1)
+               .arg(json.value("requestsPerSecond").toDouble(), 0, 'f', 2);
+
+    out << QStringLiteral("%1 %2 %3 %4 %5 %6 %7\n")
+               .arg(QStringLiteral("latency (ms)"), -16)
+               .arg(QStringLiteral("count"), 8)
+               .arg(QStringLiteral("mean"), 10)
+               .arg(QStringLiteral("p50"), 10)
+               .arg(QStringLiteral("p95"), 10)
+               .arg(QStringLiteral("p99"), 10)
+               .arg(QStringLiteral("max"), 10);
+
+    const std::pair<const char *, const char *> rows[] = {
+        {"ttft", "timeToFirstTokenMs"},
+        {"inter-token", "interTokenMs"},
+        {"end-to-end", "endToEndMs"},
+        {"queue wait", "queueWaitMs"},
+    };
+    for (const auto &[label, key] : rows) {
+        const QJsonObject row = json.value(QLatin1String(key)).toObject();
+        out << QStringLiteral("%1 %2 %3 %4 %5 %6 %7\n")
+                   .arg(QLatin1String(label), -16)
+                   .arg(row.value("count").toInteger(), 8)
+                   .arg(row.value("mean").toDouble(), 10, 'f', 1)
+                   .arg(row.value("p50").toDouble(), 10, 'f', 1)
+                   .arg(row.value("p95").toDouble(), 10, 'f', 1)
+                   .arg(row.value("p99").toDouble(), 10, 'f', 1)
+                   .arg(row.value("max").toDouble(), 10, 'f', 1);
+    }
+    out.flush();
+}
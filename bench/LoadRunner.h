@@ -0,0 +1,119 @@
+// ================================================================
+// LoadRunner.h
+// ================================================================
+#ifndef LOADRUNNER_H
+#define LOADRUNNER_H
+
+#include "BenchClient.h"
+#include "Workload.h"
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QList>
+#include <QObject>
+#include <QQueue>
+#include <QTextStream>
+#include <QTimer>
+#include <vector>
+
+/*
+  LoadRunner:
+    - Replays a workload against a set of connected BenchClients
+    - Open-loop arrivals: requests arrive on a schedule (fixed rate,
+      Poisson, or the recorded offsets) whether or not a client is free,
+      and wait in a queue until one is; latencies are measured from the
+      scheduled arrival, so queueing in the benchmark counts too
+      (no coordinated omission). Rate 0 sends everything at once
+    - Reports p50/p95/p99 of time to first token, inter-token gap and
+      end-to-end latency, plus aggregate generated tokens per second
+
+  LoadRunnerクラス:
+    - 接続済みのBenchClient群に対してワークロードを再生する
+    - オープンループの到着: クライアントの空きに関係なく、スケジュール
+      (固定レート、ポアソン、または記録された時刻) どおりにリクエストが
+      到着し、空くまでキューで待つ。レイテンシは予定到着時刻から測るため、
+      ベンチマーク内の待ちも含まれる (coordinated omissionを避ける)。
+      レート0は全てを一度に送る
+    - 最初のトークンまでの時間、トークン間隔、エンドツーエンドの
+      レイテンシのp50/p95/p99と、生成トークン数/秒の合計を報告する
+*/
+class LoadRunner : public QObject
+{
+    Q_OBJECT
+public:
+    enum class Arrival { Uniform, Poisson, Recorded };
+
+    struct Options
+    {
+        int requestCount {0};          // 0 = every workload entry once; cycles otherwise
+        double ratePerSecond {0};      // Uniform/Poisson; 0 = all at once
+        Arrival arrival {Arrival::Uniform};
+        double speed {1.0};            // Recorded: offsets divided by this
+        quint32 seed {1};              // Poisson arrivals
+    };
+
+    LoadRunner(const QList<BenchRequest> &workload, const Options &options,
+               QObject *parent = nullptr);
+
+    /*
+      start(clients):
+        - Clients must already be ready; finished() is emitted when every
+          request has completed or failed
+      start(clients):
+        - クライアントはready済みであること。全リクエストが完了または
+          失敗するとfinished()をemitする
+    */
+    void start(const QList<BenchClient *> &clients);
+
+    /*
+      report():
+        - Summary as JSON (all times in milliseconds)
+      printTable(out):
+        - The same summary as a text table
+      report():
+        - JSON形式の集計結果 (時間は全てミリ秒)
+      printTable(out):
+        - 同じ集計結果をテキストの表で出力
+    */
+    QJsonObject report() const;
+    void printTable(QTextStream &out) const;
+
+signals:
+    void finished();
+
+private slots:
+    void onArrivalTimer();
+
+private:
+    struct Sample
+    {
+        qint64 arrivalNs {0};
+        qint64 sentNs {-1};
+        qint64 firstNs {-1};
+        qint64 lastNs {-1};
+        qint64 endNs {-1};
+        int generatedTokens {0};
+        bool ok {false};
+        QString error;
+    };
+
+    void scheduleArrivals();
+    void dispatch();
+    void complete(int clientIndex, bool ok, int generatedTokens, const QString &error);
+
+    QList<BenchRequest> mWorkload;
+    Options mOptions;
+
+    QList<BenchClient *> mClients;
+    QList<int> mRunning;             // sample index per client (-1 = idle)
+    QQueue<int> mPending;            // arrived samples waiting for a client
+    std::vector<Sample> mSamples;
+    std::vector<double> mInterTokenMs;
+    std::vector<qint64> mArrivalNs;  // schedule, ascending
+    size_t mNextArrival {0};
+    int mCompleted {0};
+
+    QElapsedTimer mClock;
+    QTimer mArrivalTimer;
+};
+
+#endif // LOADRUNNER_H
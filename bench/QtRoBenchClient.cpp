@@ -0,0 +1,116 @@
+// ================================================================
+// QtRoBenchClient.cpp
+// ================================================================
+#include "QtRoBenchClient.h"
+#include <QJsonArray>
+
+QtRoBenchClient::QtRoBenchClient(bool perTokenFrames, QObject *parent)
+    : BenchClient(parent)
+    , m_perTokenFrames(perTokenFrames)
+{
+}
+
+/*
+  open(url):
+    - ready() follows once the replica has received the source's properties
+*/
+void QtRoBenchClient::open(const QUrl &url)
+{
+    if (!m_node.connectToNode(url)) {
+        emit failed(QStringLiteral("cannot connect to %1").arg(url.toString()));
+        return;
+    }
+    m_replica.reset(m_node.acquire<LlamaResponseGeneratorReplica>());
+
+    connect(m_replica.data(), &LlamaResponseGeneratorReplica::initialized,
+            this, &QtRoBenchClient::onInitialized);
+    connect(m_replica.data(), &LlamaResponseGeneratorReplica::partialResponseDelta,
+            this, [this]() {
+                if (m_busy) {
+                    emit streamed();
+                }
+            });
+    connect(m_replica.data(), &LlamaResponseGeneratorReplica::generationStats,
+            this, &QtRoBenchClient::onGenerationStats);
+    connect(m_replica.data(), &LlamaResponseGeneratorReplica::generationFinished,
+            this, &QtRoBenchClient::onGenerationFinished);
+    connect(m_replica.data(), &LlamaResponseGeneratorReplica::generationError,
+            this, &QtRoBenchClient::onFailed);
+    connect(m_replica.data(), &LlamaResponseGeneratorReplica::requestRejected,
+            this, [this](const QString &reason) { onFailed(QStringLiteral("rejected: ") + reason); });
+    connect(m_replica.data(), &LlamaResponseGeneratorReplica::generationCancelled,
+            this, [this]() { onFailed(QStringLiteral("cancelled")); });
+}
+
+/*
+  send(request):
+    - Translates the WebSocket field names back into GenerationOptions
+      (0 = server default, as on the server side)
+*/
+void QtRoBenchClient::send(const BenchRequest &request)
+{
+    m_busy            = true;
+    m_generatedTokens = 0;
+
+    QList<LlamaChatMessage> messages;
+    for (const QJsonValue &value : request.body.value(QStringLiteral("messages")).toArray()) {
+        const QJsonObject obj = value.toObject();
+        messages.append(LlamaChatMessage(obj.value(QStringLiteral("role")).toString(),
+                                         obj.value(QStringLiteral("content")).toString()));
+    }
+
+    const QJsonObject &body = request.body;
+    GenerationOptions options;
+    options.setMaxTokens(body.value(QStringLiteral("max_tokens")).toInt());
+    const QJsonValue stop = body.value(QStringLiteral("stop"));
+    if (stop.isString()) {
+        options.setStop({stop.toString()});
+    } else {
+        QStringList stopStrings;
+        for (const QJsonValue &entry : stop.toArray()) {
+            stopStrings.append(entry.toString());
+        }
+        options.setStop(stopStrings);
+    }
+    options.setTemperature(body.value(QStringLiteral("temperature")).toDouble());
+    options.setMinP(body.value(QStringLiteral("min_p")).toDouble());
+    options.setTopK(body.value(QStringLiteral("top_k")).toInt());
+    options.setSeed(body.value(QStringLiteral("seed")).toInt());
+    options.setGreedy(body.value(QStringLiteral("greedy")).toBool()
+                      || (body.contains(QStringLiteral("temperature")) && options.temperature() <= 0));
+
+    // Per request, so the global streamingMode / flush policy stay untouched
+    // リクエストごとに指定し、グローバルなstreamingMode / 送出方針は変更しない
+    const StreamOptions stream = m_perTokenFrames ? StreamOptions(true, 0, 1, false)
+                                                  : StreamOptions(true, -1, -1, true);
+    m_replica->generateStreamed(body.value(QStringLiteral("model")).toString(), messages, options, stream);
+}
+
+void QtRoBenchClient::onInitialized()
+{
+    emit ready();
+}
+
+void QtRoBenchClient::onGenerationStats(const GenerationStats &stats)
+{
+    m_generatedTokens = stats.generatedTokens();
+}
+
+void QtRoBenchClient::onGenerationFinished(const QString &finalResponse)
+{
+    Q_UNUSED(finalResponse)
+    if (!m_busy) {
+        return;
+    }
+    m_busy = false;
+    emit finished(m_generatedTokens);
+}
+
+void QtRoBenchClient::onFailed(const QString &reason)
+{
+    if (!m_busy) {
+        return;
+    }
+    m_busy = false;
+    emit failed(reason);
+}
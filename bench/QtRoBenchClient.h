@@ -0,0 +1,48 @@
+// ================================================================
+// QtRoBenchClient.h
+// ================================================================
+#ifndef QTROBENCHCLIENT_H
+#define QTROBENCHCLIENT_H
+
+#include "BenchClient.h"
+#include "rep_LlamaResponseGenerator_replica.h"
+#include <QRemoteObjectNode>
+#include <QScopedPointer>
+
+/*
+  QtRoBenchClient:
+    - BenchClient over the Qt Remote Objects source (tcp://host:12345)
+    - Uses generateStreamed() with Delta streaming per request
+    - The source has one engine shared by every replica, so its signals
+      reach all of them; the runner therefore uses a single QtRO client
+
+  QtRoBenchClientクラス:
+    - Qt Remote Objectsのソース (tcp://host:12345) 用のBenchClient
+    - generateStreamed()でリクエストごとにDeltaストリーミングを指定する
+    - ソースは全レプリカで1つのエンジンを共有し、シグナルも全レプリカに
+      届くため、ランナーはQtROクライアントを1つだけ使う
+*/
+class QtRoBenchClient : public BenchClient
+{
+    Q_OBJECT
+public:
+    explicit QtRoBenchClient(bool perTokenFrames, QObject *parent = nullptr);
+
+    void open(const QUrl &url) override;
+    void send(const BenchRequest &request) override;
+
+private slots:
+    void onInitialized();
+    void onGenerationStats(const GenerationStats &stats);
+    void onGenerationFinished(const QString &finalResponse);
+    void onFailed(const QString &reason);
+
+private:
+    bool m_perTokenFrames {true};
+    QRemoteObjectNode m_node;
+    QScopedPointer<LlamaResponseGeneratorReplica> m_replica;
+    bool m_busy {false};
+    int m_generatedTokens {0};
+};
+
+#endif // QTROBENCHCLIENT_H
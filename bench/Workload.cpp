@@ -0,0 +1,76 @@
+// ================================================================
+// Workload.cpp
+// ================================================================
+#include "Workload.h"
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+
+namespace Workload {
+
+/*
+  load(path, requests, errorMessage):
+    - Keys other than offset_ms and transport are passed through untouched,
+      so options added to the server later replay without changes here
+*/
+bool load(const QString &path, QList<BenchRequest> *requests, QString *errorMessage)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        if (errorMessage) {
+            *errorMessage = file.errorString();
+        }
+        return false;
+    }
+
+    int lineNumber = 0;
+    while (!file.atEnd()) {
+        const QByteArray line = file.readLine().trimmed();
+        ++lineNumber;
+        if (line.isEmpty() || line.startsWith('#')) {
+            continue;
+        }
+
+        QJsonParseError parseError;
+        const QJsonDocument doc = QJsonDocument::fromJson(line, &parseError);
+        if (!doc.isObject() || !doc.object().value(QStringLiteral("messages")).isArray()) {
+            if (errorMessage) {
+                *errorMessage = QStringLiteral("line %1: %2").arg(lineNumber).arg(
+                    doc.isObject() ? QStringLiteral("\"messages\" must be an array")
+                                   : parseError.errorString());
+            }
+            return false;
+        }
+
+        BenchRequest request;
+        request.body     = doc.object();
+        request.offsetMs = request.body.value(QStringLiteral("offset_ms")).toDouble(-1);
+        request.body.remove(QStringLiteral("offset_ms"));
+        request.body.remove(QStringLiteral("transport"));
+        requests->append(request);
+    }
+
+    if (requests->isEmpty()) {
+        if (errorMessage) {
+            *errorMessage = QStringLiteral("no requests");
+        }
+        return false;
+    }
+    return true;
+}
+
+BenchRequest fromPrompt(const QString &prompt, int maxTokens)
+{
+    QJsonObject message;
+    message["role"]    = QStringLiteral("user");
+    message["content"] = prompt;
+
+    BenchRequest request;
+    request.body["messages"] = QJsonArray {message};
+    if (maxTokens > 0) {
+        request.body["max_tokens"] = maxTokens;
+    }
+    return request;
+}
+
+} // namespace Workload
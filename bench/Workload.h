@@ -0,0 +1,51 @@
+// ================================================================
+// Workload.h
+// ================================================================
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <QJsonObject>
+#include <QList>
+#include <QString>
+
+/*
+  BenchRequest:
+    - One request to replay; body holds the WebSocket "generate" fields
+      ("messages", "model", "max_tokens", "stop", "temperature", ...)
+    - offsetMs is the recorded arrival time (-1 = not recorded)
+
+  BenchRequest構造体:
+    - 再生する1リクエスト。bodyはWebSocketの"generate"のフィールド
+      ("messages", "model", "max_tokens", "stop", "temperature", ...)
+    - offsetMsは記録された到着時刻 (-1 = 記録なし)
+*/
+struct BenchRequest
+{
+    QJsonObject body;
+    double offsetMs {-1};
+};
+
+namespace Workload {
+
+/*
+  load(path, requests, errorMessage):
+    - Reads a JSONL file, one request per line (the format written by the
+      server's --record-traffic); blank lines and lines starting with '#'
+      are skipped
+  load(path, requests, errorMessage):
+    - 1行1リクエストのJSONLファイルを読み込む (サーバーの--record-traffic
+      が書き出す形式)。空行と'#'で始まる行は読み飛ばす
+*/
+bool load(const QString &path, QList<BenchRequest> *requests, QString *errorMessage = nullptr);
+
+/*
+  fromPrompt(prompt, maxTokens):
+    - Single-turn request used when no workload file is given
+  fromPrompt(prompt, maxTokens):
+    - ワークロードファイルが無い場合に使う1ターンのリクエスト
+*/
+BenchRequest fromPrompt(const QString &prompt, int maxTokens);
+
+} // namespace Workload
+
+#endif // WORKLOAD_H
@@ -0,0 +1,113 @@
+// ================================================================
+// WsBenchClient.cpp
+// ================================================================
+#include "WsBenchClient.h"
+#include "WsProtocol.h"
+#include <QJsonDocument>
+
+WsBenchClient::WsBenchClient(const Options &options, QObject *parent)
+    : BenchClient(parent)
+    , m_options(options)
+{
+    connect(&m_socket, &QWebSocket::connected, this, &WsBenchClient::onConnected);
+    connect(&m_socket, &QWebSocket::textMessageReceived,
+            this, &WsBenchClient::onTextMessageReceived);
+    connect(&m_socket, &QWebSocket::binaryMessageReceived,
+            this, &WsBenchClient::onBinaryMessageReceived);
+    connect(&m_socket, &QWebSocket::errorOccurred, this, &WsBenchClient::onErrorOccurred);
+}
+
+void WsBenchClient::open(const QUrl &url)
+{
+    m_socket.open(url);
+}
+
+/*
+  send(request):
+    - The workload body already uses the "generate" field names
+*/
+void WsBenchClient::send(const BenchRequest &request)
+{
+    m_busy            = true;
+    m_generatedTokens = 0;
+    if (m_options.reinitBeforeRequest) {
+        sendJson({{QStringLiteral("action"), QStringLiteral("reinit")}});
+    }
+
+    QJsonObject json = request.body;
+    json["action"] = QStringLiteral("generate");
+    sendJson(json);
+}
+
+/*
+  onConnected():
+    - Applies the streaming settings once; they last for the connection
+*/
+void WsBenchClient::onConnected()
+{
+    sendJson({{QStringLiteral("action"), QStringLiteral("setStreamingMode")},
+              {QStringLiteral("mode"), m_options.binary ? QStringLiteral("binary")
+                                                        : QStringLiteral("delta")}});
+    if (m_options.perTokenFrames) {
+        sendJson({{QStringLiteral("action"), QStringLiteral("setFlushPolicy")},
+                  {QStringLiteral("immediate"), true}});
+    }
+    emit ready();
+}
+
+void WsBenchClient::onTextMessageReceived(const QString &message)
+{
+    const QJsonObject obj = QJsonDocument::fromJson(message.toUtf8()).object();
+    const QString action  = obj.value(QStringLiteral("action")).toString();
+
+    if (!m_busy) {
+        return;
+    }
+    if (action == QLatin1String("partialResponseDelta")) {
+        emit streamed();
+    } else if (action == QLatin1String("generationStats")) {
+        m_generatedTokens = obj.value(QStringLiteral("generatedTokens")).toInt();
+    } else if (action == QLatin1String("generationFinished")) {
+        // In binary mode the Finished frame ends the request instead
+        // バイナリ方式では代わりにFinishedフレームでリクエストが終わる
+        if (!m_options.binary) {
+            m_busy = false;
+            emit finished(m_generatedTokens);
+        }
+    } else if (action == QLatin1String("error")) {
+        m_busy = false;
+        emit failed(obj.value(QStringLiteral("errorMessage")).toString());
+    } else if (action == QLatin1String("rejected")) {
+        m_busy = false;
+        emit failed(QStringLiteral("rejected: ") + obj.value(QStringLiteral("reason")).toString());
+    } else if (action == QLatin1String("generationCancelled")) {
+        m_busy = false;
+        emit failed(QStringLiteral("cancelled"));
+    }
+}
+
+void WsBenchClient::onBinaryMessageReceived(const QByteArray &message)
+{
+    WsProtocol::Frame frame;
+    if (!m_busy || !WsProtocol::decode(message, &frame)) {
+        return;
+    }
+    if (frame.type == WsProtocol::FrameType::Delta) {
+        emit streamed();
+    } else if (frame.type == WsProtocol::FrameType::Finished) {
+        m_busy = false;
+        emit finished(m_generatedTokens);
+    }
+}
+
+void WsBenchClient::onErrorOccurred(QAbstractSocket::SocketError error)
+{
+    Q_UNUSED(error)
+    m_busy = false;
+    emit failed(m_socket.errorString());
+}
+
+void WsBenchClient::sendJson(const QJsonObject &json)
+{
+    m_socket.sendTextMessage(QString::fromUtf8(QJsonDocument(json).toJson(QJsonDocument::Compact)));
+}
@@ -0,0 +1,56 @@
+// ================================================================
+// WsBenchClient.h
+// ================================================================
+#ifndef WSBENCHCLIENT_H
+#define WSBENCHCLIENT_H
+
+#include "BenchClient.h"
+#include <QWebSocket>
+
+/*
+  WsBenchClient:
+    - BenchClient over the WebSocket endpoint (ws://host:12346)
+    - Streams with "delta" JSON or "binary" frames, and by default asks the
+      server for one frame per token so inter-token gaps are per token
+    - Optionally sends "reinit" before each request so replayed
+      conversations never share a session's KV cache
+
+  WsBenchClientクラス:
+    - WebSocketエンドポイント (ws://host:12346) 用のBenchClient
+    - "delta"のJSONまたは"binary"フレームで受信し、既定では1トークン
+      1フレームで送るようサーバーに要求するため、間隔はトークン単位になる
+    - 再生する会話同士がセッションのKVキャッシュを共有しないよう、
+      各リクエストの前に"reinit"を送ることもできる
+*/
+class WsBenchClient : public BenchClient
+{
+    Q_OBJECT
+public:
+    struct Options
+    {
+        bool binary {false};             // "binary" instead of "delta" streaming
+        bool perTokenFrames {true};      // setFlushPolicy {"immediate": true}
+        bool reinitBeforeRequest {false};
+    };
+
+    explicit WsBenchClient(const Options &options, QObject *parent = nullptr);
+
+    void open(const QUrl &url) override;
+    void send(const BenchRequest &request) override;
+
+private slots:
+    void onConnected();
+    void onTextMessageReceived(const QString &message);
+    void onBinaryMessageReceived(const QByteArray &message);
+    void onErrorOccurred(QAbstractSocket::SocketError error);
+
+private:
+    void sendJson(const QJsonObject &json);
+
+    Options m_options;
+    QWebSocket m_socket;
+    bool m_busy {false};
+    int m_generatedTokens {0};
+};
+
+#endif // WSBENCHCLIENT_H
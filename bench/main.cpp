@@ -0,0 +1,181 @@
+// ================================================================
+// main.cpp (LLMRemoteServerBench)
+// ================================================================
+#include "LoadRunner.h"
+#include "QtRoBenchClient.h"
+#include "Workload.h"
+#include "WsBenchClient.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonDocument>
+#include <QTimer>
+#include <algorithm>
+
+/*
+  LLMRemoteServerBench:
+    - Opens the requested clients, waits until all are ready, replays the
+      workload and prints the latency table (and JSON with --json)
+    - Workloads are JSONL files as written by the server's --record-traffic;
+      without one, --prompt is sent --requests times
+
+  LLMRemoteServerBench:
+    - 指定したクライアントを開き、全てがreadyになるまで待ってから
+      ワークロードを再生し、レイテンシの表を出力する (--jsonでJSONも)
+    - ワークロードはサーバーの--record-trafficが書き出すJSONLファイル。
+      無い場合は--promptを--requests回送る
+*/
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("LLMRemoteServerBench"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Load generator and latency benchmark for LLMRemoteServer"));
+    parser.addHelpOption();
+    const QCommandLineOption transportOption(QStringLiteral("transport"),
+        QStringLiteral("ws, qtro or both (default ws)."), QStringLiteral("name"), QStringLiteral("ws"));
+    const QCommandLineOption wsUrlOption(QStringLiteral("ws-url"),
+        QStringLiteral("WebSocket endpoint."), QStringLiteral("url"), QStringLiteral("ws://127.0.0.1:12346"));
+    const QCommandLineOption qtroUrlOption(QStringLiteral("qtro-url"),
+        QStringLiteral("Qt Remote Objects source."), QStringLiteral("url"), QStringLiteral("tcp://127.0.0.1:12345"));
+    const QCommandLineOption clientsOption(QStringLiteral("clients"),
+        QStringLiteral("Concurrent WebSocket clients (default 4; QtRO always uses one)."),
+        QStringLiteral("n"), QStringLiteral("4"));
+    const QCommandLineOption workloadOption(QStringLiteral("workload"),
+        QStringLiteral("JSONL workload (e.g. recorded with the server's --record-traffic)."), QStringLiteral("file"));
+    const QCommandLineOption promptOption(QStringLiteral("prompt"),
+        QStringLiteral("Prompt used without --workload."), QStringLiteral("text"),
+        QStringLiteral("Write a short story about a lighthouse keeper."));
+    const QCommandLineOption maxTokensOption(QStringLiteral("max-tokens"),
+        QStringLiteral("max_tokens of --prompt requests (default 128)."), QStringLiteral("n"), QStringLiteral("128"));
+    const QCommandLineOption requestsOption(QStringLiteral("requests"),
+        QStringLiteral("Requests to send (default: the workload once, or 32 for --prompt)."), QStringLiteral("n"));
+    const QCommandLineOption rateOption(QStringLiteral("rate"),
+        QStringLiteral("Arrivals per second (default 0 = all at once)."), QStringLiteral("r"), QStringLiteral("0"));
+    const QCommandLineOption poissonOption(QStringLiteral("poisson"),
+        QStringLiteral("Poisson arrivals at --rate instead of evenly spaced ones."));
+    const QCommandLineOption recordedOption(QStringLiteral("recorded-timing"),
+        QStringLiteral("Replay the workload's offset_ms arrival times."));
+    const QCommandLineOption speedOption(QStringLiteral("speed"),
+        QStringLiteral("Speed-up of --recorded-timing (default 1)."), QStringLiteral("x"), QStringLiteral("1"));
+    const QCommandLineOption seedOption(QStringLiteral("seed"),
+        QStringLiteral("Seed of --poisson arrivals."), QStringLiteral("n"), QStringLiteral("1"));
+    const QCommandLineOption binaryOption(QStringLiteral("binary"),
+        QStringLiteral("Use binary WebSocket frames instead of JSON deltas."));
+    const QCommandLineOption serverFlushOption(QStringLiteral("server-flush-policy"),
+        QStringLiteral("Keep the server's flush policy instead of one frame per token."));
+    const QCommandLineOption reinitOption(QStringLiteral("reinit"),
+        QStringLiteral("Reset the WebSocket session before each request."));
+    const QCommandLineOption jsonOption(QStringLiteral("json"),
+        QStringLiteral("Also write the report as JSON (- = stdout)."), QStringLiteral("file"));
+    const QCommandLineOption timeoutOption(QStringLiteral("timeout"),
+        QStringLiteral("Abort after this many seconds (default 0 = none)."), QStringLiteral("s"), QStringLiteral("0"));
+    parser.addOptions({transportOption, wsUrlOption, qtroUrlOption, clientsOption, workloadOption,
+                       promptOption, maxTokensOption, requestsOption, rateOption, poissonOption,
+                       recordedOption, speedOption, seedOption, binaryOption, serverFlushOption,
+                       reinitOption, jsonOption, timeoutOption});
+    parser.process(app);
+
+    QList<BenchRequest> workload;
+    if (parser.isSet(workloadOption)) {
+        QString error;
+        if (!Workload::load(parser.value(workloadOption), &workload, &error)) {
+            qCritical() << "Failed to load workload" << parser.value(workloadOption) << ":" << error;
+            return 1;
+        }
+    } else {
+        workload.append(Workload::fromPrompt(parser.value(promptOption),
+                                             parser.value(maxTokensOption).toInt()));
+    }
+
+    LoadRunner::Options runOptions;
+    runOptions.requestCount  = parser.isSet(requestsOption) ? parser.value(requestsOption).toInt()
+                               : parser.isSet(workloadOption) ? 0 : 32;
+    runOptions.ratePerSecond = parser.value(rateOption).toDouble();
+    runOptions.arrival       = parser.isSet(recordedOption) ? LoadRunner::Arrival::Recorded
+                               : parser.isSet(poissonOption) ? LoadRunner::Arrival::Poisson
+                                                             : LoadRunner::Arrival::Uniform;
+    runOptions.speed         = std::max(parser.value(speedOption).toDouble(), 1e-3);
+    runOptions.seed          = parser.value(seedOption).toUInt();
+
+    const QString transport  = parser.value(transportOption);
+    const bool useWs         = transport == QLatin1String("ws") || transport == QLatin1String("both");
+    const bool useQtRo       = transport == QLatin1String("qtro") || transport == QLatin1String("both");
+    if (!useWs && !useQtRo) {
+        qCritical() << "Unknown transport" << transport;
+        return 1;
+    }
+
+    WsBenchClient::Options wsOptions;
+    wsOptions.binary              = parser.isSet(binaryOption);
+    wsOptions.perTokenFrames      = !parser.isSet(serverFlushOption);
+    wsOptions.reinitBeforeRequest = parser.isSet(reinitOption);
+
+    QList<BenchClient *> clients;
+    if (useWs) {
+        const int count = std::max(1, parser.value(clientsOption).toInt());
+        for (int i = 0; i < count; ++i) {
+            auto *client = new WsBenchClient(wsOptions, &app);
+            client->open(QUrl(parser.value(wsUrlOption)));
+            clients.append(client);
+        }
+    }
+    if (useQtRo) {
+        auto *client = new QtRoBenchClient(wsOptions.perTokenFrames, &app);
+        client->open(QUrl(parser.value(qtroUrlOption)));
+        clients.append(client);
+    }
+
+    LoadRunner runner(workload, runOptions);
+
+    // Start once every client is connected; a connection failure aborts
+    // 全クライアントの接続後に開始する。接続に失敗した場合は中止
+    int readyCount = 0;
+    for (BenchClient *client : clients) {
+        QObject::connect(client, &BenchClient::ready, &runner, [&]() {
+            if (++readyCount == clients.size()) {
+                runner.start(clients);
+            }
+        });
+        QObject::connect(client, &BenchClient::failed, &app, [&](const QString &reason) {
+            if (readyCount < clients.size()) {
+                qCritical() << "Connection failed:" << reason;
+                QCoreApplication::exit(1);
+            }
+        });
+    }
+
+    QObject::connect(&runner, &LoadRunner::finished, &app, [&]() {
+        QTextStream out(stdout);
+        runner.printTable(out);
+
+        if (parser.isSet(jsonOption)) {
+            const QByteArray json = QJsonDocument(runner.report()).toJson(QJsonDocument::Indented);
+            const QString path    = parser.value(jsonOption);
+            if (path == QLatin1String("-")) {
+                out << json;
+            } else {
+                QFile file(path);
+                if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(json) != json.size()) {
+                    qCritical() << "Failed to write" << path << ":" << file.errorString();
+                    QCoreApplication::exit(1);
+                    return;
+                }
+            }
+        }
+        QCoreApplication::exit(runner.report().value("failed").toInt() > 0 ? 2 : 0);
+    });
+
+    const int timeoutSeconds = parser.value(timeoutOption).toInt();
+    if (timeoutSeconds > 0) {
+        QTimer::singleShot(timeoutSeconds * 1000, &app, [&]() {
+            qCritical() << "Timed out after" << timeoutSeconds << "s";
+            QTextStream out(stdout);
+            runner.printTable(out);
+            QCoreApplication::exit(3);
+        });
+    }
+
+    return app.exec();
+}
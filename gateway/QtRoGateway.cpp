@@ -0,0 +1,452 @@
+// ================================================================
+// QtRoGateway.cpp
+// ================================================================
+#include "QtRoGateway.h"
+#include <QDebug>
+#include <QRemoteObjectPendingCallWatcher>
+
+namespace {
+const QString kStatusKey = QStringLiteral("qtro:status");
+const QString kNoWorker  = QStringLiteral("no worker is ready");
+
+QString sessionKey(const QString &sessionId)
+{
+    return QStringLiteral("session:") + sessionId;
+}
+} // namespace
+
+QtRoGateway::QtRoGateway(WorkerPool *pool, QObject *parent)
+    : LlamaResponseGeneratorSimpleSource{parent}
+    , mPool(pool)
+{
+    connect(mPool, &WorkerPool::generatorAvailable, this, &QtRoGateway::attachWorker);
+    connect(mPool, &WorkerPool::readyWorkersChanged, this, &QtRoGateway::pinStatusWorker);
+    connect(mPool, &WorkerPool::workerRemoved, this, [this](const QString &name) {
+        for (auto it = mEmbeddingIds.begin(); it != mEmbeddingIds.end();) {
+            if (it.key().first == name) {
+                emit embeddingError(it.value(), QStringLiteral("worker %1 left").arg(name));
+                it = mEmbeddingIds.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        for (auto it = mSessionRelays.begin(); it != mSessionRelays.end();) {
+            if (it->worker == name) {
+                emit it->source->error(QStringLiteral("worker %1 left").arg(name));
+                const QString sessionId = it.key();
+                ++it;
+                dropRelay(sessionId);
+            } else {
+                ++it;
+            }
+        }
+        if (name == mStatusWorker) {
+            for (const QMetaObject::Connection &connection : std::as_const(mStatusConnections)) {
+                disconnect(connection);
+            }
+            mStatusConnections.clear();
+            mStatusWorker.clear();
+            setRemoteInitialized(false);
+            setReadinessStage(Loading);
+            pinStatusWorker();
+        }
+    });
+
+    // streamingMode is written by the clients, the workers have to follow
+    // streamingModeはクライアントが書き込むため、ワーカーに反映する
+    connect(this, &QtRoGateway::streamingModeChanged, this, [this](StreamingMode mode) {
+        for (LlamaResponseGeneratorReplica *replica : generators()) {
+            if (replica->isInitialized()) {
+                replica->pushStreamingMode(static_cast<LlamaResponseGeneratorReplica::StreamingMode>(mode));
+            }
+        }
+    });
+
+    for (WorkerPool::Worker *worker : mPool->workers()) {
+        if (worker->generator) {
+            attachWorker(worker);
+        }
+    }
+    pinStatusWorker();
+}
+
+void QtRoGateway::setHost(QRemoteObjectHostBase *host)
+{
+    mHost = host;
+}
+
+/*
+  attachWorker(worker):
+    - Generation signals carry no request id, so they are relayed as they
+      are; a client tells its reply apart as it would on a shared server
+*/
+void QtRoGateway::attachWorker(WorkerPool::Worker *worker)
+{
+    LlamaResponseGeneratorReplica *replica = worker->generator.get();
+    connect(replica, &LlamaResponseGeneratorReplica::partialResponseReady, this, &QtRoGateway::partialResponseReady);
+    connect(replica, &LlamaResponseGeneratorReplica::partialResponseDelta, this, &QtRoGateway::partialResponseDelta);
+    connect(replica, &LlamaResponseGeneratorReplica::generationFinished, this, &QtRoGateway::generationFinished);
+    connect(replica, &LlamaResponseGeneratorReplica::generationStats, this, &QtRoGateway::generationStats);
+    connect(replica, &LlamaResponseGeneratorReplica::generationError, this, &QtRoGateway::generationError);
+    connect(replica, &LlamaResponseGeneratorReplica::generationCancelled, this, &QtRoGateway::generationCancelled);
+    connect(replica, &LlamaResponseGeneratorReplica::requestQueued, this, &QtRoGateway::requestQueued);
+    connect(replica, &LlamaResponseGeneratorReplica::requestRejected, this, &QtRoGateway::requestRejected);
+    connect(replica, &LlamaResponseGeneratorReplica::initialized, this, [this, replica]() {
+        pushStreamingSettings(replica);
+    });
+    if (replica->isInitialized()) {
+        pushStreamingSettings(replica);
+    }
+
+    const QString name = worker->name;
+    connect(replica, &LlamaResponseGeneratorReplica::embeddingsReady, this,
+            [this, name](int requestId, int dimensions, const QByteArray &vectors) {
+                const auto it = mEmbeddingIds.find({name, requestId});
+                if (it != mEmbeddingIds.end()) {
+                    emit embeddingsReady(it.value(), dimensions, vectors);
+                    mEmbeddingIds.erase(it);
+                }
+            });
+    connect(replica, &LlamaResponseGeneratorReplica::embeddingError, this,
+            [this, name](int requestId, const QString &errorMessage) {
+                const auto it = mEmbeddingIds.find({name, requestId});
+                if (it != mEmbeddingIds.end()) {
+                    emit embeddingError(it.value(), errorMessage);
+                    mEmbeddingIds.erase(it);
+                }
+            });
+}
+
+void QtRoGateway::pushStreamingSettings(LlamaResponseGeneratorReplica *replica)
+{
+    replica->pushStreamingMode(static_cast<LlamaResponseGeneratorReplica::StreamingMode>(streamingMode()));
+    if (mFlushPolicySet) {
+        replica->setFlushPolicy(mFlushIntervalMs, mFlushTokens, mFlushAtNewline);
+    }
+}
+
+LlamaResponseGeneratorReplica *QtRoGateway::pickGenerator()
+{
+    WorkerPool::Worker *worker = mPool->pick();
+    return worker ? worker->generator.get() : nullptr;
+}
+
+QList<LlamaResponseGeneratorReplica *> QtRoGateway::generators() const
+{
+    QList<LlamaResponseGeneratorReplica *> result;
+    for (WorkerPool::Worker *worker : mPool->workers()) {
+        if (worker->generator) {
+            result.append(worker->generator.get());
+        }
+    }
+    return result;
+}
+
+/*
+  pinStatusWorker():
+    - Only the properties are mirrored from it; the connections are kept so
+      they can be dropped when the worker leaves
+*/
+void QtRoGateway::pinStatusWorker()
+{
+    if (!mStatusWorker.isEmpty()) {
+        return;
+    }
+    WorkerPool::Worker *worker = mPool->pick(kStatusKey);
+    if (!worker) {
+        return;
+    }
+    mStatusWorker = worker->name;
+    mStatus       = worker->generator.get();
+    qDebug() << "[QtRoGateway] Readiness mirrored from" << mStatusWorker;
+
+    LlamaResponseGeneratorReplica *replica = mStatus;
+    mStatusConnections = {
+        connect(replica, &LlamaResponseGeneratorReplica::remoteInitializedChanged, this, &QtRoGateway::mirrorStatusWorker),
+        connect(replica, &LlamaResponseGeneratorReplica::readinessStageChanged, this, &QtRoGateway::mirrorStatusWorker),
+        connect(replica, &LlamaResponseGeneratorReplica::availableModelsChanged, this, &QtRoGateway::mirrorStatusWorker),
+        connect(replica, &LlamaResponseGeneratorReplica::initialized, this, &QtRoGateway::mirrorStatusWorker),
+    };
+    if (replica->isInitialized()) {
+        mirrorStatusWorker();
+    }
+}
+
+void QtRoGateway::mirrorStatusWorker()
+{
+    if (!mStatus) {
+        return;
+    }
+    setAvailableModels(mStatus->availableModels());
+    setReadinessTimings(mStatus->readinessTimings());
+    setReadinessStage(static_cast<ReadinessStage>(mStatus->readinessStage()));
+    setRemoteInitialized(mStatus->remoteInitialized());
+}
+
+void QtRoGateway::generate(const QList<LlamaChatMessage> &messages)
+{
+    generateWithModel(QString(), messages);
+}
+
+void QtRoGateway::generateWithModel(const QString &model, const QList<LlamaChatMessage> &messages)
+{
+    LlamaResponseGeneratorReplica *replica = pickGenerator();
+    if (!replica) {
+        emit generationError(kNoWorker);
+        return;
+    }
+    replica->generateWithModel(model, messages);
+}
+
+void QtRoGateway::generateWithOptions(const QString &model,
+                                      const QList<LlamaChatMessage> &messages,
+                                      const GenerationOptions &options)
+{
+    LlamaResponseGeneratorReplica *replica = pickGenerator();
+    if (!replica) {
+        emit generationError(kNoWorker);
+        return;
+    }
+    replica->generateWithOptions(model, messages, options);
+}
+
+void QtRoGateway::generateStreamed(const QString &model,
+                                   const QList<LlamaChatMessage> &messages,
+                                   const GenerationOptions &options,
+                                   const StreamOptions &stream)
+{
+    LlamaResponseGeneratorReplica *replica = pickGenerator();
+    if (!replica) {
+        emit generationError(kNoWorker);
+        return;
+    }
+    replica->generateStreamed(model, messages, options, stream);
+}
+
+void QtRoGateway::setFlushPolicy(int intervalMs, int maxTokens, bool atNewline)
+{
+    mFlushPolicySet  = true;
+    mFlushIntervalMs = intervalMs;
+    mFlushTokens     = maxTokens;
+    mFlushAtNewline  = atNewline;
+    for (LlamaResponseGeneratorReplica *replica : generators()) {
+        if (replica->isInitialized()) {
+            replica->setFlushPolicy(intervalMs, maxTokens, atNewline);
+        }
+    }
+}
+
+/*
+  reinitEngine() / cancelGeneration():
+    - Stateless requests may run on any worker, so every worker is told
+*/
+void QtRoGateway::reinitEngine()
+{
+    for (LlamaResponseGeneratorReplica *replica : generators()) {
+        replica->reinitEngine();
+    }
+}
+
+void QtRoGateway::cancelGeneration()
+{
+    for (LlamaResponseGeneratorReplica *replica : generators()) {
+        replica->cancelGeneration();
+    }
+}
+
+/*
+  createSession(model):
+    - The session id is bound and its relay remoted before returning, so the
+      client can acquire it and a WebSocket client may resume the session
+      through the gateway right away
+    - The slot returns the id, so it has to wait for the worker, and the
+      wait stalls the gateway's event loop (every relay and WebSocket
+      client); the worker only registers the session, so the wait is kept
+      to kCreateSessionTimeoutMs, and a session created after it is closed
+*/
+QString QtRoGateway::createSession(const QString &model)
+{
+    WorkerPool::Worker *worker = mPool->pick();
+    if (!worker) {
+        qWarning() << "[QtRoGateway] Cannot create session:" << kNoWorker;
+        return QString();
+    }
+    QRemoteObjectPendingReply<QString> reply = worker->generator->createSession(model);
+    if (!reply.waitForFinished(kCreateSessionTimeoutMs)) {
+        qWarning() << "[QtRoGateway] Cannot create session: worker" << worker->name << "did not answer";
+        // The client got no id: a late answer leaves an orphaned session on the worker
+        // クライアントはIDを受け取っていない: 遅れた応答は孤立したセッションを残す
+        auto *watcher = new QRemoteObjectPendingCallWatcher(reply, this);
+        connect(watcher, &QRemoteObjectPendingCallWatcher::finished, this,
+                [generator = QPointer<LlamaResponseGeneratorReplica>(worker->generator.get())](
+                    QRemoteObjectPendingCallWatcher *call) {
+                    const QString lateId = call->returnValue().toString();
+                    if (generator && !lateId.isEmpty()) {
+                        generator->closeSession(lateId);
+                    }
+                    call->deleteLater();
+                });
+        return QString();
+    }
+    const QString sessionId = reply.returnValue();
+    if (sessionId.isEmpty()) {
+        return QString();
+    }
+    if (!relaySession(worker, sessionId)) {
+        worker->generator->closeSession(sessionId);
+        return QString();
+    }
+    mPool->bind(sessionKey(sessionId), worker->name);
+    return sessionId;
+}
+
+/*
+  relaySession(worker, sessionId):
+    - The replica is parented to the relay, so withdrawing the relay also
+      releases the worker's session source
+    - A replica turning Suspect means the worker withdrew the session
+      (closed or expired there) or went away
+*/
+bool QtRoGateway::relaySession(WorkerPool::Worker *worker, const QString &sessionId)
+{
+    if (!mHost) {
+        qWarning() << "[QtRoGateway] No host to relay session" << sessionId;
+        return false;
+    }
+    const QString name = QStringLiteral("LlamaSession/") + sessionId;
+    auto *source = new LlamaSessionSimpleSource(this);
+    source->setSessionId(sessionId);
+    auto *replica = worker->node->acquire<LlamaSessionReplica>(name);
+    replica->setParent(source);
+
+    connect(replica, &LlamaSessionReplica::delta, source, &LlamaSessionSimpleSource::delta);
+    connect(replica, &LlamaSessionReplica::finished, source, &LlamaSessionSimpleSource::finished);
+    connect(replica, &LlamaSessionReplica::stats, source, &LlamaSessionSimpleSource::stats);
+    connect(replica, &LlamaSessionReplica::error, source, &LlamaSessionSimpleSource::error);
+    connect(replica, &LlamaSessionReplica::cancelled, source, &LlamaSessionSimpleSource::cancelled);
+    connect(replica, &LlamaSessionReplica::stateChanged, this,
+            [this, sessionId](QRemoteObjectReplica::State state) {
+                if (state == QRemoteObjectReplica::Suspect) {
+                    mPool->unbind(sessionKey(sessionId));
+                    dropRelay(sessionId);
+                }
+            }, Qt::QueuedConnection);
+
+    if (!mHost->enableRemoting(source, name)) {
+        qWarning() << "[QtRoGateway] Cannot relay session" << sessionId;
+        delete source;
+        return false;
+    }
+    mSessionRelays.insert(sessionId, SessionRelay {worker->name, source, replica});
+    return true;
+}
+
+void QtRoGateway::dropRelay(const QString &sessionId)
+{
+    const SessionRelay relay = mSessionRelays.take(sessionId);
+    if (!relay.source) {
+        return;
+    }
+    if (mHost) {
+        mHost->disableRemoting(relay.source);
+    }
+    relay.source->deleteLater();
+}
+
+LlamaResponseGeneratorReplica *QtRoGateway::sessionWorker(const QString &sessionId) const
+{
+    WorkerPool::Worker *worker = mPool->boundWorker(sessionKey(sessionId));
+    return worker ? worker->generator.get() : nullptr;
+}
+
+bool QtRoGateway::appendMessage(const QString &sessionId, const LlamaChatMessage &message)
+{
+    LlamaResponseGeneratorReplica *replica = sessionWorker(sessionId);
+    if (!replica) {
+        return false;
+    }
+    QRemoteObjectPendingReply<bool> reply = replica->appendMessage(sessionId, message);
+    return reply.waitForFinished(kCallTimeoutMs) && reply.returnValue();
+}
+
+bool QtRoGateway::generateInSession(const QString &sessionId, const GenerationOptions &options)
+{
+    LlamaResponseGeneratorReplica *replica = sessionWorker(sessionId);
+    if (!replica) {
+        return false;
+    }
+
+    // The relay must be connected, or the first deltas would be lost
+    // 中継が接続済みでないと最初のdeltaが失われる
+    const auto relay = mSessionRelays.constFind(sessionId);
+    if (relay != mSessionRelays.constEnd() && !relay->replica->isInitialized()
+        && !relay->replica->waitForSource(kCallTimeoutMs)) {
+        return false;
+    }
+    QRemoteObjectPendingReply<bool> reply = replica->generateInSession(sessionId, options);
+    return reply.waitForFinished(kCallTimeoutMs) && reply.returnValue();
+}
+
+QList<LlamaChatMessage> QtRoGateway::sessionHistory(const QString &sessionId)
+{
+    LlamaResponseGeneratorReplica *replica = sessionWorker(sessionId);
+    if (!replica) {
+        return {};
+    }
+    QRemoteObjectPendingReply<QList<LlamaChatMessage>> reply = replica->sessionHistory(sessionId);
+    return reply.waitForFinished(kCallTimeoutMs) ? reply.returnValue() : QList<LlamaChatMessage>();
+}
+
+void QtRoGateway::cancelSession(const QString &sessionId)
+{
+    if (LlamaResponseGeneratorReplica *replica = sessionWorker(sessionId)) {
+        replica->cancelSession(sessionId);
+    }
+}
+
+bool QtRoGateway::closeSession(const QString &sessionId)
+{
+    LlamaResponseGeneratorReplica *replica = sessionWorker(sessionId);
+    if (!replica) {
+        return false;
+    }
+    mPool->unbind(sessionKey(sessionId));
+    dropRelay(sessionId);
+    QRemoteObjectPendingReply<bool> reply = replica->closeSession(sessionId);
+    return reply.waitForFinished(kCallTimeoutMs) && reply.returnValue();
+}
+
+int QtRoGateway::embed(const QStringList &texts)
+{
+    return embedWithModel(QString(), texts);
+}
+
+/*
+  embedWithModel(model, texts):
+    - The worker's vectors arrive after its reply, so the id mapping is in
+      place before embeddingsReady can be relayed
+*/
+int QtRoGateway::embedWithModel(const QString &model, const QStringList &texts)
+{
+    const int requestId = mNextEmbeddingId++;
+
+    // Errors are queued, so the client has the id before they arrive
+    // エラーはキュー経由で送るため、クライアントは先にIDを受け取る
+    auto failLater = [this, requestId](const QString &errorMessage) {
+        QMetaObject::invokeMethod(this, [this, requestId, errorMessage]() {
+            emit embeddingError(requestId, errorMessage);
+        }, Qt::QueuedConnection);
+        return requestId;
+    };
+
+    WorkerPool::Worker *worker = mPool->pick();
+    if (!worker) {
+        return failLater(kNoWorker);
+    }
+    QRemoteObjectPendingReply<int> reply = worker->generator->embedWithModel(model, texts);
+    if (!reply.waitForFinished(kCallTimeoutMs)) {
+        return failLater(QStringLiteral("worker %1 did not answer").arg(worker->name));
+    }
+    mEmbeddingIds.insert({worker->name, reply.returnValue()}, requestId);
+    return requestId;
+}
@@ -0,0 +1,176 @@
+// ================================================================
+// QtRoGateway.h
+// ================================================================
+#ifndef QTROGATEWAY_H
+#define QTROGATEWAY_H
+
+#include "rep_LlamaResponseGenerator_merged.h"
+#include "WorkerPool.h"
+#include <QHash>
+#include <QList>
+#include <QMetaObject>
+#include <QPair>
+#include <QPointer>
+#include <QRemoteObjectHostBase>
+
+/*
+  QtRoGateway:
+    - LlamaResponseGenerator source of the gateway; QtRO clients connect to
+      it exactly as to a single server
+    - Stateless generate* calls are balanced one by one over the ready
+      workers; the generation signals of every worker are relayed, as a
+      single server's shared engine would send them to all replicas
+    - streamingMode and setFlushPolicy() are pushed to every worker;
+      readiness and availableModels are mirrored from one status worker,
+      which moves only when that worker leaves
+    - Server-side sessions are where sharding happens: createSession picks
+      the least loaded worker and binds the session id to it in the pool, so
+      appendMessage / generateInSession / ... and WebSocket clients resuming
+      the session all reach the worker that holds its KV cache
+    - The worker remotes each session as a LlamaSession source of its own;
+      the gateway acquires it and remotes a relay under the same name, so
+      session signals reach only the replicas that acquire that session
+    - embed() goes to the least loaded worker; request ids are translated so
+      they stay unique across workers
+    - Slots returning a value wait for the worker's reply (kCallTimeoutMs;
+      createSession uses the shorter kCreateSessionTimeoutMs)
+
+  QtRoGatewayクラス:
+    - ゲートウェイのLlamaResponseGeneratorソース。QtROクライアントは単一の
+      サーバーと同じように接続する
+    - セッションを持たないgenerate*の呼び出しは、準備済みのワーカーへ
+      1件ずつ分散する。単一サーバーの共有エンジンが全レプリカへ送るのと
+      同様に、全ワーカーの生成シグナルを中継する
+    - streamingModeとsetFlushPolicy()は全ワーカーに反映する。準備状態と
+      availableModelsは1つの状態ワーカーから反映し、そのワーカーが抜けた
+      場合のみ移動する
+    - 振り分けはサーバー側セッションで行う: createSessionは最も負荷の低い
+      ワーカーを選び、プール内でセッションIDをそのワーカーに結び付ける。
+      appendMessage / generateInSession / ... や、セッションを再開する
+      WebSocketクライアントは、全てKVキャッシュを持つワーカーに届く
+    - ワーカーは各セッションを専用のLlamaSessionソースとして公開する。
+      ゲートウェイはそれを取得し、同じ名前で中継用のソースを公開するため、
+      セッションのシグナルはそのセッションを取得したレプリカにのみ届く
+    - embed()は最も負荷の低いワーカーへ送る。リクエストIDはワーカー間で
+      一意になるよう変換する
+    - 値を返すスロットはワーカーの応答を待つ (kCallTimeoutMs。createSessionは
+      より短いkCreateSessionTimeoutMs)
+*/
+class QtRoGateway : public LlamaResponseGeneratorSimpleSource
+{
+    Q_OBJECT
+public:
+    explicit QtRoGateway(WorkerPool *pool, QObject *parent = nullptr);
+
+    /*
+      setHost(host):
+        - Host that remotes this source and the session relays
+      setHost(host):
+        - このソースとセッションの中継を公開するホスト
+    */
+    void setHost(QRemoteObjectHostBase *host);
+
+    void generate(const QList<LlamaChatMessage> &messages) override;
+    void generateWithModel(const QString &model, const QList<LlamaChatMessage> &messages) override;
+    void generateWithOptions(const QString &model,
+                             const QList<LlamaChatMessage> &messages,
+                             const GenerationOptions &options) override;
+    void generateStreamed(const QString &model,
+                          const QList<LlamaChatMessage> &messages,
+                          const GenerationOptions &options,
+                          const StreamOptions &stream) override;
+    void setFlushPolicy(int intervalMs, int maxTokens, bool atNewline) override;
+    void reinitEngine() override;
+    void cancelGeneration() override;
+
+    QString createSession(const QString &model) override;
+    bool appendMessage(const QString &sessionId, const LlamaChatMessage &message) override;
+    bool generateInSession(const QString &sessionId, const GenerationOptions &options) override;
+    QList<LlamaChatMessage> sessionHistory(const QString &sessionId) override;
+    void cancelSession(const QString &sessionId) override;
+    bool closeSession(const QString &sessionId) override;
+
+    int embed(const QStringList &texts) override;
+    int embedWithModel(const QString &model, const QStringList &texts) override;
+
+private:
+    static constexpr int kCallTimeoutMs = 5000;
+
+    // createSession() blocks the gateway's event loop while it waits
+    // createSession()は待つ間ゲートウェイのイベントループを止める
+    static constexpr int kCreateSessionTimeoutMs = 1000;
+
+    /*
+      attachWorker(worker):
+        - Relays the worker's generation and embedding signals and keeps
+          its streaming settings in line with the gateway's
+      attachWorker(worker):
+        - ワーカーの生成と埋め込みのシグナルを中継し、ストリーミング設定を
+          ゲートウェイと揃える
+    */
+    void attachWorker(WorkerPool::Worker *worker);
+    void pushStreamingSettings(LlamaResponseGeneratorReplica *replica);
+
+    /*
+      pickGenerator():
+        - Least loaded ready worker for one stateless request
+      pickGenerator():
+        - ステートレスなリクエスト1件に対する最も負荷の低い準備済みワーカー
+    */
+    LlamaResponseGeneratorReplica *pickGenerator();
+    QList<LlamaResponseGeneratorReplica *> generators() const;
+
+    /*
+      pinStatusWorker():
+        - Chooses the worker readiness is mirrored from if there is none
+      pinStatusWorker():
+        - 準備状態を反映するワーカーが無ければ選ぶ
+    */
+    void pinStatusWorker();
+    void mirrorStatusWorker();
+
+    LlamaResponseGeneratorReplica *sessionWorker(const QString &sessionId) const;
+
+    /*
+      relaySession(worker, sessionId) / dropRelay(sessionId):
+        - Remotes / withdraws the relay of a session created on worker
+      relaySession(worker, sessionId) / dropRelay(sessionId):
+        - workerで作成したセッションの中継を公開 / 取り下げる
+    */
+    bool relaySession(WorkerPool::Worker *worker, const QString &sessionId);
+    void dropRelay(const QString &sessionId);
+
+    struct SessionRelay
+    {
+        QString worker;
+        LlamaSessionSimpleSource *source {nullptr};   // owns the worker's replica
+        LlamaSessionReplica *replica {nullptr};
+    };
+
+    WorkerPool *mPool {nullptr};
+    QPointer<QRemoteObjectHostBase> mHost;
+
+    // Session id -> relay of its worker's session source
+    // セッションID -> ワーカーのセッションソースの中継
+    QHash<QString, SessionRelay> mSessionRelays;
+
+    // Worker readiness is mirrored from and the connections doing it
+    // 準備状態を反映するワーカーと、そのための接続
+    QString mStatusWorker;
+    QPointer<LlamaResponseGeneratorReplica> mStatus;
+    QList<QMetaObject::Connection> mStatusConnections;
+
+    // Last setFlushPolicy() (pushed to workers that join later)
+    // 最後のsetFlushPolicy() (後から参加したワーカーにも反映する)
+    bool mFlushPolicySet {false};
+    int mFlushIntervalMs {-1};
+    int mFlushTokens {-1};
+    bool mFlushAtNewline {false};
+
+    // (worker name, worker's embedding id) -> gateway embedding id
+    // (ワーカー名, ワーカーの埋め込みID) -> ゲートウェイの埋め込みID
+    QHash<QPair<QString, int>, int> mEmbeddingIds;
+    int mNextEmbeddingId {1};
+};
+
+#endif // QTROGATEWAY_H
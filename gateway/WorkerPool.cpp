@@ -0,0 +1,207 @@
+// ================================================================
+// WorkerPool.cpp
+// ================================================================
+#include "WorkerPool.h"
+#include <QDebug>
+#include <QRemoteObjectRegistry>
+#include <limits>
+
+namespace {
+const QString kStatusPrefix = QStringLiteral("WorkerStatus/");
+
+// A waiting request costs more than a running one: it has no decode slot yet
+// 待機中のリクエストは実行中より重い (まだデコードスロットが無いため)
+constexpr qint64 kQueuedWeight = 4;
+} // namespace
+
+WorkerPool::WorkerPool(const QUrl &registryUrl, QObject *parent)
+    : QObject(parent)
+    , mRegistryHost(registryUrl)
+{
+    QRemoteObjectRegistry *registry = mRegistryHost.registry();
+    connect(registry, &QRemoteObjectRegistry::remoteObjectAdded,
+            this, &WorkerPool::onRemoteObjectAdded);
+    connect(registry, &QRemoteObjectRegistry::remoteObjectRemoved,
+            this, &WorkerPool::onRemoteObjectRemoved);
+
+    const QRemoteObjectSourceLocations existing = registry->sourceLocations();
+    for (auto it = existing.cbegin(); it != existing.cend(); ++it) {
+        onRemoteObjectAdded({it.key(), it.value()});
+    }
+    qDebug() << "[WorkerPool] Registry listening on" << registryUrl.toString();
+}
+
+WorkerPool::~WorkerPool() = default;
+
+void WorkerPool::onRemoteObjectAdded(const QRemoteObjectSourceLocation &location)
+{
+    if (location.first.startsWith(kStatusPrefix)) {
+        addWorker(location.first.mid(kStatusPrefix.size()));
+    }
+}
+
+/*
+  onRemoteObjectRemoved(location):
+    - The registry drops a worker's sources when its process goes away;
+      affinity to it is forgotten, so its sessions are re-routed (and
+      rejected there as unknown)
+*/
+void WorkerPool::onRemoteObjectRemoved(const QRemoteObjectSourceLocation &location)
+{
+    if (!location.first.startsWith(kStatusPrefix)) {
+        return;
+    }
+    const QString name = location.first.mid(kStatusPrefix.size());
+    auto it = mWorkers.find(name);
+    if (it == mWorkers.end()) {
+        return;
+    }
+    const bool wasReady = it->second->status->ready();
+    mWorkers.erase(it);
+
+    for (auto affinity = mAffinity.begin(); affinity != mAffinity.end();) {
+        if (affinity.value() == name) {
+            affinity = mAffinity.erase(affinity);
+        } else {
+            ++affinity;
+        }
+    }
+
+    qDebug() << "[WorkerPool] Worker left:" << name;
+    emit workerRemoved(name);
+    if (wasReady) {
+        emit readyWorkersChanged();
+    }
+}
+
+/*
+  addWorker(name):
+    - The registry host is a node itself, so acquiring the status replica
+      connects to the worker's status host on its own
+*/
+void WorkerPool::addWorker(const QString &name)
+{
+    if (mWorkers.count(name) > 0) {
+        return;
+    }
+    auto worker = std::make_unique<Worker>();
+    worker->name = name;
+    worker->status.reset(mRegistryHost.acquire<WorkerStatusReplica>(kStatusPrefix + name));
+
+    Worker *raw = worker.get();
+    connect(raw->status.get(), &WorkerStatusReplica::initialized, this, [this, raw]() {
+        createGenerator(*raw);
+    });
+    connect(raw->status.get(), &WorkerStatusReplica::readyChanged, this, &WorkerPool::readyWorkersChanged);
+
+    // A fresh load figure replaces the local estimate
+    // 新しい負荷の値でローカルの見積もりを置き換える
+    auto resetEstimate = [raw]() { raw->routedSinceUpdate = 0; };
+    connect(raw->status.get(), &WorkerStatusReplica::queueDepthChanged, this, resetEstimate);
+    connect(raw->status.get(), &WorkerStatusReplica::runningRequestsChanged, this, resetEstimate);
+
+    mWorkers.emplace(name, std::move(worker));
+    qDebug() << "[WorkerPool] Worker joined:" << name;
+}
+
+void WorkerPool::createGenerator(Worker &worker)
+{
+    if (worker.generator) {
+        return;
+    }
+    worker.node = std::make_unique<QRemoteObjectNode>();
+    worker.node->connectToNode(QUrl(worker.status->qtroUrl()));
+    worker.generator.reset(worker.node->acquire<LlamaResponseGeneratorReplica>());
+    qDebug() << "[WorkerPool]" << worker.name << "serves" << worker.status->qtroUrl()
+             << "and" << worker.status->wsUrl();
+    emit generatorAvailable(&worker);
+}
+
+qint64 WorkerPool::loadScore(const Worker &worker)
+{
+    return kQueuedWeight * worker.status->queueDepth() + worker.status->runningRequests()
+           + worker.routedSinceUpdate;
+}
+
+/*
+  pick(affinityKey):
+    - Ties go to the worker with fewer KV-holding sessions, then to the one
+      with more free KV cells
+    - A session lives on its worker only, so a session key is never moved
+      while that worker is still in the pool: a worker that is briefly not
+      ready (reloading, warming up) gets nullptr instead of losing the key
+*/
+WorkerPool::Worker *WorkerPool::pick(const QString &affinityKey)
+{
+    if (Worker *bound = boundWorker(affinityKey)) {
+        if (bound->status->ready()) {
+            ++bound->routedSinceUpdate;
+            return bound;
+        }
+        if (affinityKey.startsWith(QLatin1String("session:"))) {
+            return nullptr;
+        }
+    }
+
+    Worker *best = nullptr;
+    qint64 bestScore = std::numeric_limits<qint64>::max();
+    for (const auto &entry : mWorkers) {
+        Worker *worker = entry.second.get();
+        if (!worker->status->ready() || !worker->generator) {
+            continue;
+        }
+        const qint64 score = loadScore(*worker);
+        const bool better = !best || score < bestScore
+                            || (score == bestScore
+                                && (worker->status->activeSessions() < best->status->activeSessions()
+                                    || (worker->status->activeSessions() == best->status->activeSessions()
+                                        && worker->status->freeKvCells() > best->status->freeKvCells())));
+        if (better) {
+            best      = worker;
+            bestScore = score;
+        }
+    }
+    if (!best) {
+        return nullptr;
+    }
+    ++best->routedSinceUpdate;
+    if (!affinityKey.isEmpty()) {
+        mAffinity.insert(affinityKey, best->name);
+    }
+    return best;
+}
+
+WorkerPool::Worker *WorkerPool::boundWorker(const QString &affinityKey) const
+{
+    if (affinityKey.isEmpty()) {
+        return nullptr;
+    }
+    const auto it = mAffinity.constFind(affinityKey);
+    if (it == mAffinity.cend()) {
+        return nullptr;
+    }
+    const auto worker = mWorkers.find(it.value());
+    return worker != mWorkers.end() ? worker->second.get() : nullptr;
+}
+
+void WorkerPool::bind(const QString &affinityKey, const QString &workerName)
+{
+    if (!affinityKey.isEmpty() && mWorkers.count(workerName) > 0) {
+        mAffinity.insert(affinityKey, workerName);
+    }
+}
+
+void WorkerPool::unbind(const QString &affinityKey)
+{
+    mAffinity.remove(affinityKey);
+}
+
+QList<WorkerPool::Worker *> WorkerPool::workers() const
+{
+    QList<Worker *> result;
+    result.reserve(static_cast<qsizetype>(mWorkers.size()));
+    for (const auto &entry : mWorkers) {
+        result.append(entry.second.get());
+    }
+    return result;
+}
@@ -0,0 +1,146 @@
+// ================================================================
+// WorkerPool.h
+// ================================================================
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include "rep_LlamaResponseGenerator_merged.h"
+#include "rep_WorkerStatus_replica.h"
+#include <QHash>
+#include <QObject>
+#include <QRemoteObjectRegistryHost>
+#include <QUrl>
+#include <map>
+#include <memory>
+
+/*
+  WorkerPool:
+    - Hosts the QtRO registry that LLMRemoteServer workers join with
+      --registry; every worker registers a "WorkerStatus/<name>" source
+    - Keeps one WorkerStatus replica per worker (endpoints, readiness and
+      load) and, once its endpoints are known, one LlamaResponseGenerator
+      replica on a node of its own
+    - pick() routes by affinity: a session key bound to a live worker stays
+      there, so its KV cache stays warm; otherwise the least loaded ready
+      worker is chosen and the key is bound to it. Stateless requests pass
+      no key and are balanced one by one
+    - Load = queued requests (weighted) + running requests + requests routed
+      since the worker last published, so a burst between two updates does
+      not all land on the same worker
+
+  WorkerPoolクラス:
+    - LLMRemoteServerのワーカーが--registryで参加するQtROレジストリをホストする。
+      各ワーカーは"WorkerStatus/<名前>"ソースを登録する
+    - ワーカーごとにWorkerStatusレプリカ (エンドポイント、準備状態、負荷) を
+      保持し、エンドポイントが分かった時点で専用ノード上に
+      LlamaResponseGeneratorレプリカを1つ作成する
+    - pick()はアフィニティで振り分ける: 生存中のワーカーに結び付いた
+      セッションのキーはそのワーカーに留まり、KVキャッシュが温かいまま
+      保たれる。それ以外は最も負荷の低い準備済みワーカーを選び、キーを
+      そのワーカーに結び付ける。ステートレスなリクエストはキーを渡さず、
+      1件ずつ分散する
+    - 負荷 = 待機中リクエスト (重み付き) + 実行中リクエスト + 前回の公開以降に
+      振り分けたリクエスト。2回の更新の間に集中したリクエストが同じワーカーに
+      偏らないようにする
+*/
+class WorkerPool : public QObject
+{
+    Q_OBJECT
+public:
+    struct Worker
+    {
+        QString name;
+        std::unique_ptr<WorkerStatusReplica> status;
+        std::unique_ptr<QRemoteObjectNode> node;
+        std::unique_ptr<LlamaResponseGeneratorReplica> generator;
+        int routedSinceUpdate {0};
+    };
+
+    /*
+      Constructor:
+        - Starts the registry host on registryUrl (e.g. tcp://0.0.0.0:12400)
+      コンストラクタ:
+        - registryUrl (例 tcp://0.0.0.0:12400) でレジストリのホストを開始
+    */
+    explicit WorkerPool(const QUrl &registryUrl, QObject *parent = nullptr);
+    ~WorkerPool() override;
+
+    /*
+      pick(affinityKey):
+        - Worker for the key (see above); nullptr while no worker is ready
+        - A "session:" key bound to a worker that is not ready gets nullptr
+          until the worker is ready again or leaves the pool
+        - An empty key only balances load and binds nothing
+      pick(affinityKey):
+        - キーに対するワーカー (上記参照)。準備済みのワーカーが無い間はnullptr
+        - 準備完了でないワーカーに結び付いた"session:"キーは、ワーカーが
+          準備完了に戻るかプールから外れるまでnullptr
+        - 空のキーは負荷分散のみで、何も結び付けない
+    */
+    Worker *pick(const QString &affinityKey = QString());
+
+    /*
+      boundWorker(affinityKey):
+        - Worker the key is bound to, nullptr if none or gone
+      boundWorker(affinityKey):
+        - キーが結び付いたワーカー。無い場合や消えた場合はnullptr
+    */
+    Worker *boundWorker(const QString &affinityKey) const;
+
+    void bind(const QString &affinityKey, const QString &workerName);
+    void unbind(const QString &affinityKey);
+
+    /*
+      workers():
+        - All known workers, ready or not
+      workers():
+        - 準備状態にかかわらず、既知の全ワーカー
+    */
+    QList<Worker *> workers() const;
+
+signals:
+    /*
+      generatorAvailable(worker):
+        - The worker's LlamaResponseGenerator replica exists (not necessarily
+          connected yet)
+      generatorAvailable(worker):
+        - ワーカーのLlamaResponseGeneratorレプリカが作成された
+          (接続済みとは限らない)
+    */
+    void generatorAvailable(WorkerPool::Worker *worker);
+
+    /*
+      workerRemoved(name):
+        - The worker left the registry; its replicas are already gone
+      workerRemoved(name):
+        - ワーカーがレジストリから外れた。レプリカは削除済み
+    */
+    void workerRemoved(const QString &name);
+
+    /*
+      readyWorkersChanged():
+        - A worker became ready or stopped being ready
+      readyWorkersChanged():
+        - ワーカーが準備完了になった、または準備完了でなくなった
+    */
+    void readyWorkersChanged();
+
+private slots:
+    void onRemoteObjectAdded(const QRemoteObjectSourceLocation &location);
+    void onRemoteObjectRemoved(const QRemoteObjectSourceLocation &location);
+
+private:
+    void addWorker(const QString &name);
+    void createGenerator(Worker &worker);
+    static qint64 loadScore(const Worker &worker);
+
+    QRemoteObjectRegistryHost mRegistryHost;
+
+    std::map<QString, std::unique_ptr<Worker>> mWorkers;
+
+    // Affinity key ("session:<id>") -> worker name
+    // アフィニティキー ("session:<id>") -> ワーカー名
+    QHash<QString, QString> mAffinity;
+};
+
+#endif // WORKERPOOL_H
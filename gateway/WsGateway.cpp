@@ -0,0 +1,47 @@
+// ================================================================
+// WsGateway.cpp
+// ================================================================
+#include "WsGateway.h"
+#include "WsGatewayConnection.h"
+#include <QDebug>
+
+WsGateway::WsGateway(WorkerPool *pool, QObject *parent)
+    : QObject(parent)
+    , m_webSocketServer(new QWebSocketServer(QStringLiteral("LLMRemoteGateway"),
+                                             QWebSocketServer::NonSecureMode, this))
+    , m_pool(pool)
+{
+    connect(m_webSocketServer, &QWebSocketServer::newConnection, this, &WsGateway::onNewConnection);
+}
+
+WsGateway::~WsGateway()
+{
+    m_webSocketServer->close();
+    qDeleteAll(m_connections);
+    m_connections.clear();
+}
+
+bool WsGateway::startServer(quint16 port, const QHostAddress &address)
+{
+    if (!m_webSocketServer->listen(address, port)) {
+        qWarning() << "[WsGateway] Failed to listen on port" << port << ":" << m_webSocketServer->errorString();
+        return false;
+    }
+    qDebug() << "[WsGateway] Listening on ws://" << address.toString() << ":" << port;
+    return true;
+}
+
+void WsGateway::onNewConnection()
+{
+    while (QWebSocket *socket = m_webSocketServer->nextPendingConnection()) {
+        auto *connection = new WsGatewayConnection(socket, m_pool);
+        connect(connection, &WsGatewayConnection::closed, this, &WsGateway::onConnectionClosed);
+        m_connections.append(connection);
+    }
+}
+
+void WsGateway::onConnectionClosed(WsGatewayConnection *connection)
+{
+    m_connections.removeOne(connection);
+    connection->deleteLater();
+}
@@ -0,0 +1,51 @@
+// ================================================================
+// WsGateway.h
+// ================================================================
+#ifndef WSGATEWAY_H
+#define WSGATEWAY_H
+
+#include <QHostAddress>
+#include <QList>
+#include <QObject>
+#include <QWebSocketServer>
+
+class WorkerPool;
+class WsGatewayConnection;
+
+/*
+  WsGateway:
+    - WebSocket endpoint of the gateway, speaking the server's protocol
+    - Each accepted client becomes a WsGatewayConnection, which routes each
+      of its messages to a worker
+
+  WsGatewayクラス:
+    - ゲートウェイのWebSocketエンドポイント (サーバーと同じプロトコル)
+    - 受け付けた各クライアントはWsGatewayConnectionになり、メッセージごとに
+      ワーカーへ振り分ける
+*/
+class WsGateway : public QObject
+{
+    Q_OBJECT
+public:
+    explicit WsGateway(WorkerPool *pool, QObject *parent = nullptr);
+    ~WsGateway() override;
+
+    /*
+      startServer(port, address):
+        - Starts listening; returns false if the port cannot be bound
+      startServer(port, address):
+        - 待ち受けを開始。ポートを確保できない場合はfalseを返す
+    */
+    bool startServer(quint16 port, const QHostAddress &address = QHostAddress::Any);
+
+private slots:
+    void onNewConnection();
+    void onConnectionClosed(WsGatewayConnection *connection);
+
+private:
+    QWebSocketServer *m_webSocketServer {nullptr};
+    WorkerPool *m_pool {nullptr};
+    QList<WsGatewayConnection *> m_connections;
+};
+
+#endif // WSGATEWAY_H
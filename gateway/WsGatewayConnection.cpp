@@ -0,0 +1,270 @@
+// ================================================================
+// WsGatewayConnection.cpp
+// ================================================================
+#include "WsGatewayConnection.h"
+#include "WorkerPool.h"
+#include <QDebug>
+#include <QJsonDocument>
+
+namespace {
+QString compact(const QJsonObject &json)
+{
+    return QString::fromUtf8(QJsonDocument(json).toJson(QJsonDocument::Compact));
+}
+} // namespace
+
+WsGatewayConnection::WsGatewayConnection(QWebSocket *client, WorkerPool *pool, QObject *parent)
+    : QObject(parent)
+    , m_client(client)
+    , m_pool(pool)
+{
+    m_client->setParent(this);
+    connect(m_client, &QWebSocket::textMessageReceived, this, &WsGatewayConnection::onClientTextMessage);
+    connect(m_client, &QWebSocket::disconnected, this, &WsGatewayConnection::onClientDisconnected);
+}
+
+WsGatewayConnection::~WsGatewayConnection()
+{
+    for (const Upstream &upstream : std::as_const(m_upstreams)) {
+        upstream.socket->disconnect(this);
+        upstream.socket->abort();
+    }
+}
+
+/*
+  onClientTextMessage(message):
+    - Settings are remembered before routing, so the upstream the message
+      goes to receives them through syncSettings() like every other one
+    - A "stream" field of a stateless generate changes the worker's
+      streaming mode for good, so it is remembered as a setting as well
+*/
+void WsGatewayConnection::onClientTextMessage(const QString &message)
+{
+    const QJsonObject obj = QJsonDocument::fromJson(message.toUtf8()).object();
+    const QString action = obj.value(QStringLiteral("action")).toString();
+    const bool stateless = obj.value(QStringLiteral("sessionId")).toString().isEmpty();
+    const bool setsStreamingMode = action == QLatin1String("setStreamingMode");
+    const bool setsFlushPolicy = action == QLatin1String("setFlushPolicy");
+    const bool streamedGenerate = stateless && action == QLatin1String("generate")
+                                  && obj.contains(QStringLiteral("stream"));
+
+    if (setsStreamingMode || streamedGenerate) {
+        const QString mode = obj.value(setsStreamingMode ? QStringLiteral("mode") : QStringLiteral("stream")).toString();
+        m_streamingMode.message = setsStreamingMode
+                                      ? message
+                                      : compact({{QStringLiteral("action"), QStringLiteral("setStreamingMode")},
+                                                 {QStringLiteral("mode"), mode}});
+        m_streamingMode.binary = mode == QLatin1String("binary");
+        ++m_streamingMode.version;
+    } else if (setsFlushPolicy) {
+        m_flushPolicy.message = message;
+        ++m_flushPolicy.version;
+    }
+
+    const QString workerName = route(obj);
+    if (workerName.isEmpty()) {
+        if (action == QLatin1String("cancel")) {
+            return;
+        }
+        // A session stays with its worker while that worker is not ready
+        // セッションはワーカーが準備完了でない間もそのワーカーに留まる
+        const QString sessionId = obj.value(QStringLiteral("sessionId")).toString();
+        const WorkerPool::Worker *bound =
+            sessionId.isEmpty() ? nullptr : m_pool->boundWorker(QStringLiteral("session:") + sessionId);
+        sendError(bound ? QStringLiteral("worker %1 is not ready").arg(bound->name)
+                        : QStringLiteral("no worker is ready"));
+        return;
+    }
+    Upstream *target = upstream(workerName);
+    if (!target) {
+        sendError(QStringLiteral("worker %1 is unreachable").arg(workerName));
+        return;
+    }
+
+    if (setsStreamingMode || setsFlushPolicy) {
+        syncSettings(*target, setsStreamingMode);
+        return;
+    }
+    if (streamedGenerate) {
+        // The generate applies the mode itself
+        // 生成リクエスト自体が方式を適用する
+        target->streamingModeVersion = m_streamingMode.version;
+    }
+    syncSettings(*target, false);
+    send(*target, message);
+}
+
+void WsGatewayConnection::onClientDisconnected()
+{
+    for (const Upstream &upstream : std::as_const(m_upstreams)) {
+        upstream.socket->disconnect(this);
+        upstream.socket->close();
+    }
+    emit closed(this);
+}
+
+/*
+  route(obj):
+    - pick() with a session key keeps an existing binding (empty while the
+      bound worker is not ready) and binds a new key to the least loaded
+      worker, which answers "unknown session" if the session is not there;
+      an empty key only balances
+*/
+QString WsGatewayConnection::route(const QJsonObject &obj)
+{
+    const QString action = obj.value(QStringLiteral("action")).toString();
+    const QString sessionId = obj.value(QStringLiteral("sessionId")).toString();
+
+    if (!sessionId.isEmpty()) {
+        const WorkerPool::Worker *worker = m_pool->pick(QStringLiteral("session:") + sessionId);
+        return worker ? worker->name : QString();
+    }
+    if (action == QLatin1String("cancel")) {
+        return m_statelessWorker;
+    }
+    const bool followsStateless = action == QLatin1String("reinit")
+                                  || action == QLatin1String("setStreamingMode")
+                                  || action == QLatin1String("setFlushPolicy");
+    if (followsStateless && m_upstreams.contains(m_statelessWorker)) {
+        return m_statelessWorker;
+    }
+
+    const WorkerPool::Worker *worker = m_pool->pick();
+    if (!worker) {
+        return QString();
+    }
+    if (action == QLatin1String("generate")) {
+        m_statelessWorker = worker->name;
+    }
+    return worker->name;
+}
+
+WsGatewayConnection::Upstream *WsGatewayConnection::upstream(const QString &workerName)
+{
+    const auto found = m_upstreams.find(workerName);
+    if (found != m_upstreams.end()) {
+        return &found.value();
+    }
+    const WorkerPool::Worker *worker = nullptr;
+    for (const WorkerPool::Worker *candidate : m_pool->workers()) {
+        if (candidate->name == workerName) {
+            worker = candidate;
+            break;
+        }
+    }
+    if (!worker) {
+        return nullptr;
+    }
+
+    auto *socket = new QWebSocket(QString(), QWebSocketProtocol::VersionLatest, this);
+    connect(socket, &QWebSocket::connected, this, [this, workerName]() {
+        onUpstreamConnected(workerName);
+    });
+    connect(socket, &QWebSocket::textMessageReceived, this, [this, workerName](const QString &message) {
+        onUpstreamTextMessage(workerName, message);
+    });
+    connect(socket, &QWebSocket::binaryMessageReceived, m_client, &QWebSocket::sendBinaryMessage);
+    connect(socket, &QWebSocket::disconnected, this, [this, workerName]() {
+        onUpstreamDisconnected(workerName);
+    });
+    socket->open(QUrl(worker->status->wsUrl()));
+    qDebug() << "[WsGatewayConnection]" << m_client->peerAddress().toString() << "->" << workerName;
+
+    Upstream &created = m_upstreams[workerName];
+    created.socket = socket;
+    return &created;
+}
+
+/*
+  syncSettings(upstream, confirmStreamingMode):
+    - Only a binary streaming mode is confirmed by the worker, so only that
+      reply has to be hidden
+*/
+void WsGatewayConnection::syncSettings(Upstream &upstream, bool confirmStreamingMode)
+{
+    if (upstream.streamingModeVersion != m_streamingMode.version) {
+        upstream.streamingModeVersion = m_streamingMode.version;
+        send(upstream, m_streamingMode.message);
+        if (m_streamingMode.binary && !confirmStreamingMode) {
+            ++upstream.hiddenConfirmations;
+        }
+    }
+    if (upstream.flushPolicyVersion != m_flushPolicy.version) {
+        upstream.flushPolicyVersion = m_flushPolicy.version;
+        send(upstream, m_flushPolicy.message);
+    }
+}
+
+void WsGatewayConnection::send(Upstream &upstream, const QString &message)
+{
+    if (upstream.open) {
+        upstream.socket->sendTextMessage(message);
+    } else {
+        upstream.pending.append(message);
+    }
+}
+
+void WsGatewayConnection::onUpstreamConnected(const QString &workerName)
+{
+    Upstream &upstream = m_upstreams[workerName];
+    upstream.open = true;
+    for (const QString &message : std::as_const(upstream.pending)) {
+        upstream.socket->sendTextMessage(message);
+    }
+    upstream.pending.clear();
+}
+
+/*
+  onUpstreamTextMessage(workerName, message):
+    - Only the session replies and hidden confirmations are parsed; deltas
+      pass through untouched
+*/
+void WsGatewayConnection::onUpstreamTextMessage(const QString &workerName, const QString &message)
+{
+    Upstream &upstream = m_upstreams[workerName];
+    if (upstream.hiddenConfirmations > 0 && message.contains(QLatin1String("\"streamingMode\""))
+        && QJsonDocument::fromJson(message.toUtf8()).object().value(QStringLiteral("action")).toString()
+               == QLatin1String("streamingMode")) {
+        --upstream.hiddenConfirmations;
+        return;
+    }
+    if (message.contains(QLatin1String("\"sessionCreated\""))
+        || message.contains(QLatin1String("\"sessionClosed\""))) {
+        const QJsonObject obj = QJsonDocument::fromJson(message.toUtf8()).object();
+        const QString action = obj.value(QStringLiteral("action")).toString();
+        const QString key = QStringLiteral("session:") + obj.value(QStringLiteral("sessionId")).toString();
+        if (action == QLatin1String("sessionCreated")) {
+            m_pool->bind(key, workerName);
+        } else if (action == QLatin1String("sessionClosed")) {
+            m_pool->unbind(key);
+        }
+    }
+    m_client->sendTextMessage(message);
+}
+
+/*
+  onUpstreamDisconnected(workerName):
+    - The upstream is dropped; the next message for the worker opens a new
+      one if the worker is still in the pool
+*/
+void WsGatewayConnection::onUpstreamDisconnected(const QString &workerName)
+{
+    const Upstream upstream = m_upstreams.take(workerName);
+    if (!upstream.socket) {
+        return;
+    }
+    upstream.socket->deleteLater();
+    if (m_statelessWorker == workerName) {
+        m_statelessWorker.clear();
+    }
+    sendError(upstream.open ? QStringLiteral("worker %1 went away").arg(workerName)
+                            : QStringLiteral("worker %1 is unreachable").arg(workerName));
+}
+
+void WsGatewayConnection::sendError(const QString &errorMessage)
+{
+    QJsonObject json;
+    json["action"]       = QStringLiteral("error");
+    json["errorMessage"] = errorMessage;
+    m_client->sendTextMessage(compact(json));
+}
@@ -0,0 +1,145 @@
+// ================================================================
+// WsGatewayConnection.h
+// ================================================================
+#ifndef WSGATEWAYCONNECTION_H
+#define WSGATEWAYCONNECTION_H
+
+#include <QHash>
+#include <QJsonObject>
+#include <QObject>
+#include <QStringList>
+#include <QWebSocket>
+
+class WorkerPool;
+
+/*
+  WsGatewayConnection:
+    - One WebSocket client of the gateway, piped to the WebSocket endpoints
+      of the workers its messages are routed to (one upstream per worker,
+      opened on first use)
+    - Every message is routed on its own: a "sessionId" routes to the
+      worker holding that session (a resumed session may live elsewhere
+      than the previous one), everything else - stateless "generate",
+      "createSession", "embed", ... - goes to the least loaded worker
+    - "cancel" / "reinit" without a session follow the last stateless
+      generate; "setStreamingMode" / "setFlushPolicy" are replayed to every
+      upstream before its next message, so all workers stream alike
+    - Messages are forwarded unchanged in both directions; "sessionCreated"
+      and "sessionClosed" replies keep the pool's session affinity current
+    - Messages sent before an upstream is open are buffered
+    - A worker going away is reported as an error; the client stays
+      connected, closing it closes every upstream
+
+  WsGatewayConnectionクラス:
+    - ゲートウェイの1つのWebSocketクライアント。メッセージの振り分け先の
+      ワーカーのWebSocketエンドポイントへ中継する (ワーカーごとに1つの
+      上流接続を、初回使用時に開く)
+    - メッセージは1つずつ振り分ける: "sessionId"があればそのセッションを
+      持つワーカーへ (再開したセッションは前のセッションと別のワーカーに
+      あってもよい)。それ以外 (セッションを持たない"generate"、
+      "createSession"、"embed"など) は最も負荷の低いワーカーへ送る
+    - セッションを持たない"cancel" / "reinit"は最後のセッション無しの生成に
+      従う。"setStreamingMode" / "setFlushPolicy"は各上流接続の次の
+      メッセージの前に再送し、全ワーカーが同じ形式で送出するようにする
+    - メッセージは双方向にそのまま転送する。"sessionCreated"と"sessionClosed"の
+      応答でプールのセッションアフィニティを更新する
+    - 上流接続が開く前に送られたメッセージはバッファする
+    - ワーカーが消えた場合はエラーで通知し、クライアントは接続したまま。
+      クライアントが切断すると全ての上流接続を閉じる
+*/
+class WsGatewayConnection : public QObject
+{
+    Q_OBJECT
+public:
+    /*
+      Constructor:
+        - Takes ownership of the client socket
+      コンストラクタ:
+        - クライアントのソケットの所有権を受け取る
+    */
+    WsGatewayConnection(QWebSocket *client, WorkerPool *pool, QObject *parent = nullptr);
+    ~WsGatewayConnection() override;
+
+signals:
+    /*
+      closed(connection):
+        - The client disconnected; the gateway deletes the connection
+      closed(connection):
+        - クライアントが切断した。ゲートウェイが接続を削除する
+    */
+    void closed(WsGatewayConnection *connection);
+
+private slots:
+    void onClientTextMessage(const QString &message);
+    void onClientDisconnected();
+
+private:
+    // Latest setting of its kind; the version tells upstreams whether they have it
+    // 種類ごとの最新の設定。versionで上流接続が反映済みかを判断する
+    struct Setting
+    {
+        QString message;
+        int version {0};
+        bool binary {false};    // a streaming mode the worker confirms
+    };
+
+    struct Upstream
+    {
+        QWebSocket *socket {nullptr};
+        bool open {false};
+        QStringList pending;
+        int streamingModeVersion {0};
+        int flushPolicyVersion {0};
+        int hiddenConfirmations {0};   // "streamingMode" replies to replayed settings
+    };
+
+    /*
+      route(obj):
+        - Worker for a client message (see above), empty if none is ready
+      route(obj):
+        - クライアントのメッセージの振り分け先 (上記参照)。準備済みの
+          ワーカーが無い場合は空
+    */
+    QString route(const QJsonObject &obj);
+
+    /*
+      upstream(workerName):
+        - The worker's upstream, opened on first use; nullptr if the worker
+          is gone
+      upstream(workerName):
+        - ワーカーの上流接続。初回使用時に開く。ワーカーが消えた場合はnullptr
+    */
+    Upstream *upstream(const QString &workerName);
+
+    /*
+      syncSettings(upstream, confirmStreamingMode):
+        - Sends the settings the upstream has not seen yet; without
+          confirmStreamingMode the worker's confirmation is not forwarded
+      syncSettings(upstream, confirmStreamingMode):
+        - 上流接続が未反映の設定を送る。confirmStreamingModeが無い場合、
+          ワーカーからの確認応答は転送しない
+    */
+    void syncSettings(Upstream &upstream, bool confirmStreamingMode);
+
+    void send(Upstream &upstream, const QString &message);
+    void onUpstreamConnected(const QString &workerName);
+    void onUpstreamTextMessage(const QString &workerName, const QString &message);
+    void onUpstreamDisconnected(const QString &workerName);
+    void sendError(const QString &errorMessage);
+
+    QWebSocket *m_client {nullptr};
+    WorkerPool *m_pool {nullptr};
+
+    // Worker name -> upstream
+    // ワーカー名 -> 上流接続
+    QHash<QString, Upstream> m_upstreams;
+
+    // Worker of the last stateless generate ("cancel" / "reinit" go there)
+    // 最後のセッション無しの生成のワーカー ("cancel" / "reinit"の送り先)
+    QString m_statelessWorker;
+
+    Setting m_streamingMode;
+    Setting m_flushPolicy;
+};
+
+#endif // WSGATEWAYCONNECTION_H
@@ -0,0 +1,62 @@
+// ================================================================
+// main.cpp (LLMRemoteGateway)
+// ================================================================
+#include "QtRoGateway.h"
+#include "WorkerPool.h"
+#include "WsGateway.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QHostAddress>
+
+/*
+  LLMRemoteGateway:
+    - Front end for several LLMRemoteServer workers (e.g. one per NUMA node,
+      or on several hosts) behind the usual QtRO and WebSocket endpoints
+    - Workers join with --registry tcp://<gateway>:12400 and publish their
+      load; see gateway/run_local_cluster.sh for a localhost setup
+
+  LLMRemoteGateway:
+    - 複数のLLMRemoteServerワーカー (NUMAノードごとや複数ホストなど) を、
+      通常のQtROとWebSocketのエンドポイントの後ろにまとめるフロントエンド
+    - ワーカーは--registry tcp://<ゲートウェイ>:12400で参加し、負荷を公開する。
+      ローカルでの構成はgateway/run_local_cluster.shを参照
+*/
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("LLMRemoteGateway"));
+
+    qSetMessagePattern("[%{file}:%{line}] %{message}");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Session-affine gateway for LLMRemoteServer workers"));
+    parser.addHelpOption();
+    const QCommandLineOption listenOption(QStringLiteral("listen"),
+        QStringLiteral("Address of the client endpoints and the registry."), QStringLiteral("address"),
+        QStringLiteral("0.0.0.0"));
+    const QCommandLineOption qtroPortOption(QStringLiteral("qtro-port"),
+        QStringLiteral("QtRO port for clients (default 12345)."), QStringLiteral("port"), QStringLiteral("12345"));
+    const QCommandLineOption wsPortOption(QStringLiteral("ws-port"),
+        QStringLiteral("WebSocket port for clients (default 12346)."), QStringLiteral("port"), QStringLiteral("12346"));
+    const QCommandLineOption registryPortOption(QStringLiteral("registry-port"),
+        QStringLiteral("Port of the registry workers join (default 12400)."), QStringLiteral("port"),
+        QStringLiteral("12400"));
+    parser.addOptions({listenOption, qtroPortOption, wsPortOption, registryPortOption});
+    parser.process(app);
+
+    const QString address = parser.value(listenOption);
+
+    WorkerPool pool(QUrl(QStringLiteral("tcp://%1:%2").arg(address, parser.value(registryPortOption))));
+
+    QtRoGateway qtroGateway(&pool);
+    QRemoteObjectHost srcNode(QUrl(QStringLiteral("tcp://%1:%2").arg(address, parser.value(qtroPortOption))));
+    srcNode.enableRemoting(&qtroGateway);
+    qtroGateway.setHost(&srcNode);
+
+    WsGateway wsGateway(&pool);
+    if (!wsGateway.startServer(static_cast<quint16>(parser.value(wsPortOption).toUInt()), QHostAddress(address))) {
+        return 1;
+    }
+
+    return app.exec();
+}
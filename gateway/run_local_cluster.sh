@@ -0,0 +1,36 @@
+#!/usr/bin/env bash
+# ----------------------------------------------------------------------------
+# ゲートウェイとN個のワーカーをlocalhostで起動する (Ctrl+Cで全て停止)
+# Starts the gateway and N workers on localhost (Ctrl+C stops them all)
+#
+#   gateway/run_local_cluster.sh <build dir> [workers (default 2)] [server args...]
+#
+# Clients use the usual ports (QtRO 12345, WebSocket 12346); worker i listens
+# on 13000+10*i (QtRO), +1 (WebSocket), +2 (metrics) and +3 (status).
+# クライアントは通常のポート (QtRO 12345、WebSocket 12346) を使う。ワーカーiは
+# 13000+10*i (QtRO)、+1 (WebSocket)、+2 (メトリクス)、+3 (状態) で待ち受ける。
+# ----------------------------------------------------------------------------
+set -euo pipefail
+
+BUILD_DIR=${1:?usage: $0 <build dir> [workers] [server args...]}
+WORKERS=${2:-2}
+shift $(( $# >= 2 ? 2 : 1 ))
+
+REGISTRY_PORT=12400
+pids=()
+trap 'kill "${pids[@]}" 2>/dev/null; wait' EXIT INT TERM
+
+"$BUILD_DIR/gateway/LLMRemoteGateway" --listen 127.0.0.1 --registry-port "$REGISTRY_PORT" &
+pids+=($!)
+sleep 1
+
+for ((i = 0; i < WORKERS; ++i)); do
+    base=$((13000 + 10 * i))
+    "$BUILD_DIR/LLMRemoteServer" \
+        --qtro-port "$base" --ws-port "$((base + 1))" \
+        --metrics-port "$((base + 2))" --status-port "$((base + 3))" \
+        --registry "tcp://127.0.0.1:$REGISTRY_PORT" --worker-name "worker$i" "$@" &
+    pids+=($!)
+done
+
+wait -n
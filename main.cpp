@@ -1,6 +1,14 @@
 #include "QtRoRemoteGenerator.h"
 #include "QtWSRemoteGenerator.h"
+#include "ServerConfig.h"
+#include "EngineThreads.h"
+#include "CpuPlacement.h"
+#include "MetricsServer.h"
+#include "TrafficRecorder.h"
+#include "WorkerStatusPublisher.h"
+#include <QCommandLineParser>
 #include <QCoreApplication>
+#include <memory>
 
 int main(int argc, char *argv[])
 {
@@ -8,13 +16,121 @@ int main(int argc, char *argv[])
 
     qSetMessagePattern("[%{file}:%{line}] %{message}");
 
+    // Optional JSON settings file (see ServerConfig.h for the keys)
+    // 任意のJSON設定ファイル (キーはServerConfig.hを参照)
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    const QCommandLineOption configOption(QStringLiteral("config"),
+                                          QStringLiteral("JSON settings file."),
+                                          QStringLiteral("file"));
+    parser.addOption(configOption);
+    const QCommandLineOption recordOption(QStringLiteral("record-traffic"),
+                                          QStringLiteral("Append every generate request to a JSONL workload file "
+                                                         "(replayable with LLMRemoteServerBench)."),
+                                          QStringLiteral("file"));
+    parser.addOption(recordOption);
+
+    // Overrides of the config file, so several workers can share one file
+    // 設定ファイルの上書き (複数のワーカーが1つのファイルを共有できるように)
+    const QCommandLineOption qtroPortOption(QStringLiteral("qtro-port"),
+                                            QStringLiteral("QtRO port (default 12345)."),
+                                            QStringLiteral("port"));
+    const QCommandLineOption wsPortOption(QStringLiteral("ws-port"),
+                                          QStringLiteral("WebSocket port (default 12346)."),
+                                          QStringLiteral("port"));
+    const QCommandLineOption metricsPortOption(QStringLiteral("metrics-port"),
+                                               QStringLiteral("Prometheus /metrics port (0 = disabled)."),
+                                               QStringLiteral("port"));
+    const QCommandLineOption statusPortOption(QStringLiteral("status-port"),
+                                              QStringLiteral("Port of the WorkerStatus source (worker mode)."),
+                                              QStringLiteral("port"));
+    const QCommandLineOption registryOption(QStringLiteral("registry"),
+                                            QStringLiteral("Join the gateway registry at this URL as a worker, "
+                                                           "e.g. tcp://127.0.0.1:12400."),
+                                            QStringLiteral("url"));
+    const QCommandLineOption nameOption(QStringLiteral("worker-name"),
+                                        QStringLiteral("Name of this worker in the registry."),
+                                        QStringLiteral("name"));
+    parser.addOptions({qtroPortOption, wsPortOption, metricsPortOption, statusPortOption,
+                       registryOption, nameOption});
+    parser.process(app);
+
+    if (parser.isSet(configOption)) {
+        QString error;
+        if (!ServerConfig::instance().loadFromFile(parser.value(configOption), &error)) {
+            qCritical() << "Failed to load config" << parser.value(configOption) << ":" << error;
+            return 1;
+        }
+    }
+
+    ServerConfig &config = ServerConfig::instance();
+    auto overridePort = [&parser](const QCommandLineOption &option, int &field) {
+        if (parser.isSet(option)) {
+            field = parser.value(option).toInt();
+        }
+    };
+    overridePort(qtroPortOption, config.qtroPort);
+    overridePort(wsPortOption, config.wsPort);
+    overridePort(metricsPortOption, config.metricsPort);
+    overridePort(statusPortOption, config.statusPort);
+    if (parser.isSet(registryOption)) {
+        config.registryUrl = parser.value(registryOption);
+    }
+    if (parser.isSet(nameOption)) {
+        config.workerName = parser.value(nameOption);
+    }
+
+    // Before any other thread starts: they inherit the networking CPUs
+    // 他のスレッドが開始する前に呼ぶ (各スレッドはネットワーク用CPUを引き継ぐ)
+    CpuPlacement::instance().initialize();
+
+    if (parser.isSet(recordOption)) {
+        QString error;
+        if (!TrafficRecorder::instance().open(parser.value(recordOption), &error)) {
+            qCritical() << "Failed to open traffic file" << parser.value(recordOption) << ":" << error;
+            return 1;
+        }
+    }
+
     QtRORemoteGenerator llamaResponseGenerator;
 
-    QRemoteObjectHost srcNode(QUrl(QStringLiteral("tcp://0.0.0.0:12345")));
+    QRemoteObjectHost srcNode(QUrl(QStringLiteral("tcp://%1:%2").arg(config.listenAddress).arg(config.qtroPort)));
     srcNode.enableRemoting(&llamaResponseGenerator);
+    llamaResponseGenerator.setHost(&srcNode);
 
     QtWSRemoteGenerator wsRemoteGenerator;
-    wsRemoteGenerator.startServer(12346);
+    wsRemoteGenerator.startServer(static_cast<quint16>(config.wsPort), QHostAddress(config.listenAddress));
+
+    // Prometheus scrape endpoint next to the two listeners
+    // 2つのリスナーと並ぶPrometheusのスクレイプ用エンドポイント
+    MetricsServer metricsServer;
+    if (config.metricsPort > 0) {
+        metricsServer.startServer(static_cast<quint16>(config.metricsPort));
+    }
+
+    // Worker mode: the status source is registered in the gateway's registry;
+    // a separate host, so the generator itself stays out of the registry
+    // (every worker's generator has the same name). The registry hands the
+    // host URL to the gateway, so it is bound to advertiseHost.
+    // ワーカーモード: 状態ソースをゲートウェイのレジストリに登録する。
+    // ジェネレータ自体はレジストリに載せないよう別のホストを使う
+    // (全ワーカーのジェネレータが同じ名前を持つため)。レジストリはホストの
+    // URLをゲートウェイに渡すため、advertiseHostで待ち受ける
+    std::unique_ptr<QRemoteObjectHost> statusNode;
+    std::unique_ptr<WorkerStatusPublisher> workerStatus;
+    if (!config.registryUrl.isEmpty()) {
+        workerStatus = std::make_unique<WorkerStatusPublisher>(&llamaResponseGenerator);
+        statusNode = std::make_unique<QRemoteObjectHost>(
+            QUrl(QStringLiteral("tcp://%1:%2").arg(config.advertiseHost).arg(config.statusPort)),
+            QUrl(config.registryUrl));
+        statusNode->enableRemoting(workerStatus.get(), QStringLiteral("WorkerStatus/") + workerStatus->name());
+        qDebug() << "Joined gateway registry" << config.registryUrl << "as" << workerStatus->name();
+    }
+
+    const int exitCode = app.exec();
 
-    return app.exec();
+    // Stop the engine threads while the application object still exists
+    // アプリケーションオブジェクトが存在するうちにエンジンスレッドを停止
+    EngineThreads::instance().shutdown();
+    return exitCode;
 }